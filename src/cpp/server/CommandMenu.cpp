@@ -4,10 +4,12 @@
 #include <QTranslator>
 
 #include "CommandMenu.h"
+#include "MainWindow.h"
 #include "SettingsDialog.h"
 #include "actor/Pawn.h"
 #include "admin/AdminMenu.h"
 #include "net/Session.h"
+#include "scene/Minimap.h"
 #include "scene/Scene.h"
 #include "scene/Zone.h"
 #include "scene/ScenePropertiesDialog.h"
@@ -89,6 +91,7 @@ void CommandMenu::createToolsMenu ()
 
     menu->addButton(tr("Go to &Zone"), session, SLOT(showGoToZoneDialog()));
     menu->addButton(tr("Go to &Scene"), session, SLOT(showGoToSceneDialog()));
+    menu->addButton(tr("Toggle &Map"), session->mainWindow()->minimap(), SLOT(cycle()));
 
     menu->pack();
     menu->center();
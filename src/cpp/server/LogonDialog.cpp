@@ -7,7 +7,7 @@
 
 #include "LogonDialog.h"
 #include "ServerApp.h"
-#include "db/DatabaseThread.h"
+#include "db/DatabasePool.h"
 #include "db/UserRepository.h"
 #include "net/Session.h"
 #include "ui/Border.h"
@@ -160,8 +160,14 @@ void LogonDialog::logon ()
         nrec.setPassword(_password->text());
         nrec.dateOfBirth = dob;
         nrec.email = _email->text().trimmed();
-        QMetaObject::invokeMethod(
-            session->app()->databaseThread()->userRepository(), "updateUser",
+        if (nrec.transient()) {
+            // the guest hasn't been stored yet, so insert rather than update
+            session->app()->databasePool()->userRepository(nrec.id)->invoke("insertUser",
+                Q_ARG(const UserRecord&, nrec), Q_ARG(bool, false), Q_ARG(const Callback&,
+                    Callback(_this, "userMaybeInserted(UserRecord)")));
+            return;
+        }
+        session->app()->databasePool()->userRepository(nrec.id)->invoke("updateUser",
             Q_ARG(const UserRecord&, nrec), Q_ARG(const Callback&,
                 Callback(_this, "userMaybeUpdated(UserRecord,bool)",
                     Q_ARG(const UserRecord&, nrec))));
@@ -170,8 +176,7 @@ void LogonDialog::logon ()
         // block logon and send off the request
         _logonBlocked = true;
         _logon->setEnabled(false);
-        QMetaObject::invokeMethod(
-            session->app()->databaseThread()->userRepository(), "validateLogon",
+        session->app()->databasePool()->userRepository()->invoke("validateLogon",
             Q_ARG(const UserRecord&, session->user()), Q_ARG(const QString&, _username->text()),
             Q_ARG(const QString&, _password->text()), Q_ARG(const Callback&,
                 Callback(_this, "logonMaybeValidated(QVariant)")));
@@ -209,6 +214,11 @@ void LogonDialog::userMaybeUpdated (const UserRecord& user, bool success)
     }
 }
 
+void LogonDialog::userMaybeInserted (const UserRecord& user)
+{
+    userMaybeUpdated(user, user.id != 0);
+}
+
 void LogonDialog::logonMaybeValidated (const QVariant& result)
 {
     switch (result.toInt()) {
@@ -238,8 +248,7 @@ void LogonDialog::logonMaybeValidated (const QVariant& result)
 void LogonDialog::maybeSendUsernameEmail (const QString& email)
 {
     // look up the username
-    QMetaObject::invokeMethod(
-        session()->app()->databaseThread()->userRepository(), "loadUserByEmail",
+    session()->app()->databasePool()->userRepository()->invoke("loadUserByEmail",
         Q_ARG(const QString&, email), Q_ARG(const Callback&, Callback(_this,
             "maybeSendUsernameEmail(UserRecord)")));
 }
@@ -261,8 +270,7 @@ void LogonDialog::maybeSendUsernameEmail (const UserRecord& urec)
 void LogonDialog::maybeSendPasswordEmail (const QString& email)
 {
     // look up the user record
-    QMetaObject::invokeMethod(
-        session()->app()->databaseThread()->userRepository(), "loadUserByEmail",
+    session()->app()->databasePool()->userRepository()->invoke("loadUserByEmail",
         Q_ARG(const QString&, email), Q_ARG(const Callback&, Callback(_this,
             "maybeSendPasswordEmail(UserRecord)")));
 }
@@ -276,8 +284,7 @@ void LogonDialog::maybeSendPasswordEmail (const UserRecord& urec)
     qDebug() << "Inserting password reset." << urec.name << urec.email;
 
     // insert the reset
-    QMetaObject::invokeMethod(
-        session()->app()->databaseThread()->userRepository(), "insertPasswordReset",
+    session()->app()->databasePool()->userRepository()->invoke("insertPasswordReset",
         Q_ARG(quint64, urec.id), Q_ARG(const Callback&, Callback(_this,
             "sendPasswordEmail(QString,QString)", Q_ARG(const QString&, urec.email))));
 }
@@ -74,6 +74,11 @@ protected:
      */
     Q_INVOKABLE void userMaybeUpdated (const UserRecord& user, bool success);
 
+    /**
+     * Reports back from a user insertion request.
+     */
+    Q_INVOKABLE void userMaybeInserted (const UserRecord& user);
+
     /**
      * If the result contains a UserRecord, the user was logged on; otherwise, the result
      * will contain an error code.
@@ -11,6 +11,7 @@
 #include "chat/ChatWindow.h"
 #include "net/Session.h"
 #include "scene/Legend.h"
+#include "scene/Minimap.h"
 #include "scene/SceneView.h"
 #include "scene/Scene.h"
 #include "scene/Zone.h"
@@ -27,7 +28,13 @@ MainWindow::MainWindow (Session* parent) :
     setLayout(new BorderLayout());
 
     addChild(_sceneView = new SceneView(parent), BorderLayout::Center);
-    addChild(_legend = new Legend(parent), BorderLayout::East);
+
+    // the minimap (hidden until toggled) sits above the legend
+    Container* east = new Container(new BoxLayout(Qt::Vertical,
+        BoxLayout::HStretch | BoxLayout::VStretch, Qt::AlignTop, 0));
+    east->addChild(_minimap = new Minimap(parent), BoxLayout::Fixed);
+    east->addChild(_legend = new Legend(parent));
+    addChild(east, BorderLayout::East);
 }
 
 void MainWindow::updateTitle ()
@@ -7,6 +7,7 @@
 #include "ui/Window.h"
 
 class Legend;
+class Minimap;
 class SceneView;
 
 /**
@@ -33,6 +34,11 @@ public:
      */
     Legend* legend () const { return _legend; }
 
+    /**
+     * Returns a pointer to the minimap.
+     */
+    Minimap* minimap () const { return _minimap; }
+
 public slots:
 
     /**
@@ -57,6 +63,9 @@ protected:
     
     /** The legend. */
     Legend* _legend;
+
+    /** The minimap. */
+    Minimap* _minimap;
 };
 
 #endif // MAIN_WINDOW
@@ -3,7 +3,7 @@
 
 #include "RuntimeConfig.h"
 #include "ServerApp.h"
-#include "db/DatabaseThread.h"
+#include "db/DatabasePool.h"
 #include "db/PropertyRepository.h"
 
 RuntimeConfig::RuntimeConfig (ServerApp* app) :
@@ -15,7 +15,7 @@ RuntimeConfig::RuntimeConfig (ServerApp* app) :
     app->peerManager()->registerSharedObject(this);
 
     // register as a persistent object to allow properties to be saved to database
-    app->databaseThread()->propertyRepository()->registerPersistentObject(this, "RuntimeConfig");
+    app->databasePool()->propertyRepository()->registerPersistentObject(this, "RuntimeConfig");
 }
 
 RuntimeConfig::RuntimeConfig (QObject* parent) :
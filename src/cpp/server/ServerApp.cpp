@@ -16,7 +16,7 @@
 #include <QtDebug>
 
 #include "ServerApp.h"
-#include "db/DatabaseThread.h"
+#include "db/DatabasePool.h"
 #include "http/HttpManager.h"
 #include "http/ImportExportManager.h"
 #include "net/ConnectionManager.h"
@@ -277,8 +277,8 @@ ServerApp::ServerApp (int& argc, char** argv) :
     _rebootTimer = new QTimer(this);
     connect(_rebootTimer, SIGNAL(timeout()), SLOT(updateReboot()));
 
-    // create the database thread
-    _databaseThread = new DatabaseThread(this);
+    // create the database thread pool
+    _databasePool = new DatabasePool(this);
 
     // create the managers (peer manager first, as the others must register with it)
     _peerManager = new PeerManager(this);
@@ -292,7 +292,7 @@ ServerApp::ServerApp (int& argc, char** argv) :
     _peerManager->registerSharedObject(this);
 
     // start the database and scene threads
-    _databaseThread->start();
+    _databasePool->startThreads();
     _sceneManager->startThreads();
 
     // connect the cleanup signal
@@ -415,9 +415,8 @@ void ServerApp::cleanup ()
     // shut down the scene threads
     _sceneManager->stopThreads();
 
-    // shut down the database thread
-    _databaseThread->exit();
-    _databaseThread->wait();
+    // shut down the database threads
+    _databasePool->stopThreads();
 
     // process events again in case debug messages were enqueued
     processEvents();
@@ -22,7 +22,7 @@ class QTranslator;
 class ArgumentDescriptorList;
 class Callback;
 class ConnectionManager;
-class DatabaseThread;
+class DatabasePool;
 class HttpManager;
 class ImportExportManager;
 class PeerManager;
@@ -108,9 +108,9 @@ public:
     SceneManager* sceneManager () const { return _sceneManager; }
 
     /**
-     * Returns a pointer to the database thread.
+     * Returns a pointer to the database thread pool.
      */
-    DatabaseThread* databaseThread () const { return _databaseThread; }
+    DatabasePool* databasePool () const { return _databasePool; }
 
     /**
      * Attempts to send an email.  The provided callback will receive an empty string on success or
@@ -205,8 +205,8 @@ protected:
     /** The scene manager. */
     SceneManager* _sceneManager;
 
-    /** The database thread. */
-    DatabaseThread* _databaseThread;
+    /** The database thread pool. */
+    DatabasePool* _databasePool;
 
     /** The reboot timer. */
     QTimer* _rebootTimer;
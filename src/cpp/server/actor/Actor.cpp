@@ -8,59 +8,41 @@ Actor::Actor (Scene* scene, int character, const QString& label, const QPoint& p
         int collisionFlags, int collisionMask, int spawnMask) :
     QObject(scene),
     _scene(scene),
-    _next(0),
-    _position(position)
+    _pool(&scene->actorPool()),
+    _index(scene->addActor(character, label, position, collisionFlags, collisionMask, spawnMask))
 {
-    _data = new ActorData();
-    _data->character = character;
-    if (!label.isEmpty()) {
-        _data->label = QSharedPointer<CharacterLabelPair>(
-            new CharacterLabelPair(character, label));
-    }
-    _data->collisionFlags = collisionFlags;
-    _data->collisionMask = collisionMask;
-    _data->spawnMask = spawnMask;
-    
-    _scene->addSpatial(this);
+    _pool->setObject(_index, this);
 }
 
 Actor::~Actor ()
 {
-    _scene->removeSpatial(this);
+    _scene->removeActor(_index);
 }
 
 void Actor::setCharacter (int character)
 {
-    int ochar = this->character();
-    if (ochar != character) {
-        _data->character = character;
-        if (!_data->label.isNull()) {
-            _data->label = QSharedPointer<CharacterLabelPair>(
-                new CharacterLabelPair(character, _data->label->second));
-        }
-        _scene->characterLabelChanged(this, ochar);
+    if (this->character() != character) {
+        _scene->setActorCharacter(_index, character);
     }
 }
 
 void Actor::setLabel (const QString& label)
 {
     if (this->label() != label) {
-        _data->label = QSharedPointer<CharacterLabelPair>(
-            label.isEmpty() ? 0 : new CharacterLabelPair(_data->character, label));
-        _scene->characterLabelChanged(this, _data->character);
+        _scene->setActorLabel(_index, label);
     }
 }
 
 void Actor::setCollisionFlags (int flags)
 {
     if (collisionFlags() != flags) {
-        _data->collisionFlags = flags;
+        _scene->setActorCollisionFlags(_index, flags);
     }
 }
 
 bool Actor::move (const QPoint& position)
 {
-    if ((_scene->collisionFlags(position) & collisionMask()) == 0) {
+    if (!_scene->collides(position, collisionMask())) {
         setPosition(position);
         return true;
         
@@ -71,12 +53,9 @@ bool Actor::move (const QPoint& position)
 
 void Actor::setPosition (const QPoint& position)
 {
-    if (_position != position) {
-        _scene->removeSpatial(this, &position);
-        QPoint opos = _position;
-        _position = position;
-        _scene->addSpatial(this);
-
+    QPoint opos = this->position();
+    if (opos != position) {
+        _scene->setActorPosition(_index, position);
         emit positionChanged(opos);
     }
 }
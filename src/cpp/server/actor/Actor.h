@@ -5,44 +5,15 @@
 #define ACTOR
 
 #include <QObject>
-#include <QPair>
 #include <QPoint>
-#include <QSharedData>
-#include <QSharedPointer>
 
-class Scene;
-
-/** Pairs a visible character with its label. */
-typedef QPair<int, QString> CharacterLabelPair;
-
-/** A pointer to a label. */
-typedef CharacterLabelPair* LabelPointer;
+#include "actor/ActorPool.h"
 
-/**
- * The actor's shared data.
- */
-class ActorData : public QSharedData
-{
-public:
-
-    /** The actor's character. */
-    int character;
-    
-    /** The label pointer. */
-    QSharedPointer<CharacterLabelPair> label;
-    
-    /** The actor's collision flags. */
-    int collisionFlags;
-    
-    /** The actor's collision mask. */
-    int collisionMask;
-    
-    /** The actor's spawn mask. */
-    int spawnMask;
-};
+class Scene;
 
 /**
- * An active participant in the scene.
+ * An active participant in the scene.  The actor's data lives in the scene's actor pool; the
+ * object refers to it by index.
  */
 class Actor : public QObject
 {
@@ -62,14 +33,9 @@ public:
     virtual ~Actor ();
 
     /**
-     * Sets the next actor in the linked list.
+     * Returns the index of the actor in the scene's pool.
      */
-    void setNext (Actor* next) { _next = next; }
-
-    /**
-     * Returns the next actor in the linked list.
-     */
-    Actor* next () const { return _next; }
+    int index () const { return _index; }
 
     /**
      * Sets the actor's character.
@@ -79,7 +45,7 @@ public:
     /**
      * Returns the actor's character.
      */
-    int character () const { return _data->character; }
+    int character () const { return _pool->character(_index); }
 
     /**
      * Sets the actor's label.
@@ -89,12 +55,12 @@ public:
     /**
      * Returns the actor's label.
      */
-    QString label () const { return _data->label.isNull() ? QString() : _data->label->second; }
+    QString label () const { return _pool->label(_index); }
 
     /**
      * Returns a pointer to the actor's label, or zero for none.
      */
-    LabelPointer labelPointer () const { return _data->label.data(); }
+    LabelPointer labelPointer () const { return _pool->labelPointer(_index); }
 
     /**
      * Sets the actor's collision flags.
@@ -104,27 +70,27 @@ public:
     /**
      * Returns the actor's collision flags.
      */
-    int collisionFlags () const { return _data->collisionFlags; }
+    int collisionFlags () const { return _pool->collisionFlags(_index); }
     
     /**
      * Sets the actor's collision mask.
      */
-    void setCollisionMask (int mask) { _data->collisionMask = mask; }
+    void setCollisionMask (int mask) { _pool->setCollisionMask(_index, mask); }
     
     /**
      * Returns the actor's collision mask.
      */
-    int collisionMask () const { return _data->collisionMask; }
+    int collisionMask () const { return _pool->collisionMask(_index); }
     
     /**
      * Sets the actor's spawn mask.
      */
-    void setSpawnMask (int mask) { _data->spawnMask = mask; }
+    void setSpawnMask (int mask) { _pool->setSpawnMask(_index, mask); }
 
     /**
      * Returns the actor's spawn mask.
      */
-    int spawnMask () const { return _data->spawnMask; }
+    int spawnMask () const { return _pool->spawnMask(_index); }
 
     /**
      * Attempts to move to the specified position, returning true if successful.
@@ -137,9 +103,9 @@ public:
     void setPosition (const QPoint& position);
 
     /**
-     * Returns a reference to the actor's position.
+     * Returns the actor's position.
      */
-    const QPoint& position () const { return _position; }
+    QPoint position () const { return _pool->position(_index); }
 
     /**
      * Notifies the actor that the location under it has changed in the scene record.
@@ -160,14 +126,11 @@ protected:
     /** The scene containing the actor. */
     Scene* _scene;
 
-    /** The next actor in the list, if any. */
-    Actor* _next;
+    /** The scene's actor pool. */
+    ActorPool* _pool;
 
-    /** The actor's position. */
-    QPoint _position;
-    
-    /** The actor's shared data. */
-    QSharedDataPointer<ActorData> _data;
+    /** The index of the actor in the pool. */
+    int _index;
 };
 
 #endif // ACTOR
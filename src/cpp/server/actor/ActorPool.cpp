@@ -0,0 +1,91 @@
+//
+// $Id$
+
+#include "actor/ActorPool.h"
+
+ActorPool::ActorPool () :
+    _size(0)
+{
+}
+
+void ActorPool::reserve (int capacity)
+{
+    _positions.reserve(capacity);
+    _characters.reserve(capacity);
+    _collisionFlags.reserve(capacity);
+    _collisionMasks.reserve(capacity);
+    _spawnMasks.reserve(capacity);
+    _next.reserve(capacity);
+    _objects.reserve(capacity);
+    _labels.reserve(capacity);
+}
+
+int ActorPool::allocate (int character, const QString& label, const QPoint& position,
+    int collisionFlags, int collisionMask, int spawnMask)
+{
+    QSharedPointer<CharacterLabelPair> lptr;
+    if (!label.isEmpty()) {
+        lptr = QSharedPointer<CharacterLabelPair>(new CharacterLabelPair(character, label));
+    }
+    _size++;
+
+    // reuse a released index if possible
+    if (!_free.isEmpty()) {
+        int idx = _free.last();
+        _free.pop_back();
+        _positions[idx] = position;
+        _characters[idx] = character;
+        _collisionFlags[idx] = collisionFlags;
+        _collisionMasks[idx] = collisionMask;
+        _spawnMasks[idx] = spawnMask;
+        _next[idx] = None;
+        _objects[idx] = 0;
+        _labels[idx] = lptr;
+        _live.setBit(idx);
+        return idx;
+    }
+    int idx = _positions.size();
+    _positions.append(position);
+    _characters.append(character);
+    _collisionFlags.append(collisionFlags);
+    _collisionMasks.append(collisionMask);
+    _spawnMasks.append(spawnMask);
+    _next.append(None);
+    _objects.append(0);
+    _labels.append(lptr);
+    _live.resize(idx + 1);
+    _live.setBit(idx);
+    return idx;
+}
+
+void ActorPool::release (int idx)
+{
+    _labels[idx].clear();
+    _objects[idx] = 0;
+    _live.clearBit(idx);
+    _free.append(idx);
+    _size--;
+}
+
+void ActorPool::setCharacter (int idx, int character)
+{
+    _characters[idx] = character;
+    QSharedPointer<CharacterLabelPair>& label = _labels[idx];
+    if (!label.isNull()) {
+        label = QSharedPointer<CharacterLabelPair>(
+            new CharacterLabelPair(character, label->second));
+    }
+}
+
+void ActorPool::setLabel (int idx, const QString& label)
+{
+    _labels[idx] = QSharedPointer<CharacterLabelPair>(
+        label.isEmpty() ? 0 : new CharacterLabelPair(_characters.at(idx), label));
+}
+
+qint64 ActorPool::memoryUsage () const
+{
+    return sizeof(ActorPool) + _positions.capacity() * (qint64)(sizeof(QPoint) +
+        sizeof(int)*5 + sizeof(Actor*) + sizeof(QSharedPointer<CharacterLabelPair>)) +
+        _live.size() / 8 + _free.capacity() * (qint64)sizeof(int);
+}
@@ -0,0 +1,210 @@
+//
+// $Id$
+
+#ifndef ACTOR_POOL
+#define ACTOR_POOL
+
+#include <QBitArray>
+#include <QPair>
+#include <QPoint>
+#include <QSharedPointer>
+#include <QString>
+#include <QVector>
+
+class Actor;
+
+/** Pairs a visible character with its label. */
+typedef QPair<int, QString> CharacterLabelPair;
+
+/** A pointer to a label. */
+typedef CharacterLabelPair* LabelPointer;
+
+/**
+ * Stores the data of a scene's actors in parallel arrays indexed by actor, so that spawning
+ * actors doesn't require an allocation apiece and iterating over them touches only the arrays
+ * required.  Released indices are reused by subsequent allocations.
+ */
+class ActorPool
+{
+public:
+
+    /** The index representing the lack of an actor. */
+    static const int None = -1;
+
+    /**
+     * Creates an empty pool.
+     */
+    ActorPool ();
+
+    /**
+     * Reserves space for the specified total number of actors.
+     */
+    void reserve (int capacity);
+
+    /**
+     * Allocates a new actor, returning its index.
+     */
+    int allocate (int character, const QString& label, const QPoint& position,
+        int collisionFlags, int collisionMask, int spawnMask);
+
+    /**
+     * Releases the actor at the specified index.
+     */
+    void release (int idx);
+
+    /**
+     * Returns the number of live actors.
+     */
+    int size () const { return _size; }
+
+    /**
+     * Returns the number of indices (live or free) in the pool.  Live indices are less than this.
+     */
+    int capacity () const { return _positions.size(); }
+
+    /**
+     * Checks whether the specified index refers to a live actor.
+     */
+    bool live (int idx) const { return _live.testBit(idx); }
+
+    /**
+     * Returns a pointer to the array of actor positions, for iteration.
+     */
+    const QPoint* positions () const { return _positions.constData(); }
+
+    /**
+     * Returns a pointer to the array of actor characters, for iteration.
+     */
+    const int* characters () const { return _characters.constData(); }
+
+    /**
+     * Sets the position of the actor at the specified index.
+     */
+    void setPosition (int idx, const QPoint& position) { _positions[idx] = position; }
+
+    /**
+     * Returns the position of the actor at the specified index.
+     */
+    const QPoint& position (int idx) const { return _positions.at(idx); }
+
+    /**
+     * Sets the character of the actor at the specified index, updating its label if it has one.
+     */
+    void setCharacter (int idx, int character);
+
+    /**
+     * Returns the character of the actor at the specified index.
+     */
+    int character (int idx) const { return _characters.at(idx); }
+
+    /**
+     * Sets the label of the actor at the specified index.
+     */
+    void setLabel (int idx, const QString& label);
+
+    /**
+     * Returns the label of the actor at the specified index.
+     */
+    QString label (int idx) const {
+        const QSharedPointer<CharacterLabelPair>& label = _labels.at(idx);
+        return label.isNull() ? QString() : label->second; }
+
+    /**
+     * Returns a pointer to the label of the actor at the specified index, or zero for none.
+     */
+    LabelPointer labelPointer (int idx) const { return _labels.at(idx).data(); }
+
+    /**
+     * Sets the collision flags of the actor at the specified index.
+     */
+    void setCollisionFlags (int idx, int flags) { _collisionFlags[idx] = flags; }
+
+    /**
+     * Returns the collision flags of the actor at the specified index.
+     */
+    int collisionFlags (int idx) const { return _collisionFlags.at(idx); }
+
+    /**
+     * Sets the collision mask of the actor at the specified index.
+     */
+    void setCollisionMask (int idx, int mask) { _collisionMasks[idx] = mask; }
+
+    /**
+     * Returns the collision mask of the actor at the specified index.
+     */
+    int collisionMask (int idx) const { return _collisionMasks.at(idx); }
+
+    /**
+     * Sets the spawn mask of the actor at the specified index.
+     */
+    void setSpawnMask (int idx, int mask) { _spawnMasks[idx] = mask; }
+
+    /**
+     * Returns the spawn mask of the actor at the specified index.
+     */
+    int spawnMask (int idx) const { return _spawnMasks.at(idx); }
+
+    /**
+     * Sets the index of the next actor in the list at the location of the specified actor.
+     */
+    void setNext (int idx, int next) { _next[idx] = next; }
+
+    /**
+     * Returns the index of the next actor in the list at the location of the specified actor, or
+     * None for none.
+     */
+    int next (int idx) const { return _next.at(idx); }
+
+    /**
+     * Sets the object representing the actor at the specified index.
+     */
+    void setObject (int idx, Actor* object) { _objects[idx] = object; }
+
+    /**
+     * Returns the object representing the actor at the specified index, or zero if the actor has
+     * no object.
+     */
+    Actor* object (int idx) const { return _objects.at(idx); }
+
+    /**
+     * Returns the approximate number of bytes occupied by the pool.
+     */
+    qint64 memoryUsage () const;
+
+protected:
+
+    /** The actor positions. */
+    QVector<QPoint> _positions;
+
+    /** The actor characters. */
+    QVector<int> _characters;
+
+    /** The actor collision flags. */
+    QVector<int> _collisionFlags;
+
+    /** The actor collision masks. */
+    QVector<int> _collisionMasks;
+
+    /** The actor spawn masks. */
+    QVector<int> _spawnMasks;
+
+    /** The indices of the next actors in the location lists. */
+    QVector<int> _next;
+
+    /** The objects representing the actors, if any. */
+    QVector<Actor*> _objects;
+
+    /** The actor labels. */
+    QVector<QSharedPointer<CharacterLabelPair> > _labels;
+
+    /** Whether each index refers to a live actor. */
+    QBitArray _live;
+
+    /** The released indices available for reuse. */
+    QVector<int> _free;
+
+    /** The number of live actors. */
+    int _size;
+};
+
+#endif // ACTOR_POOL
@@ -2,6 +2,7 @@
 // $Id$
 
 #include <QKeyEvent>
+#include <QMetaObject>
 
 #include "Protocol.h"
 #include "actor/Pawn.h"
@@ -9,7 +10,8 @@
 #include "scene/Scene.h"
 
 Pawn::Pawn (Scene* scene, Session* session, const QPoint& position) :
-    Actor(scene, session->user().avatar.unicode(), session->user().name, position, 2, 1, 3),
+    Actor(scene, session->user().avatar.unicode(), session->user().name, position,
+        CollisionFlags, CollisionMask, SpawnMask),
     _session(session),
     _cursor(false)
 {
@@ -33,8 +35,8 @@ void Pawn::keyPressEvent (QKeyEvent* e)
     if (_cursor && !text.isEmpty()) {
         QChar character = text.at(0);
         if (character.isPrint()) {
-            _scene->set(_position, character.unicode());
-            setPosition(QPoint(_position.x() + 1, _position.y()));
+            _scene->set(position(), character.unicode());
+            setPosition(QPoint(position().x() + 1, position().y()));
             return;
         }
     }
@@ -46,31 +48,31 @@ void Pawn::keyPressEvent (QKeyEvent* e)
     switch (e->key()) {
         case Qt::Key_Backspace:
             if (_cursor) {
-                setPosition(QPoint(_position.x() - 1, _position.y()));
-                _scene->set(_position, ' ');
+                setPosition(QPoint(position().x() - 1, position().y()));
+                _scene->set(position(), ' ');
             }
             break;
 
         case Qt::Key_Delete:
             if (_cursor) {
-                _scene->set(_position, ' ');
+                _scene->set(position(), ' ');
             }
             break;
 
         case Qt::Key_Left:
-            move(QPoint(_position.x() - 1, _position.y()));
+            walk(QPoint(position().x() - 1, position().y()));
             break;
 
         case Qt::Key_Right:
-            move(QPoint(_position.x() + 1, _position.y()));
+            walk(QPoint(position().x() + 1, position().y()));
             break;
 
         case Qt::Key_Up:
-            move(QPoint(_position.x(), _position.y() - 1));
+            walk(QPoint(position().x(), position().y() - 1));
             break;
 
         case Qt::Key_Down:
-            move(QPoint(_position.x(), _position.y() + 1));
+            walk(QPoint(position().x(), position().y() + 1));
             break;
 
         default:
@@ -91,8 +93,24 @@ void Pawn::sceneChangedUnderneath (int character)
     }
 }
 
+void Pawn::walk (const QPoint& position)
+{
+    if (!move(position)) {
+        return;
+    }
+    const ScenePortal* portal = _scene->portal(position);
+    if (portal == 0) {
+        _scene->prefetchPortals(_session, position);
+        return;
+    }
+    // the move deletes the pawn, so it must wait until we've finished handling the event
+    QMetaObject::invokeMethod(_session, "moveThroughPortal", Qt::QueuedConnection,
+        Q_ARG(quint32, portal->targetZoneId), Q_ARG(quint32, portal->targetSceneId),
+        Q_ARG(const QPoint&, portal->targetPosition));
+}
+
 void Pawn::updateCharacter ()
 {
-    setCharacter(_cursor ? (_scene->record().get(_position) | REVERSE_FLAG) :
+    setCharacter(_cursor ? (_scene->record().get(position()) | REVERSE_FLAG) :
         _session->user().avatar.unicode());
 }
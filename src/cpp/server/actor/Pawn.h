@@ -19,6 +19,15 @@ class Pawn : public Actor
 
 public:
 
+    /** The collision flags of pawns. */
+    static const int CollisionFlags = 2;
+
+    /** The collision mask of pawns. */
+    static const int CollisionMask = 1;
+
+    /** The spawn mask of pawns. */
+    static const int SpawnMask = 3;
+
     /**
      * Creates a new pawn.
      */
@@ -65,6 +74,12 @@ protected slots:
 
 protected:
 
+    /**
+     * Moves the pawn to the specified position if possible, passing through any portal there or
+     * prefetching the targets of those nearby.
+     */
+    void walk (const QPoint& position);
+
     /** The session controlling the pawn. */
     Session* _session;
 
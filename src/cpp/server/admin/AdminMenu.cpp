@@ -4,6 +4,7 @@
 #include <QTranslator>
 
 #include "admin/AdminMenu.h"
+#include "admin/DatabaseStatsDialog.h"
 #include "admin/EditUserDialog.h"
 #include "admin/GenerateInvitesDialog.h"
 #include "admin/RuntimeConfigDialog.h"
@@ -20,6 +21,8 @@ AdminMenu::AdminMenu (Session* parent, int deleteOnReleaseKey) :
         Q_ARG(Session*, parent));
     addButton(tr("Generate &Invites..."), &GenerateInvitesDialog::staticMetaObject,
         Q_ARG(Session*, parent));
+    addButton(tr("&Database Stats..."), &DatabaseStatsDialog::staticMetaObject,
+        Q_ARG(Session*, parent));
 
     pack();
     center();
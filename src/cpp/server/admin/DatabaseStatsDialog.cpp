@@ -0,0 +1,103 @@
+//
+// $Id$
+
+#include <QHash>
+#include <QMap>
+#include <QStringList>
+#include <QTranslator>
+
+#include "ServerApp.h"
+#include "admin/DatabaseStatsDialog.h"
+#include "db/DatabasePool.h"
+#include "db/DatabaseThread.h"
+#include "net/Session.h"
+#include "ui/Border.h"
+#include "ui/Button.h"
+#include "ui/Layout.h"
+#include "ui/ScrollingList.h"
+#include "ui/TabbedPane.h"
+
+// translate through the session
+#define tr(...) this->session()->translator()->translate("DatabaseStatsDialog", __VA_ARGS__)
+
+/**
+ * Formats a time given in nanoseconds as milliseconds.
+ */
+static QString millis (qint64 time)
+{
+    return QString::number(time / 1000000.0, 'f', 1);
+}
+
+DatabaseStatsDialog::DatabaseStatsDialog (Session* parent) :
+    Window(parent, parent->highestWindowLayer(), true, true)
+{
+    setBorder(new FrameBorder());
+    setLayout(new BoxLayout(Qt::Vertical, BoxLayout::HStretch, Qt::AlignCenter, 1));
+
+    TabbedPane* tabs = new TabbedPane(Qt::Horizontal);
+    addChild(tabs);
+    tabs->addTab(tr("Requests"), _requests = new ScrollingList(10));
+    tabs->addTab(tr("Queues"), _queues = new ScrollingList(10));
+    tabs->addTab(tr("Slow Queries"), _slowQueries = new ScrollingList(10));
+
+    Button* refresh = new Button(tr("Refresh"));
+    connect(refresh, SIGNAL(pressed()), SLOT(refresh()));
+    Button* close = new Button(tr("Close"));
+    connect(close, SIGNAL(pressed()), SLOT(deleteLater()));
+    addChild(BoxLayout::createHBox(Qt::AlignCenter, 2, refresh, close));
+
+    setPreferredSize(QSize(70, -1));
+
+    refresh();
+
+    pack();
+    center();
+}
+
+void DatabaseStatsDialog::refresh ()
+{
+    DatabasePool* pool = session()->app()->databasePool();
+
+    // combine the counters for each method across threads
+    QStringList queues;
+    QHash<QString, InvocationStats> combined;
+    for (int ii = 0; ii < DatabasePool::RequestClassCount; ii++) {
+        foreach (DatabaseThread* thread, pool->threads((DatabasePool::RequestClass)ii)) {
+            queues.append(tr("%1: %2 queued (max %3)").arg(thread->connectionName()).arg(
+                thread->queueDepth()).arg(thread->maxQueueDepth()));
+            QHash<QString, InvocationStats> stats = thread->invocationStats();
+            for (QHash<QString, InvocationStats>::const_iterator it = stats.constBegin(),
+                    end = stats.constEnd(); it != end; it++) {
+                InvocationStats& total = combined[it.key()];
+                const InvocationStats& tstats = it.value();
+                total.invocations += tstats.invocations;
+                total.totalWait += tstats.totalWait;
+                total.maxWait = qMax(total.maxWait, tstats.maxWait);
+                total.totalTime += tstats.totalTime;
+                total.maxTime = qMax(total.maxTime, tstats.maxTime);
+            }
+        }
+    }
+    _queues->setValues(queues);
+
+    // list the methods in order of total time taken, greatest first
+    QMap<qint64, QString> requests;
+    for (QHash<QString, InvocationStats>::const_iterator it = combined.constBegin(),
+            end = combined.constEnd(); it != end; it++) {
+        const InvocationStats& stats = it.value();
+        requests.insertMulti(-(stats.totalWait + stats.totalTime),
+            tr("%1: %2 calls, wait %3/%4 ms, exec %5/%6 ms (mean/max)").arg(it.key()).arg(
+                stats.invocations).arg(millis(stats.totalWait / (qint64)stats.invocations)).arg(
+                millis(stats.maxWait)).arg(millis(stats.totalTime / (qint64)stats.invocations)).
+                    arg(millis(stats.maxTime)));
+    }
+    _requests->setValues(requests.values());
+
+    // list the slow queries, most recent first
+    QStringList slowQueries;
+    foreach (const SlowQuery& query, pool->slowQueryLog().queries()) {
+        slowQueries.prepend(tr("%1 %2 %3 ms: %4").arg(query.when.toString("hh:mm:ss")).arg(
+            query.connectionName).arg(millis(query.time)).arg(query.sql.simplified()));
+    }
+    _slowQueries->setValues(slowQueries);
+}
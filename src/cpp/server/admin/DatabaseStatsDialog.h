@@ -0,0 +1,45 @@
+//
+// $Id$
+
+#ifndef DATABASE_STATS_DIALOG
+#define DATABASE_STATS_DIALOG
+
+#include "ui/Window.h"
+
+class ScrollingList;
+class Session;
+
+/**
+ * Displays the database request counters and the recent slow queries.
+ */
+class DatabaseStatsDialog : public Window
+{
+    Q_OBJECT
+
+public:
+
+    /**
+     * Initializes the dialog.
+     */
+    Q_INVOKABLE DatabaseStatsDialog (Session* parent);
+
+protected slots:
+
+    /**
+     * Updates the lists with the current counters.
+     */
+    void refresh ();
+
+protected:
+
+    /** The queue depths of the database threads. */
+    ScrollingList* _queues;
+
+    /** The counters for each repository method. */
+    ScrollingList* _requests;
+
+    /** The recent slow queries. */
+    ScrollingList* _slowQueries;
+};
+
+#endif // DATABASE_STATS_DIALOG
@@ -1,13 +1,12 @@
 //
 // $Id$
 
-#include <QMetaObject>
 #include <QTranslator>
 
 #include "LogonDialog.h"
 #include "ServerApp.h"
 #include "admin/EditUserDialog.h"
-#include "db/DatabaseThread.h"
+#include "db/DatabasePool.h"
 #include "net/Session.h"
 #include "ui/Border.h"
 #include "ui/Button.h"
@@ -116,8 +115,7 @@ void EditUserDialog::updateSearch ()
 void EditUserDialog::search ()
 {
     // send the request off to the database
-    QMetaObject::invokeMethod(
-        session()->app()->databaseThread()->userRepository(), "loadUser",
+    session()->app()->databasePool()->userRepository()->invoke("loadUser",
         Q_ARG(const QString&, _username->text()),
         Q_ARG(const Callback&, Callback(_this, "userMaybeLoaded(UserRecord)")));
 }
@@ -157,8 +155,7 @@ void EditUserDialog::apply ()
         (_insider->selected() ? UserRecord::Insider : UserRecord::NoFlag);
 
     // send the request off to the database
-    QMetaObject::invokeMethod(
-        session()->app()->databaseThread()->userRepository(), "updateUser",
+    session()->app()->databasePool()->userRepository(_user.id)->invoke("updateUser",
         Q_ARG(const UserRecord&, _user),
         Q_ARG(const Callback&, Callback(_this, "userMaybeUpdated(bool)")));
 }
@@ -200,8 +197,7 @@ void EditUserDialog::userMaybeLoaded (const UserRecord& user)
 void EditUserDialog::reallyDelete ()
 {
     // send the request off to the database
-    QMetaObject::invokeMethod(
-        session()->app()->databaseThread()->userRepository(), "deleteUser",
+    session()->app()->databasePool()->userRepository(_user.id)->invoke("deleteUser",
         Q_ARG(quint32, _user.id));
 
     // reset the interface
@@ -5,7 +5,7 @@
 
 #include "ServerApp.h"
 #include "admin/GenerateInvitesDialog.h"
-#include "db/DatabaseThread.h"
+#include "db/DatabasePool.h"
 #include "db/UserRepository.h"
 #include "net/Session.h"
 #include "ui/Border.h"
@@ -68,16 +68,14 @@ void GenerateInvitesDialog::generate ()
     int flags = (_admin->selected() ? UserRecord::Admin : 0) |
         (_insider->selected() ? UserRecord::Insider : 0);
     if (_tabs->selectedIndex() == 0) {
-        QMetaObject::invokeMethod(
-            session()->app()->databaseThread()->userRepository(), "insertInvite",
+        session()->app()->databasePool()->userRepository()->invoke("insertInvite",
             Q_ARG(const QString&, _description->text()), Q_ARG(int, flags),
             Q_ARG(int, _count->text().toInt()), Q_ARG(const Callback&,
                 Callback(_this, "showInviteUrl(QString)")));
     
     } else {
         QStringList emails = _emails->text().split(QRegExp("\\s+"));
-        QMetaObject::invokeMethod(
-            session()->app()->databaseThread()->userRepository(), "insertInvites",
+        session()->app()->databasePool()->userRepository()->invoke("insertInvites",
             Q_ARG(const QStringList&, emails), Q_ARG(int, flags),
             Q_ARG(const Callback&, Callback(_this, "mailInvites(QStringList,QStringList)",
                 Q_ARG(const QStringList&, emails))));
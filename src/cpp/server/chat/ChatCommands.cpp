@@ -3,6 +3,8 @@
 
 #include <QHash>
 #include <QMetaObject>
+#include <QRect>
+#include <QStringList>
 #include <QTranslator>
 
 #include "ServerApp.h"
@@ -542,6 +544,198 @@ public:
     }
 };
 
+/**
+ * Base class for commands that edit the scene.
+ */
+class SceneEditCommand : public ChatCommand
+{
+public:
+
+    virtual bool canAccess (Session* session) {
+        return session->scene() != 0 && session->pawn() != 0 && session->scene()->canEdit(session);
+    }
+
+protected:
+
+    /**
+     * Parses a region size from the first two arguments and returns the corresponding region
+     * with its upper-left corner at the pawn's position, or an empty region if invalid.
+     */
+    static QRect parseRegion (Session* session, const QStringList& args) {
+        // bound the dimensions separately so that their product can't overflow
+        int width = args.value(0).toInt(), height = args.value(1).toInt();
+        return (width > 0 && height > 0 && width <= MaxRegionSize && height <= MaxRegionSize) ?
+            QRect(session->pawn()->position(), QSize(width, height)) : QRect();
+    }
+
+    /** The maximum width and height of the regions that may be edited at once. */
+    static const int MaxRegionSize = 256;
+};
+
+/**
+ * Handles the /fill command.
+ */
+class FillCommand : public SceneEditCommand
+{
+    Q_DECLARE_TR_FUNCTIONS(ChatCommands)
+
+public:
+
+    virtual QString aliases (QTranslator* translator) { return tr("fill"); }
+
+    virtual QString usage (QTranslator* translator, const QString& cmd) {
+        return tr("Usage: /%1 width height [character]\n"
+            "  Fills the region starting at your position (with spaces, if no character).")
+                .arg(cmd);
+    }
+
+    virtual QString handle (Session* session, QTranslator* translator,
+            const QString& cmd, const QString& args) {
+        session->chatEntryWindow()->addToHistory("/" + cmd + " ");
+        QStringList list = args.split(' ', QString::SkipEmptyParts);
+        QRect region = parseRegion(session, list);
+        if (region.isEmpty() || list.size() > 3 || list.value(2).length() > 1) {
+            return usage(translator, cmd);
+        }
+        session->scene()->fill(region, list.size() == 3 ? list.at(2).at(0).unicode() : ' ');
+        return "";
+    }
+};
+
+/**
+ * Handles the /copy command.
+ */
+class CopyCommand : public SceneEditCommand
+{
+    Q_DECLARE_TR_FUNCTIONS(ChatCommands)
+
+public:
+
+    virtual QString aliases (QTranslator* translator) { return tr("copy"); }
+
+    virtual QString usage (QTranslator* translator, const QString& cmd) {
+        return tr("Usage: /%1 width height\n"
+            "  Copies the region starting at your position to the clipboard.").arg(cmd);
+    }
+
+    virtual QString handle (Session* session, QTranslator* translator,
+            const QString& cmd, const QString& args) {
+        session->chatEntryWindow()->addToHistory("/" + cmd + " ");
+        QStringList list = args.split(' ', QString::SkipEmptyParts);
+        QRect region = parseRegion(session, list);
+        if (region.isEmpty() || list.size() != 2) {
+            return usage(translator, cmd);
+        }
+        if (!session->scene()->loadRegion(region)) {
+            return tr("Part of the region is still loading.  Please try again in a moment.");
+        }
+        session->setClipboard(session->scene()->copy(region));
+        return "";
+    }
+};
+
+/**
+ * Handles the /paste command.
+ */
+class PasteCommand : public SceneEditCommand
+{
+    Q_DECLARE_TR_FUNCTIONS(ChatCommands)
+
+public:
+
+    virtual QString aliases (QTranslator* translator) { return tr("paste"); }
+
+    virtual QString usage (QTranslator* translator, const QString& cmd) {
+        return tr("Usage: /%1\n"
+            "  Pastes the contents of the clipboard at your position.").arg(cmd);
+    }
+
+    virtual QString handle (Session* session, QTranslator* translator,
+            const QString& cmd, const QString& args) {
+        session->chatEntryWindow()->addToHistory("/" + cmd);
+        if (session->clipboard().data.isEmpty()) {
+            return tr("The clipboard is empty.");
+        }
+        session->scene()->paste(session->pawn()->position(), session->clipboard());
+        return "";
+    }
+};
+
+/**
+ * Handles the /move command.
+ */
+class MoveCommand : public SceneEditCommand
+{
+    Q_DECLARE_TR_FUNCTIONS(ChatCommands)
+
+public:
+
+    virtual QString aliases (QTranslator* translator) { return tr("move"); }
+
+    virtual QString usage (QTranslator* translator, const QString& cmd) {
+        return tr("Usage: /%1 width height dx dy\n"
+            "  Moves the region starting at your position by the given offset.").arg(cmd);
+    }
+
+    virtual QString handle (Session* session, QTranslator* translator,
+            const QString& cmd, const QString& args) {
+        session->chatEntryWindow()->addToHistory("/" + cmd + " ");
+        QStringList list = args.split(' ', QString::SkipEmptyParts);
+        QRect region = parseRegion(session, list);
+        bool dxok, dyok;
+        QPoint offset(list.value(2).toInt(&dxok), list.value(3).toInt(&dyok));
+        if (region.isEmpty() || list.size() != 4 || !(dxok && dyok)) {
+            return usage(translator, cmd);
+        }
+        if (!session->scene()->move(region, region.topLeft() + offset)) {
+            return tr("Part of the region is still loading.  Please try again in a moment.");
+        }
+        return "";
+    }
+};
+
+/**
+ * Handles the /portal command.
+ */
+class PortalCommand : public SceneEditCommand
+{
+    Q_DECLARE_TR_FUNCTIONS(ChatCommands)
+
+public:
+
+    virtual QString aliases (QTranslator* translator) { return tr("portal"); }
+
+    virtual QString usage (QTranslator* translator, const QString& cmd) {
+        return tr("Usage: /%1 [zone_id scene_id x y]\n"
+            "  Creates a portal at your position leading to the given zone (0 for this one) and\n"
+            "  scene (0 for the zone's default), or removes the portal at your position.")
+                .arg(cmd);
+    }
+
+    virtual QString handle (Session* session, QTranslator* translator,
+            const QString& cmd, const QString& args) {
+        session->chatEntryWindow()->addToHistory("/" + cmd + " ");
+        QPoint position = session->pawn()->position();
+        QStringList list = args.split(' ', QString::SkipEmptyParts);
+        if (list.isEmpty()) {
+            if (session->scene()->portal(position) == 0) {
+                return tr("There is no portal here.");
+            }
+            session->scene()->removePortal(position);
+            return "";
+        }
+        bool zok, sok, xok, yok;
+        ScenePortal portal = { position, list.value(0).toUInt(&zok), list.value(1).toUInt(&sok),
+            QPoint(list.value(2).toInt(&xok), list.value(3).toInt(&yok)) };
+        if (list.size() != 4 || !(zok && sok && xok && yok) ||
+                (portal.targetZoneId == 0 && portal.targetSceneId == 0)) {
+            return usage(translator, cmd);
+        }
+        session->scene()->setPortal(portal);
+        return "";
+    }
+};
+
 /**
  * Handles the /eval command.
  */
@@ -637,7 +831,9 @@ static QHash<QString, CommandMap> createCommandMapMap (ServerApp* app)
         new EmoteCommand(), new ShoutCommand(), new TellCommand(), new RespondCommand(),
         new MuteCommand(), new UnmuteCommand(), new BroadcastCommand(), new RebootCommand(),
         new SGoCommand(), new ZGoCommand(), new PGoCommand(), new SummonCommand(),
-        new SpawnCommand(), new EvalCommand(), new UploadCommand(), new InputCommand() };
+        new SpawnCommand(), new FillCommand(), new CopyCommand(), new PasteCommand(),
+        new MoveCommand(), new PortalCommand(), new EvalCommand(), new UploadCommand(),
+        new InputCommand() };
 
     QHash<QString, CommandMap> map;
     for (int ii = 0; ii < sizeof(handlers) / sizeof(ChatCommand*); ii++) {
@@ -82,45 +82,39 @@ ChatWindow::ChatWindow (Session* parent) :
     setBackground(0);
 }
 
-void ChatWindow::display (const QString& speaker, const QString& message, SpeakMode mode)
+QString ChatWindow::format (
+    QTranslator* translator, const QString& speaker, const QString& message, SpeakMode mode)
 {
     QString format;
     switch (mode) {
         case NormalMode:
-            format = tr("%1 says, \"%2\"");
+            format = translator->translate("ChatWindow", "%1 says, \"%2\"");
             break;
 
         case EmoteMode:
-            format = tr("%1 %2");
+            format = translator->translate("ChatWindow", "%1 %2");
             break;
 
         case ShoutMode:
-            format = tr("%1 shouts, \"%2\"");
+            format = translator->translate("ChatWindow", "%1 shouts, \"%2\"");
             break;
 
         case BroadcastMode:
-            format = tr("%1 broadcasts, \"%2\"");
+            format = translator->translate("ChatWindow", "%1 broadcasts, \"%2\"");
             break;
 
         case TellMode:
-            format = tr("%1 tells you, \"%2\"");
-            _lastSender = speaker;
+            format = translator->translate("ChatWindow", "%1 tells you, \"%2\"");
             break;
     }
-    display(format.arg(speaker, message));
+    return format.arg(speaker, message);
 }
 
-void ChatWindow::display (const TranslationKey& key)
-{
-    display(key.translate(session()->translator()));
-}
-
-void ChatWindow::display (const QString& text)
+QStringList ChatWindow::wrap (const QString& text, int width)
 {
-    // break the text up into lines and append to the list
+    // break the text up into lines
+    QStringList lines;
     int length = 0;
-    QRect innerRect = this->innerRect();
-    int wlimit = innerRect.width();
     const QChar* start = text.constData(), *whitespace = 0;
     bool wrun = false;
     for (const QChar* ptr = start, *end = ptr + text.size(); ptr < end; ptr++) {
@@ -134,7 +128,7 @@ void ChatWindow::display (const QString& text)
             } else {
                 wrun = false;
             }
-            if (++length <= wlimit) {
+            if (++length <= width) {
                 continue;
             }
             if (whitespace == 0) { // nowhere to break
@@ -148,16 +142,43 @@ void ChatWindow::display (const QString& text)
             }
             ptr--;
         }
-        addChild(new Label(QString(start, length)));
+        lines.append(QString(start, length));
         start = ptr + 1;
         length = 0;
         whitespace = 0;
         wrun = false;
     }
-    addChild(new Label(QString(start, length)));
+    lines.append(QString(start, length));
+    return lines;
+}
+
+void ChatWindow::display (const QString& speaker, const QString& message, SpeakMode mode)
+{
+    if (mode == TellMode) {
+        _lastSender = speaker;
+    }
+    display(format(session()->translator(), speaker, message, mode));
+}
+
+void ChatWindow::display (const TranslationKey& key)
+{
+    display(key.translate(session()->translator()));
+}
+
+void ChatWindow::display (const QString& text)
+{
+    displayLines(wrap(text, lineWidth()));
+}
+
+void ChatWindow::displayLines (const QStringList& lines)
+{
+    foreach (const QString& line, lines) {
+        addChild(new Label(line));
+    }
 
     // remove any lines beyond the limit
-    while (_children.size() > innerRect.height()) {
+    int hlimit = innerRect().height();
+    while (_children.size() > hlimit) {
         removeChildAt(0);
     }
 }
@@ -11,6 +11,8 @@
 
 #include "ui/Window.h"
 
+class QTranslator;
+
 class ChatCommand;
 class Label;
 class TextField;
@@ -28,6 +30,17 @@ public:
     /** The available modes of speech. */
     enum SpeakMode { NormalMode, EmoteMode, ShoutMode, BroadcastMode, TellMode };
 
+    /**
+     * Formats a message spoken in the specified mode using the given translator.
+     */
+    static QString format (QTranslator* translator, const QString& speaker,
+        const QString& message, SpeakMode mode);
+
+    /**
+     * Breaks text up into lines no wider than the specified width.
+     */
+    static QStringList wrap (const QString& text, int width);
+
     /**
      * Initializes the window.
      */
@@ -59,6 +72,16 @@ public:
      */
     void display (const QString& text);
 
+    /**
+     * Returns the width to which displayed text is wrapped.
+     */
+    int lineWidth () const { return innerRect().width(); }
+
+    /**
+     * Displays text already wrapped to the line width.
+     */
+    void displayLines (const QStringList& lines);
+
     /**
      * Clears the display.
      */
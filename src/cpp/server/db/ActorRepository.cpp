@@ -7,13 +7,14 @@
 #include <QtDebug>
 
 #include "db/ActorRepository.h"
+#include "db/DatabaseThread.h"
 #include "util/Callback.h"
 
 void ActorRepository::init ()
 {
     // create the tables if they don't yet exist
-    QSqlDatabase database = QSqlDatabase::database();
-    QSqlQuery query;
+    QSqlDatabase database = DatabaseThread::connection();
+    QSqlQuery query(DatabaseThread::connection());
 
     if (!database.tables().contains("ACTORS")) {
         /*
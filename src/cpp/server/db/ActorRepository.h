@@ -4,14 +4,14 @@
 #ifndef ACTOR_REPOSITORY
 #define ACTOR_REPOSITORY
 
-#include <QObject>
+#include "db/Repository.h"
 
 class Callback;
 
 /**
  * Handles database queries associated with actors.
  */
-class ActorRepository : public QObject
+class ActorRepository : public Repository
 {
     Q_OBJECT
 
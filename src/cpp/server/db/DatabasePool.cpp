@@ -0,0 +1,219 @@
+//
+// $Id$
+
+#include <QHash>
+#include <QMetaObject>
+#include <QTimer>
+#include <QUrl>
+
+#include "ServerApp.h"
+#include "db/DatabasePool.h"
+#include "db/DatabaseThread.h"
+#include "db/UserRepository.h"
+#include "http/HttpConnection.h"
+
+/** The config keys containing the number of threads for each class of request. */
+static const char* ThreadCountKeys[] = {
+    "database_interactive_threads", "database_bulk_threads", "database_background_threads" };
+
+/** The names of the request classes, used to name the connections. */
+static const char* RequestClassNames[] = { "interactive", "bulk", "background" };
+
+/** The number of slow queries retained for inspection. */
+static const int SlowQueryLogSize = 100;
+
+/** The names, types and descriptions of the per-method metrics. */
+static const char* RequestMetrics[][3] = {
+    { "witgap_db_requests_total", "counter", "Repository requests processed." },
+    { "witgap_db_request_wait_seconds_total", "counter", "Time requests spent queued." },
+    { "witgap_db_request_wait_seconds_max", "gauge", "Longest time a request spent queued." },
+    { "witgap_db_request_seconds_total", "counter", "Time spent executing requests." },
+    { "witgap_db_request_seconds_max", "gauge", "Longest time spent executing a request." } };
+
+/**
+ * Returns the value of one of the per-method metrics.
+ */
+static double requestMetric (const InvocationStats& stats, int metric)
+{
+    switch (metric) {
+        case 0: return stats.invocations;
+        case 1: return stats.totalWait / 1000000000.0;
+        case 2: return stats.maxWait / 1000000000.0;
+        case 3: return stats.totalTime / 1000000000.0;
+        default: return stats.maxTime / 1000000000.0;
+    }
+}
+
+/**
+ * Appends the header of a metric in the Prometheus text format.
+ */
+static void appendMetricHeader (QByteArray& out, const char* name, const char* type,
+    const char* help)
+{
+    out += QByteArray("# HELP ") + name + " " + help + "\n";
+    out += QByteArray("# TYPE ") + name + " " + type + "\n";
+}
+
+DatabasePool::DatabasePool (ServerApp* app) :
+    QObject(app),
+    _app(app),
+    _threadCount(0),
+    _userCache(app->config().value("user_cache_size", 10000).toInt()),
+    _slowQueryLog(app->config().value("database_slow_query_time", 250).toLongLong() * 1000000,
+        SlowQueryLogSize),
+    _metricsToken(app->config().value("metrics_token").toString()),
+    _userFlushTimer(new QTimer(this))
+{
+    _userFlushTimer->setInterval(app->config().value("user_flush_interval", 60).toInt() * 1000);
+    connect(_userFlushTimer, SIGNAL(timeout()), SLOT(flushUsers()));
+
+    for (int ii = 0; ii < RequestClassCount; ii++) {
+        int nthreads = qMax(1, app->config().value(ThreadCountKeys[ii], 1).toInt());
+        for (int jj = 0; jj < nthreads; jj++) {
+            // the first thread created initializes the schema for the rest
+            _threads[ii].append(new DatabaseThread(app, this,
+                QString("%1-%2").arg(RequestClassNames[ii]).arg(jj), _threadCount++ == 0));
+        }
+    }
+}
+
+void DatabasePool::startThreads ()
+{
+    for (int ii = 0; ii < RequestClassCount; ii++) {
+        foreach (DatabaseThread* thread, _threads[ii]) {
+            thread->start();
+        }
+    }
+    _userFlushTimer->start();
+
+    // register for /metrics (the HTTP manager doesn't exist when we're created)
+    _app->httpManager()->registerSubhandler("metrics", this);
+}
+
+void DatabasePool::stopThreads ()
+{
+    // write the pending changes before we go
+    _userFlushTimer->stop();
+    userRepository(Background)->invokeAndWait("flushUsers");
+
+    for (int ii = 0; ii < RequestClassCount; ii++) {
+        foreach (DatabaseThread* thread, _threads[ii]) {
+            thread->exit();
+            thread->wait();
+        }
+    }
+}
+
+DatabaseThread* DatabasePool::thread (RequestClass rclass)
+{
+    const QList<DatabaseThread*>& threads = _threads[rclass];
+    if (threads.size() == 1) {
+        return threads.at(0);
+    }
+    // the count may wrap around, so make sure the index is positive
+    uint count = _requestCount.fetchAndAddRelaxed(1);
+    return threads.at(count % threads.size());
+}
+
+DatabaseThread* DatabasePool::thread (RequestClass rclass, quint64 key)
+{
+    const QList<DatabaseThread*>& threads = _threads[rclass];
+    return threads.at(key % threads.size());
+}
+
+ActorRepository* DatabasePool::actorRepository (RequestClass rclass)
+{
+    return thread(rclass)->actorRepository();
+}
+
+PeerRepository* DatabasePool::peerRepository (RequestClass rclass)
+{
+    return thread(rclass)->peerRepository();
+}
+
+PropertyRepository* DatabasePool::propertyRepository () const
+{
+    return _threads[Background].at(0)->propertyRepository();
+}
+
+SceneRepository* DatabasePool::sceneRepository (RequestClass rclass)
+{
+    return thread(rclass)->sceneRepository();
+}
+
+SceneRepository* DatabasePool::sceneRepository (quint32 sceneId)
+{
+    return thread(Bulk, sceneId)->sceneRepository();
+}
+
+UserRepository* DatabasePool::userRepository (RequestClass rclass)
+{
+    return thread(rclass)->userRepository();
+}
+
+UserRepository* DatabasePool::userRepository (quint64 userId)
+{
+    return thread(Interactive, userId)->userRepository();
+}
+
+QByteArray DatabasePool::metrics () const
+{
+    QList<DatabaseThread*> threads;
+    for (int ii = 0; ii < RequestClassCount; ii++) {
+        threads += _threads[ii];
+    }
+    QByteArray out;
+    appendMetricHeader(out, "witgap_db_queue_depth", "gauge", "Repository requests queued.");
+    foreach (DatabaseThread* thread, threads) {
+        out += "witgap_db_queue_depth{thread=\"" + thread->connectionName().toAscii() + "\"} " +
+            QByteArray::number(thread->queueDepth()) + "\n";
+    }
+    appendMetricHeader(out, "witgap_db_queue_depth_max", "gauge",
+        "Most repository requests ever queued at once.");
+    foreach (DatabaseThread* thread, threads) {
+        out += "witgap_db_queue_depth_max{thread=\"" + thread->connectionName().toAscii() +
+            "\"} " + QByteArray::number(thread->maxQueueDepth()) + "\n";
+    }
+
+    // take a snapshot of each thread's counters so that the metrics are consistent
+    QList<QHash<QString, InvocationStats> > stats;
+    foreach (DatabaseThread* thread, threads) {
+        stats.append(thread->invocationStats());
+    }
+    for (int ii = 0, nn = sizeof(RequestMetrics) / sizeof(RequestMetrics[0]); ii < nn; ii++) {
+        const char** metric = RequestMetrics[ii];
+        appendMetricHeader(out, metric[0], metric[1], metric[2]);
+        for (int jj = 0; jj < threads.size(); jj++) {
+            QByteArray thread = threads.at(jj)->connectionName().toAscii();
+            const QHash<QString, InvocationStats>& tstats = stats.at(jj);
+            for (QHash<QString, InvocationStats>::const_iterator it = tstats.constBegin(),
+                    end = tstats.constEnd(); it != end; it++) {
+                out += QByteArray(metric[0]) + "{thread=\"" + thread + "\",method=\"" +
+                    it.key().toAscii() + "\"} " +
+                    QByteArray::number(requestMetric(it.value(), ii), 'g', 12) + "\n";
+            }
+        }
+    }
+
+    appendMetricHeader(out, "witgap_db_slow_queries_total", "counter",
+        "Queries that exceeded the slow query time.");
+    out += "witgap_db_slow_queries_total " + QByteArray::number(_slowQueryLog.count()) + "\n";
+    return out;
+}
+
+bool DatabasePool::handleRequest (
+    HttpConnection* connection, const QString& name, const QString& path)
+{
+    // the metrics are only available to those who know the configured token
+    if (_metricsToken.isEmpty() ||
+            connection->requestUrl().queryItemValue("token") != _metricsToken) {
+        return false;
+    }
+    connection->respond("200 OK", metrics(), "text/plain; version=0.0.4");
+    return true;
+}
+
+void DatabasePool::flushUsers ()
+{
+    userRepository(Background)->invoke("flushUsers");
+}
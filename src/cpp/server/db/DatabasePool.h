@@ -0,0 +1,209 @@
+//
+// $Id$
+
+#ifndef DATABASE_POOL
+#define DATABASE_POOL
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QList>
+#include <QObject>
+#include <QSemaphore>
+
+#include "db/NameIndex.h"
+#include "db/ResourceIndex.h"
+#include "db/SlowQueryLog.h"
+#include "db/UserCache.h"
+#include "http/HttpManager.h"
+
+class ActorRepository;
+class DatabaseThread;
+class PeerRepository;
+class PropertyRepository;
+class QTimer;
+class SceneRepository;
+class ServerApp;
+class UserRepository;
+
+/**
+ * Maintains a pool of database threads, each with its own connection, and routes repository
+ * requests to them according to their class.  Within a class, each calling thread is always
+ * routed to the same database thread, so that requests made by any one thread are processed in
+ * the order in which they were made.
+ */
+class DatabasePool : public QObject, public HttpRequestHandler
+{
+    Q_OBJECT
+
+public:
+
+    /** The classes of request, each of which is served by its own threads. */
+    enum RequestClass { Interactive, Bulk, Background, RequestClassCount };
+
+    /**
+     * Creates the pool and its threads.
+     */
+    DatabasePool (ServerApp* app);
+
+    /**
+     * Starts the database threads and registers the metrics handler.
+     */
+    void startThreads ();
+
+    /**
+     * Stops the database threads, waiting for each to finish.  Pending user changes are flushed
+     * first.
+     */
+    void stopThreads ();
+
+    /**
+     * Returns the database thread that should process a request of the specified class.  The
+     * threads take turns, so requests made this way may be processed in any order.
+     */
+    DatabaseThread* thread (RequestClass rclass);
+
+    /**
+     * Returns the database thread that should process a request of the specified class
+     * concerning the identified object, which is always the same thread.  Requests about an
+     * object are thus processed in order, regardless of the threads from which they're made.
+     */
+    DatabaseThread* thread (RequestClass rclass, quint64 key);
+
+    /**
+     * Returns a reference to the threads serving the specified class of request.
+     */
+    const QList<DatabaseThread*>& threads (RequestClass rclass) const { return _threads[rclass]; }
+
+    /**
+     * Returns a pointer to the actor repository to use for the specified class of request.
+     */
+    ActorRepository* actorRepository (RequestClass rclass = Interactive);
+
+    /**
+     * Returns a pointer to the peer repository to use for the specified class of request.
+     */
+    PeerRepository* peerRepository (RequestClass rclass = Background);
+
+    /**
+     * Returns a pointer to the property repository.  Because it tracks the registered persistent
+     * objects, there's only one, on the first background thread.
+     */
+    PropertyRepository* propertyRepository () const;
+
+    /**
+     * Returns a pointer to the scene repository to use for the specified class of request.
+     */
+    SceneRepository* sceneRepository (RequestClass rclass = Bulk);
+
+    /**
+     * Returns a pointer to the (bulk) scene repository that handles the identified scene.
+     * Instances migrate between threads, so requests involving a scene's blocks must go through
+     * here to be processed in order.
+     */
+    SceneRepository* sceneRepository (quint32 sceneId);
+
+    /**
+     * Returns a pointer to the user repository to use for the specified class of request.
+     */
+    UserRepository* userRepository (RequestClass rclass = Interactive);
+
+    /**
+     * Returns a pointer to the (interactive) user repository that handles the identified user.
+     * Requests that change a user must go through here to be processed in order.
+     */
+    UserRepository* userRepository (quint64 userId);
+
+    /**
+     * Returns a reference to the index of taken user names, which is shared by all threads.
+     */
+    NameIndex& nameIndex () { return _nameIndex; }
+
+    /**
+     * Returns a reference to the index of scene names, which is shared by all threads.
+     */
+    ResourceIndex& sceneIndex () { return _sceneIndex; }
+
+    /**
+     * Returns a reference to the index of zone names, which is shared by all threads.
+     */
+    ResourceIndex& zoneIndex () { return _zoneIndex; }
+
+    /**
+     * Returns a reference to the cache of user records, which is shared by all threads.
+     */
+    UserCache& userCache () { return _userCache; }
+
+    /**
+     * Returns a reference to the log of slow queries, which is shared by all threads.
+     */
+    SlowQueryLog& slowQueryLog () { return _slowQueryLog; }
+
+    /**
+     * Writes the request and query counters for all threads in the Prometheus text format.
+     */
+    QByteArray metrics () const;
+
+    /**
+     * Handles an HTTP request.
+     */
+    virtual bool handleRequest (
+        HttpConnection* connection, const QString& name, const QString& path);
+
+    /**
+     * Notes that the schema has been initialized by the first thread, allowing the others to
+     * begin processing requests.
+     */
+    void schemaInitialized () { _schemaInitialized.release(_threadCount - 1); }
+
+    /**
+     * Waits for the schema to be initialized by the first thread.
+     */
+    void waitForSchema () { _schemaInitialized.acquire(); }
+
+protected slots:
+
+    /**
+     * Writes the pending user changes on a background thread.
+     */
+    void flushUsers ();
+
+protected:
+
+    /** The server application. */
+    ServerApp* _app;
+
+    /** The threads serving each class of request. */
+    QList<DatabaseThread*> _threads[RequestClassCount];
+
+    /** The total number of threads. */
+    int _threadCount;
+
+    /** Released by the first thread once the schema has been initialized. */
+    QSemaphore _schemaInitialized;
+
+    /** The number of unkeyed requests routed, which determines the next one's thread. */
+    QAtomicInt _requestCount;
+
+    /** The index of taken user names. */
+    NameIndex _nameIndex;
+
+    /** The index of scene names. */
+    ResourceIndex _sceneIndex;
+
+    /** The index of zone names. */
+    ResourceIndex _zoneIndex;
+
+    /** The cache of user records. */
+    UserCache _userCache;
+
+    /** The log of slow queries. */
+    SlowQueryLog _slowQueryLog;
+
+    /** The token required to fetch the metrics, or empty to disable them. */
+    QString _metricsToken;
+
+    /** Periodically flushes the pending user changes. */
+    QTimer* _userFlushTimer;
+};
+
+#endif // DATABASE_POOL
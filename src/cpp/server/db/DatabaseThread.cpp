@@ -3,33 +3,86 @@
 
 #include <time.h>
 
+#include <QMutexLocker>
 #include <QtDebug>
 #include <QSqlDatabase>
 #include <QSqlError>
+#include <QSqlQuery>
 
 #include "ServerApp.h"
 #include "db/ActorRepository.h"
+#include "db/DatabasePool.h"
 #include "db/DatabaseThread.h"
 #include "db/PeerRepository.h"
 #include "db/PropertyRepository.h"
 #include "db/SceneRepository.h"
+#include "db/StatementCache.h"
 #include "db/UserRepository.h"
 #include "util/General.h"
 
-DatabaseThread::DatabaseThread (ServerApp* app) :
-    QThread(app),
+/** The pragmas executed on opening an embedded SQLite database. */
+static const char* SqlitePragmas[] = {
+    // readers don't block the writer and vice versa, which our separate threads rely upon
+    "pragma journal_mode = WAL",
+
+    // with WAL, syncing at checkpoints only is safe against corruption
+    "pragma synchronous = NORMAL",
+
+    // wait for other threads' write locks rather than failing immediately
+    "pragma busy_timeout = 10000",
+
+    // keep temporary tables and indices (used for sorting, for instance) off the disk
+    "pragma temp_store = MEMORY",
+
+    // a 16 MB page cache per connection
+    "pragma cache_size = -16384",
+
+    0 };
+
+QSqlDatabase DatabaseThread::connection ()
+{
+    return static_cast<DatabaseThread*>(QThread::currentThread())->_database;
+}
+
+PreparedQuery DatabaseThread::prepare (const QString& sql)
+{
+    return static_cast<DatabaseThread*>(QThread::currentThread())->_statementCache->prepare(sql);
+}
+
+bool DatabaseThread::sqlite ()
+{
+    return static_cast<DatabaseThread*>(QThread::currentThread())->_sqlite;
+}
+
+QString DatabaseThread::autoIncrementKey (const QString& type)
+{
+    // SQLite only auto-increments its rowid alias, which must be declared exactly so
+    return sqlite() ? QString("integer primary key autoincrement") :
+        type + " not null auto_increment primary key";
+}
+
+DatabaseThread::DatabaseThread (
+        ServerApp* app, DatabasePool* pool, const QString& connectionName, bool primary) :
+    QThread(pool),
     _app(app),
+    _pool(pool),
+    _connectionName(connectionName),
+    _primary(primary),
+    _statementCache(0),
     _type(app->config().value("database_type").toString()),
+    _sqlite(_type == "QSQLITE"),
     _hostname(app->config().value("database_hostname").toString()),
     _port(app->config().value("database_port").toInt()),
     _databaseName(app->config().value("database_name").toString()),
     _username(app->config().value("database_username").toString()),
     _password(app->config().value("database_password").toString()),
     _connectOptions(app->config().value("database_connect_options").toString()),
+    _queueDepth(0),
+    _maxQueueDepth(0),
     _actorRepository(new ActorRepository()),
     _peerRepository(new PeerRepository()),
     _propertyRepository(new PropertyRepository(app)),
-    _sceneRepository(new SceneRepository()),
+    _sceneRepository(new SceneRepository(app)),
     _userRepository(new UserRepository(app))
 {
     // move the repositories to this thread
@@ -40,6 +93,47 @@ DatabaseThread::DatabaseThread (ServerApp* app) :
     _userRepository->moveToThread(this);
 }
 
+void DatabaseThread::invocationPosted ()
+{
+    QMutexLocker locker(&_statsMutex);
+    _maxQueueDepth = qMax(_maxQueueDepth, ++_queueDepth);
+}
+
+void DatabaseThread::invocationProcessed (const QString& method, qint64 wait, qint64 time)
+{
+    QMutexLocker locker(&_statsMutex);
+    _queueDepth--;
+    QHash<QString, InvocationStats>::iterator it = _invocationStats.find(method);
+    if (it == _invocationStats.end()) {
+        InvocationStats stats = { 0, 0, 0, 0, 0 };
+        it = _invocationStats.insert(method, stats);
+    }
+    InvocationStats& stats = it.value();
+    stats.invocations++;
+    stats.totalWait += wait;
+    stats.maxWait = qMax(stats.maxWait, wait);
+    stats.totalTime += time;
+    stats.maxTime = qMax(stats.maxTime, time);
+}
+
+int DatabaseThread::queueDepth () const
+{
+    QMutexLocker locker(&_statsMutex);
+    return _queueDepth;
+}
+
+int DatabaseThread::maxQueueDepth () const
+{
+    QMutexLocker locker(&_statsMutex);
+    return _maxQueueDepth;
+}
+
+QHash<QString, InvocationStats> DatabaseThread::invocationStats () const
+{
+    QMutexLocker locker(&_statsMutex);
+    return _invocationStats;
+}
+
 void DatabaseThread::run ()
 {
     // seed the random number generator for this thread
@@ -49,30 +143,52 @@ void DatabaseThread::run ()
     _runtimeConfig = _app->runtimeConfig();
 
     // connect to the configured database
-    QString connectionName;
-    {
-        QSqlDatabase db = QSqlDatabase::addDatabase(_type);
-        connectionName = db.connectionName();
-        db.setHostName(_hostname);
-        db.setPort(_port);
-        db.setDatabaseName(_databaseName);
-        db.setUserName(_username);
-        db.setPassword(_password);
-        db.setConnectOptions(_connectOptions);
-        if (db.open()) {
-            // initialize repositories
+    _database = QSqlDatabase::addDatabase(_type, _connectionName);
+    _database.setDatabaseName(_databaseName);
+    if (!_sqlite) {
+        _database.setHostName(_hostname);
+        _database.setPort(_port);
+        _database.setUserName(_username);
+        _database.setPassword(_password);
+        _database.setConnectOptions(_connectOptions);
+    }
+    bool open = _database.open();
+    if (open) {
+        if (_sqlite) {
+            QSqlQuery query(_database);
+            for (const char** pragma = SqlitePragmas; *pragma != 0; pragma++) {
+                if (!query.exec(*pragma)) {
+                    qWarning() << "Failed to set pragma." << *pragma << query.lastError();
+                }
+            }
+        }
+        _statementCache = new StatementCache(_database, &_pool->slowQueryLog());
+    } else {
+        qCritical() << "Failed to connect to database:" << _connectionName << _database.lastError();
+    }
+
+    // the primary thread initializes the repositories; the rest wait for it to finish
+    if (_primary) {
+        if (open) {
             _actorRepository->init();
             _peerRepository->init();
             _propertyRepository->init();
             _sceneRepository->init();
             _userRepository->init();
+        }
+        _pool->schemaInitialized();
 
-            // enter event loop
-            exec();
+    } else {
+        _pool->waitForSchema();
+    }
 
-        } else {
-            qCritical() << "Failed to connect to database:" << db.lastError();
-        }
+    // enter event loop
+    if (open) {
+        exec();
+        qDebug() << "Statement cache hit rate." << _connectionName << _statementCache->hitRate();
     }
-    QSqlDatabase::removeDatabase(connectionName);
+    delete _statementCache;
+    _statementCache = 0;
+    _database = QSqlDatabase();
+    QSqlDatabase::removeDatabase(_connectionName);
 }
@@ -4,18 +4,49 @@
 #ifndef DATABASE_THREAD
 #define DATABASE_THREAD
 
+#include <QHash>
+#include <QMutex>
+#include <QSqlDatabase>
+#include <QString>
 #include <QThread>
 
 class ActorRepository;
+class DatabasePool;
 class PeerRepository;
 class PropertyRepository;
 class RuntimeConfig;
+class PreparedQuery;
 class SceneRepository;
 class ServerApp;
+class StatementCache;
 class UserRepository;
 
 /**
- * Performs database queries in a separate thread.
+ * Counters kept for each repository method.
+ */
+class InvocationStats
+{
+public:
+
+    /** The number of times the method has been invoked. */
+    quint64 invocations;
+
+    /** The total time that invocations spent queued, in nanoseconds. */
+    qint64 totalWait;
+
+    /** The longest time that a single invocation spent queued, in nanoseconds. */
+    qint64 maxWait;
+
+    /** The total time spent executing the method, in nanoseconds. */
+    qint64 totalTime;
+
+    /** The longest time spent on a single execution, in nanoseconds. */
+    qint64 maxTime;
+};
+
+/**
+ * Performs database queries in a separate thread using its own connection.  Each thread has its
+ * own instances of the repositories.
  */
 class DatabaseThread : public QThread
 {
@@ -23,16 +54,81 @@ class DatabaseThread : public QThread
 
 public:
 
+    /**
+     * Returns the connection of the calling thread, which must be a database thread.
+     */
+    static QSqlDatabase connection ();
+
+    /**
+     * Returns a query for the specified statement from the calling thread's statement cache.
+     * The calling thread must be a database thread.
+     */
+    static PreparedQuery prepare (const QString& sql);
+
+    /**
+     * Checks whether the calling thread's connection is to an embedded SQLite database, whose
+     * dialect differs from MySQL's in a few respects.
+     */
+    static bool sqlite ();
+
+    /**
+     * Returns the column definition of an auto-incrementing primary key with the specified
+     * (MySQL) integer type in the dialect of the calling thread's connection.
+     */
+    static QString autoIncrementKey (const QString& type);
+
     /**
      * Initializes the thread.
+     *
+     * @param primary whether this thread is responsible for initializing the schema.
+     */
+    DatabaseThread (ServerApp* app, DatabasePool* pool, const QString& connectionName,
+        bool primary);
+
+    /**
+     * Returns a reference to the name of the thread's connection.
+     */
+    const QString& connectionName () const { return _connectionName; }
+
+    /**
+     * Notes that a repository request has been queued.  This method is thread-safe.
+     */
+    void invocationPosted ();
+
+    /**
+     * Records the wait and execution times of a repository request.  This method is
+     * thread-safe.
+     *
+     * @param method the qualified name of the repository method.
+     */
+    void invocationProcessed (const QString& method, qint64 wait, qint64 time);
+
+    /**
+     * Returns the number of requests currently queued.  This method is thread-safe.
+     */
+    int queueDepth () const;
+
+    /**
+     * Returns the largest number of requests ever queued at once.  This method is thread-safe.
+     */
+    int maxQueueDepth () const;
+
+    /**
+     * Returns the counters for each repository method, mapped by qualified name.  This method
+     * is thread-safe.
      */
-    DatabaseThread (ServerApp* app);
+    QHash<QString, InvocationStats> invocationStats () const;
 
     /**
      * Returns a pointer to the database thread's synchronized copy of the runtime config.
      */
     RuntimeConfig* runtimeConfig () const { return _runtimeConfig; }
 
+    /**
+     * Returns a pointer to the thread's statement cache, valid while the thread is running.
+     */
+    StatementCache* statementCache () const { return _statementCache; }
+
     /**
      * Returns a pointer to the actor repository.
      */
@@ -68,9 +164,27 @@ protected:
     /** The server application. */
     ServerApp* _app;
 
+    /** The pool to which the thread belongs. */
+    DatabasePool* _pool;
+
+    /** The name of our connection. */
+    QString _connectionName;
+
+    /** Whether or not we initialize the schema. */
+    bool _primary;
+
+    /** Our connection, valid while the thread is running. */
+    QSqlDatabase _database;
+
+    /** The prepared statements for our connection. */
+    StatementCache* _statementCache;
+
     /** The connection type. */
     QString _type;
 
+    /** Whether the connection is to an embedded SQLite database. */
+    bool _sqlite;
+
     /** The host to connect to. */
     QString _hostname;
 
@@ -89,6 +203,18 @@ protected:
     /** The options to use when connecting. */
     QString _connectOptions;
 
+    /** Protects the request counters. */
+    mutable QMutex _statsMutex;
+
+    /** The number of requests queued. */
+    int _queueDepth;
+
+    /** The largest number of requests ever queued. */
+    int _maxQueueDepth;
+
+    /** The counters for each repository method. */
+    QHash<QString, InvocationStats> _invocationStats;
+
     /** Our synchronized copy of the runtime config. */
     RuntimeConfig* _runtimeConfig;
 
@@ -0,0 +1,127 @@
+//
+// $Id$
+
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QtDebug>
+
+#include "db/DatabaseThread.h"
+#include "db/NameIndex.h"
+
+/** The number of filter bits allocated per name, which gives a false positive rate under 1%. */
+static const int BitsPerName = 10;
+
+/** The number of bits set for each name. */
+static const int ProbeCount = 7;
+
+/** The minimum number of names for which we size the filter. */
+static const int MinCapacity = 4096;
+
+NameIndex::NameIndex () :
+    _bits(MinCapacity * BitsPerName),
+    _count(0),
+    _capacity(MinCapacity),
+    _loaded(false),
+    _loading(false)
+{
+}
+
+void NameIndex::load ()
+{
+    {
+        QWriteLocker locker(&_lock);
+        if (_loading) {
+            return; // another thread beat us to it
+        }
+        _loading = true;
+        _pending.clear();
+    }
+    QSqlQuery query(DatabaseThread::connection());
+    query.setForwardOnly(true);
+    query.exec("select count(*) from USERS");
+    int count = query.next() ? query.value(0).toInt() : 0;
+
+    // leave room for the table to double before we need to rebuild
+    int capacity = qMax(MinCapacity, count * 2);
+    QBitArray bits(capacity * BitsPerName);
+    count = 0;
+    if (!query.exec("select NAME_LOWER from USERS")) {
+        qWarning() << "Failed to load name index." << query.lastError();
+        QWriteLocker locker(&_lock);
+        _loading = false;
+        return;
+    }
+    while (query.next()) {
+        insert(bits, query.value(0).toString());
+        count++;
+    }
+
+    // add anything inserted while we were scanning, then swap in the new filter
+    QWriteLocker locker(&_lock);
+    foreach (const QString& nameLower, _pending) {
+        insert(bits, nameLower);
+        count++;
+    }
+    _pending.clear();
+    _bits = bits;
+    _count = count;
+    _capacity = capacity;
+    _loaded = true;
+    _loading = false;
+    qDebug() << "Name index loaded." << count << "names," << bits.size() << "bits.";
+}
+
+void NameIndex::insert (const QString& nameLower)
+{
+    QWriteLocker locker(&_lock);
+    insert(_bits, nameLower);
+    _count++;
+    if (_loading) {
+        _pending.append(nameLower);
+    }
+}
+
+bool NameIndex::isLoaded () const
+{
+    QReadLocker locker(&_lock);
+    return _loaded;
+}
+
+bool NameIndex::mayContain (const QString& nameLower) const
+{
+    quint32 h1, h2;
+    hash(nameLower, h1, h2);
+
+    QReadLocker locker(&_lock);
+    for (int ii = 0; ii < ProbeCount; ii++) {
+        if (!_bits.testBit((h1 + ii*h2) % _bits.size())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool NameIndex::needsRebuild () const
+{
+    QReadLocker locker(&_lock);
+    return _count > _capacity;
+}
+
+void NameIndex::hash (const QString& nameLower, quint32& h1, quint32& h2)
+{
+    // FNV-1a supplies the first hash, Qt's string hash the second
+    h1 = 2166136261U;
+    foreach (QChar ch, nameLower) {
+        h1 = (h1 ^ ch.unicode()) * 16777619U;
+    }
+    h2 = qHash(nameLower);
+}
+
+void NameIndex::insert (QBitArray& bits, const QString& nameLower)
+{
+    quint32 h1, h2;
+    hash(nameLower, h1, h2);
+    for (int ii = 0; ii < ProbeCount; ii++) {
+        bits.setBit((h1 + ii*h2) % bits.size());
+    }
+}
@@ -0,0 +1,90 @@
+//
+// $Id$
+
+#ifndef NAME_INDEX
+#define NAME_INDEX
+
+#include <QBitArray>
+#include <QReadWriteLock>
+#include <QString>
+#include <QStringList>
+
+/**
+ * An in-memory index of the (lowercase) names taken by stored users, shared by all of the database
+ * threads.  The index is a Bloom filter: if it reports that a name isn't taken, the name is
+ * certainly free; if it reports that a name may be taken, only the database can say for sure.
+ * Names are never removed, so the names of deleted users simply read as false positives until
+ * the index is next rebuilt.
+ */
+class NameIndex
+{
+public:
+
+    /**
+     * Creates an empty index.
+     */
+    NameIndex ();
+
+    /**
+     * (Re)loads the index from the database on the calling thread's connection.  The current
+     * filter remains in use until the new one is ready.
+     */
+    void load ();
+
+    /**
+     * Adds a name to the index.
+     */
+    void insert (const QString& nameLower);
+
+    /**
+     * Checks whether the index has been loaded.  Until it has, {@link #mayContain} knows only
+     * the names inserted since startup, so its negative answers can't be trusted.
+     */
+    bool isLoaded () const;
+
+    /**
+     * Checks whether the specified name may be taken.
+     */
+    bool mayContain (const QString& nameLower) const;
+
+    /**
+     * Checks whether enough names have been added since the index was sized that it should be
+     * rebuilt to keep the false positive rate down.
+     */
+    bool needsRebuild () const;
+
+protected:
+
+    /**
+     * Computes the two base hashes for a name, from which the probe positions are derived.
+     */
+    static void hash (const QString& nameLower, quint32& h1, quint32& h2);
+
+    /**
+     * Sets the bits for a name in the specified filter.
+     */
+    static void insert (QBitArray& bits, const QString& nameLower);
+
+    /** Guards the filter. */
+    mutable QReadWriteLock _lock;
+
+    /** The filter bits. */
+    QBitArray _bits;
+
+    /** The number of names added to the filter. */
+    int _count;
+
+    /** The number of names for which the filter was sized. */
+    int _capacity;
+
+    /** Whether the index has been loaded at least once. */
+    bool _loaded;
+
+    /** Whether a thread is currently (re)loading the index. */
+    bool _loading;
+
+    /** The names inserted during the current load, which must be added to the new filter. */
+    QStringList _pending;
+};
+
+#endif // NAME_INDEX
@@ -6,7 +6,9 @@
 #include <QStringList>
 #include <QtDebug>
 
+#include "db/DatabaseThread.h"
 #include "db/PeerRepository.h"
+#include "db/StatementCache.h"
 #include "util/Callback.h"
 
 // register our types with the metatype system
@@ -16,8 +18,8 @@ int peerRecordListType = qRegisterMetaType<PeerRecordList>("PeerRecordList");
 void PeerRepository::init ()
 {
     // create the tables if they don't yet exist
-    QSqlDatabase database = QSqlDatabase::database();
-    QSqlQuery query;
+    QSqlDatabase database = DatabaseThread::connection();
+    QSqlQuery query(DatabaseThread::connection());
 
     if (!database.tables().contains("PEERS")) {
         qDebug() << "Creating PEERS table.";
@@ -35,8 +37,8 @@ void PeerRepository::init ()
 
 void PeerRepository::loadPeers (const Callback& callback)
 {
-    QSqlQuery query;
-    query.prepare("select NAME, REGION, INTERNAL_HOSTNAME, EXTERNAL_HOSTNAME, PORT, ACTIVE, "
+    PreparedQuery query = DatabaseThread::prepare(
+        "select NAME, REGION, INTERNAL_HOSTNAME, EXTERNAL_HOSTNAME, PORT, ACTIVE, "
         "UPDATED from PEERS");
     query.exec();
 
@@ -53,8 +55,8 @@ void PeerRepository::loadPeers (const Callback& callback)
 void PeerRepository::storePeer (const PeerRecord& prec)
 {
     // first try updating
-    QSqlQuery query;
-    query.prepare("update PEERS set REGION = ?, INTERNAL_HOSTNAME = ?, EXTERNAL_HOSTNAME = ?, "
+    PreparedQuery query = DatabaseThread::prepare(
+        "update PEERS set REGION = ?, INTERNAL_HOSTNAME = ?, EXTERNAL_HOSTNAME = ?, "
         "PORT = ?, ACTIVE = ?, UPDATED = ? where NAME = ?");
     query.addBindValue(prec.region);
     query.addBindValue(prec.internalHostname);
@@ -70,7 +72,8 @@ void PeerRepository::storePeer (const PeerRecord& prec)
     if (query.numRowsAffected() > 0) {
         return;
     }
-    query.prepare("insert into PEERS (NAME, REGION, INTERNAL_HOSTNAME, EXTERNAL_HOSTNAME, PORT, "
+    query = DatabaseThread::prepare(
+        "insert into PEERS (NAME, REGION, INTERNAL_HOSTNAME, EXTERNAL_HOSTNAME, PORT, "
         "ACTIVE, UPDATED) values (?, ?, ?, ?, ?, ?, ?)");
     query.addBindValue(prec.name);
     query.addBindValue(prec.region);
@@ -7,7 +7,8 @@
 #include <QDateTime>
 #include <QList>
 #include <QMetaType>
-#include <QObject>
+
+#include "db/Repository.h"
 
 class Callback;
 class PeerRecord;
@@ -15,7 +16,7 @@ class PeerRecord;
 /**
  * Handles database queries associated with peers.
  */
-class PeerRepository : public QObject
+class PeerRepository : public Repository
 {
     Q_OBJECT
 
@@ -8,8 +8,10 @@
 #include <QtDebug>
 
 #include "ServerApp.h"
+#include "db/DatabasePool.h"
 #include "db/DatabaseThread.h"
 #include "db/PropertyRepository.h"
+#include "db/StatementCache.h"
 #include "peer/PeerManager.h"
 #include "util/General.h"
 
@@ -38,8 +40,8 @@ void PropertyRepository::registerPersistentObject (QObject* object, const QStrin
 void PropertyRepository::init ()
 {
     // create the table if it doesn't yet exist
-    QSqlDatabase database = QSqlDatabase::database();
-    QSqlQuery query;
+    QSqlDatabase database = DatabaseThread::connection();
+    QSqlQuery query(DatabaseThread::connection());
 
     if (!database.tables().contains("PROPERTIES")) {
         qDebug() << "Creating PROPERTIES table.";
@@ -55,8 +57,8 @@ void PropertyRepository::init ()
 void PropertyRepository::loadProperty (
     const QString& objectName, const QString& propertyName, const Callback& callback)
 {
-    QSqlQuery query;
-    query.prepare("select VALUE from PROPERTIES where OBJECT_NAME = ? and PROPERTY_NAME = ?");
+    PreparedQuery query = DatabaseThread::prepare(
+        "select VALUE from PROPERTIES where OBJECT_NAME = ? and PROPERTY_NAME = ?");
     query.addBindValue(objectName);
     query.addBindValue(propertyName);
     query.exec();
@@ -79,8 +81,8 @@ void PropertyRepository::storeProperty (
     out << value;
 
     // first try updating
-    QSqlQuery query;
-    query.prepare("update PROPERTIES set VALUE = ? where OBJECT_NAME = ? and PROPERTY_NAME = ?");
+    PreparedQuery query = DatabaseThread::prepare(
+        "update PROPERTIES set VALUE = ? where OBJECT_NAME = ? and PROPERTY_NAME = ?");
     query.addBindValue(data);
     query.addBindValue(objectName);
     query.addBindValue(propertyName);
@@ -90,7 +92,8 @@ void PropertyRepository::storeProperty (
     if (query.numRowsAffected() > 0) {
         return;
     }
-    query.prepare("insert into PROPERTIES (OBJECT_NAME, PROPERTY_NAME, VALUE) values (?, ?, ?)");
+    query = DatabaseThread::prepare(
+        "insert into PROPERTIES (OBJECT_NAME, PROPERTY_NAME, VALUE) values (?, ?, ?)");
     query.addBindValue(objectName);
     query.addBindValue(propertyName);
     query.addBindValue(data);
@@ -118,7 +121,7 @@ PropertyPersister::PropertyPersister (
     connect(object, signal(_property.notifySignal().signature()), SLOT(propertyChanged()));
 
     // load the initial value
-    QMetaObject::invokeMethod(_app->databaseThread()->propertyRepository(), "loadProperty",
+    _app->databasePool()->propertyRepository()->invoke("loadProperty",
         Q_ARG(const QString&, object->objectName()), Q_ARG(const QString&, _property.name()),
         Q_ARG(const Callback&, Callback(_this, "setProperty(QVariant)")));
 }
@@ -134,7 +137,7 @@ void PropertyPersister::propertyChanged ()
         return;
     }
     QObject* parent = this->parent();
-    QMetaObject::invokeMethod(_app->databaseThread()->propertyRepository(), "storeProperty",
+    _app->databasePool()->propertyRepository()->invoke("storeProperty",
         Q_ARG(const QString&, parent->objectName()), Q_ARG(const QString&, _property.name()),
         Q_ARG(const QVariant&, _property.read(parent)));
 }
@@ -7,6 +7,7 @@
 #include <QMetaProperty>
 #include <QObject>
 
+#include "db/Repository.h"
 #include "util/Callback.h"
 
 class ServerApp;
@@ -14,7 +15,7 @@ class ServerApp;
 /**
  * Handles database queries associated with persistent object properties.
  */
-class PropertyRepository : public QObject
+class PropertyRepository : public Repository
 {
     Q_OBJECT
 
@@ -0,0 +1,121 @@
+//
+// $Id$
+
+#include <QByteArray>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QEvent>
+#include <QList>
+#include <QMetaType>
+#include <QSemaphore>
+#include <QVariant>
+#include <QtDebug>
+
+#include "db/DatabaseThread.h"
+#include "db/Repository.h"
+
+/**
+ * Requests the invocation of a repository method.
+ */
+class InvocationEvent : public QEvent
+{
+public:
+
+    /** The type of invocation events. */
+    static const QEvent::Type Type;
+
+    /**
+     * Creates a new invocation event, noting the time of its creation.
+     */
+    InvocationEvent (const char* method, QSemaphore* done = 0) :
+        QEvent(Type), method(method), done(done) { posted.start(); }
+
+    /** The name of the method to invoke. */
+    QByteArray method;
+
+    /** The argument type names, as given to Q_ARG. */
+    QList<QByteArray> types;
+
+    /** The argument values. */
+    QVariantList args;
+
+    /** Started when the event was posted. */
+    QElapsedTimer posted;
+
+    /** If non-null, a semaphore to release once the method has returned. */
+    QSemaphore* done;
+};
+
+const QEvent::Type InvocationEvent::Type = (QEvent::Type)QEvent::registerEventType();
+
+/** The maximum number of arguments to a repository method. */
+static const int MaxArguments = 10;
+
+/**
+ * Helper function for invocations: copies the arguments into the event, as
+ * QMetaObject::invokeMethod would for a queued call.
+ */
+static void setArguments (InvocationEvent* event, QGenericArgument val0, QGenericArgument val1,
+    QGenericArgument val2, QGenericArgument val3, QGenericArgument val4, QGenericArgument val5,
+    QGenericArgument val6, QGenericArgument val7, QGenericArgument val8, QGenericArgument val9)
+{
+    QGenericArgument args[] = { val0, val1, val2, val3, val4, val5, val6, val7, val8, val9 };
+    for (int ii = 0; ii < MaxArguments && args[ii].name() != 0; ii++) {
+        event->types.append(args[ii].name());
+        event->args.append(QVariant(QMetaType::type(args[ii].name()), args[ii].data()));
+    }
+}
+
+void Repository::invoke (const char* method,
+    QGenericArgument val0, QGenericArgument val1, QGenericArgument val2, QGenericArgument val3,
+    QGenericArgument val4, QGenericArgument val5, QGenericArgument val6, QGenericArgument val7,
+    QGenericArgument val8, QGenericArgument val9)
+{
+    InvocationEvent* event = new InvocationEvent(method);
+    setArguments(event, val0, val1, val2, val3, val4, val5, val6, val7, val8, val9);
+    static_cast<DatabaseThread*>(thread())->invocationPosted();
+    QCoreApplication::postEvent(this, event);
+}
+
+void Repository::invokeAndWait (const char* method,
+    QGenericArgument val0, QGenericArgument val1, QGenericArgument val2, QGenericArgument val3,
+    QGenericArgument val4, QGenericArgument val5, QGenericArgument val6, QGenericArgument val7,
+    QGenericArgument val8, QGenericArgument val9)
+{
+    QSemaphore done;
+    InvocationEvent* event = new InvocationEvent(method, &done);
+    setArguments(event, val0, val1, val2, val3, val4, val5, val6, val7, val8, val9);
+    static_cast<DatabaseThread*>(thread())->invocationPosted();
+    QCoreApplication::postEvent(this, event);
+    done.acquire();
+}
+
+bool Repository::event (QEvent* event)
+{
+    if (event->type() != InvocationEvent::Type) {
+        return QObject::event(event);
+    }
+    InvocationEvent* ievent = static_cast<InvocationEvent*>(event);
+    qint64 wait = ievent->posted.nsecsElapsed();
+
+    // use the original type names, which may be typedefs of the variants' types
+    QGenericArgument args[MaxArguments];
+    for (int ii = 0, nn = ievent->args.size(); ii < nn; ii++) {
+        args[ii] = QGenericArgument(ievent->types.at(ii).constData(),
+            ievent->args.at(ii).constData());
+    }
+    QElapsedTimer timer;
+    timer.start();
+    if (!QMetaObject::invokeMethod(this, ievent->method.constData(), Qt::DirectConnection,
+            args[0], args[1], args[2], args[3], args[4], args[5], args[6], args[7], args[8],
+            args[9])) {
+        qWarning() << "Failed to invoke repository method." << metaObject()->className() <<
+            ievent->method;
+    }
+    static_cast<DatabaseThread*>(thread())->invocationProcessed(
+        QString(metaObject()->className()) + "::" + ievent->method, wait, timer.nsecsElapsed());
+    if (ievent->done != 0) {
+        ievent->done->release();
+    }
+    return true;
+}
@@ -0,0 +1,52 @@
+//
+// $Id$
+
+#ifndef REPOSITORY
+#define REPOSITORY
+
+#include <QObject>
+
+class QEvent;
+
+/**
+ * Base class for the repositories, which lets requests be timed from the moment they are made.
+ */
+class Repository : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    /**
+     * Invokes a method on the repository in its database thread, recording the time that the
+     * request spends waiting in the thread's queue and executing.  Arguments are given as for
+     * QMetaObject::invokeMethod.  This method is thread-safe.
+     */
+    void invoke (const char* method,
+        QGenericArgument val0 = QGenericArgument(), QGenericArgument val1 = QGenericArgument(),
+        QGenericArgument val2 = QGenericArgument(), QGenericArgument val3 = QGenericArgument(),
+        QGenericArgument val4 = QGenericArgument(), QGenericArgument val5 = QGenericArgument(),
+        QGenericArgument val6 = QGenericArgument(), QGenericArgument val7 = QGenericArgument(),
+        QGenericArgument val8 = QGenericArgument(), QGenericArgument val9 = QGenericArgument());
+
+    /**
+     * Invokes a method on the repository in its database thread as {@link #invoke} does, but
+     * blocks until the method has returned.  Like a blocking queued connection, this will
+     * deadlock if called from the repository's own thread.
+     */
+    void invokeAndWait (const char* method,
+        QGenericArgument val0 = QGenericArgument(), QGenericArgument val1 = QGenericArgument(),
+        QGenericArgument val2 = QGenericArgument(), QGenericArgument val3 = QGenericArgument(),
+        QGenericArgument val4 = QGenericArgument(), QGenericArgument val5 = QGenericArgument(),
+        QGenericArgument val6 = QGenericArgument(), QGenericArgument val7 = QGenericArgument(),
+        QGenericArgument val8 = QGenericArgument(), QGenericArgument val9 = QGenericArgument());
+
+protected:
+
+    /**
+     * Handles invocation events.
+     */
+    virtual bool event (QEvent* event);
+};
+
+#endif // REPOSITORY
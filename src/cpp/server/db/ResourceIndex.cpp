@@ -0,0 +1,97 @@
+//
+// $Id$
+
+#include <QtAlgorithms>
+
+#include "db/ResourceIndex.h"
+
+void ResourceIndex::reset (const ResourceDescriptorList& descs)
+{
+    QVector<Entry> entries;
+    entries.reserve(descs.size());
+    QHash<quint32, QString> keys;
+    keys.reserve(descs.size());
+    foreach (const ResourceDescriptor& desc, descs) {
+        Entry entry = { desc.name.toLower(), desc };
+        entries.append(entry);
+        keys.insert(desc.id, entry.key);
+    }
+    qSort(entries);
+
+    QWriteLocker locker(&_lock);
+    _entries = entries;
+    _keys = keys;
+}
+
+void ResourceIndex::insert (const ResourceDescriptor& desc)
+{
+    QWriteLocker locker(&_lock);
+    int idx = indexOf(desc.id);
+    if (idx != -1) {
+        _entries.remove(idx);
+    }
+    Entry entry = { desc.name.toLower(), desc };
+    _entries.insert(qLowerBound(_entries.begin(), _entries.end(), entry), entry);
+    _keys.insert(desc.id, entry.key);
+}
+
+void ResourceIndex::rename (quint32 id, const QString& name)
+{
+    QWriteLocker locker(&_lock);
+    int idx = indexOf(id);
+    if (idx == -1 || _entries.at(idx).desc.name == name) {
+        return;
+    }
+    Entry entry = _entries.at(idx);
+    _entries.remove(idx);
+    entry.key = name.toLower();
+    entry.desc.name = name;
+    _entries.insert(qLowerBound(_entries.begin(), _entries.end(), entry), entry);
+    _keys.insert(id, entry.key);
+}
+
+void ResourceIndex::remove (quint32 id)
+{
+    QWriteLocker locker(&_lock);
+    int idx = indexOf(id);
+    if (idx != -1) {
+        _entries.remove(idx);
+        _keys.remove(id);
+    }
+}
+
+ResourceDescriptor ResourceIndex::descriptor (quint32 id) const
+{
+    QReadLocker locker(&_lock);
+    int idx = indexOf(id);
+    return (idx == -1) ? NoResource : _entries.at(idx).desc;
+}
+
+ResourceDescriptorList ResourceIndex::find (
+    const QString& prefix, quint64 creatorId, int offset, int limit) const
+{
+    // the first possible match is the first entry whose key is at least the prefix
+    Entry first = { prefix.toLower(), NoResource };
+
+    QReadLocker locker(&_lock);
+    ResourceDescriptorList descs;
+    for (QVector<Entry>::const_iterator it = qLowerBound(_entries, first), end = _entries.end();
+            it != end && it->key.startsWith(first.key) && descs.size() != limit; it++) {
+        if ((creatorId == 0 || it->desc.creatorId == creatorId) && offset-- <= 0) {
+            descs.append(it->desc);
+        }
+    }
+    return descs;
+}
+
+int ResourceIndex::indexOf (quint32 id) const
+{
+    QHash<quint32, QString>::const_iterator kit = _keys.constFind(id);
+    if (kit == _keys.constEnd()) {
+        return -1;
+    }
+    Entry entry = { kit.value(), NoResource };
+    entry.desc.id = id;
+    QVector<Entry>::const_iterator it = qBinaryFind(_entries, entry);
+    return (it == _entries.constEnd()) ? -1 : it - _entries.constBegin();
+}
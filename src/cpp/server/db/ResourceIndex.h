@@ -0,0 +1,97 @@
+//
+// $Id$
+
+#ifndef RESOURCE_INDEX
+#define RESOURCE_INDEX
+
+#include <QHash>
+#include <QReadWriteLock>
+#include <QString>
+#include <QVector>
+
+#include "util/General.h"
+
+/**
+ * An in-memory index of resource descriptors (scenes, zones) sorted by lowercase name, so that
+ * prefix searches can be answered without consulting the database.  The index is loaded once at
+ * startup and kept up to date as resources are inserted, renamed, and deleted on any peer.  All
+ * methods are thread-safe.
+ */
+class ResourceIndex
+{
+public:
+
+    /**
+     * Replaces the contents of the index.
+     */
+    void reset (const ResourceDescriptorList& descs);
+
+    /**
+     * Adds a descriptor to the index, replacing any existing one with the same id.
+     */
+    void insert (const ResourceDescriptor& desc);
+
+    /**
+     * Changes the name of an indexed resource.
+     */
+    void rename (quint32 id, const QString& name);
+
+    /**
+     * Removes a resource from the index.
+     */
+    void remove (quint32 id);
+
+    /**
+     * Returns the descriptor of the identified resource, or NoResource if not indexed.
+     */
+    ResourceDescriptor descriptor (quint32 id) const;
+
+    /**
+     * Finds resources whose names start with the specified prefix, in order of name.
+     *
+     * @param creatorId the id of the creator whose resources are desired, or 0 for all creators.
+     * @param offset the number of matching resources to skip.
+     * @param limit the maximum number of resources to return, or -1 for all.
+     */
+    ResourceDescriptorList find (const QString& prefix, quint64 creatorId = 0,
+        int offset = 0, int limit = -1) const;
+
+protected:
+
+    /**
+     * An entry in the index.
+     */
+    class Entry
+    {
+    public:
+
+        /** The lowercase name, on which the index is sorted. */
+        QString key;
+
+        /** The resource descriptor. */
+        ResourceDescriptor desc;
+
+        /**
+         * Orders entries by key, then by id.
+         */
+        bool operator< (const Entry& other) const {
+            return compare(key, other.key, desc.id, other.desc.id) < 0; }
+    };
+
+    /**
+     * Returns the position of the entry for the specified resource, or -1 if not indexed.  The
+     * caller must hold the lock.
+     */
+    int indexOf (quint32 id) const;
+
+    /** Guards the index. */
+    mutable QReadWriteLock _lock;
+
+    /** The entries, sorted by key. */
+    QVector<Entry> _entries;
+
+    /** The keys of the indexed resources, mapped by id. */
+    QHash<quint32, QString> _keys;
+};
+
+#endif // RESOURCE_INDEX
@@ -0,0 +1,224 @@
+//
+// $Id$
+
+#include <limits.h>
+
+#include <QByteArray>
+#include <QHash>
+#include <QVarLengthArray>
+#include <QtDebug>
+#include <QtEndian>
+
+#include "db/SceneRepository.h"
+
+/** Flag indicating that the encoded block payload is deflated. */
+static const char DeflatedFlag = 0x01;
+
+/** The payload size (in bytes) above which we attempt to deflate encoded blocks. */
+static const int DeflateThreshold = 64;
+
+/** The compression level used to deflate encoded blocks, favoring speed over size. */
+static const int DeflateLevel = 1;
+
+/**
+ * Appends a variable-length unsigned integer to the specified array.
+ */
+static void writeVarint (QByteArray& out, quint32 value)
+{
+    for (; value >= 0x80; value >>= 7) {
+        out.append((char)(value & 0x7F | 0x80));
+    }
+    out.append((char)value);
+}
+
+/**
+ * Reads a variable-length unsigned integer, advancing the pointer past it.
+ *
+ * @return the value read, or -1 if the data ended before the value did or the value doesn't
+ * fit in 32 bits.
+ */
+static int readVarint (const uchar*& ptr, const uchar* end)
+{
+    quint32 value = 0;
+    for (int shift = 0; ptr < end && shift < 32; shift += 7) {
+        uchar byte = *ptr++;
+        value |= (quint32)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return (int)qMin(value, (quint32)INT_MAX);
+        }
+    }
+    return -1;
+}
+
+SceneRecord::Block::Block () :
+    QIntVector(Size*Size, ' '),
+    _filled(0)
+{
+}
+
+SceneRecord::Block::Block (const int* data) :
+    QIntVector(Size*Size, ' '),
+    _filled(0)
+{
+    for (int* ptr = this->data(), *end = ptr + Size*Size; ptr < end; ptr++, data++) {
+        _filled += ((*ptr = *data) != ' ');
+    }
+}
+
+SceneRecord::Block::Block (const QByteArray& encoded) :
+    QIntVector(Size*Size, ' '),
+    _filled(0)
+{
+    if (encoded.isEmpty()) {
+        return;
+    }
+    if (encoded.at(0) == 0) {
+        // legacy rows hold the compressed raw values, which start with a big-endian length
+        QByteArray data = qUncompress(encoded);
+        if (data.size() != Size*Size*(int)sizeof(int)) {
+            qWarning() << "Invalid legacy block data." << data.size();
+            return;
+        }
+        const int* values = (const int*)data.constData();
+        for (int* ptr = this->data(), *end = ptr + Size*Size; ptr < end; ptr++, values++) {
+            _filled += ((*ptr = *values) != ' ');
+        }
+        return;
+    }
+    if (encoded.at(0) != EncodingVersion || encoded.size() < 2) {
+        qWarning() << "Unknown block encoding." << (int)encoded.at(0);
+        return;
+    }
+    QByteArray inflated;
+    const uchar* ptr = (const uchar*)encoded.constData() + 2;
+    const uchar* end = (const uchar*)encoded.constData() + encoded.size();
+    if (encoded.at(1) & DeflatedFlag) {
+        inflated = qUncompress(ptr, end - ptr);
+        ptr = (const uchar*)inflated.constData();
+        end = ptr + inflated.size();
+    }
+
+    // a partially decoded block is no more use than an empty one
+    if (!decode(ptr, end)) {
+        fill(' ');
+        _filled = 0;
+    }
+}
+
+QByteArray SceneRecord::Block::encode () const
+{
+    // build the palette of values other than space, in order of first appearance
+    const int* values = constData();
+    const int count = Size*Size;
+    QHash<int, int> indices;
+    QVarLengthArray<int, 256> palette;
+    for (int ii = 0; ii < count; ii++) {
+        int value = values[ii];
+        if (value != ' ' && !indices.contains(value)) {
+            indices.insert(value, palette.size());
+            palette.append(value);
+        }
+    }
+    bool wide = palette.size() > 256;
+
+    QByteArray payload;
+    writeVarint(payload, palette.size());
+    for (int ii = 0; ii < palette.size(); ii++) {
+        uchar bytes[4];
+        qToBigEndian<qint32>(palette[ii], bytes);
+        payload.append((const char*)bytes, 4);
+    }
+
+    // write alternating runs of spaces and palette indices
+    for (int idx = 0; idx < count; ) {
+        int start = idx;
+        while (idx < count && values[idx] == ' ') {
+            idx++;
+        }
+        writeVarint(payload, idx - start);
+        start = idx;
+        while (idx < count && values[idx] != ' ') {
+            idx++;
+        }
+        writeVarint(payload, idx - start);
+        for (int ii = start; ii < idx; ii++) {
+            int index = indices.value(values[ii]);
+            if (wide) {
+                payload.append((char)(index >> 8));
+            }
+            payload.append((char)index);
+        }
+    }
+
+    // deflate the payload if it's large enough to benefit
+    QByteArray encoded;
+    encoded.append((char)EncodingVersion);
+    if (payload.size() > DeflateThreshold) {
+        QByteArray deflated = qCompress(payload, DeflateLevel);
+        if (deflated.size() < payload.size()) {
+            encoded.append(DeflatedFlag);
+            encoded.append(deflated);
+            return encoded;
+        }
+    }
+    encoded.append((char)0);
+    encoded.append(payload);
+    return encoded;
+}
+
+void SceneRecord::Block::set (const QPoint& pos, int character)
+{
+    int& value = (*this)[(pos.y() & Mask) << LgSize | pos.x() & Mask];
+    _filled += (value == ' ') - (character == ' ');
+    value = character;
+}
+
+int SceneRecord::Block::get (const QPoint& pos) const
+{
+    return at((pos.y() & Mask) << LgSize | pos.x() & Mask);
+}
+
+bool SceneRecord::Block::decode (const uchar* ptr, const uchar* end)
+{
+    // read the palette
+    int paletteSize = readVarint(ptr, end);
+    if (paletteSize < 0 || paletteSize > Size*Size || end - ptr < paletteSize * 4) {
+        qWarning() << "Invalid block palette." << paletteSize;
+        return false;
+    }
+    QVarLengthArray<int, 256> palette(paletteSize);
+    for (int ii = 0; ii < paletteSize; ii++, ptr += 4) {
+        palette[ii] = qFromBigEndian<qint32>(ptr);
+    }
+    bool wide = paletteSize > 256;
+
+    // read the alternating runs of spaces and palette indices
+    int* values = data();
+    for (int idx = 0, count = Size*Size; idx < count; ) {
+        int spaces = readVarint(ptr, end);
+        int literals = readVarint(ptr, end);
+        if (spaces < 0 || literals < 0 || spaces > count - idx ||
+                literals > count - idx - spaces || end - ptr < literals * (wide ? 2 : 1) ||
+                spaces + literals == 0) {
+            qWarning() << "Invalid block runs." << idx;
+            return false;
+        }
+        idx += spaces;
+        for (int jj = 0; jj < literals; jj++) {
+            int index = wide ? (ptr[0] << 8 | ptr[1]) : ptr[0];
+            ptr += (wide ? 2 : 1);
+            if (index >= paletteSize) {
+                qWarning() << "Invalid block palette index." << index;
+                return false;
+            }
+            if ((values[idx++] = palette[index]) != ' ') {
+                _filled++;
+            }
+        }
+    }
+    if (ptr != end) {
+        qWarning() << "Trailing block data." << (end - ptr);
+        return false;
+    }
+    return true;
+}
@@ -3,72 +3,127 @@
 
 #include <string.h>
 
+#include <QHash>
+#include <QRect>
 #include <QSqlDatabase>
 #include <QSqlError>
+#include <QSqlIndex>
 #include <QSqlQuery>
+#include <QSqlRecord>
 #include <QStringList>
+#include <QVariant>
 #include <QtDebug>
 
+#include "ServerApp.h"
+#include "db/DatabasePool.h"
+#include "db/DatabaseThread.h"
+#include "db/ResourceIndex.h"
 #include "db/SceneRepository.h"
+#include "db/StatementCache.h"
 #include "util/Callback.h"
 
 // register our types with the metatype system
 int sceneRecordType = qRegisterMetaType<SceneRecord>();
+int sceneBlockChangesType = qRegisterMetaType<SceneBlockChanges>();
+int sceneBlockHashType = qRegisterMetaType<SceneBlockHash>("SceneBlockHash");
+int sceneEditsType = qRegisterMetaType<SceneEdits>();
+
+/** The statement used to create the scene block table, with its name as the argument. */
+static const char* CreateSceneBlocks =
+    "create table %1 ("
+        "SCENE_ID int unsigned not null,"
+        "X int not null,"
+        "Y int not null,"
+        "DATA blob not null,"
+        "primary key (SCENE_ID, X, Y))";
+
+SceneRepository::SceneRepository (ServerApp* app) :
+    _app(app)
+{
+}
 
 void SceneRepository::init ()
 {
     // create the tables if they don't yet exist
-    QSqlDatabase database = QSqlDatabase::database();
-    QSqlQuery query;
+    QSqlDatabase database = DatabaseThread::connection();
+    QSqlQuery query(DatabaseThread::connection());
 
     if (!database.tables().contains("SCENES")) {
         qDebug() << "Creating SCENES table.";
         query.exec(
             "create table SCENES ("
-                "ID int unsigned not null auto_increment primary key,"
+                "ID " + DatabaseThread::autoIncrementKey("int unsigned") + ","
                 "NAME varchar(255) not null,"
                 "NAME_LOWER varchar(255) not null,"
                 "CREATOR_ID bigint unsigned not null,"
                 "CREATED datetime not null,"
                 "SCROLL_WIDTH smallint unsigned not null,"
                 "SCROLL_HEIGHT smallint unsigned not null,"
-                "index (NAME_LOWER),"
-                "index (CREATOR_ID))");
+                "SEED int unsigned not null default 0,"
+                "LAYERS varchar(1024) not null default '')");
+        query.exec("create index SCENES_NAME_LOWER on SCENES (NAME_LOWER)");
+        query.exec("create index SCENES_CREATOR_ID on SCENES (CREATOR_ID)");
+
+    } else if (!database.record("SCENES").contains("SEED")) {
+        qDebug() << "Adding generation columns to SCENES table.";
+        query.exec("alter table SCENES add column SEED int unsigned not null default 0");
+        query.exec("alter table SCENES add column LAYERS varchar(1024) not null default ''");
     }
 
     if (!database.tables().contains("SCENE_BLOCKS")) {
         qDebug() << "Creating SCENE_BLOCKS table.";
+        query.exec(QString(CreateSceneBlocks).arg("SCENE_BLOCKS"));
+
+    } else if (database.primaryIndex("SCENE_BLOCKS").isEmpty()) {
+        // copy into a table keyed on the block location, discarding any duplicates
+        qDebug() << "Adding primary key to SCENE_BLOCKS table.";
+        query.exec(QString(CreateSceneBlocks).arg("SCENE_BLOCKS_KEYED"));
+        query.exec(QString("insert %1 into SCENE_BLOCKS_KEYED (SCENE_ID, X, Y, DATA) "
+            "select SCENE_ID, X, Y, DATA from SCENE_BLOCKS").arg(
+                DatabaseThread::sqlite() ? "or ignore" : "ignore"));
+        query.exec("drop table SCENE_BLOCKS");
+        query.exec("alter table SCENE_BLOCKS_KEYED rename to SCENE_BLOCKS");
+    }
+
+    if (!database.tables().contains("SCENE_PORTALS")) {
+        qDebug() << "Creating SCENE_PORTALS table.";
         query.exec(
-            "create table SCENE_BLOCKS ("
+            "create table SCENE_PORTALS ("
                 "SCENE_ID int unsigned not null,"
                 "X int not null,"
                 "Y int not null,"
-                "DATA blob not null,"
-                "index (SCENE_ID),"
-                "index (X, Y))");
+                "TARGET_ZONE_ID int unsigned not null,"
+                "TARGET_SCENE_ID int unsigned not null,"
+                "TARGET_X int not null,"
+                "TARGET_Y int not null,"
+                "primary key (SCENE_ID, X, Y))");
     }
 
     if (!database.tables().contains("ZONES")) {
         qDebug() << "Creating ZONES table.";
         query.exec(
             "create table ZONES ("
-                "ID int unsigned not null auto_increment primary key,"
+                "ID " + DatabaseThread::autoIncrementKey("int unsigned") + ","
                 "NAME varchar(255) not null,"
                 "NAME_LOWER varchar(255) not null,"
                 "CREATOR_ID bigint unsigned not null,"
                 "CREATED datetime not null,"
                 "MAX_POPULATION smallint unsigned not null,"
-                "DEFAULT_SCENE_ID int unsigned not null,"
-                "index (NAME_LOWER),"
-                "index (CREATOR_ID))");
+                "DEFAULT_SCENE_ID int unsigned not null default 0)");
+        query.exec("create index ZONES_NAME_LOWER on ZONES (NAME_LOWER)");
+        query.exec("create index ZONES_CREATOR_ID on ZONES (CREATOR_ID)");
     }
+
+    // load the name indices used for prefix searches
+    loadIndex("SCENES", _app->databasePool()->sceneIndex());
+    loadIndex("ZONES", _app->databasePool()->zoneIndex());
 }
 
 void SceneRepository::insertScene (
     const QString& name, quint64 creatorId, const Callback& callback)
 {
-    QSqlQuery query;
-    query.prepare("insert into SCENES (NAME, NAME_LOWER, CREATOR_ID, CREATED, SCROLL_WIDTH, "
+    PreparedQuery query = DatabaseThread::prepare(
+        "insert into SCENES (NAME, NAME_LOWER, CREATOR_ID, CREATED, SCROLL_WIDTH, "
         "SCROLL_HEIGHT) values (?, ?, ?, ?, ?, ?)");
     query.addBindValue(name);
     query.addBindValue(name.toLower());
@@ -81,12 +136,23 @@ void SceneRepository::insertScene (
     callback.invoke(Q_ARG(quint32, query.lastInsertId().toUInt()));
 }
 
-void SceneRepository::loadScene (quint32 id, const Callback& callback)
+/**
+ * Helper function for scene loading: reads the blocks selected by the query (as X, Y, DATA) into
+ * the provided hash.
+ */
+static void readBlocks (QSqlQuery& query, SceneBlockHash& blocks)
 {
-    QSqlQuery query;
-    query.prepare(
-        "select SCENES.NAME, CREATOR_ID, USERS.NAME, SCENES.CREATED, SCROLL_WIDTH, SCROLL_HEIGHT "
-            "from SCENES, USERS where SCENES.CREATOR_ID = USERS.ID and SCENES.ID = ?");
+    while (query.next()) {
+        blocks.insert(QPoint(query.value(0).toInt(), query.value(1).toInt()),
+            SceneRecord::Block(query.value(2).toByteArray()));
+    }
+}
+
+void SceneRepository::loadScene (quint32 id, int pagingThreshold, const Callback& callback)
+{
+    PreparedQuery query = DatabaseThread::prepare(
+        "select SCENES.NAME, CREATOR_ID, USERS.NAME, SCENES.CREATED, SCROLL_WIDTH, SCROLL_HEIGHT, "
+            "SEED, LAYERS from SCENES, USERS where SCENES.CREATOR_ID = USERS.ID and SCENES.ID = ?");
     query.addBindValue(id);
     query.exec();
 
@@ -96,122 +162,228 @@ void SceneRepository::loadScene (quint32 id, const Callback& callback)
     }
     SceneRecord scene = {
         id, query.value(0).toString(), query.value(1).toULongLong(), query.value(2).toString(),
-        query.value(3).toDateTime(), query.value(4).toUInt(), query.value(5).toUInt() };
+        query.value(3).toDateTime(), query.value(4).toUInt(), query.value(5).toUInt(),
+        query.value(6).toUInt(), query.value(7).toString() };
 
-    query.prepare("select X, Y, DATA from SCENE_BLOCKS where SCENE_ID = ?");
+    query = DatabaseThread::prepare(
+        "select X, Y, TARGET_ZONE_ID, TARGET_SCENE_ID, TARGET_X, TARGET_Y "
+        "from SCENE_PORTALS where SCENE_ID = ?");
     query.addBindValue(id);
     query.exec();
 
     while (query.next()) {
-        QByteArray data = qUncompress(query.value(2).toByteArray());
-        scene.blocks.insert(QPoint(query.value(0).toInt(), query.value(1).toInt()),
-            SceneRecord::Block((int*)data.constData()));
+        ScenePortal portal = { QPoint(query.value(0).toInt(), query.value(1).toInt()),
+            query.value(2).toUInt(), query.value(3).toUInt(),
+            QPoint(query.value(4).toInt(), query.value(5).toInt()) };
+        scene.portals.append(portal);
+    }
+
+    // the blocks of generated scenes are only the modified ones, and are always paged
+    if (scene.generated()) {
+        query = DatabaseThread::prepare("select X, Y from SCENE_BLOCKS where SCENE_ID = ?");
+        query.addBindValue(id);
+        query.exec();
+
+        while (query.next()) {
+            scene.modified.insert(QPoint(query.value(0).toInt(), query.value(1).toInt()));
+        }
+        scene.unloaded = scene.modified;
+        callback.invoke(Q_ARG(const SceneRecord&, scene));
+        return;
+    }
+
+    if (pagingThreshold != -1) {
+        query = DatabaseThread::prepare("select count(*) from SCENE_BLOCKS where SCENE_ID = ?");
+        query.addBindValue(id);
+        query.exec();
+        query.next();
+
+        // large scenes are paged in by the scene as needed; here we just load the keys
+        if (query.value(0).toInt() > pagingThreshold) {
+            query = DatabaseThread::prepare("select X, Y from SCENE_BLOCKS where SCENE_ID = ?");
+            query.addBindValue(id);
+            query.exec();
+
+            while (query.next()) {
+                scene.unloaded.insert(QPoint(query.value(0).toInt(), query.value(1).toInt()));
+            }
+            callback.invoke(Q_ARG(const SceneRecord&, scene));
+            return;
+        }
     }
 
+    query = DatabaseThread::prepare("select X, Y, DATA from SCENE_BLOCKS where SCENE_ID = ?");
+    query.addBindValue(id);
+    query.exec();
+    readBlocks(query, scene.blocks);
+
     callback.invoke(Q_ARG(const SceneRecord&, scene));
 }
 
-void SceneRepository::loadSceneName (quint32 id, const Callback& callback)
+void SceneRepository::loadSceneBlocks (quint32 id, const QRect& keys, const Callback& callback)
 {
-    QSqlQuery query;
-    query.prepare("select NAME from SCENES where ID = ?");
+    PreparedQuery query = DatabaseThread::prepare(
+        "select X, Y, DATA from SCENE_BLOCKS where SCENE_ID = ? and "
+        "X between ? and ? and Y between ? and ?");
     query.addBindValue(id);
+    query.addBindValue(keys.left());
+    query.addBindValue(keys.right());
+    query.addBindValue(keys.top());
+    query.addBindValue(keys.bottom());
     query.exec();
 
-    callback.invoke(Q_ARG(const QString&, query.next() ? query.value(0).toString() : ""));
-}
+    SceneBlockHash blocks;
+    readBlocks(query, blocks);
 
-/**
- * Helper function for find methods: turns a prefix into a "like" pattern with appropriate
- * escaping.
- */
-static QString likePattern (const QString& prefix)
-{
-    return prefix.toLower().replace('%', "\\%").replace('_', "\\_") += '%';
+    callback.invoke(Q_ARG(const SceneBlockHash&, blocks));
 }
 
-void SceneRepository::findScenes (
-    const QString& prefix, quint64 creatorId, const Callback& callback)
+void SceneRepository::loadSceneName (quint32 id, const Callback& callback)
 {
-    QSqlQuery query;
-    QString pattern = likePattern(prefix);
-    QString base = "select SCENES.ID, SCENES.NAME, CREATOR_ID, USERS.NAME, SCENES.CREATED from "
-        "SCENES, USERS where SCENES.CREATOR_ID = USERS.ID and SCENES.NAME_LOWER like ?";
-    if (creatorId == 0) {
-        query.prepare(base);
-        query.addBindValue(pattern);
-    } else {
-        query.prepare(base + " and CREATOR_ID = ?");
-        query.addBindValue(pattern);
-        query.addBindValue(creatorId);
-    }
+    PreparedQuery query = DatabaseThread::prepare("select NAME from SCENES where ID = ?");
+    query.addBindValue(id);
     query.exec();
 
-    ResourceDescriptorList descs;
-    while (query.next()) {
-        ResourceDescriptor desc = { query.value(0).toUInt(), query.value(1).toString(),
-            query.value(2).toULongLong(), query.value(3).toString(), query.value(4).toDateTime() };
-        descs.append(desc);
-    }
-    callback.invoke(Q_ARG(const ResourceDescriptorList&, descs));
+    callback.invoke(Q_ARG(const QString&, query.next() ? query.value(0).toString() : ""));
 }
 
 void SceneRepository::updateScene (const SceneRecord& srec, const Callback& callback)
 {
-    QSqlQuery query;
-    query.prepare("update SCENES set NAME = ?, NAME_LOWER = ?, SCROLL_WIDTH = ?, "
-        "SCROLL_HEIGHT = ? where ID = ?");
+    // update the record and replace the portals in one transaction, so that a failure can't
+    // leave the scene without its portals
+    QSqlDatabase database = DatabaseThread::connection();
+    if (!database.transaction()) {
+        qWarning() << "Failed to begin scene update transaction:" << srec.id <<
+            database.lastError();
+        return;
+    }
+    PreparedQuery query = DatabaseThread::prepare(
+        "update SCENES set NAME = ?, NAME_LOWER = ?, SCROLL_WIDTH = ?, "
+        "SCROLL_HEIGHT = ?, SEED = ?, LAYERS = ? where ID = ?");
     query.addBindValue(srec.name);
     query.addBindValue(srec.name.toLower());
     query.addBindValue(srec.scrollWidth);
     query.addBindValue(srec.scrollHeight);
+    query.addBindValue(srec.seed);
+    query.addBindValue(srec.layers);
     query.addBindValue(srec.id);
-    query.exec();
+    bool success = query.exec();
 
+    // the portals are few, so we simply replace them all
+    if (success) {
+        query = DatabaseThread::prepare("delete from SCENE_PORTALS where SCENE_ID = ?");
+        query.addBindValue(srec.id);
+        success = query.exec();
+    }
+    if (success) {
+        query = DatabaseThread::prepare(
+            "insert into SCENE_PORTALS (SCENE_ID, X, Y, TARGET_ZONE_ID, TARGET_SCENE_ID, "
+            "TARGET_X, TARGET_Y) values (?, ?, ?, ?, ?, ?, ?)");
+        foreach (const ScenePortal& portal, srec.portals) {
+            query.addBindValue(srec.id);
+            query.addBindValue(portal.position.x());
+            query.addBindValue(portal.position.y());
+            query.addBindValue(portal.targetZoneId);
+            query.addBindValue(portal.targetSceneId);
+            query.addBindValue(portal.targetPosition.x());
+            query.addBindValue(portal.targetPosition.y());
+            if (!(success = query.exec())) {
+                break;
+            }
+        }
+    }
+    if (!(success && database.commit())) {
+        qWarning() << "Failed to update scene:" << srec.id << query.lastError() <<
+            database.lastError();
+        database.rollback();
+        return;
+    }
     callback.invoke();
 }
 
-void SceneRepository::updateSceneBlocks (const SceneRecord& srec)
+void SceneRepository::updateSceneBlocks (
+    const SceneBlockChanges& changes, const Callback& callback)
 {
-    QSqlQuery query;
-
-    query.prepare("insert into SCENE_BLOCKS (SCENE_ID, X, Y, DATA) values (?, ?, ?, ?)");
-    foreach (const QPoint& key, srec.added) {
-        query.addBindValue(srec.id);
-        query.addBindValue(key.x());
-        query.addBindValue(key.y());
-        query.addBindValue(qCompress((const uchar*)srec.blocks[key].constData(),
-            SceneRecord::Block::Size*SceneRecord::Block::Size*sizeof(int)));
-        query.exec();
+    QSqlDatabase database = DatabaseThread::connection();
+    PreparedQuery query;
+
+    // apply the whole flush in one transaction, with one batch per statement
+    if (!database.transaction()) {
+        qWarning() << "Failed to begin scene block transaction:" << changes.sceneId <<
+            database.lastError();
+        callback.invoke(Q_ARG(bool, false));
+        return;
+    }
+    bool success = true;
+
+    // added and updated blocks are both simply stored
+    if (!(changes.added.isEmpty() && changes.updated.isEmpty())) {
+        QVariantList sceneIds, xs, ys, data;
+        for (int ii = 0; ii < 2; ii++) {
+            const SceneBlockHash& blocks = (ii == 0) ? changes.added : changes.updated;
+            for (SceneBlockHash::const_iterator it = blocks.constBegin(), end = blocks.constEnd();
+                    it != end; it++) {
+                sceneIds.append(changes.sceneId);
+                xs.append(it.key().x());
+                ys.append(it.key().y());
+                data.append(it.value().encode());
+            }
+        }
+        query = DatabaseThread::prepare(DatabaseThread::sqlite() ?
+            "insert or replace into SCENE_BLOCKS (SCENE_ID, X, Y, DATA) values (?, ?, ?, ?)" :
+            "insert into SCENE_BLOCKS (SCENE_ID, X, Y, DATA) values (?, ?, ?, ?) "
+            "on duplicate key update DATA = values(DATA)");
+        query.addBindValue(sceneIds);
+        query.addBindValue(xs);
+        query.addBindValue(ys);
+        query.addBindValue(data);
+        if (!query.execBatch()) {
+            qWarning() << "Failed to store scene blocks:" << changes.sceneId << query.lastError();
+            success = false;
+        }
     }
 
-    query.prepare("update SCENE_BLOCKS set DATA = ? where SCENE_ID = ? and X = ? and Y = ?");
-    foreach (const QPoint& key, srec.updated) {
-        query.addBindValue(qCompress((const uchar*)srec.blocks[key].constData(),
-            SceneRecord::Block::Size*SceneRecord::Block::Size*sizeof(int)));
-        query.addBindValue(srec.id);
-        query.addBindValue(key.x());
-        query.addBindValue(key.y());
-        query.exec();
+    if (success && !changes.removed.isEmpty()) {
+        QVariantList sceneIds, xs, ys;
+        foreach (const QPoint& key, changes.removed) {
+            sceneIds.append(changes.sceneId);
+            xs.append(key.x());
+            ys.append(key.y());
+        }
+        query = DatabaseThread::prepare(
+            "delete from SCENE_BLOCKS where SCENE_ID = ? and X = ? and Y = ?");
+        query.addBindValue(sceneIds);
+        query.addBindValue(xs);
+        query.addBindValue(ys);
+        if (!query.execBatch()) {
+            qWarning() << "Failed to delete scene blocks:" << changes.sceneId <<
+                query.lastError();
+            success = false;
+        }
     }
 
-    query.prepare("delete from SCENE_BLOCKS where SCENE_ID = ? and X = ? and Y = ?");
-    foreach (const QPoint& key, srec.removed) {
-        query.addBindValue(srec.id);
-        query.addBindValue(key.x());
-        query.addBindValue(key.y());
-        query.exec();
+    if (success && !database.commit()) {
+        qWarning() << "Failed to commit scene block changes:" << changes.sceneId <<
+            database.lastError();
+        success = false;
     }
+    if (!success) {
+        database.rollback();
+    }
+    callback.invoke(Q_ARG(bool, success));
 }
 
 void SceneRepository::deleteScene (quint32 id, const Callback& callback)
 {
-    QSqlQuery query;
-    query.prepare("delete from SCENES where ID = ?");
+    PreparedQuery query = DatabaseThread::prepare("delete from SCENES where ID = ?");
     query.addBindValue(id);
     query.exec();
 
-    query.prepare("delete from SCENE_BLOCKS where ID = ?");
+    query = DatabaseThread::prepare("delete from SCENE_BLOCKS where SCENE_ID = ?");
+    query.addBindValue(id);
+    query.exec();
+
+    query = DatabaseThread::prepare("delete from SCENE_PORTALS where SCENE_ID = ?");
     query.addBindValue(id);
     query.exec();
 
@@ -220,8 +392,8 @@ void SceneRepository::deleteScene (quint32 id, const Callback& callback)
 
 void SceneRepository::insertZone (const QString& name, quint64 creatorId, const Callback& callback)
 {
-    QSqlQuery query;
-    query.prepare("insert into ZONES (NAME, NAME_LOWER, CREATOR_ID, CREATED, MAX_POPULATION) "
+    PreparedQuery query = DatabaseThread::prepare(
+        "insert into ZONES (NAME, NAME_LOWER, CREATOR_ID, CREATED, MAX_POPULATION) "
         "values (?, ?, ?, ?, ?)");
     query.addBindValue(name);
     query.addBindValue(name.toLower());
@@ -235,8 +407,7 @@ void SceneRepository::insertZone (const QString& name, quint64 creatorId, const
 
 void SceneRepository::loadZone (quint32 id, const Callback& callback)
 {
-    QSqlQuery query;
-    query.prepare(
+    PreparedQuery query = DatabaseThread::prepare(
         "select ZONES.NAME, CREATOR_ID, USERS.NAME, ZONES.CREATED, MAX_POPULATION, "
             "DEFAULT_SCENE_ID from ZONES, USERS where ZONES.CREATOR_ID = USERS.ID "
             "and ZONES.ID = ?");
@@ -255,44 +426,17 @@ void SceneRepository::loadZone (quint32 id, const Callback& callback)
 
 void SceneRepository::loadZoneName (quint32 id, const Callback& callback)
 {
-    QSqlQuery query;
-    query.prepare("select NAME from ZONES where ID = ?");
+    PreparedQuery query = DatabaseThread::prepare("select NAME from ZONES where ID = ?");
     query.addBindValue(id);
     query.exec();
 
     callback.invoke(Q_ARG(const QString&, query.next() ? query.value(0).toString() : ""));
 }
 
-void SceneRepository::findZones (
-    const QString& prefix, quint64 creatorId, const Callback& callback)
-{
-    QSqlQuery query;
-    QString pattern = likePattern(prefix);
-    QString base = "select ZONES.ID, ZONES.NAME, CREATOR_ID, USERS.NAME, ZONES.CREATED from "
-        "ZONES, USERS where ZONES.CREATOR_ID = USERS.ID and ZONES.NAME_LOWER like ?";
-    if (creatorId == 0) {
-        query.prepare(base);
-        query.addBindValue(pattern);
-    } else {
-        query.prepare(base + " and CREATOR_ID = ?");
-        query.addBindValue(pattern);
-        query.addBindValue(creatorId);
-    }
-    query.exec();
-
-    ResourceDescriptorList zones;
-    while (query.next()) {
-        ResourceDescriptor zone = { query.value(0).toUInt(), query.value(1).toString(),
-            query.value(2).toULongLong(), query.value(3).toString(), query.value(4).toDateTime() };
-        zones.append(zone);
-    }
-    callback.invoke(Q_ARG(const ResourceDescriptorList&, zones));
-}
-
 void SceneRepository::updateZone (const ZoneRecord& zrec, const Callback& callback)
 {
-    QSqlQuery query;
-    query.prepare("update ZONES set NAME = ?, NAME_LOWER = ?, MAX_POPULATION = ?, "
+    PreparedQuery query = DatabaseThread::prepare(
+        "update ZONES set NAME = ?, NAME_LOWER = ?, MAX_POPULATION = ?, "
         "DEFAULT_SCENE_ID = ? where ID = ?");
     query.addBindValue(zrec.name);
     query.addBindValue(zrec.name.toLower());
@@ -306,51 +450,121 @@ void SceneRepository::updateZone (const ZoneRecord& zrec, const Callback& callba
 
 void SceneRepository::deleteZone (quint32 id, const Callback& callback)
 {
-    QSqlQuery query;
-    query.prepare("delete from ZONES where ID = ?");
+    PreparedQuery query = DatabaseThread::prepare("delete from ZONES where ID = ?");
     query.addBindValue(id);
     query.exec();
 
     callback.invoke();
 }
 
-SceneRecord::Block::Block () :
-    QIntVector(Size*Size, ' '),
-    _filled(0)
+void SceneRepository::loadIndex (const QString& table, ResourceIndex& index)
 {
+    QSqlQuery query(DatabaseThread::connection());
+    query.setForwardOnly(true);
+    query.exec(QString("select %1.ID, %1.NAME, CREATOR_ID, USERS.NAME, %1.CREATED from %1, USERS "
+        "where %1.CREATOR_ID = USERS.ID").arg(table));
+
+    ResourceDescriptorList descs;
+    while (query.next()) {
+        ResourceDescriptor desc = { query.value(0).toUInt(), query.value(1).toString(),
+            query.value(2).toULongLong(), query.value(3).toString(), query.value(4).toDateTime() };
+        descs.append(desc);
+    }
+    index.reset(descs);
+    qDebug() << "Name index loaded." << table << descs.size();
 }
 
-SceneRecord::Block::Block (const int* data) :
-    QIntVector(Size*Size, ' '),
-    _filled(0)
+void SceneRecord::set (const QPoint& pos, int character)
 {
-    for (int* ptr = this->data(), *end = ptr + Size*Size; ptr < end; ptr++, data++) {
-        _filled += ((*ptr = *data) != ' ');
+    QPoint key(pos.x() >> Block::LgSize, pos.y() >> Block::LgSize);
+    Block& block = blocks[key];
+    int ofilled = block.filled();
+    block.set(pos, character);
+    blockChanged(key, ofilled);
+}
+
+int SceneRecord::get (const QPoint& pos) const
+{
+    QPoint key(pos.x() >> Block::LgSize, pos.y() >> Block::LgSize);
+    QHash<QPoint, Block>::const_iterator it = blocks.constFind(key);
+    return (it == blocks.constEnd()) ? ' ' : (*it).get(pos);
+}
+
+void SceneRecord::set (const QRect& bounds, const int* data, int xstep, int stride)
+{
+    for (int by = bounds.top() >> Block::LgSize, by2 = bounds.bottom() >> Block::LgSize;
+            by <= by2; by++) {
+        for (int bx = bounds.left() >> Block::LgSize, bx2 = bounds.right() >> Block::LgSize;
+                bx <= bx2; bx++) {
+            QPoint key(bx, by);
+            QRect isect = bounds.intersected(QRect(
+                bx << Block::LgSize, by << Block::LgSize, Block::Size, Block::Size));
+            Block& block = blocks[key];
+            int ofilled = block.filled();
+            const int* lptr = data + (isect.top() - bounds.top()) * stride +
+                (isect.left() - bounds.left()) * xstep;
+            for (int yy = isect.top(), y2 = isect.bottom(); yy <= y2; yy++, lptr += stride) {
+                const int* ptr = lptr;
+                for (int xx = isect.left(), x2 = isect.right(); xx <= x2; xx++, ptr += xstep) {
+                    block.set(QPoint(xx, yy), *ptr);
+                }
+            }
+            blockChanged(key, ofilled);
+        }
     }
 }
 
-void SceneRecord::Block::set (const QPoint& pos, int character)
+SceneRegion SceneRecord::copy (const QRect& bounds) const
 {
-    int& value = (*this)[(pos.y() & Mask) << LgSize | pos.x() & Mask];
-    _filled += (value == ' ') - (character == ' ');
-    value = character;
+    SceneRegion region = { bounds.size(), QIntVector(bounds.width() * bounds.height(), ' ') };
+    for (int by = bounds.top() >> Block::LgSize, by2 = bounds.bottom() >> Block::LgSize;
+            by <= by2; by++) {
+        for (int bx = bounds.left() >> Block::LgSize, bx2 = bounds.right() >> Block::LgSize;
+                bx <= bx2; bx++) {
+            QHash<QPoint, Block>::const_iterator it = blocks.constFind(QPoint(bx, by));
+            if (it == blocks.constEnd()) {
+                continue;
+            }
+            QRect isect = bounds.intersected(QRect(
+                bx << Block::LgSize, by << Block::LgSize, Block::Size, Block::Size));
+            int* lptr = region.data.data() + (isect.top() - bounds.top()) * bounds.width() +
+                (isect.left() - bounds.left());
+            for (int yy = isect.top(), y2 = isect.bottom(); yy <= y2; yy++) {
+                int* ptr = lptr;
+                for (int xx = isect.left(), x2 = isect.right(); xx <= x2; xx++) {
+                    *ptr++ = it->get(QPoint(xx, yy));
+                }
+                lptr += bounds.width();
+            }
+        }
+    }
+    return region;
 }
 
-int SceneRecord::Block::get (const QPoint& pos) const
+void SceneRecord::paste (const QPoint& pos, const SceneRegion& region)
 {
-    return at((pos.y() & Mask) << LgSize | pos.x() & Mask);
+    set(QRect(pos, region.size), region.data.constData(), 1, region.size.width());
 }
 
-void SceneRecord::set (const QPoint& pos, int character)
+void SceneRecord::move (const QRect& bounds, const QPoint& pos)
 {
-    QPoint key(pos.x() >> Block::LgSize, pos.y() >> Block::LgSize);
-    Block& block = blocks[key];
-    int ofilled = block.filled();
-    block.set(pos, character);
+    SceneRegion region = copy(bounds);
+    fill(bounds, ' ');
+    paste(pos, region);
+}
+
+void SceneRecord::blockChanged (const QPoint& key, int ofilled)
+{
+    if (generated()) {
+        // keep even empty blocks; they're compared against the baseline on flush
+        updated.insert(key);
+        return;
+    }
 
     // perhaps remove, update delta sets
-    if (block.filled() == 0) {
-        blocks.remove(key);
+    QHash<QPoint, Block>::iterator it = blocks.find(key);
+    if (it->filled() == 0) {
+        blocks.erase(it);
         if (ofilled != 0) { // removed
             if (!added.remove(key)) {
                 updated.remove(key);
@@ -372,16 +586,25 @@ void SceneRecord::set (const QPoint& pos, int character)
     }
 }
 
-int SceneRecord::get (const QPoint& pos) const
-{
-    QPoint key(pos.x() >> Block::LgSize, pos.y() >> Block::LgSize);
-    QHash<QPoint, Block>::const_iterator it = blocks.constFind(key);
-    return (it == blocks.constEnd()) ? ' ' : (*it).get(pos);
-}
-
 void SceneRecord::clean ()
 {
     added.clear();
     updated.clear();
     removed.clear();
 }
+
+SceneBlockChanges SceneRecord::takeChanges ()
+{
+    // the blocks are implicitly shared, so this copies only the block pointers
+    SceneBlockChanges changes;
+    changes.sceneId = id;
+    foreach (const QPoint& key, added) {
+        changes.added.insert(key, blocks.value(key));
+    }
+    foreach (const QPoint& key, updated) {
+        changes.updated.insert(key, blocks.value(key));
+    }
+    changes.removed = removed.toList();
+    clean();
+    return changes;
+}
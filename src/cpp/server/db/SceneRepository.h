@@ -4,32 +4,46 @@
 #ifndef SCENE_REPOSITORY
 #define SCENE_REPOSITORY
 
+#include <QByteArray>
 #include <QDateTime>
 #include <QHash>
 #include <QList>
 #include <QMetaType>
-#include <QObject>
 #include <QPoint>
 #include <QSet>
+#include <QSize>
+#include <QVector>
 
+#include "db/Repository.h"
 #include "util/General.h"
 #include "util/Streaming.h"
 
 class Callback;
+class ResourceIndex;
+class SceneBlockChanges;
+class ServerApp;
+class QRect;
+
 class SceneRecord;
 class ZoneRecord;
 
 /**
  * Handles database queries associated with scenes.
  */
-class SceneRepository : public QObject
+class SceneRepository : public Repository
 {
     Q_OBJECT
 
 public:
 
     /**
-     * Initializes the repository, performing any necessary migrations.
+     * Creates the scene repository.
+     */
+    SceneRepository (ServerApp* app);
+
+    /**
+     * Initializes the repository, performing any necessary migrations, and loads the scene and
+     * zone name indices.
      */
     void init ();
 
@@ -41,32 +55,35 @@ public:
 
     /**
      * Loads a scene.  The callback will receive the {@link SceneRecord}.
+     *
+     * @param pagingThreshold if the scene has more than this many blocks, only their keys will
+     * be loaded (into {@link SceneRecord#unloaded}), and the blocks themselves must be requested
+     * with {@link #loadSceneBlocks}.  -1 to always load all blocks.
      */
-    Q_INVOKABLE void loadScene (quint32 id, const Callback& callback);
+    Q_INVOKABLE void loadScene (quint32 id, int pagingThreshold, const Callback& callback);
 
     /**
-     * Loads the name of a scene.
+     * Loads the blocks of a scene whose keys fall within the specified (block) bounds.  The
+     * callback will receive a SceneBlockHash containing the blocks.
      */
-    Q_INVOKABLE void loadSceneName (quint32 id, const Callback& callback);
+    Q_INVOKABLE void loadSceneBlocks (quint32 id, const QRect& keys, const Callback& callback);
 
     /**
-     * Finds scenes whose names start with the specified prefix.  The callback will receive a
-     * ResourceDescriptorList containing the scene descriptors.
-     *
-     * @param creatorId the id of the creator whose scenes are desired, or 0 for all creators.
+     * Loads the name of a scene.
      */
-    Q_INVOKABLE void findScenes (
-        const QString& prefix, quint64 creatorId, const Callback& callback);
+    Q_INVOKABLE void loadSceneName (quint32 id, const Callback& callback);
 
     /**
-     * Updates a scene record.
+     * Updates a scene record.  The callback is invoked only if the update succeeds.
      */
     Q_INVOKABLE void updateScene (const SceneRecord& srec, const Callback& callback);
 
     /**
-     * Updates a scene's blocks.
+     * Writes a batch of changed scene blocks in a single transaction.  The callback will receive
+     * a bool indicating whether the changes were committed (if not, none of them were written).
      */
-    Q_INVOKABLE void updateSceneBlocks (const SceneRecord& srec);
+    Q_INVOKABLE void updateSceneBlocks (const SceneBlockChanges& changes,
+        const Callback& callback);
 
     /**
      * Deletes the identified scene.
@@ -88,15 +105,6 @@ public:
      */
     Q_INVOKABLE void loadZoneName (quint32 id, const Callback& callback);
 
-    /**
-     * Finds zones whose names start with the specified prefix.  The callback will receive a
-     * ResourceDescriptorList containing the zone descriptors.
-     *
-     * @param creatorId the id of the creator whose zones are desired, or 0 for all creators.
-     */
-    Q_INVOKABLE void findZones (
-        const QString& prefix, quint64 creatorId, const Callback& callback);
-
     /**
      * Updates a zone record.
      */
@@ -106,6 +114,51 @@ public:
      * Deletes the identified zone.
      */
     Q_INVOKABLE void deleteZone (quint32 id, const Callback& callback);
+
+protected:
+
+    /**
+     * Loads the descriptors of all resources in the specified table (SCENES or ZONES) into the
+     * provided index.
+     */
+    void loadIndex (const QString& table, ResourceIndex& index);
+
+    /** The server application. */
+    ServerApp* _app;
+};
+
+/**
+ * A rectangular region of scene contents, such as that copied to a clipboard.
+ */
+class SceneRegion
+{
+public:
+
+    /** The size of the region. */
+    QSize size;
+
+    /** The contents of the region, row by row. */
+    QIntVector data;
+};
+
+/**
+ * A location in a scene that moves pawns stepping onto it to another scene.
+ */
+class ScenePortal
+{
+public:
+
+    /** The location of the portal within its scene. */
+    QPoint position;
+
+    /** The id of the target zone, or zero for the zone containing the portal. */
+    quint32 targetZoneId;
+
+    /** The id of the target scene, or zero for the target zone's default scene. */
+    quint32 targetSceneId;
+
+    /** The location at which to arrive in the target scene. */
+    QPoint targetPosition;
 };
 
 /**
@@ -131,6 +184,14 @@ public:
         /** The coordinate mask. */
         static const int Mask = Size - 1;
 
+        /**
+         * The version of the block encoding written by encode.  The encoding starts with the
+         * version byte and a flags byte, followed by the (optionally deflated) payload: the
+         * palette of non-space values as big-endian ints, then alternating runs of spaces and
+         * palette indices.
+         */
+        static const int EncodingVersion = 1;
+
         /**
          * Creates an empty block.
          */
@@ -141,6 +202,18 @@ public:
          */
         Block (const int* data);
 
+        /**
+         * Creates a block from its encoded form, which may be either the output of encode or
+         * (for blocks stored before the encoding was versioned) the compressed raw values.  Data
+         * that can't be decoded in full yields an empty block.
+         */
+        Block (const QByteArray& encoded);
+
+        /**
+         * Encodes the block for storage.
+         */
+        QByteArray encode () const;
+
         /**
          * Returns the number of non-empty locations in the block.
          */
@@ -158,6 +231,13 @@ public:
 
     protected:
 
+        /**
+         * Decodes the payload of the current encoding into the (empty) block.
+         *
+         * @return whether the payload was valid and consumed in full.
+         */
+        bool decode (const uchar* ptr, const uchar* end);
+
         /** The number of non-empty locations. */
         int _filled;
     };
@@ -183,12 +263,35 @@ public:
     /** The height of the scroll region. */
     quint16 scrollHeight;
 
-    /** The scene blocks. */
+    /** The seed from which the scene contents are generated. */
+    quint32 seed;
+
+    /** The layers from which the scene contents are generated, or empty if not generated. */
+    QString layers;
+
+    /** The portals leading out of the scene. */
+    QList<ScenePortal> portals;
+
+    /** The scene blocks.  For generated scenes, this includes empty blocks. */
     QHash<QPoint, Block> blocks;
 
-    /** Keys of blocks added, updated, and removed since the last flush. */
+    /** The keys of blocks that exist in the database but have not been loaded. */
+    QSet<QPoint> unloaded;
+
+    /** For generated scenes, the keys of the (stored) blocks that differ from the baseline. */
+    QSet<QPoint> modified;
+
+    /**
+     * Keys of blocks added, updated, and removed since the last flush.  For generated scenes, all
+     * changed blocks are marked as updated, to be compared against the baseline on flush.
+     */
     QSet<QPoint> added, updated, removed;
 
+    /**
+     * Checks whether the scene contents are generated.
+     */
+    bool generated () const { return !layers.isEmpty(); }
+
     /**
      * Sets the value at the specified location.
      */
@@ -199,6 +302,46 @@ public:
      */
     int get (const QPoint& pos) const;
 
+    /**
+     * Sets the contents of a region from the provided data, a block at a time.
+     *
+     * @param xstep the amount by which to advance the data pointer for each column (zero to
+     * repeat the same value).
+     * @param stride the amount by which to advance the data pointer for each row.
+     */
+    void set (const QRect& bounds, const int* data, int xstep, int stride);
+
+    /**
+     * Fills a region with the specified character.
+     */
+    void fill (const QRect& bounds, int character) { set(bounds, &character, 0, 0); }
+
+    /**
+     * Returns a copy of the contents of a region.  Locations in blocks absent from the record
+     * (including, in paged scenes, those not loaded) are copied as spaces, so callers must make
+     * sure that paged regions are loaded first.
+     */
+    SceneRegion copy (const QRect& bounds) const;
+
+    /**
+     * Pastes a region with its upper-left corner at the specified location.
+     */
+    void paste (const QPoint& pos, const SceneRegion& region);
+
+    /**
+     * Moves the contents of a region so that its upper-left corner is at the specified location.
+     * As with copy, paged regions must be loaded first.
+     */
+    void move (const QRect& bounds, const QPoint& pos);
+
+    /**
+     * Updates the delta sets (and removes the block if empty) after a change to the block with
+     * the specified key.
+     *
+     * @param ofilled the number of non-empty locations in the block before the change.
+     */
+    void blockChanged (const QPoint& key, int ofilled);
+
     /**
      * Checks whether the blocks have changed.
      */
@@ -208,13 +351,85 @@ public:
      * Clears the update sets.
      */
     void clean ();
+
+    /**
+     * Collects the blocks changed since the last flush into a batch and clears the update sets.
+     */
+    SceneBlockChanges takeChanges ();
 };
 
 Q_DECLARE_METATYPE(SceneRecord)
 
+/** Maps block keys to scene blocks. */
+typedef QHash<QPoint, SceneRecord::Block> SceneBlockHash;
+
+Q_DECLARE_METATYPE(SceneBlockHash)
+
+/**
+ * Contains only the blocks of a scene that have changed since the last flush.
+ */
+class SceneBlockChanges
+{
+public:
+
+    /** The scene id. */
+    quint32 sceneId;
+
+    /** The blocks added since the last flush. */
+    SceneBlockHash added;
+
+    /** The blocks updated since the last flush. */
+    SceneBlockHash updated;
+
+    /** The keys of the blocks removed since the last flush. */
+    QList<QPoint> removed;
+};
+
+Q_DECLARE_METATYPE(SceneBlockChanges)
+
 /** A record for the lack of a scene. */
 const SceneRecord NoScene = { 0 };
 
+/**
+ * The cells changed in a single scene block.
+ */
+class SceneBlockEdit
+{
+    STREAMABLE
+
+public:
+
+    /** The key of the (record) block. */
+    STREAM QPoint key;
+
+    /** The changed cells, as alternating block-relative indices and new values. */
+    STREAM QVector<int> cells;
+};
+
+DECLARE_STREAMABLE_METATYPE(SceneBlockEdit)
+
+/**
+ * A batch of edits made to a scene in one instance, propagated to the other instances holding the
+ * scene.
+ */
+class SceneEdits
+{
+    STREAMABLE
+
+public:
+
+    /** The id of the scene edited. */
+    STREAM quint32 sceneId;
+
+    /** The id of the instance in which the edits were made. */
+    STREAM quint64 instanceId;
+
+    /** The edited blocks. */
+    STREAM QList<SceneBlockEdit> blocks;
+};
+
+DECLARE_STREAMABLE_METATYPE(SceneEdits)
+
 /**
  * Holds the metadata associated with a zone.
  */
@@ -0,0 +1,43 @@
+//
+// $Id$
+
+#include <QMutexLocker>
+#include <QRegExp>
+#include <QtDebug>
+
+#include "db/SlowQueryLog.h"
+
+SlowQueryLog::SlowQueryLog (qint64 threshold, int capacity) :
+    _threshold(threshold),
+    _capacity(capacity),
+    _count(0)
+{
+}
+
+void SlowQueryLog::append (const QString& connectionName, const QString& sql, qint64 time)
+{
+    // our statements bind their values, but redact any quoted literals just in case
+    QString redacted = sql;
+    redacted.replace(QRegExp("'([^']|'')*'"), "'?'");
+    qWarning() << "Slow query." << connectionName << time / 1000000 << "ms" << redacted;
+
+    SlowQuery query = { QDateTime::currentDateTime(), connectionName, redacted, time };
+    QMutexLocker locker(&_mutex);
+    _count++;
+    _queries.append(query);
+    if (_queries.size() > _capacity) {
+        _queries.removeFirst();
+    }
+}
+
+QList<SlowQuery> SlowQueryLog::queries () const
+{
+    QMutexLocker locker(&_mutex);
+    return _queries;
+}
+
+quint64 SlowQueryLog::count () const
+{
+    QMutexLocker locker(&_mutex);
+    return _count;
+}
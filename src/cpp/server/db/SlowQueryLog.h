@@ -0,0 +1,86 @@
+//
+// $Id$
+
+#ifndef SLOW_QUERY_LOG
+#define SLOW_QUERY_LOG
+
+#include <QDateTime>
+#include <QList>
+#include <QMutex>
+#include <QString>
+
+/**
+ * Describes a query that took longer than the configured threshold.
+ */
+class SlowQuery
+{
+public:
+
+    /** When the query finished. */
+    QDateTime when;
+
+    /** The name of the connection on which it was executed. */
+    QString connectionName;
+
+    /** The statement, with any literal values redacted.  Bound values are never recorded. */
+    QString sql;
+
+    /** The time taken, in nanoseconds. */
+    qint64 time;
+};
+
+/**
+ * Logs and retains the most recent slow queries.  This class is thread-safe.
+ */
+class SlowQueryLog
+{
+public:
+
+    /**
+     * Creates a log.
+     *
+     * @param threshold the minimum execution time, in nanoseconds, of the queries to log, or 0
+     * to log none.
+     * @param capacity the number of queries to retain.
+     */
+    SlowQueryLog (qint64 threshold, int capacity);
+
+    /**
+     * Checks whether a query that took the specified time should be logged.
+     */
+    bool isSlow (qint64 time) const { return _threshold > 0 && time >= _threshold; }
+
+    /**
+     * Logs a slow query.
+     */
+    void append (const QString& connectionName, const QString& sql, qint64 time);
+
+    /**
+     * Returns the retained queries, oldest first.
+     */
+    QList<SlowQuery> queries () const;
+
+    /**
+     * Returns the total number of queries logged.
+     */
+    quint64 count () const;
+
+protected:
+
+    /** Protects the log. */
+    mutable QMutex _mutex;
+
+    /** The threshold at which we log queries. */
+    qint64 _threshold;
+
+    /** The number of queries to retain. */
+    int _capacity;
+
+    /** The retained queries. */
+    QList<SlowQuery> _queries;
+
+    /** The total number of queries logged. */
+    quint64 _count;
+};
+
+#endif // SLOW_QUERY_LOG
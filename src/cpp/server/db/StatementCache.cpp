@@ -0,0 +1,119 @@
+//
+// $Id$
+
+#include <QElapsedTimer>
+#include <QSqlError>
+#include <QtDebug>
+
+#include "db/SlowQueryLog.h"
+#include "db/StatementCache.h"
+
+PreparedQuery& PreparedQuery::operator= (const PreparedQuery& other)
+{
+    // retain first, in case the two share the statement
+    if (other._statement != 0) {
+        other._statement->handles++;
+    }
+    release();
+    QSqlQuery::operator=(other);
+    _statement = other._statement;
+    return *this;
+}
+
+bool PreparedQuery::exec ()
+{
+    QElapsedTimer timer;
+    timer.start();
+    bool success = QSqlQuery::exec();
+    executed(success, timer.nsecsElapsed());
+    return success;
+}
+
+bool PreparedQuery::execBatch (BatchExecutionMode mode)
+{
+    QElapsedTimer timer;
+    timer.start();
+    bool success = QSqlQuery::execBatch(mode);
+    executed(success, timer.nsecsElapsed());
+    return success;
+}
+
+void PreparedQuery::release ()
+{
+    if (_statement != 0 && --_statement->handles == 0) {
+        _statement->query.finish();
+    }
+}
+
+void PreparedQuery::executed (bool success, qint64 time)
+{
+    if (_statement == 0) {
+        return;
+    }
+    StatementStats& stats = _statement->stats;
+    stats.executions++;
+    stats.totalTime += time;
+    stats.maxTime = qMax(stats.maxTime, time);
+
+    // log the statement (but never its bound values) if it took too long
+    SlowQueryLog* log = _statement->cache->slowQueryLog();
+    if (log != 0 && log->isSlow(time)) {
+        log->append(_statement->cache->connectionName(), lastQuery(), time);
+    }
+
+    // the server may have dropped the handle (on reconnection, say), so prepare it again
+    if (!success) {
+        _statement->stale = true;
+    }
+}
+
+StatementCache::StatementCache (const QSqlDatabase& database, SlowQueryLog* slowQueryLog) :
+    _database(database),
+    _slowQueryLog(slowQueryLog),
+    _hits(0),
+    _misses(0)
+{
+}
+
+StatementCache::~StatementCache ()
+{
+    qDeleteAll(_statements);
+}
+
+PreparedQuery StatementCache::prepare (const QString& sql)
+{
+    CachedStatement*& statement = _statements[sql];
+    if (statement == 0) {
+        statement = new CachedStatement();
+        statement->query = QSqlQuery(_database);
+        statement->stale = true;
+        StatementStats stats = { 0, 0, 0, 0 };
+        statement->stats = stats;
+        statement->cache = this;
+        statement->handles = 0;
+
+    } else if (!statement->stale) {
+        // release any results from the last execution
+        _hits++;
+        statement->query.finish();
+        return PreparedQuery(statement->query, statement);
+    }
+    _misses++;
+    statement->stats.prepares++;
+    if (!statement->query.prepare(sql)) {
+        qWarning() << "Failed to prepare statement." << sql << statement->query.lastError();
+        return PreparedQuery(statement->query, statement);
+    }
+    statement->stale = false;
+    return PreparedQuery(statement->query, statement);
+}
+
+QHash<QString, StatementStats> StatementCache::stats () const
+{
+    QHash<QString, StatementStats> stats;
+    for (QHash<QString, CachedStatement*>::const_iterator it = _statements.constBegin(),
+            end = _statements.constEnd(); it != end; it++) {
+        stats.insert(it.key(), it.value()->stats);
+    }
+    return stats;
+}
@@ -0,0 +1,200 @@
+//
+// $Id$
+
+#ifndef STATEMENT_CACHE
+#define STATEMENT_CACHE
+
+#include <QHash>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QString>
+
+class SlowQueryLog;
+class StatementCache;
+
+/**
+ * Counters kept for each cached statement.
+ */
+class StatementStats
+{
+public:
+
+    /** The number of times the statement has been prepared. */
+    quint64 prepares;
+
+    /** The number of times the statement has been executed. */
+    quint64 executions;
+
+    /** The total time spent executing the statement, in nanoseconds. */
+    qint64 totalTime;
+
+    /** The longest time spent on a single execution, in nanoseconds. */
+    qint64 maxTime;
+};
+
+/**
+ * A cache entry: a prepared query along with its counters.
+ */
+class CachedStatement
+{
+public:
+
+    /** The prepared query. */
+    QSqlQuery query;
+
+    /** Whether the query must be prepared again before its next use. */
+    bool stale;
+
+    /** The counters for the statement. */
+    StatementStats stats;
+
+    /** The cache to which the statement belongs. */
+    StatementCache* cache;
+
+    /** The number of live queries sharing the statement. */
+    int handles;
+};
+
+/**
+ * A query obtained from the statement cache, which records its execution times in the cache.
+ * When the last query sharing a statement is released, the statement is finished, so that its
+ * results (and, with SQLite, its read snapshot) aren't held until the statement's next use.
+ */
+class PreparedQuery : public QSqlQuery
+{
+public:
+
+    /**
+     * Creates an invalid query.
+     */
+    PreparedQuery () : _statement(0) { }
+
+    /**
+     * Creates a query sharing the provided prepared query.
+     */
+    PreparedQuery (const QSqlQuery& query, CachedStatement* statement) :
+        QSqlQuery(query), _statement(statement) { retain(); }
+
+    /**
+     * Creates a query sharing the other's statement.
+     */
+    PreparedQuery (const PreparedQuery& other) :
+        QSqlQuery(other), _statement(other._statement) { retain(); }
+
+    /**
+     * Destroys the query, finishing the statement if no other queries share it.
+     */
+    ~PreparedQuery () { release(); }
+
+    /**
+     * Makes this query share the other's statement, releasing the current one.
+     */
+    PreparedQuery& operator= (const PreparedQuery& other);
+
+    /**
+     * Executes the query, recording the time taken.
+     */
+    bool exec ();
+
+    /**
+     * Executes the query in batch mode, recording the time taken.
+     */
+    bool execBatch (BatchExecutionMode mode = ValuesAsRows);
+
+protected:
+
+    /**
+     * Notes that this query shares the statement.
+     */
+    void retain () { if (_statement != 0) _statement->handles++; }
+
+    /**
+     * Notes that this query no longer shares the statement, finishing it if it was the last.
+     */
+    void release ();
+
+    /**
+     * Records the outcome of an execution.
+     */
+    void executed (bool success, qint64 time);
+
+    /** The cache entry, if any. */
+    CachedStatement* _statement;
+};
+
+/**
+ * Caches prepared statements for a single connection, keyed by their SQL, so that each is parsed
+ * and planned by the server only once.
+ */
+class StatementCache
+{
+public:
+
+    /**
+     * Creates a cache for the specified connection.
+     *
+     * @param slowQueryLog the log in which to record slow executions, if any.
+     */
+    StatementCache (const QSqlDatabase& database, SlowQueryLog* slowQueryLog = 0);
+
+    /**
+     * Destroys the cache.
+     */
+    ~StatementCache ();
+
+    /**
+     * Returns a query for the specified statement, preparing it if it isn't already cached.
+     * Bound values must be added afresh before each execution.
+     */
+    PreparedQuery prepare (const QString& sql);
+
+    /**
+     * Returns a pointer to the log of slow executions, if any.
+     */
+    SlowQueryLog* slowQueryLog () const { return _slowQueryLog; }
+
+    /**
+     * Returns the name of the cache's connection.
+     */
+    QString connectionName () const { return _database.connectionName(); }
+
+    /**
+     * Returns the number of requests satisfied from the cache.
+     */
+    quint64 hits () const { return _hits; }
+
+    /**
+     * Returns the number of requests that required preparing a statement.
+     */
+    quint64 misses () const { return _misses; }
+
+    /**
+     * Returns the fraction of requests satisfied from the cache.
+     */
+    float hitRate () const { return (_hits + _misses) == 0 ? 0.0f :
+        _hits / (float)(_hits + _misses); }
+
+    /**
+     * Returns the counters for each cached statement.
+     */
+    QHash<QString, StatementStats> stats () const;
+
+protected:
+
+    /** The connection on which we prepare statements. */
+    QSqlDatabase _database;
+
+    /** The log of slow executions, if any. */
+    SlowQueryLog* _slowQueryLog;
+
+    /** The cached statements, mapped by SQL. */
+    QHash<QString, CachedStatement*> _statements;
+
+    /** The number of requests satisfied from the cache. */
+    quint64 _hits;
+
+    /** The number of requests that required preparing a statement. */
+    quint64 _misses;
+};
+
+#endif // STATEMENT_CACHE
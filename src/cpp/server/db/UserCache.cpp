@@ -0,0 +1,113 @@
+//
+// $Id$
+
+#include <QMutexLocker>
+
+#include "db/UserCache.h"
+#include "db/UserRepository.h"
+
+UserCache::UserCache (int capacity) :
+    _records(capacity),
+    _generation(0)
+{
+}
+
+bool UserCache::get (quint64 id, UserRecord& urec)
+{
+    QMutexLocker locker(&_mutex);
+    UserRecord* cached = _records.object(id);
+    if (cached == 0) {
+        return false;
+    }
+    urec = *cached;
+    return true;
+}
+
+bool UserCache::getByName (const QString& nameLower, UserRecord& urec)
+{
+    QMutexLocker locker(&_mutex);
+    QHash<QString, quint64>::iterator it = _ids.find(nameLower);
+    if (it == _ids.end()) {
+        return false;
+    }
+    // the record may have been evicted or renamed since we mapped the name
+    UserRecord* cached = _records.object(it.value());
+    if (cached == 0 || cached->name.toLower() != nameLower) {
+        _ids.erase(it);
+        return false;
+    }
+    urec = *cached;
+    return true;
+}
+
+void UserCache::put (UserRecord& urec)
+{
+    if (urec.transient()) {
+        return;
+    }
+    QMutexLocker locker(&_mutex);
+    insert(urec);
+}
+
+void UserCache::put (UserRecord& urec, quint64 generation)
+{
+    if (urec.transient()) {
+        return;
+    }
+    QMutexLocker locker(&_mutex);
+    if (_generation == generation) {
+        insert(urec);
+    }
+}
+
+void UserCache::remove (quint64 id)
+{
+    QMutexLocker locker(&_mutex);
+    _records.remove(id);
+    _generation++;
+}
+
+quint64 UserCache::generation ()
+{
+    QMutexLocker locker(&_mutex);
+    return _generation;
+}
+
+void UserCache::setLastOnline (quint64 id, const QDateTime& time)
+{
+    QMutexLocker locker(&_mutex);
+    _lastOnline.insert(id, time);
+    UserRecord* cached = _records.object(id);
+    if (cached != 0) {
+        cached->lastOnline = time;
+    }
+}
+
+QHash<quint64, QDateTime> UserCache::takeLastOnline ()
+{
+    QMutexLocker locker(&_mutex);
+    QHash<quint64, QDateTime> lastOnline = _lastOnline;
+    _lastOnline.clear();
+    return lastOnline;
+}
+
+void UserCache::insert (UserRecord& urec)
+{
+    QHash<quint64, QDateTime>::const_iterator it = _lastOnline.constFind(urec.id);
+    if (it != _lastOnline.constEnd() && it.value() > urec.lastOnline) {
+        urec.lastOnline = it.value();
+    }
+    _records.insert(urec.id, new UserRecord(urec));
+    _ids.insert(urec.name.toLower(), urec.id);
+
+    // evicted records leave their names behind; clear them out once they start to pile up
+    if (_ids.size() > _records.maxCost() * 2) {
+        for (QHash<QString, quint64>::iterator nit = _ids.begin(); nit != _ids.end(); ) {
+            if (_records.contains(nit.value())) {
+                nit++;
+            } else {
+                nit = _ids.erase(nit);
+            }
+        }
+    }
+}
@@ -0,0 +1,102 @@
+//
+// $Id$
+
+#ifndef USER_CACHE
+#define USER_CACHE
+
+#include <QCache>
+#include <QDateTime>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+
+class UserRecord;
+
+/**
+ * Caches the user records loaded on this peer, shared by all of the database threads, and holds
+ * the low-value changes (last online times) that are written to the database in periodic batches
+ * rather than as they occur.  Records changed on another peer are removed on notification, so
+ * the cache never holds a record that's older than the database.  All methods are thread-safe.
+ */
+class UserCache
+{
+public:
+
+    /**
+     * Creates a cache holding at most the specified number of records.
+     */
+    UserCache (int capacity);
+
+    /**
+     * Looks up a cached record by id.
+     *
+     * @return whether the record was found.
+     */
+    bool get (quint64 id, UserRecord& urec);
+
+    /**
+     * Looks up a cached record by lowercase name.
+     *
+     * @return whether the record was found.
+     */
+    bool getByName (const QString& nameLower, UserRecord& urec);
+
+    /**
+     * Adds or replaces a record.  If a newer last online time is pending for the user, it
+     * replaces the one in the record.  Transient users are never cached.
+     */
+    void put (UserRecord& urec);
+
+    /**
+     * Adds or replaces a record loaded from the database, unless a record has been removed since
+     * the specified generation was fetched: the load may have read the row before the change
+     * that caused the removal, and caching it would bring the old values back.
+     *
+     * @param generation the value of {@link #generation} fetched before the load.
+     */
+    void put (UserRecord& urec, quint64 generation);
+
+    /**
+     * Removes a record, if cached.  Pending changes are retained.
+     */
+    void remove (quint64 id);
+
+    /**
+     * Returns the current generation, which increases whenever a record is removed.
+     */
+    quint64 generation ();
+
+    /**
+     * Sets a user's last online time, to be written on the next flush.
+     */
+    void setLastOnline (quint64 id, const QDateTime& time);
+
+    /**
+     * Removes and returns the pending last online times, mapped by user id.
+     */
+    QHash<quint64, QDateTime> takeLastOnline ();
+
+protected:
+
+    /**
+     * Adds or replaces a record.  The caller must hold the mutex.
+     */
+    void insert (UserRecord& urec);
+
+    /** Guards the cache. */
+    QMutex _mutex;
+
+    /** The cached records, mapped by id. */
+    QCache<quint64, UserRecord> _records;
+
+    /** The ids of the cached records, mapped by lowercase name.  May contain stale entries. */
+    QHash<QString, quint64> _ids;
+
+    /** The last online times awaiting a flush, mapped by user id. */
+    QHash<quint64, QDateTime> _lastOnline;
+
+    /** The number of removals so far. */
+    quint64 _generation;
+};
+
+#endif // USER_CACHE
@@ -3,15 +3,23 @@
 
 #include <QCryptographicHash>
 #include <QFile>
+#include <QHash>
 #include <QSqlDatabase>
 #include <QSqlError>
 #include <QSqlQuery>
 #include <QStringList>
+#include <QVariant>
 #include <QtDebug>
 
 #include "ServerApp.h"
+#include "db/DatabasePool.h"
 #include "db/DatabaseThread.h"
+#include "db/NameIndex.h"
+#include "db/StatementCache.h"
+#include "db/UserCache.h"
 #include "db/UserRepository.h"
+#include "net/ConnectionManager.h"
+#include "peer/PeerManager.h"
 #include "util/Callback.h"
 #include "util/General.h"
 
@@ -24,46 +32,46 @@ UserRepository::UserRepository (ServerApp* app) :
     QDataStream pin(&pfile);
 
     // first, the probabilities for each name length
+    double lengths[MaxNameLength - MinNameLength + 1];
     for (int ii = 0; ii < MaxNameLength - MinNameLength + 1; ii++) {
-        pin >> _nameLengths[ii];
+        pin >> lengths[ii];
     }
+    _nameLengths = AliasTable(lengths, MaxNameLength - MinNameLength + 1);
 
     // then, the probabilities that each state will follow each other
     for (int ii = 0; ii < NameChainStates; ii++) {
+        double chain[NameChainStates];
         for (int jj = 0; jj < NameChainStates; jj++) {
-            pin >> _nameChain[ii][jj];
+            pin >> chain[jj];
         }
+        _nameChain[ii] = AliasTable(chain, NameChainStates);
     }
 
     // load the blocked named list
     QFile bfile(app->config().value("blocked_names").toString());
     bfile.open(QIODevice::ReadOnly | QIODevice::Text);
 
-    QString pattern;
+    QStringList patterns;
     while (!bfile.atEnd()) {
         QString line = bfile.readLine().trimmed();
-        if (line.isEmpty()) {
-            continue;
-        }
-        if (!pattern.isEmpty()) {
-            pattern += '|';
+        if (!line.isEmpty()) {
+            patterns.append(line.toLower());
         }
-        pattern += line;
     }
-    _blockedNameExp = QRegExp(pattern);
+    _blockedNames = StringMatcher(patterns);
 }
 
 void UserRepository::init ()
 {
     // create the tables if they don't yet exist
-    QSqlDatabase database = QSqlDatabase::database();
-    QSqlQuery query;
+    QSqlDatabase database = DatabaseThread::connection();
+    QSqlQuery query(DatabaseThread::connection());
 
     if (!database.tables().contains("USERS")) {
         qDebug() << "Creating USERS table.";
         query.exec(
             "create table USERS ("
-                "ID bigint unsigned not null auto_increment primary key,"
+                "ID " + DatabaseThread::autoIncrementKey("bigint unsigned") + ","
                 "SESSION_TOKEN binary(16) not null,"
                 "NAME varchar(16) not null,"
                 "NAME_LOWER varchar(16) not null unique,"
@@ -72,43 +80,46 @@ void UserRepository::init ()
                 "LAST_ONLINE datetime not null,"
                 "PASSWORD_SALT binary(8) not null,"
                 "PASSWORD_HASH binary(16),"
-                "DATE_OF_BIRTH date not null,"
-                "EMAIL varchar(255) not null,"
-                "FLAGS int unsigned not null,"
-                "LAST_ZONE_ID int unsigned not null,"
-                "LAST_SCENE_ID int unsigned not null,"
-                "index (EMAIL))");
+                "DATE_OF_BIRTH date,"
+                "EMAIL varchar(255) not null default '',"
+                "FLAGS int unsigned not null default 0,"
+                "LAST_ZONE_ID int unsigned not null default 0,"
+                "LAST_SCENE_ID int unsigned not null default 0)");
+        query.exec("create index USERS_EMAIL on USERS (EMAIL)");
     }
 
     if (!database.tables().contains("PASSWORD_RESETS")) {
         qDebug() << "Creating PASSWORD_RESETS table.";
         query.exec(
             "create table PASSWORD_RESETS ("
-                "ID int unsigned not null auto_increment primary key,"
+                "ID " + DatabaseThread::autoIncrementKey("int unsigned") + ","
                 "TOKEN binary(16) not null,"
                 "USER_ID bigint unsigned not null,"
-                "CREATED datetime not null,"
-                "index (CREATED),"
-                "index (USER_ID))");
+                "CREATED datetime not null)");
+        query.exec("create index PASSWORD_RESETS_CREATED on PASSWORD_RESETS (CREATED)");
+        query.exec("create index PASSWORD_RESETS_USER_ID on PASSWORD_RESETS (USER_ID)");
     }
     
     if (!database.tables().contains("INVITES")) {
         qDebug() << "Creating INVITES table.";
         query.exec(
             "create table INVITES ("
-                "ID int unsigned not null auto_increment primary key,"
+                "ID " + DatabaseThread::autoIncrementKey("int unsigned") + ","
                 "TOKEN binary(16) not null,"
                 "DESCRIPTION varchar(255) not null,"
                 "FLAGS int unsigned not null,"
                 "TOTAL int unsigned not null,"
-                "REDEEMED int unsigned not null,"
-                "CREATED datetime not null,"
-                "index (CREATED))");
+                "REDEEMED int unsigned not null default 0,"
+                "CREATED datetime not null)");
+        query.exec("create index INVITES_CREATED on INVITES (CREATED)");
         
         // insert the initial admin invite
         insertInvite("Bootstrap admin invite.", UserRecord::Admin, 1, Callback(this,
             "reportBootstrapInvite(QString)"));
     }
+
+    // load the names of the stored users
+    _app->databasePool()->nameIndex().load();
 }
 
 /**
@@ -130,30 +141,35 @@ static QChar randomAvatar ()
 void UserRepository::validateSessionToken (
     quint64 userId, const QByteArray& token, const Callback& callback)
 {
-    QSqlQuery query;
+    PreparedQuery query;
     QDateTime now = QDateTime::currentDateTime();
 
-    // try to update the timestamp if we were passed what looks like a valid id
-    if (userId != 0) {
-        query.prepare("update USERS set LAST_ONLINE = ? where ID = ? and SESSION_TOKEN = ?");
-        query.addBindValue(now);
-        query.addBindValue(userId);
-        query.addBindValue(token);
-        query.exec();
-        if (query.numRowsAffected() > 0) { // valid; return what we were passed
-            // look up the user record
-            query.prepare("select NAME, AVATAR, CREATED, PASSWORD_SALT, PASSWORD_HASH, "
+    // check the cache, then the database, if we were passed what looks like a valid id
+    if (userId != 0 && !(userId & UserRecord::TransientIdFlag)) {
+        UserCache& cache = _app->databasePool()->userCache();
+        UserRecord urec;
+        quint64 generation = cache.generation();
+        if (!(cache.get(userId, urec) && urec.sessionToken == token)) {
+            query = DatabaseThread::prepare(
+                "select NAME, AVATAR, CREATED, PASSWORD_SALT, PASSWORD_HASH, "
                 "DATE_OF_BIRTH, EMAIL, FLAGS, LAST_ZONE_ID, LAST_SCENE_ID from USERS "
-                "where ID = ?");
+                "where ID = ? and SESSION_TOKEN = ?");
             query.addBindValue(userId);
+            query.addBindValue(token);
             query.exec();
-            query.next();
-            UserRecord urec = {
-                userId, token, query.value(0).toString(), QChar(query.value(1).toUInt()),
-                query.value(2).toDateTime(), now, query.value(3).toByteArray(),
-                query.value(4).toByteArray(), query.value(5).toDate(), query.value(6).toString(),
-                (UserRecord::Flags)query.value(7).toUInt(), query.value(8).toUInt(),
-                query.value(9).toUInt() };
+            if (query.next()) {
+                UserRecord lrec = {
+                    userId, token, query.value(0).toString(), QChar(query.value(1).toUInt()),
+                    query.value(2).toDateTime(), now, query.value(3).toByteArray(),
+                    query.value(4).toByteArray(), query.value(5).toDate(),
+                    query.value(6).toString(), (UserRecord::Flags)query.value(7).toUInt(),
+                    query.value(8).toUInt(), query.value(9).toUInt() };
+                cache.put(urec = lrec, generation);
+            }
+        }
+        if (urec.id != 0) { // valid; return what we were passed
+            // the timestamp will be written with the next flush
+            cache.setLastOnline(userId, urec.lastOnline = now);
 
             // make sure they can actually log on
             if (validateLogon(urec) == NoError) {
@@ -164,37 +180,124 @@ void UserRepository::validateSessionToken (
         }
     }
 
-    // if that didn't work, we must generate a new user with a random name/avatar
-    createUser(callback);
+    // if that didn't work, the caller must create a new user
+    callback.invoke(Q_ARG(const UserRecord&, NoUser));
 }
 
-void UserRepository::createUser (const Callback& callback)
+/**
+ * Helper function for user creation: returns a random salt for password hashing.
+ */
+static QByteArray generateSalt ()
 {
-    QSqlQuery query;
-    QDateTime now = QDateTime::currentDateTime();
-
-    // generate a random salt
     QByteArray salt(8, 0);
     for (int ii = 0; ii < 8; ii++) {
         salt[ii] = qrand() % 256;
     }
-    query.prepare("insert into USERS (SESSION_TOKEN, NAME, NAME_LOWER, AVATAR, "
-        "CREATED, LAST_ONLINE, PASSWORD_SALT) values (?, ?, ?, ?, ?, ?, ?)");
-    QByteArray ntoken = generateToken(16);
-    query.addBindValue(ntoken);
-    QString name = uniqueRandomName();
-    query.addBindValue(name);
+    return salt;
+}
+
+UserRecord UserRepository::createGuest (int attempt) const
+{
+    // generate a random id in the transient range
+    quint64 id = UserRecord::TransientIdFlag | (quint64)(qrand() & 0x7FFFFFFF) << 32 |
+        (quint64)(qrand() & 0xFFFF) << 16 | (quint64)(qrand() & 0xFFFF);
+
+    // generate a random name that isn't in the blocked name list or (probably) taken
+    NameIndex& index = _app->databasePool()->nameIndex();
+    QString name;
+    do {
+        name = randomName();
+        if (attempt > 1) {
+            // start inserting numbers after the first failed attempts
+            name.insert(qrand() % (name.length() + 1), QString::number(attempt));
+        }
+    } while (_blockedNames.matches(name) || index.mayContain(name));
+
+    QDateTime now = QDateTime::currentDateTime();
+    UserRecord urec = { id, generateToken(16), name, randomAvatar(), now, now, generateSalt() };
+    return urec;
+}
+
+void UserRepository::isNameTaken (const QString& name, const Callback& callback)
+{
+    PreparedQuery query = DatabaseThread::prepare(
+        "select count(*) from USERS where NAME_LOWER = ?");
     query.addBindValue(name.toLower());
-    QChar avatar = randomAvatar();
-    query.addBindValue(avatar.unicode());
-    query.addBindValue(now);
-    query.addBindValue(now);
-    query.addBindValue(salt);
     query.exec();
+    callback.invoke(Q_ARG(bool, query.next() && query.value(0).toInt() > 0));
+}
 
-    UserRecord urec = { query.lastInsertId().toULongLong(), ntoken, name, avatar, now, now, salt };
-    qDebug() << "User created." << urec.id << urec.name;
-    callback.invoke(Q_ARG(const UserRecord&, urec));
+/**
+ * Helper function for user updates: stores the mutable fields of the record, returning whether
+ * the update succeeded.
+ */
+static bool storeUser (const UserRecord& urec)
+{
+    PreparedQuery query = DatabaseThread::prepare(
+        "update USERS set NAME = ?, NAME_LOWER = ?, AVATAR = ?, PASSWORD_HASH = ?, "
+        "DATE_OF_BIRTH = ?, EMAIL = ?, FLAGS = ? where ID = ?");
+    query.addBindValue(urec.name);
+    query.addBindValue(urec.name.toLower());
+    query.addBindValue(urec.avatar.unicode());
+    query.addBindValue(urec.passwordHash);
+    query.addBindValue(urec.dateOfBirth);
+    query.addBindValue(urec.email.toLower());
+    query.addBindValue((int)urec.flags);
+    query.addBindValue(urec.id);
+    return query.exec();
+}
+
+void UserRepository::insertUser (
+    const UserRecord& urec, bool renameIfTaken, const Callback& callback)
+{
+    // make sure the name is available; we need only ask the database if the index says that it
+    // may be taken or hasn't yet loaded
+    UserRecord nrec = urec;
+    QString nameLower = nrec.name.toLower();
+    NameIndex& index = _app->databasePool()->nameIndex();
+    PreparedQuery query;
+    bool taken = false;
+    if (!index.isLoaded() || index.mayContain(nameLower)) {
+        query = DatabaseThread::prepare("select count(*) from USERS where NAME_LOWER = ?");
+        query.addBindValue(nameLower);
+        query.exec();
+        taken = query.next() && query.value(0).toInt() > 0;
+    }
+    if (taken || _blockedNames.matches(nameLower)) {
+        if (!renameIfTaken) {
+            callback.invoke(Q_ARG(const UserRecord&, NoUser));
+            return;
+        }
+        nrec.name = uniqueRandomName();
+    }
+
+    query = DatabaseThread::prepare("insert into USERS (SESSION_TOKEN, NAME, NAME_LOWER, AVATAR, "
+        "CREATED, LAST_ONLINE, PASSWORD_SALT) values (?, ?, ?, ?, ?, ?, ?)");
+    query.addBindValue(nrec.sessionToken);
+    query.addBindValue(nrec.name);
+    query.addBindValue(nrec.name.toLower());
+    query.addBindValue(nrec.avatar.unicode());
+    query.addBindValue(nrec.created);
+    query.addBindValue(nrec.lastOnline);
+    query.addBindValue(nrec.passwordSalt);
+    if (!query.exec()) {
+        // someone else took the name in the meantime
+        callback.invoke(Q_ARG(const UserRecord&, NoUser));
+        return;
+    }
+    nrec.id = query.lastInsertId().toULongLong();
+    _app->databasePool()->userCache().put(nrec);
+    index.insert(nrec.name.toLower());
+    if (index.needsRebuild()) {
+        index.load();
+    }
+
+    // store the account fields, if they've been set
+    if (nrec.loggedOn() || !nrec.email.isEmpty()) {
+        storeUser(nrec);
+    }
+    qDebug() << "User inserted." << nrec.id << nrec.name;
+    callback.invoke(Q_ARG(const UserRecord&, nrec));
 }
 
 /**
@@ -203,8 +306,7 @@ void UserRepository::createUser (const Callback& callback)
 static UserRecord loadUserRecord (const QString& field, const QVariant& value)
 {
     // look up the user id, password hash and salt
-    QSqlQuery query;
-    query.prepare(
+    PreparedQuery query = DatabaseThread::prepare(
         "select ID, SESSION_TOKEN, NAME, AVATAR, CREATED, LAST_ONLINE, PASSWORD_SALT, "
         "PASSWORD_HASH, DATE_OF_BIRTH, EMAIL, FLAGS, LAST_ZONE_ID, LAST_SCENE_ID from "
         "USERS where " + field + " = ?");
@@ -237,7 +339,7 @@ static QByteArray hashPassword (const QString& password, const QByteArray& salt)
 void UserRepository::validateLogon (
     const UserRecord& orec, const QString& name, const QString& password, const Callback& callback)
 {
-    UserRecord nrec = loadUserRecord("NAME_LOWER", name.toLower());
+    UserRecord nrec = cachedUser(name.toLower());
     if (nrec.id == 0) {
         // no such user
         callback.invoke(Q_ARG(const QVariant&, QVariant(NoSuchUser)));
@@ -263,50 +365,53 @@ void UserRepository::validateLogon (
 
 void UserRepository::loadUser (const QString& name, const Callback& callback)
 {
-    callback.invoke(Q_ARG(const UserRecord&, loadUserRecord("NAME_LOWER", name.toLower())));
+    callback.invoke(Q_ARG(const UserRecord&, cachedUser(name.toLower())));
 }
 
 void UserRepository::loadUserByEmail (const QString& email, const Callback& callback)
 {
-    callback.invoke(Q_ARG(const UserRecord&, loadUserRecord("EMAIL", email.toLower())));
+    UserCache& cache = _app->databasePool()->userCache();
+    quint64 generation = cache.generation();
+    UserRecord urec = loadUserRecord("EMAIL", email.toLower());
+    if (urec.id != 0) {
+        cache.put(urec, generation);
+    }
+    callback.invoke(Q_ARG(const UserRecord&, urec));
 }
 
 void UserRepository::updateUser (const UserRecord& urec, const Callback& callback)
 {
     // check the name against our block list
     QString nameLower = urec.name.toLower();
-    if (nameLower.contains(_blockedNameExp)) {
+    if (_blockedNames.matches(nameLower)) {
         callback.invoke(Q_ARG(bool, false));
         return;
     }
 
-    QSqlQuery query;
-    query.prepare("update USERS set NAME = ?, NAME_LOWER = ?, AVATAR = ?, PASSWORD_HASH = ?, "
-        "DATE_OF_BIRTH = ?, EMAIL = ?, FLAGS = ? where ID = ?");
-    query.addBindValue(urec.name);
-    query.addBindValue(nameLower);
-    query.addBindValue(urec.avatar.unicode());
-    query.addBindValue(urec.passwordHash);
-    query.addBindValue(urec.dateOfBirth);
-    query.addBindValue(urec.email.toLower());
-    query.addBindValue((int)urec.flags);
-    query.addBindValue(urec.id);
+    bool success = storeUser(urec);
+    if (success) {
+        _app->databasePool()->nameIndex().insert(nameLower);
 
-    callback.invoke(Q_ARG(bool, query.exec()));
+        // the caller's record may not be current in every field, so rather than caching it, we
+        // force the next lookup to go to the database
+        uncacheUser(urec.id);
+    }
+    callback.invoke(Q_ARG(bool, success));
 }
 
 void UserRepository::deleteUser (quint64 id)
 {
-    QSqlQuery query;
-    query.prepare("delete from USERS where ID = ?");
+    PreparedQuery query = DatabaseThread::prepare("delete from USERS where ID = ?");
     query.addBindValue(id);
     query.exec();
+
+    uncacheUser(id);
 }
 
 void UserRepository::insertPasswordReset (quint64 userId, const Callback& callback)
 {
-    QSqlQuery query;
-    query.prepare("insert into PASSWORD_RESETS (TOKEN, USER_ID, CREATED) values (?, ?, ?)");
+    PreparedQuery query = DatabaseThread::prepare(
+        "insert into PASSWORD_RESETS (TOKEN, USER_ID, CREATED) values (?, ?, ?)");
     QByteArray token = generateToken(16);
     query.addBindValue(token);
     query.addBindValue(userId);
@@ -321,8 +426,8 @@ void UserRepository::insertPasswordReset (quint64 userId, const Callback& callba
 void UserRepository::validatePasswordReset (
     const UserRecord& orec, quint32 id, const QByteArray& token, const Callback& callback)
 {
-    QSqlQuery query;
-    query.prepare("select USER_ID from PASSWORD_RESETS where ID = ? and TOKEN = ?");
+    PreparedQuery query = DatabaseThread::prepare(
+        "select USER_ID from PASSWORD_RESETS where ID = ? and TOKEN = ?");
     query.addBindValue(id);
     query.addBindValue(token);
     query.exec();
@@ -335,13 +440,13 @@ void UserRepository::validatePasswordReset (
     quint64 userId = query.value(0).toULongLong();
 
     // if successful, delete it, making sure that no one beat us to the punch
-    UserRecord nrec = loadUserRecord("ID", userId);
+    UserRecord nrec = cachedUser(userId);
     LogonError error = validateLogon(nrec);
     if (error != NoError) {
         callback.invoke(Q_ARG(const QVariant&, QVariant(error)));
         return;
     }
-    query.prepare("delete from PASSWORD_RESETS where ID = ?");
+    query = DatabaseThread::prepare("delete from PASSWORD_RESETS where ID = ?");
     query.addBindValue(id);
     query.exec();
     if (query.numRowsAffected() == 0) {
@@ -371,14 +476,43 @@ void UserRepository::insertInvites (const QStringList& descriptions, int flags,
 
 void UserRepository::validateInvite (quint32 id, const QByteArray& token, const Callback& callback)
 {
-    QSqlQuery query;
-    query.prepare("select count(*) from INVITES where ID = ? and TOKEN = ? and REDEEMED < TOTAL");
+    PreparedQuery query = DatabaseThread::prepare(
+        "select count(*) from INVITES where ID = ? and TOKEN = ? and REDEEMED < TOTAL");
+    query.addBindValue(id);
+    query.addBindValue(token);
     query.exec();
     query.next();
     
     callback.invoke(Q_ARG(bool, query.value(0).toUInt() > 0));
 }
 
+void UserRepository::flushUsers ()
+{
+    QHash<quint64, QDateTime> lastOnline = _app->databasePool()->userCache().takeLastOnline();
+    if (lastOnline.isEmpty()) {
+        return;
+    }
+    QVariantList times, ids;
+    for (QHash<quint64, QDateTime>::const_iterator it = lastOnline.constBegin(),
+            end = lastOnline.constEnd(); it != end; it++) {
+        times.append(it.value());
+        ids.append(it.key());
+    }
+
+    // write them all in one transaction
+    QSqlDatabase database = DatabaseThread::connection();
+    database.transaction();
+    PreparedQuery query = DatabaseThread::prepare(
+        "update USERS set LAST_ONLINE = ? where ID = ?");
+    query.addBindValue(times);
+    query.addBindValue(ids);
+    query.execBatch();
+    if (!database.commit()) {
+        qWarning() << "Failed to flush last online times:" << database.lastError();
+        database.rollback();
+    }
+}
+
 void UserRepository::reportBootstrapInvite (const QString& url)
 {
     qDebug() << "Bootstrap admin invite created." << url;
@@ -386,7 +520,8 @@ void UserRepository::reportBootstrapInvite (const QString& url)
 
 QString UserRepository::uniqueRandomName () const
 {
-    QSqlQuery query;
+    const NameIndex& index = _app->databasePool()->nameIndex();
+    PreparedQuery query;
 
     for (int ii = 0;; ii++) {
         // generate a list of possible names
@@ -398,14 +533,30 @@ QString UserRepository::uniqueRandomName () const
                 name.insert(qrand() % (name.length() + 1), QString::number(ii));
             }
             // make sure it isn't in the blocked name list
-            if (!name.contains(_blockedNameExp)) {
-                names.append(name);
+            if (_blockedNames.matches(name)) {
+                continue;
+            }
+            // if the index is loaded and doesn't have it, it's definitely free
+            if (index.isLoaded() && !index.mayContain(name)) {
+                return name;
             }
+            names.append(name);
         }
 
-        // remove names used by users
-        query.prepare("select NAME_LOWER from USERS where NAME_LOWER in ?");
-        query.addBindValue(names);
+        // the index can give false positives (and knows nothing until loaded), so check the rest
+        // against the database
+        if (names.isEmpty()) {
+            continue;
+        }
+        QStringList placeholders;
+        for (int jj = 0; jj < names.size(); jj++) {
+            placeholders.append("?");
+        }
+        query = DatabaseThread::prepare("select NAME_LOWER from USERS where NAME_LOWER in (" +
+            placeholders.join(", ") + ")");
+        foreach (const QString& name, names) {
+            query.addBindValue(name);
+        }
         query.exec();
         while (query.next()) {
             names.removeAll(query.value(0).toString());
@@ -419,11 +570,11 @@ QString UserRepository::uniqueRandomName () const
 
 QString UserRepository::randomName () const
 {
-    int length = MinNameLength + randomIndex(_nameLengths);
+    int length = MinNameLength + _nameLengths.sample();
     QString name(length, ' ');
     int last = 0;
     for (int ii = 0; ii < length; ii++) {
-        last = randomIndex(_nameChain[last]);
+        last = _nameChain[last].sample();
         name[ii] = 'a' + (last - 1);
     }
     return name;
@@ -442,7 +593,7 @@ UserRepository::LogonError UserRepository::validateLogon (const UserRecord& urec
     }    
     
     // make sure they're allowed on at present
-    RuntimeConfig::LogonPolicy policy = _app->databaseThread()->runtimeConfig()->logonPolicy();
+    RuntimeConfig::LogonPolicy policy = _app->runtimeConfig()->logonPolicy();
     if (policy == RuntimeConfig::AdminsOnly && !urec.flags.testFlag(UserRecord::Admin) ||
            policy == RuntimeConfig::InsidersOnly && !urec.insiderPlus()) {
         return ServerClosed;
@@ -454,26 +605,62 @@ UserRepository::LogonError UserRepository::validateLogon (const UserRecord& urec
 
 void UserRepository::logon (const UserRecord& orec, UserRecord& nrec, const Callback& callback)
 {
-    // update the session token and last online timestamp
-    QSqlQuery query;
-    query.prepare("update USERS set SESSION_TOKEN = ?, LAST_ONLINE = ? where ID = ?");
+    // update the session token; the last online timestamp will be written with the next flush
+    PreparedQuery query = DatabaseThread::prepare(
+        "update USERS set SESSION_TOKEN = ? where ID = ?");
     query.addBindValue(nrec.sessionToken = generateToken(16));
-    query.addBindValue(nrec.lastOnline = QDateTime::currentDateTime());
     query.addBindValue(nrec.id);
     query.exec();
 
-    // if the old record has no password, delete it
-    if (!orec.loggedOn()) {
+    // the old token must no longer be accepted anywhere
+    UserCache& cache = _app->databasePool()->userCache();
+    uncacheUser(nrec.id);
+    cache.setLastOnline(nrec.id, nrec.lastOnline = QDateTime::currentDateTime());
+    cache.put(nrec);
+
+    // if the old record has no password, delete it (unless it was never stored)
+    if (!orec.loggedOn() && !orec.transient()) {
         deleteUser(orec.id);
     }
 
     callback.invoke(Q_ARG(const QVariant&, QVariant::fromValue(nrec)));
 }
 
+UserRecord UserRepository::cachedUser (quint64 id)
+{
+    // if a record is removed while we load, ours may predate the change that removed it
+    UserCache& cache = _app->databasePool()->userCache();
+    quint64 generation = cache.generation();
+    UserRecord urec;
+    if (!cache.get(id, urec) && (urec = loadUserRecord("ID", id)).id != 0) {
+        cache.put(urec, generation);
+    }
+    return urec;
+}
+
+UserRecord UserRepository::cachedUser (const QString& nameLower)
+{
+    UserCache& cache = _app->databasePool()->userCache();
+    quint64 generation = cache.generation();
+    UserRecord urec;
+    if (!cache.getByName(nameLower, urec) &&
+            (urec = loadUserRecord("NAME_LOWER", nameLower)).id != 0) {
+        cache.put(urec, generation);
+    }
+    return urec;
+}
+
+void UserRepository::uncacheUser (quint64 id)
+{
+    _app->databasePool()->userCache().remove(id);
+    _app->peerManager()->invokeOthers(_app->connectionManager(), "uncacheUser(quint64)",
+        Q_ARG(quint64, id));
+}
+
 QString UserRepository::insertInvite (const QString& description, int flags, int count)
 {
-    QSqlQuery query;
-    query.prepare("insert into INVITES (TOKEN, DESCRIPTION, FLAGS, TOTAL, CREATED) "
+    PreparedQuery query = DatabaseThread::prepare(
+        "insert into INVITES (TOKEN, DESCRIPTION, FLAGS, TOTAL, CREATED) "
         "values (?, ?, ?, ?, ?)");
     QByteArray token = generateToken(16);
     query.addBindValue(token);
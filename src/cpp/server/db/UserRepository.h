@@ -8,11 +8,12 @@
 #include <QDate>
 #include <QDateTime>
 #include <QMetaType>
-#include <QObject>
-#include <QRegExp>
 #include <QString>
 
+#include "db/Repository.h"
+#include "util/General.h"
 #include "util/Streaming.h"
+#include "util/StringMatcher.h"
 
 class Callback;
 class ServerApp;
@@ -21,7 +22,7 @@ class UserRecord;
 /**
  * Handles database queries associated with users.
  */
-class UserRepository : public QObject
+class UserRepository : public Repository
 {
     Q_OBJECT
 
@@ -44,18 +45,38 @@ public:
      * Validates the specified session token.
      *
      * @param callback the callback that will be invoked with the {@link UserRecord} of the user
-     * associated with the session.
+     * associated with the session, or with a record whose id is zero if the token is invalid.
      */
     Q_INVOKABLE void validateSessionToken (
         quint64 userId, const QByteArray& token, const Callback& callback);
 
     /**
-     * Creates a new, passwordless user.
+     * Creates a transient, passwordless guest user that exists only in memory until inserted.
+     * This doesn't access the database, and may be called from any thread.  The name is checked
+     * against the index of stored names, so until the index has loaded, callers must check it
+     * against the database.
      *
-     * @param callback the callback that will be invoked with the new {@link UserRecord} of the
-     * user associated with the session.
+     * @param attempt the number of previous attempts to find an unused name, which determines
+     * whether digits are added to the name.
      */
-    Q_INVOKABLE void createUser (const Callback& callback);
+    UserRecord createGuest (int attempt) const;
+
+    /**
+     * Checks whether a stored user has the specified name.  The callback will receive a bool
+     * indicating whether the name is taken.
+     */
+    Q_INVOKABLE void isNameTaken (const QString& name, const Callback& callback);
+
+    /**
+     * Inserts a transient user into the database.
+     *
+     * @param renameIfTaken if true and the user's name is taken, a unique random name will be
+     * chosen instead.  Otherwise, the insertion will fail.
+     * @param callback the callback that will be invoked with the inserted {@link UserRecord}, or
+     * with a record whose id is zero if the insertion failed.
+     */
+    Q_INVOKABLE void insertUser (
+        const UserRecord& urec, bool renameIfTaken, const Callback& callback);
 
     /**
      * Attempts to validate a user logon.
@@ -125,6 +146,11 @@ public:
     Q_INVOKABLE void validateInvite (
         quint32 id, const QByteArray& token, const Callback& callback);
 
+    /**
+     * Writes the pending last online times to the database in a single batch.
+     */
+    Q_INVOKABLE void flushUsers ();
+
 protected:
 
     /**
@@ -133,7 +159,8 @@ protected:
     Q_INVOKABLE void reportBootstrapInvite (const QString& url);
 
     /**
-     * Generates a random name that isn't used by any session/user.
+     * Generates a random name that isn't used by any stored user.  The name index rules out most
+     * candidates without consulting the database.
      */
     QString uniqueRandomName () const;
 
@@ -142,6 +169,22 @@ protected:
      */
     QString randomName () const;
 
+    /**
+     * Returns the identified user's record from the cache, loading and caching it if necessary.
+     */
+    UserRecord cachedUser (quint64 id);
+
+    /**
+     * Returns the named user's record from the cache, loading and caching it if necessary.
+     */
+    UserRecord cachedUser (const QString& nameLower);
+
+    /**
+     * Removes a user's record from the caches of this and all other peers, after a change that
+     * the cached records don't reflect.
+     */
+    void uncacheUser (quint64 id);
+
     /**
      * Helper function for logon methods; determines whether the described user can log on.
      */
@@ -165,17 +208,17 @@ protected:
     /** The minimum and maximum random name lengths. */
     static const int MinNameLength = 4, MaxNameLength = 12;
 
-    /** Probabilities for each name length. */
-    double _nameLengths[MaxNameLength - MinNameLength + 1];
+    /** Samples the name lengths. */
+    AliasTable _nameLengths;
 
     /** The number of states in the name chain (letters plus start/end). */
     static const int NameChainStates = 26 + 1;
 
-    /** The Markov chain for random name letters. */
-    double _nameChain[NameChainStates][NameChainStates];
+    /** Samples the Markov chain for random name letters, one table per preceding state. */
+    AliasTable _nameChain[NameChainStates];
 
-    /** The expression that matches blocked names. */
-    QRegExp _blockedNameExp;
+    /** Matches blocked names. */
+    StringMatcher _blockedNames;
 };
 
 /**
@@ -192,6 +235,9 @@ public:
 
     Q_DECLARE_FLAGS(Flags, Flag)
 
+    /** Set in the ids of transient users, which have yet to be inserted into the database. */
+    static const quint64 TransientIdFlag = Q_UINT64_C(0x8000000000000000);
+
     /** The user id. */
     STREAM quint64 id;
 
@@ -241,6 +287,11 @@ public:
      */
     bool loggedOn () const { return !passwordHash.isEmpty(); }
 
+    /**
+     * Checks whether the user exists only in memory.
+     */
+    bool transient () const { return id & TransientIdFlag; }
+
     /**
      * Checks whether the user is at least an insider.
      */
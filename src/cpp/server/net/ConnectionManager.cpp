@@ -10,7 +10,7 @@
 
 #include "ServerApp.h"
 #include "chat/ChatWindow.h"
-#include "db/DatabaseThread.h"
+#include "db/DatabasePool.h"
 #include "db/UserRepository.h"
 #include "http/HttpConnection.h"
 #include "net/ConnectionManager.h"
@@ -25,6 +25,9 @@ ConnectionManager::ConnectionManager (ServerApp* app) :
     _geoIp(GeoIP_open(app->config().value("geoip_db").toByteArray().constData(), GEOIP_STANDARD)),
     _this(this)
 {
+    // seed the random number generator for this thread, which generates guests
+    qsrand(currentTimeMillis());
+
     // read the private RSA key
     FILE* keyFile = fopen(app->config().value("private_key").toByteArray().constData(), "r");
     if (keyFile == 0) {
@@ -88,8 +91,14 @@ void ConnectionManager::connectionEstablished (Connection* connection)
         return;
     }
 
-    // otherwise, go to the database to validate the token or generate a new one
-    QMetaObject::invokeMethod(_app->databaseThread()->userRepository(), "validateSessionToken",
+    // guests exist only in memory, so if the session is gone, so is the guest
+    if (userId & UserRecord::TransientIdFlag) {
+        tokenValidated(connection->pointer(), NoUser);
+        return;
+    }
+
+    // otherwise, go to the database to validate the token
+    _app->databasePool()->userRepository(userId)->invoke("validateSessionToken",
         Q_ARG(quint64, userId), Q_ARG(const QByteArray&, sessionToken),
         Q_ARG(const Callback&, Callback(_this,
             "tokenValidated(SharedConnectionPointer,UserRecord)",
@@ -100,12 +109,21 @@ void ConnectionManager::transferSession (const SessionTransfer& transfer)
 {
     qDebug() << "Session transferred." << transfer.user.name;
 
+    // the transferred record is the freshest we have
+    UserRecord user = transfer.user;
+    _app->databasePool()->userCache().put(user);
+
     // create and map the session
     Session* session = new Session(_app, SharedConnectionPointer(), transfer.user, transfer);
     _sessions.insert(transfer.user.id, session);
     _names.insert(transfer.user.name.toLower(), session);
 }
 
+void ConnectionManager::uncacheUser (quint64 id)
+{
+    _app->databasePool()->userCache().remove(id);
+}
+
 void ConnectionManager::broadcast (const QString& speaker, const QString& message)
 {
     foreach (Session* session, _sessions) {
@@ -152,6 +170,11 @@ void ConnectionManager::summon (
     }
 }
 
+void ConnectionManager::createGuest (const Callback& callback)
+{
+    generateGuest(callback);
+}
+
 void ConnectionManager::sessionChanged (
     quint64 oldId, quint64 newId, const QString& oldName, const QString& newName)
 {
@@ -195,27 +218,73 @@ void ConnectionManager::connectionMaybeSet (const SharedConnectionPointer& connp
         return;
     }
 
-    // create a new user
-    QMetaObject::invokeMethod(_app->databaseThread()->userRepository(), "createUser",
-        Q_ARG(const Callback&, Callback(_this,
-            "tokenValidated(SharedConnectionPointer,UserRecord)",
-            Q_ARG(const SharedConnectionPointer&, connptr))));
+    // create a new guest
+    tokenValidated(connptr, NoUser);
 }
 
 void ConnectionManager::tokenValidated (
-    const SharedConnectionPointer& connptr, const UserRecord& user)
+    const SharedConnectionPointer& connptr, const UserRecord& urec)
 {
     // make sure the connection is still in business
     if (!connptr->isOpen()) {
         return;
     }
 
+    // if the token was invalid, create a new guest and come back with it
+    if (urec.id == 0) {
+        generateGuest(Callback(_this, "tokenValidated(SharedConnectionPointer,UserRecord)",
+            Q_ARG(const SharedConnectionPointer&, connptr)));
+        return;
+    }
+
     // set the user id and token cookies
-    connptr->setCookie("userId", QString::number(user.id, 16).rightJustified(16, '0'));
-    connptr->setCookie("sessionToken", user.sessionToken.toHex());
+    connptr->setCookie("userId", QString::number(urec.id, 16).rightJustified(16, '0'));
+    connptr->setCookie("sessionToken", urec.sessionToken.toHex());
 
     // create and map the session
-    Session* session = new Session(_app, connptr, user, SessionTransfer());
-    _sessions.insert(user.id, session);
-    _names.insert(user.name.toLower(), session);
+    Session* session = new Session(_app, connptr, urec, SessionTransfer());
+    _sessions.insert(urec.id, session);
+    _names.insert(urec.name.toLower(), session);
+}
+
+void ConnectionManager::guestNameChecked (
+    const Callback& callback, int attempt, const UserRecord& urec, bool taken)
+{
+    // a session may also have taken the name while we were checking
+    if (taken || isNameInUse(urec.name.toLower())) {
+        generateGuest(callback, attempt + 1);
+    } else {
+        callback.invoke(Q_ARG(const UserRecord&, urec));
+    }
+}
+
+void ConnectionManager::generateGuest (const Callback& callback, int attempt)
+{
+    // keep generating until we find an id and name that no session is using
+    UserRepository* repository = _app->databasePool()->userRepository();
+    for (;; attempt++) {
+        UserRecord urec = repository->createGuest(attempt);
+        if (_app->peerManager()->sessions().contains(urec.id) ||
+                isNameInUse(urec.name.toLower())) {
+            continue;
+        }
+        // the guest's name avoids those in the index of stored names, but until the index has
+        // loaded, only the database can say whether a user has it
+        if (!_app->databasePool()->nameIndex().isLoaded()) {
+            repository->invoke("isNameTaken", Q_ARG(const QString&, urec.name),
+                Q_ARG(const Callback&, Callback(_this,
+                    "guestNameChecked(Callback,int,UserRecord,bool)",
+                    Q_ARG(const Callback&, callback), Q_ARG(int, attempt),
+                    Q_ARG(const UserRecord&, urec))));
+            return;
+        }
+        callback.invoke(Q_ARG(const UserRecord&, urec));
+        return;
+    }
+}
+
+bool ConnectionManager::isNameInUse (const QString& nameLower) const
+{
+    return _names.contains(nameLower) ||
+        _app->peerManager()->sessionsByName().contains(nameLower);
 }
@@ -66,6 +66,11 @@ public:
      */
     Q_INVOKABLE void transferSession (const SessionTransfer& transfer);
 
+    /**
+     * Removes a user's record from this peer's cache, having been changed on another peer.
+     */
+    Q_INVOKABLE void uncacheUser (quint64 id);
+
     /**
      * Broadcasts a message to all online users.
      */
@@ -91,6 +96,12 @@ public:
     Q_INVOKABLE void summon (
         const QString& name, const QString& summoner, const Callback& callback);
 
+    /**
+     * Creates a transient guest user with an id and name not used by any session or stored user.
+     * The callback will receive the {@link UserRecord}.
+     */
+    Q_INVOKABLE void createGuest (const Callback& callback);
+
     /**
      * Notifies the manager that a session's id and/or name has changed.
      */
@@ -128,6 +139,25 @@ protected:
     Q_INVOKABLE void tokenValidated (
         const SharedConnectionPointer& connptr, const UserRecord& user);
 
+    /**
+     * Continues generating a guest once the database has reported whether its name is taken.
+     */
+    Q_INVOKABLE void guestNameChecked (
+        const Callback& callback, int attempt, const UserRecord& urec, bool taken);
+
+    /**
+     * Generates a transient guest user with an id and name not used by any session or stored
+     * user, passing it to the callback.
+     *
+     * @param attempt the number of previous attempts to find an unused name.
+     */
+    void generateGuest (const Callback& callback, int attempt = 0);
+
+    /**
+     * Checks whether a session on any peer is using the specified (lowercase) name.
+     */
+    bool isNameInUse (const QString& nameLower) const;
+
     /** The server application. */
     ServerApp* _app;
 
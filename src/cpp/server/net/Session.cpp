@@ -3,6 +3,7 @@
 
 #include <limits>
 
+#include <QDateTime>
 #include <QEvent>
 #include <QKeyEvent>
 #include <QMouseEvent>
@@ -19,7 +20,8 @@
 #include "SettingsDialog.h"
 #include "actor/Pawn.h"
 #include "db/ActorRepository.h"
-#include "db/DatabaseThread.h"
+#include "db/DatabasePool.h"
+#include "db/ResourceIndex.h"
 #include "db/SceneRepository.h"
 #include "net/ConnectionManager.h"
 #include "net/Session.h"
@@ -44,6 +46,12 @@ int sessionPointerType = qRegisterMetaType<Session*>("Session*");
 /** The time to allow a disconnected session to linger before closing it. */
 static const int DisconnectTimeout = 5 * 60 * 1000;
 
+/** The time for which to use a prefetched place, short of the instance's reservation timeout. */
+static const quint64 PrefetchedPlaceLifetime = 4000;
+
+/** The number of times we try to store a guest before giving up. */
+static const int MaxUserInsertAttempts = 3;
+
 Session::Session (ServerApp* app, const SharedConnectionPointer& connection,
         const UserRecord& user, const SessionTransfer& transfer) :
     CallableObject(app->connectionManager()),
@@ -59,7 +67,13 @@ Session::Session (ServerApp* app, const SharedConnectionPointer& connection,
     _user(user),
     _instance(0),
     _scene(0),
-    _pawn(0)
+    _pawn(0),
+    _prefetchZoneId(0),
+    _prefetchPending(false),
+    _prefetchInstanceId(0),
+    _prefetchTime(0),
+    _prefetchMoveWaiting(false),
+    _prefetchMoveSceneId(0)
 {
     // add info on all peers
     const QString& peer = _app->peerManager()->record().name;
@@ -320,17 +334,15 @@ void Session::loggedOn (const UserRecord& user, bool stayLoggedIn)
 
 void Session::logoff ()
 {
-    // request a new, anonymous user from the repository
-    QMetaObject::invokeMethod(_app->databaseThread()->userRepository(), "createUser",
+    // request a new guest from the connection manager
+    QMetaObject::invokeMethod(_app->connectionManager(), "createGuest",
         Q_ARG(const Callback&, Callback(_this, "loggedOff(UserRecord)")));
 }
 
 void Session::moveToScene (const QString& prefix)
 {
-    // look up the prefix in the database
-    QMetaObject::invokeMethod(_app->databaseThread()->sceneRepository(), "findScenes",
-        Q_ARG(const QString&, prefix), Q_ARG(quint32, 0), Q_ARG(const Callback&,
-            Callback(_this, "continueMovingToScene(ResourceDescriptorList)")));
+    // look up the prefix in the index
+    continueMovingToScene(_app->databasePool()->sceneIndex().find(prefix));
 }
 
 void Session::moveToScene (quint32 id, const QVariant& portal)
@@ -346,10 +358,8 @@ void Session::moveToScene (quint32 id, const QVariant& portal)
 
 void Session::moveToZone (const QString& prefix)
 {
-    // look up the prefix in the database
-    QMetaObject::invokeMethod(_app->databaseThread()->sceneRepository(), "findZones",
-        Q_ARG(const QString&, prefix), Q_ARG(quint32, 0), Q_ARG(const Callback&,
-            Callback(_this, "continueMovingToZone(ResourceDescriptorList)")));
+    // look up the prefix in the index
+    continueMovingToZone(_app->databasePool()->zoneIndex().find(prefix));
 }
 
 void Session::moveToZone (quint32 id, quint32 sceneId, const QVariant& portal)
@@ -360,6 +370,22 @@ void Session::moveToZone (quint32 id, quint32 sceneId, const QVariant& portal)
         return;
     }
 
+    // use the place reserved by the prefetcher, if any, waiting for it if it's still pending
+    if (_prefetchZoneId == id) {
+        if (_prefetchPending) {
+            _prefetchMoveWaiting = true;
+            _prefetchMoveSceneId = sceneId;
+            _prefetchMovePortal = portal;
+            return;
+        }
+        if (currentTimeMillis() - _prefetchTime < PrefetchedPlaceLifetime) {
+            _prefetchZoneId = 0;
+            continueMovingToZone(sceneId, portal, _prefetchPeer, _prefetchInstanceId);
+            return;
+        }
+    }
+    cancelPrefetchedPlace();
+
     // reserve a place in an instance
     QMetaObject::invokeMethod(_app->peerManager(), "reserveInstancePlace",
         Q_ARG(quint64, _user.id), Q_ARG(const QString&, _region), Q_ARG(quint32, id),
@@ -384,6 +410,37 @@ void Session::moveToInstance (quint64 id, quint32 sceneId, const QVariant& porta
             Q_ARG(quint32, sceneId), Q_ARG(const QVariant&, portal))));
 }
 
+void Session::moveThroughPortal (quint32 zoneId, quint32 sceneId, const QPoint& position)
+{
+    if (_instance == 0) {
+        return;
+    }
+    if (zoneId == 0 || zoneId == _instance->record().id) {
+        moveToScene(sceneId == 0 ? _instance->record().defaultSceneId : sceneId, position);
+    } else {
+        moveToZone(zoneId, sceneId, position);
+    }
+}
+
+void Session::prefetchZone (quint32 id, quint32 sceneId, const Callback& callback)
+{
+    // one request at a time; there's nothing to do if we already hold a place in the zone
+    if (_prefetchPending || (_prefetchZoneId == id &&
+            currentTimeMillis() - _prefetchTime < PrefetchedPlaceLifetime)) {
+        callback.invoke();
+        return;
+    }
+    cancelPrefetchedPlace();
+    _prefetchZoneId = id;
+    _prefetchPending = true;
+
+    QMetaObject::invokeMethod(_app->peerManager(), "reserveInstancePlace",
+        Q_ARG(quint64, _user.id), Q_ARG(const QString&, _region), Q_ARG(quint32, id),
+        Q_ARG(const Callback&, Callback(_this,
+            "placePrefetched(quint32,Callback,QString,quint64)",
+            Q_ARG(quint32, sceneId), Q_ARG(const Callback&, callback))));
+}
+
 void Session::moveToPlayer (const QString& name)
 {
     QMetaObject::invokeMethod(_app->peerManager(), "getSessionInfo", Q_ARG(const QString&, name),
@@ -402,7 +459,7 @@ void Session::summonPlayer (const QString& name)
 void Session::spawnActor (const QString& prefix)
 {
     // look up the prefix in the database
-    QMetaObject::invokeMethod(_app->databaseThread()->actorRepository(), "findActors",
+    _app->databasePool()->actorRepository()->invoke("findActors",
         Q_ARG(const QString&, prefix), Q_ARG(quint32, 0), Q_ARG(const Callback&,
             Callback(_this, "continueSpawningActor(ResourceDescriptorList)")));
 }
@@ -422,7 +479,13 @@ void Session::setSettings (const QString& password, const QString& email, QChar
     _user.setPassword(password);
     _user.email = email;
     _user.avatar = avatar;
-    QMetaObject::invokeMethod(_app->databaseThread()->userRepository(), "updateUser",
+
+    // guests are stored along with their first settings
+    if (_user.transient()) {
+        insertUser(Callback());
+        return;
+    }
+    _app->databasePool()->userRepository(_user.id)->invoke("updateUser",
         Q_ARG(const UserRecord&, _user), Q_ARG(const Callback&, Callback()));
 }
 
@@ -547,16 +610,28 @@ void Session::showGoToSceneDialog ()
 
 void Session::createScene ()
 {
+    // guests must be stored before they can own anything
+    if (_user.transient()) {
+        insertUser(Callback(_this, "createScene()"));
+        return;
+    }
+
     // insert the scene into the database
-    QMetaObject::invokeMethod(_app->databaseThread()->sceneRepository(), "insertScene",
+    _app->databasePool()->sceneRepository(DatabasePool::Interactive)->invoke("insertScene",
         Q_ARG(const QString&, tr("Untitled Scene")), Q_ARG(quint64, _user.id),
         Q_ARG(const Callback&, Callback(_this, "sceneCreated(quint32)")));
 }
 
 void Session::createZone ()
 {
+    // guests must be stored before they can own anything
+    if (_user.transient()) {
+        insertUser(Callback(_this, "createZone()"));
+        return;
+    }
+
     // insert the zone into the database
-    QMetaObject::invokeMethod(_app->databaseThread()->sceneRepository(), "insertZone",
+    _app->databasePool()->sceneRepository(DatabasePool::Interactive)->invoke("insertZone",
         Q_ARG(const QString&, tr("Untitled Zone")), Q_ARG(quint64, _user.id),
         Q_ARG(const Callback&, Callback(_this, "zoneCreated(quint32)")));
 }
@@ -772,8 +847,8 @@ void Session::setConnection (const SharedConnectionPointer& connection)
     quint32 resetId = conn->query().value("resetId", "0").toUInt();
     if (resetId != 0) {
         QByteArray token = QByteArray::fromHex(conn->query().value("resetToken", "").toAscii());
-        QMetaObject::invokeMethod(_app->databaseThread()->userRepository(),
-            "validatePasswordReset", Q_ARG(const UserRecord&, _user), Q_ARG(quint32, resetId),
+        _app->databasePool()->userRepository()->invoke("validatePasswordReset",
+            Q_ARG(const UserRecord&, _user), Q_ARG(quint32, resetId),
             Q_ARG(const QByteArray&, token), Q_ARG(const Callback&, Callback(
                 _this, "passwordResetMaybeValidated(QVariant)")));
     }
@@ -782,8 +857,8 @@ void Session::setConnection (const SharedConnectionPointer& connection)
     quint32 inviteId = conn->query().value("inviteId", "0").toUInt();
     if (inviteId != 0) {
         QByteArray token = QByteArray::fromHex(conn->query().value("inviteToken", "").toAscii());
-        QMetaObject::invokeMethod(_app->databaseThread()->userRepository(),
-            "validateInvite", Q_ARG(quint32, inviteId), Q_ARG(const QByteArray&, token),
+        _app->databasePool()->userRepository()->invoke("validateInvite",
+            Q_ARG(quint32, inviteId), Q_ARG(const QByteArray&, token),
             Q_ARG(const Callback&, Callback(_this, "inviteMaybeValidated(quint32,bool)",
                 Q_ARG(quint32, inviteId))));
     }
@@ -814,6 +889,12 @@ void Session::sceneCreated (quint32 id)
 {
     qDebug() << "Created scene." << _user.name << id;
 
+    // add it to the name index on all peers
+    QMetaObject::invokeMethod(_app->sceneManager(), "broadcastSceneInserted",
+        Q_ARG(quint32, id), Q_ARG(const QString&, tr("Untitled Scene")),
+        Q_ARG(quint64, _user.id), Q_ARG(const QString&, _user.name),
+        Q_ARG(const QDateTime&, QDateTime::currentDateTime()));
+
     moveToScene(id);
 }
 
@@ -821,6 +902,12 @@ void Session::zoneCreated (quint32 id)
 {
     qDebug() << "Created zone." << _user.name << id;
 
+    // add it to the name index on all peers
+    QMetaObject::invokeMethod(_app->sceneManager(), "broadcastZoneInserted",
+        Q_ARG(quint32, id), Q_ARG(const QString&, tr("Untitled Zone")),
+        Q_ARG(quint64, _user.id), Q_ARG(const QString&, _user.name),
+        Q_ARG(const QDateTime&, QDateTime::currentDateTime()));
+
     moveToZone(id);
 }
 
@@ -840,7 +927,8 @@ void Session::sceneMaybeResolved (const QVariant& portal, QObject* scene)
         showInfoDialog(tr("Failed to resolve scene."));
         return;
     }
-    // enter the scene
+    // leave the old scene and enter the new one
+    leaveScene();
     _scene = static_cast<Scene*>(scene);
     _mainWindow->connect(_scene, SIGNAL(recordChanged(SceneRecord)), SLOT(updateTitle()));
     _pawn = _scene->addSession(this, portal);
@@ -908,6 +996,9 @@ void Session::continueMovingToZone (
         transfer.chatCommandHistory = _chatEntryWindow->history();
         _app->peerManager()->invoke(peer, _app->connectionManager(),
             "transferSession(SessionTransfer)", Q_ARG(const SessionTransfer&, transfer));
+
+        // the user's record will be changed on the other peer from now on
+        _app->databasePool()->userCache().remove(_user.id);
         return;
     }
     // move the session to the instance thread
@@ -921,6 +1012,48 @@ void Session::continueMovingToZone (
         Q_ARG(quint32, sceneId), Q_ARG(const QVariant&, portal));
 }
 
+void Session::placePrefetched (
+    quint32 sceneId, const Callback& callback, const QString& peer, quint64 instanceId)
+{
+    _prefetchPending = false;
+    callback.invoke();
+
+    // release the place if we abandoned it while it was being reserved
+    if (_prefetchZoneId == 0) {
+        _app->peerManager()->invoke(peer, _app->sceneManager(),
+            "cancelInstancePlaceReservation(quint64,quint64)",
+            Q_ARG(quint64, _user.id), Q_ARG(quint64, instanceId));
+        return;
+    }
+    _prefetchPeer = peer;
+    _prefetchInstanceId = instanceId;
+    _prefetchTime = currentTimeMillis();
+
+    // complete the move if one is waiting; otherwise, warm the scene in the instance
+    if (_prefetchMoveWaiting) {
+        _prefetchMoveWaiting = false;
+        _prefetchZoneId = 0;
+        continueMovingToZone(_prefetchMoveSceneId, _prefetchMovePortal, peer, instanceId);
+        return;
+    }
+    _app->peerManager()->invoke(peer, _app->sceneManager(), "prefetchScene(quint64,quint32)",
+        Q_ARG(quint64, instanceId), Q_ARG(quint32, sceneId));
+}
+
+void Session::cancelPrefetchedPlace ()
+{
+    if (_prefetchZoneId == 0) {
+        return;
+    }
+    if (!_prefetchPending) {
+        _app->peerManager()->invoke(_prefetchPeer, _app->sceneManager(),
+            "cancelInstancePlaceReservation(quint64,quint64)",
+            Q_ARG(quint64, _user.id), Q_ARG(quint64, _prefetchInstanceId));
+    }
+    _prefetchZoneId = 0;
+    _prefetchMoveWaiting = false;
+}
+
 void Session::continueSpawningActor (const ResourceDescriptorList& actors)
 {
     if (actors.isEmpty()) {
@@ -933,6 +1066,7 @@ void Session::continueSpawningActor (const ResourceDescriptorList& actors)
 
 void Session::leaveZone ()
 {
+    leaveScene();
     if (_instance != 0) {
         _instance->removeSession(this);
         _instance->disconnect(_mainWindow);
@@ -947,6 +1081,13 @@ void Session::leaveZone ()
 
 void Session::continueMovingToZone (QObject* instance, quint32 sceneId, const QVariant& portal)
 {
+    // the instance may have migrated to another thread in the meantime
+    if (instance->thread() != thread()) {
+        moveToThread(instance->thread());
+        QMetaObject::invokeMethod(this, "continueMovingToZone", Q_ARG(QObject*, instance),
+            Q_ARG(quint32, sceneId), Q_ARG(const QVariant&, portal));
+        return;
+    }
     _instance = static_cast<Instance*>(instance);
     _mainWindow->connect(_instance, SIGNAL(recordChanged(ZoneRecord)), SLOT(updateTitle()));
     _instance->addSession(this);
@@ -994,6 +1135,68 @@ void Session::loggedOff (const UserRecord& user)
     }
 }
 
+void Session::userInserted (const UserRecord& orec, int attempt, const UserRecord& nrec)
+{
+    // if we've become someone else in the meantime, the callbacks can proceed as them
+    if (_user.id != orec.id) {
+        invokeUserInsertCallbacks();
+        return;
+    }
+    if (nrec.id == 0) {
+        // another user may have taken the name at the same moment, in which case the retry will
+        // pick a new one
+        if (attempt + 1 < MaxUserInsertAttempts) {
+            requestUserInsert(attempt + 1);
+            return;
+        }
+        qWarning() << "Failed to store guest." << orec.id << orec.name;
+        _userInsertCallbacks.clear();
+        showInfoDialog(tr("Failed to store user.  Please try again later."));
+        return;
+    }
+    qDebug() << "Guest stored." << orec.id << nrec.id << nrec.name;
+    _user.id = nrec.id;
+    _user.name = nrec.name;
+
+    // store any settings changed in the meantime
+    if (_user.avatar != orec.avatar || _user.passwordHash != orec.passwordHash ||
+            _user.email != orec.email) {
+        _app->databasePool()->userRepository(_user.id)->invoke("updateUser",
+            Q_ARG(const UserRecord&, _user), Q_ARG(const Callback&, Callback()));
+    }
+
+    // update mappings
+    userChanged();
+
+    invokeUserInsertCallbacks();
+}
+
+void Session::insertUser (const Callback& callback)
+{
+    // if an insertion is already in progress, just wait for it
+    _userInsertCallbacks.append(callback);
+    if (_userInsertCallbacks.size() == 1) {
+        requestUserInsert(0);
+    }
+}
+
+void Session::requestUserInsert (int attempt)
+{
+    _app->databasePool()->userRepository(_user.id)->invoke("insertUser",
+        Q_ARG(const UserRecord&, _user), Q_ARG(bool, true), Q_ARG(const Callback&,
+            Callback(_this, "userInserted(UserRecord,int,UserRecord)",
+                Q_ARG(const UserRecord&, _user), Q_ARG(int, attempt))));
+}
+
+void Session::invokeUserInsertCallbacks ()
+{
+    QList<Callback> callbacks = _userInsertCallbacks;
+    _userInsertCallbacks.clear();
+    foreach (const Callback& callback, callbacks) {
+        callback.invoke();
+    }
+}
+
 void Session::userChanged ()
 {
     // let the connection manager update its mappings
@@ -9,6 +9,7 @@
 #include <QSize>
 
 #include "chat/ChatWindow.h"
+#include "db/SceneRepository.h"
 #include "db/UserRepository.h"
 #include "net/Connection.h"
 #include "peer/PeerManager.h"
@@ -104,6 +105,16 @@ public:
      */
     Pawn* pawn () const { return _pawn; }
 
+    /**
+     * Sets the contents of the scene clipboard.
+     */
+    void setClipboard (const SceneRegion& region) { _clipboard = region; }
+
+    /**
+     * Returns a reference to the contents of the scene clipboard.
+     */
+    const SceneRegion& clipboard () const { return _clipboard; }
+
     /**
      * Increments the window id counter and returns its value.
      */
@@ -247,6 +258,21 @@ public:
      */
     void moveToInstance (quint64 id, quint32 sceneId = 0, const QVariant& portal = QVariant());
 
+    /**
+     * Moves the user through a portal to the identified zone (or the current zone, if zero) and
+     * scene (or the zone's default, if zero).  The move is queued so that it may be requested
+     * from within the pawn's event handlers.
+     */
+    Q_INVOKABLE void moveThroughPortal (quint32 zoneId, quint32 sceneId, const QPoint& position);
+
+    /**
+     * Reserves a place in an instance of the identified zone ahead of a move there, and warms the
+     * identified scene within it.  The place is used by the next move to the zone if it happens
+     * before the reservation expires.  The callback is invoked (without arguments) when the
+     * request completes.
+     */
+    void prefetchZone (quint32 id, quint32 sceneId, const Callback& callback);
+
     /**
      * Moves to the named player.
      */
@@ -481,6 +507,17 @@ protected:
     Q_INVOKABLE void continueMovingToZone (
         quint32 sceneId, const QVariant& portal, const QString& peer, quint64 instanceId);
 
+    /**
+     * Stores (or applies, if a move is waiting on it) a place reserved by the prefetcher.
+     */
+    Q_INVOKABLE void placePrefetched (quint32 sceneId, const Callback& callback,
+        const QString& peer, quint64 instanceId);
+
+    /**
+     * Releases any place reserved by the prefetcher.
+     */
+    void cancelPrefetchedPlace ();
+
     /**
      * Continues the process of spawning an actor.
      */
@@ -520,6 +557,31 @@ protected:
      */
     Q_INVOKABLE void loggedOff (const UserRecord& user);
 
+    /**
+     * Reports back from a request to insert our transient user into the database.
+     *
+     * @param orec the record as it was when the insertion was requested.
+     * @param attempt the number of the attempt, starting at zero.
+     * @param nrec the inserted record, or a record with an id of zero if the insertion failed.
+     */
+    Q_INVOKABLE void userInserted (const UserRecord& orec, int attempt, const UserRecord& nrec);
+
+    /**
+     * Inserts our transient user into the database, invoking the callback once it's there.  If
+     * the insertion fails repeatedly, the callback is dropped and the user told of the failure.
+     */
+    void insertUser (const Callback& callback);
+
+    /**
+     * Sends a request to insert our transient user.
+     */
+    void requestUserInsert (int attempt);
+
+    /**
+     * Invokes and clears the callbacks waiting on the insertion of our user.
+     */
+    void invokeUserInsertCallbacks ();
+
     /**
      * Handles a user record change.
      */
@@ -590,6 +652,9 @@ protected:
     /** The currently logged in user. */
     UserRecord _user;
 
+    /** The callbacks waiting on the insertion of our transient user, if it's in progress. */
+    QList<Callback> _userInsertCallbacks;
+
     /** The currently occupied zone instance. */
     Instance* _instance;
 
@@ -598,6 +663,33 @@ protected:
 
     /** The currently controlled pawn. */
     Pawn* _pawn;
+
+    /** The region most recently copied from a scene. */
+    SceneRegion _clipboard;
+
+    /** The id of the zone in which the prefetcher has reserved (or is reserving) a place. */
+    quint32 _prefetchZoneId;
+
+    /** Whether the prefetcher's reservation request is still pending. */
+    bool _prefetchPending;
+
+    /** The peer hosting the instance in which the prefetcher reserved a place. */
+    QString _prefetchPeer;
+
+    /** The id of the instance in which the prefetcher reserved a place. */
+    quint64 _prefetchInstanceId;
+
+    /** The time at which the prefetcher's place was reserved. */
+    quint64 _prefetchTime;
+
+    /** Whether a move to the prefetched zone is waiting on the pending reservation. */
+    bool _prefetchMoveWaiting;
+
+    /** The scene to which the waiting move will proceed. */
+    quint32 _prefetchMoveSceneId;
+
+    /** The portal through which the waiting move will enter the scene. */
+    QVariant _prefetchMovePortal;
 };
 
 /**
@@ -13,7 +13,7 @@
 #include <QtDebug>
 
 #include "ServerApp.h"
-#include "db/DatabaseThread.h"
+#include "db/DatabasePool.h"
 #include "db/PropertyRepository.h"
 #include "net/ConnectionManager.h"
 #include "net/Session.h"
@@ -97,7 +97,7 @@ PeerManager::PeerManager (ServerApp* app) :
     }
 
     // enqueue an activation update
-    QMetaObject::invokeMethod(app->databaseThread()->peerRepository(), "storePeer",
+    app->databasePool()->peerRepository()->invoke("storePeer",
         Q_ARG(const PeerRecord&, _record));
 
     // deactivate when the application is exiting
@@ -586,11 +586,11 @@ void PeerManager::requestSession (
 void PeerManager::refreshPeers ()
 {
     // enqueue an update for our own record
-    QMetaObject::invokeMethod(_app->databaseThread()->peerRepository(), "storePeer",
+    _app->databasePool()->peerRepository()->invoke("storePeer",
         Q_ARG(const PeerRecord&, _record));
 
     // load everyone else's
-    QMetaObject::invokeMethod(_app->databaseThread()->peerRepository(), "loadPeers",
+    _app->databasePool()->peerRepository()->invoke("loadPeers",
         Q_ARG(const Callback&, Callback(_this, "updatePeers(PeerRecordList)")));
 }
 
@@ -598,7 +598,7 @@ void PeerManager::deactivate ()
 {
     // note in the database that we're no longer active
     _record.active = false;
-    QMetaObject::invokeMethod(_app->databaseThread()->peerRepository(), "storePeer",
+    _app->databasePool()->peerRepository()->invoke("storePeer",
         Q_ARG(const PeerRecord&, _record));
 }
 
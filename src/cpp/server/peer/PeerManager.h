@@ -120,6 +120,11 @@ public:
      */
     const QHash<quint64, SessionInfoPointer>& sessions () const { return _sessions; }
 
+    /**
+     * Returns a reference to the session map keyed by lowercase name.
+     */
+    const QHash<QString, SessionInfoPointer>& sessionsByName () const { return _sessionsByName; }
+
     /**
      * Returns a reference to the local session map.
      */
@@ -25,16 +25,9 @@ Legend::Legend (Session* session) :
     connect(session, SIGNAL(willLeaveScene(Scene*)), SLOT(handleWillLeaveScene(Scene*)));
 }
 
-/**
- * Creates a label component.
- */
-Component* createLabel (const CharacterLabelPair& pair)
+Legend::~Legend ()
 {
-    Container* cont = new Container(new BoxLayout(
-        Qt::Horizontal, BoxLayout::HStretch, Qt::AlignTop, 1));
-    cont->addChild(new Label(QIntVector(1, pair.first)), BoxLayout::Fixed);
-    cont->addChild(new Label(pair.second));
-    return cont;
+    qDeleteAll(_pool);
 }
 
 void Legend::labelChanged (LabelPointer olabel, LabelPointer nlabel, const QPoint* npos)
@@ -43,14 +36,14 @@ void Legend::labelChanged (LabelPointer olabel, LabelPointer nlabel, const QPoin
         QHash<LabelPointer, LabelMapping>::iterator it = _labels.find(olabel);
         if (--it->count == 0 && (npos == 0 ||
                 !session()->mainWindow()->sceneView()->worldBounds().contains(*npos))) {
-            removeChild(it->component);
+            removeLabel(it->component);
             _labels.erase(it);
         }
     }
     if (nlabel != 0) {
         LabelMapping& mapping = _labels[nlabel];
         if (mapping.count++ == 0 && mapping.component == 0) {
-            addChild(mapping.component = createLabel(*nlabel));
+            mapping.component = addLabel(*nlabel);
         }
     }
 }
@@ -85,8 +78,8 @@ void Legend::update (const QRect& oldBounds)
     QRect isect = oldBounds.intersected(newBounds);
     if (isect.isEmpty()) {
         // wipe out everything, add new bounds
-        removeAllChildren();
-        _labels.clear();   
+        removeAllLabels();
+        _labels.clear();
         add(newBounds);
         return;
     }
@@ -108,80 +101,60 @@ void Legend::update (const QRect& oldBounds)
 
 void Legend::add (const QRect& bounds)
 {
-    Scene* scene = session()->scene();
-    const QHash<QPoint, Scene::LabelBlock>& labels = scene->labels();
-    
-    int bx1 = bounds.left() >> Scene::LabelBlock::LgSize;
-    int bx2 = bounds.right() >> Scene::LabelBlock::LgSize;
-    int by1 = bounds.top() >> Scene::LabelBlock::LgSize;
-    int by2 = bounds.bottom() >> Scene::LabelBlock::LgSize;
-    QRect bbounds(0, 0, Scene::LabelBlock::Size, Scene::LabelBlock::Size);
-    for (int by = by1; by <= by2; by++) {
-        for (int bx = bx1; bx <= bx2; bx++) {
-            QHash<QPoint, Scene::LabelBlock>::const_iterator it = labels.constFind(QPoint(bx, by));
-            if (it != labels.constEnd()) {
-                const Scene::LabelBlock& block = *it;
-                bbounds.moveTo(bx << Scene::LabelBlock::LgSize, by << Scene::LabelBlock::LgSize);
-                QRect ibounds = bbounds.intersected(bounds);
-                
-                const LabelPointer* lptr = block.constData() +
-                    (ibounds.top() - bbounds.top() << Scene::LabelBlock::LgSize) +
-                        (ibounds.left() - bbounds.left());
-                for (int ii = 0, nn = ibounds.height(); ii < nn; ii++) {
-                    for (const LabelPointer* ptr = lptr, *end = ptr + ibounds.width();
-                            ptr != end; ptr++) {
-                        LabelPointer label = *ptr;
-                        if (label != 0) {
-                            LabelMapping& mapping = _labels[label];
-                            if (mapping.count++ == 0) {
-                                addChild(mapping.component = createLabel(*label));
-                            }
-                        }
-                    }
-                    lptr += Scene::LabelBlock::Size;
-                }
-            }
+    foreach (const Scene::PositionLabel& plabel, session()->scene()->labelsWithin(bounds)) {
+        LabelMapping& mapping = _labels[plabel.second];
+        if (mapping.count++ == 0) {
+            mapping.component = addLabel(*plabel.second);
         }
     }
 }
 
 void Legend::subtract (const QRect& bounds)
 {
-    Scene* scene = session()->scene();
-    const QHash<QPoint, Scene::LabelBlock>& labels = scene->labels();
-    
-    int bx1 = bounds.left() >> Scene::LabelBlock::LgSize;
-    int bx2 = bounds.right() >> Scene::LabelBlock::LgSize;
-    int by1 = bounds.top() >> Scene::LabelBlock::LgSize;
-    int by2 = bounds.bottom() >> Scene::LabelBlock::LgSize;
-    QRect bbounds(0, 0, Scene::LabelBlock::Size, Scene::LabelBlock::Size);
-    for (int by = by1; by <= by2; by++) {
-        for (int bx = bx1; bx <= bx2; bx++) {
-            QHash<QPoint, Scene::LabelBlock>::const_iterator it = labels.constFind(QPoint(bx, by));
-            if (it != labels.constEnd()) {
-                const Scene::LabelBlock& block = *it;
-                bbounds.moveTo(bx << Scene::LabelBlock::LgSize, by << Scene::LabelBlock::LgSize);
-                QRect ibounds = bbounds.intersected(bounds);
-                
-                const LabelPointer* lptr = block.constData() +
-                    (ibounds.top() - bbounds.top() << Scene::LabelBlock::LgSize) +
-                        (ibounds.left() - bbounds.left());
-                for (int ii = 0, nn = ibounds.height(); ii < nn; ii++) {
-                    for (const LabelPointer* ptr = lptr, *end = ptr + ibounds.width();
-                            ptr != end; ptr++) {
-                        LabelPointer label = *ptr;
-                        if (label != 0) {
-                            QHash<LabelPointer, LabelMapping>::iterator it =
-                                _labels.find(label);
-                            if (--it->count == 0) {
-                                removeChild(it->component);
-                                _labels.erase(it);
-                            }
-                        }
-                    }
-                    lptr += Scene::LabelBlock::Size;
-                }
-            }
+    foreach (const Scene::PositionLabel& plabel, session()->scene()->labelsWithin(bounds)) {
+        QHash<LabelPointer, LabelMapping>::iterator it = _labels.find(plabel.second);
+        if (--it->count == 0) {
+            removeLabel(it->component);
+            _labels.erase(it);
         }
     }
 }
+
+/** The maximum number of label components to keep for reuse. */
+static const int MaxPooledLabels = 32;
+
+Component* Legend::addLabel (const CharacterLabelPair& pair)
+{
+    Container* cont;
+    if (_pool.isEmpty()) {
+        cont = new Container(new BoxLayout(
+            Qt::Horizontal, BoxLayout::HStretch, Qt::AlignTop, 1));
+        cont->addChild(new Label(QIntVector(1, pair.first)), BoxLayout::Fixed);
+        cont->addChild(new Label(pair.second));
+
+    } else {
+        cont = _pool.takeLast();
+        static_cast<Label*>(cont->children().at(0))->setText(QIntVector(1, pair.first));
+        static_cast<Label*>(cont->children().at(1))->setText(pair.second);
+    }
+    addChild(cont);
+    return cont;
+}
+
+void Legend::removeLabel (Component* component)
+{
+    if (_pool.size() < MaxPooledLabels) {
+        removeChild(component, false);
+        _pool.append(static_cast<Container*>(component));
+
+    } else {
+        removeChild(component);
+    }
+}
+
+void Legend::removeAllLabels ()
+{
+    while (!_children.isEmpty()) {
+        removeLabel(_children.last());
+    }
+}
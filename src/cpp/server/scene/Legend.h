@@ -21,6 +21,11 @@ public:
      */
     Legend (Session* session);
 
+    /**
+     * Destroys the legend.
+     */
+    virtual ~Legend ();
+
     /**
      * Notes that a label has changed within the view bounds.
      *
@@ -71,8 +76,26 @@ protected:
      */
     void subtract (const QRect& bounds);
 
+    /**
+     * Adds a label component to the legend, reusing one from the pool if possible.
+     */
+    Component* addLabel (const CharacterLabelPair& pair);
+
+    /**
+     * Removes a label component from the legend, returning it to the pool.
+     */
+    void removeLabel (Component* component);
+
+    /**
+     * Removes all label components from the legend, returning them to the pool.
+     */
+    void removeAllLabels ();
+
     /** The set of active labels. */
     QHash<LabelPointer, LabelMapping> _labels;
+
+    /** Label components available for reuse. */
+    QList<Container*> _pool;
 };
 
 #endif // LEGEND
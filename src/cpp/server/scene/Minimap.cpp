@@ -0,0 +1,139 @@
+//
+// $Id$
+
+#include <QVarLengthArray>
+
+#include "Protocol.h"
+#include "actor/Pawn.h"
+#include "net/Session.h"
+#include "scene/Minimap.h"
+#include "scene/Scene.h"
+#include "ui/Border.h"
+
+Minimap::Minimap (Session* session) :
+    Component(0),
+    _level(Scene::Tile::LevelCount - 1)
+{
+    setBorder(new FrameBorder(-1, -1, -1, -1, '-', '+', '|', -1));
+    setPreferredSize(QSize(20, 11));
+    setVisible(false);
+
+    connect(session, SIGNAL(didEnterScene(Scene*)), SLOT(handleDidEnterScene(Scene*)));
+    connect(session, SIGNAL(willLeaveScene(Scene*)), SLOT(handleWillLeaveScene(Scene*)));
+}
+
+Minimap::~Minimap ()
+{
+    Session* session = this->session();
+    if (session != 0) {
+        Scene* scene = session->scene();
+        if (scene != 0) {
+            scene->removeMinimap(this);
+        }
+    }
+}
+
+void Minimap::tilesChanged (const QRect& bounds)
+{
+    if (!visible()) {
+        return;
+    }
+    int lgScale = Scene::Tile::lgScale(_level);
+    QRect sbounds(QPoint(bounds.left() >> lgScale, bounds.top() >> lgScale),
+        QPoint(bounds.right() >> lgScale, bounds.bottom() >> lgScale));
+    QRect isect = sbounds.intersected(_summaryBounds);
+    if (!isect.isEmpty()) {
+        dirty(isect.translated(innerRect().topLeft() - _summaryBounds.topLeft()));
+    }
+}
+
+void Minimap::cycle ()
+{
+    if (!visible()) {
+        _level = Scene::Tile::LevelCount - 1;
+        setVisible(true);
+
+    } else if (_level > 0) {
+        _level--;
+        _summaryBounds = QRect();
+        maybeRecenter();
+
+    } else {
+        setVisible(false);
+    }
+}
+
+void Minimap::handleDidEnterScene (Scene* scene)
+{
+    scene->addMinimap(this);
+
+    Pawn* pawn = session()->pawn();
+    if (pawn != 0) {
+        connect(pawn, SIGNAL(positionChanged(QPoint)), SLOT(maybeRecenter()));
+    }
+    _summaryBounds = QRect();
+    maybeRecenter();
+}
+
+void Minimap::handleWillLeaveScene (Scene* scene)
+{
+    Pawn* pawn = session()->pawn();
+    if (pawn != 0) {
+        disconnect(pawn);
+    }
+    scene->removeMinimap(this);
+}
+
+void Minimap::maybeRecenter ()
+{
+    Pawn* pawn = session()->pawn();
+    QRect bounds;
+    if (pawn != 0) {
+        int lgScale = Scene::Tile::lgScale(_level);
+        QPoint pos = pawn->position();
+        QSize size = innerRect().size();
+        bounds = QRect(QPoint(pos.x() >> lgScale, pos.y() >> lgScale) -
+            QPoint(size.width()/2, size.height()/2), size);
+    }
+    if (_summaryBounds != bounds) {
+        _summaryBounds = bounds;
+        dirty();
+    }
+}
+
+void Minimap::invalidate ()
+{
+    Component::invalidate();
+
+    // resize the summary bounds if necessary
+    maybeRecenter();
+}
+
+void Minimap::draw (DrawContext* ctx)
+{
+    Component::draw(ctx);
+
+    Scene* scene = session()->scene();
+    if (scene == 0 || _summaryBounds.isEmpty()) {
+        return;
+    }
+
+    // draw the dirty rows, a tile span at a time
+    QRect inner = innerRect();
+    int width = _summaryBounds.width(), height = _summaryBounds.height();
+    QVarLengthArray<int, 64> buffer(width);
+    for (int yy = 0; yy < height; yy++) {
+        if (ctx->isDirty(QRect(inner.left(), inner.top() + yy, width, 1))) {
+            scene->getSummaryRow(_level, _summaryBounds.left(), _summaryBounds.top() + yy,
+                width, buffer.data());
+            ctx->drawContents(inner.left(), inner.top() + yy, width, 1, buffer.constData());
+        }
+    }
+
+    // mark the pawn's location
+    Pawn* pawn = session()->pawn();
+    if (pawn != 0) {
+        ctx->drawChar(inner.left() + width/2, inner.top() + height/2,
+            pawn->character() | REVERSE_FLAG);
+    }
+}
@@ -0,0 +1,90 @@
+//
+// $Id$
+
+#ifndef MINIMAP
+#define MINIMAP
+
+#include <QRect>
+
+#include "ui/Component.h"
+
+class Scene;
+
+/**
+ * Displays an overview of the area around the pawn, drawn from the scene's summary tiles so that
+ * the cost of drawing depends only on the size of the map, not on the area shown.
+ */
+class Minimap : public Component
+{
+    Q_OBJECT
+
+public:
+
+    /**
+     * Initializes the map.
+     */
+    Minimap (Session* session);
+
+    /**
+     * Destroys the map.
+     */
+    virtual ~Minimap ();
+
+    /**
+     * Returns the level of detail shown.
+     */
+    int level () const { return _level; }
+
+    /**
+     * Returns a reference to the bounds of the map in summary space (that is, world space scaled
+     * down by the scale of the level shown).
+     */
+    const QRect& summaryBounds () const { return _summaryBounds; }
+
+    /**
+     * Notes that the summary tiles covering the specified region (in world space) have changed.
+     */
+    void tilesChanged (const QRect& bounds);
+
+public slots:
+
+    /**
+     * Cycles between hiding the map and showing it at each level of detail, coarsest first.
+     */
+    void cycle ();
+
+    /**
+     * Notes that we just entered a scene.
+     */
+    void handleDidEnterScene (Scene* scene);
+
+    /**
+     * Notes that we're about to leave a scene.
+     */
+    void handleWillLeaveScene (Scene* scene);
+
+    /**
+     * Centers the map around the pawn, if it has moved far enough to require it.
+     */
+    void maybeRecenter ();
+
+    /**
+     * Invalidates the component.
+     */
+    virtual void invalidate ();
+
+protected:
+
+    /**
+     * Draws the component.
+     */
+    virtual void draw (DrawContext* ctx);
+
+    /** The level of detail shown. */
+    int _level;
+
+    /** The bounds of the map in summary space. */
+    QRect _summaryBounds;
+};
+
+#endif // MINIMAP
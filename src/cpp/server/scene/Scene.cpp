@@ -3,364 +3,1110 @@
 
 #include <queue>
 
-#include <QMetaObject>
+#include <QMap>
+#include <QRect>
+#include <QSet>
+#include <QTimer>
 #include <QtDebug>
 
 #include "MainWindow.h"
 #include "Protocol.h"
 #include "ServerApp.h"
 #include "actor/Pawn.h"
-#include "db/DatabaseThread.h"
+#include "db/DatabasePool.h"
 #include "net/Session.h"
 #include "scene/Legend.h"
+#include "scene/Minimap.h"
 #include "scene/Scene.h"
 #include "scene/SceneManager.h"
 #include "scene/SceneView.h"
+#include "scene/Zone.h"
 
 using namespace std;
 
-Scene::Scene (ServerApp* app, const SceneRecord& record) :
-    _app(app),
-    _record(record)
+/** The interval after the first unpublished edit at which edits are published. */
+static const int EditPublishInterval = 100;
+
+/** The maximum distance from the requested location at which pawns may be spawned. */
+static const int MaxSpawnDistance = 16;
+
+Scene::Scene (Instance* instance, const SceneRecord& record) :
+    _instance(instance),
+    _app(instance->zone()->app()),
+    _record(record),
+    _autosaveTimer(new QTimer(this)),
+    _collisionBits(0),
+    _idleSince(currentTimeMillis()),
+    _reportedMemoryUsage(0),
+    _paged(false),
+    _generatorVersion(0),
+    _generatorResetPending(false),
+    _publishTimer(new QTimer(this))
 {
     // initialize the contents from the record
-    for (QHash<QPoint, SceneRecord::Block>::const_iterator it = _record.blocks.constBegin(),
+    for (SceneBlockHash::const_iterator it = _record.blocks.constBegin(),
             end = _record.blocks.constEnd(); it != end; it++) {
-        const QPoint& key = it.key();
-        const SceneRecord::Block& sblock = it.value();
-
-        // find the extents of the source block (inclusive)
-        int sx1 = key.x() << SceneRecord::Block::LgSize;
-        int sx2 = sx1 + SceneRecord::Block::Size - 1;
-        int sy1 = key.y() << SceneRecord::Block::LgSize;
-        int sy2 = sy1 + SceneRecord::Block::Size - 1;
-
-        // map them to destination blocks
-        int bx1 = sx1 >> Scene::Block::LgSize;
-        int bx2 = sx2 >> Scene::Block::LgSize;
-        int by1 = sy1 >> Scene::Block::LgSize;
-        int by2 = sy2 >> Scene::Block::LgSize;
-
-        // iterate over intersected destination blocks
-        for (int by = by1; by <= by2; by++) {
-            for (int bx = bx1; bx <= bx2; bx++) {
-                Block& dblock = _blocks[QPoint(bx, by)];
-
-                // find the extents of the destination block
-                int dx1 = bx << Scene::Block::LgSize;
-                int dx2 = dx1 + Scene::Block::Size - 1;
-                int dy1 = by << Scene::Block::LgSize;
-                int dy2 = dy1 + Scene::Block::Size - 1;
-
-                // find the intersection extents
-                int x1 = qMax(sx1, dx1);
-                int x2 = qMin(sx2, dx2);
-                int y1 = qMax(sy1, dy1);
-                int y2 = qMin(sy2, dy2);
-
-                // copy/process the area of intersection
-                const int* lsptr = sblock.constData() +
-                    (y1 - sy1 << SceneRecord::Block::LgSize) + (x1 - sx1);
-                int* ldptr = dblock.data() + (y1 - dy1 << Scene::Block::LgSize) + (x1 - dx1);
-                int filled = dblock.filled();
-                for (int yy = y1; yy <= y2; yy++) {
-                    const int *sptr = lsptr;
-                    int* dptr = ldptr;
-                    for (int xx = x1; xx <= x2; xx++) {
-                        if ((*dptr++ = *sptr++) != ' ') {
-                            filled++;
-                        }
-                    }
-                    lsptr += SceneRecord::Block::Size;
-                    ldptr += Scene::Block::Size;
-                }
-                dblock.setFilled(filled);
-            }
-        }
+        copyRecordBlock(it.key(), it.value());
     }
-    
-    new Actor(this, '@', "Column", QPoint(0, 1), 1, 2, 0);
+    if (_record.generated()) {
+        _generator = SceneGeneratorPointer(new SceneGenerator(
+            _record, _app->sceneManager()->sceneGeneratorCacheSize()));
+    }
+    _paged = _record.generated() || !_record.unloaded.isEmpty();
+    indexPortals();
+
+    addActor('@', "Column", QPoint(0, 1), 1, 2, 0);
+
+    // flush at the configured interval after the first unsaved change
+    _autosaveTimer->setSingleShot(true);
+    _autosaveTimer->setInterval(_app->sceneManager()->sceneAutosaveInterval());
+    connect(_autosaveTimer, SIGNAL(timeout()), SLOT(flush()));
+
+    // publish edits to the other instances in batches
+    _publishTimer->setSingleShot(true);
+    _publishTimer->setInterval(EditPublishInterval);
+    connect(_publishTimer, SIGNAL(timeout()), SLOT(publishEdits()));
+
+    updateMemoryUsage();
 }
 
-int Scene::collisionFlags (const QPoint& pos) const
+Scene::~Scene ()
 {
-    QPoint key(pos.x() >> Scene::Block::LgSize, pos.y() >> Scene::Block::LgSize);
-    QHash<QPoint, FlagBlock>::const_iterator it = _collisionFlags.constFind(key);
-    if (it == _collisionFlags.constEnd()) {
-        return 0;
+    // delete the actors while we can still remove them from our maps
+    qDeleteAll(findChildren<Actor*>());
+
+    // we can't wait for the outcome of our last flushes, so publish their edits now
+    foreach (const SceneEdits& edits, _flushingEdits) {
+        publish(edits);
     }
-    return (it == _collisionFlags.constEnd()) ? 0 : it->get(pos);
+
+    _app->sceneManager()->adjustSceneMemoryUsage(-_reportedMemoryUsage);
 }
 
-bool Scene::canEdit (Session* session) const
+int Scene::collisionFlags (const QPoint& pos) const
 {
-    return session->admin() || session->user().id == _record.creatorId;
+    QPoint key(pos.x() >> CollisionBlock::LgSize, pos.y() >> CollisionBlock::LgSize);
+    int flags = 0;
+    for (int bit = 0, mask = _collisionBits; mask != 0; bit++) {
+        int flag = 1 << bit;
+        if ((mask & flag) == 0) {
+            continue;
+        }
+        mask &= ~flag;
+        const CollisionPlane& plane = _collisionPlanes[bit];
+        CollisionPlane::const_iterator it = plane.constFind(key);
+        if (it != plane.constEnd() && it->get(pos)) {
+            flags |= flag;
+        }
+    }
+    return flags;
 }
 
-void Scene::setProperties (const QString& name, quint16 scrollWidth, quint16 scrollHeight)
+bool Scene::collides (const QPoint& pos, int mask) const
 {
-    // update the record
-    SceneRecord record = _record;
-    record.name = name;
-    record.scrollWidth = scrollWidth;
-    record.scrollHeight = scrollHeight;
-
-    // update in database
-    QMetaObject::invokeMethod(_app->databaseThread()->sceneRepository(), "updateScene",
-        Q_ARG(const SceneRecord&, record), Q_ARG(const Callback&, Callback(
-            _app->sceneManager(), "broadcastSceneUpdated(SceneRecord)",
-            Q_ARG(const SceneRecord&, record))));
+    QPoint key(pos.x() >> CollisionBlock::LgSize, pos.y() >> CollisionBlock::LgSize);
+    for (int bit = 0, remaining = mask & _collisionBits; remaining != 0; bit++) {
+        int flag = 1 << bit;
+        if ((remaining & flag) == 0) {
+            continue;
+        }
+        remaining &= ~flag;
+        const CollisionPlane& plane = _collisionPlanes[bit];
+        CollisionPlane::const_iterator it = plane.constFind(key);
+        if (it != plane.constEnd() && it->get(pos)) {
+            return true;
+        }
+    }
+    return false;
 }
 
-void Scene::set (const QPoint& pos, int character)
+bool Scene::collides (const QRect& rect, int mask) const
 {
-    // set in the record
-    _record.set(pos, character);
-
-    // notify the top actor at the position, if any; otherwise, set in the contents
-    Actor* actor = _actors.value(pos);
-    if (actor != 0) {
-        actor->sceneChangedUnderneath(character);
-    } else {
-        setInBlocks(pos, character);
+    if ((mask &= _collisionBits) == 0 || rect.isEmpty()) {
+        return false;
+    }
+    for (int by = rect.top() >> CollisionBlock::LgSize,
+            by2 = rect.bottom() >> CollisionBlock::LgSize; by <= by2; by++) {
+        int y1 = qMax(rect.top(), by << CollisionBlock::LgSize);
+        int y2 = qMin(rect.bottom(), (by << CollisionBlock::LgSize) + CollisionBlock::Mask);
+        for (int bx = rect.left() >> CollisionBlock::LgSize,
+                bx2 = rect.right() >> CollisionBlock::LgSize; bx <= bx2; bx++) {
+            quint32 span = CollisionBlock::span(
+                qMax(rect.left(), bx << CollisionBlock::LgSize),
+                qMin(rect.right(), (bx << CollisionBlock::LgSize) + CollisionBlock::Mask));
+            QPoint key(bx, by);
+            for (int bit = 0, remaining = mask; remaining != 0; bit++) {
+                int flag = 1 << bit;
+                if ((remaining & flag) == 0) {
+                    continue;
+                }
+                remaining &= ~flag;
+                const CollisionPlane& plane = _collisionPlanes[bit];
+                CollisionPlane::const_iterator it = plane.constFind(key);
+                if (it != plane.constEnd() && it->intersects(y1, y2, span)) {
+                    return true;
+                }
+            }
+        }
     }
+    return false;
 }
 
-void Scene::remove ()
+bool Scene::collides (const QVector<QPoint>& path, int mask) const
 {
-    // delete from the database
-    QMetaObject::invokeMethod(_app->databaseThread()->sceneRepository(), "deleteScene",
-        Q_ARG(quint64, _record.id), Q_ARG(const Callback&, Callback(
-            _app->sceneManager(), "broadcastSceneDeleted(quint32)",
-            Q_ARG(quint32, _record.id))));
+    if ((mask & _collisionBits) == 0) {
+        return false;
+    }
+    for (int ii = 0, nn = path.size(); ii < nn; ii++) {
+        // extend the run for as long as the path continues in the same unit step
+        QPoint start = path.at(ii);
+        if (ii + 1 < nn) {
+            QPoint step = path.at(ii + 1) - start;
+            if (step.manhattanLength() == 1) {
+                for (ii++; ii + 1 < nn && path.at(ii + 1) - path.at(ii) == step; ii++);
+            }
+        }
+        const QPoint& end = path.at(ii);
+        if (collides(QRect(QPoint(qMin(start.x(), end.x()), qMin(start.y(), end.y())),
+                QPoint(qMax(start.x(), end.x()), qMax(start.y(), end.y()))), mask)) {
+            return true;
+        }
+    }
+    return false;
 }
 
-Pawn* Scene::addSession (Session* session, const QVariant& portal)
+bool Scene::findSpawnPoint (
+    const QPoint& origin, int mask, int maxDistance, QPoint* result) const
 {
-    _sessions.append(session);
+    if ((mask &= _collisionBits) == 0) {
+        *result = origin;
+        return maxDistance >= 0;
+    }
+    // search the rows in order of increasing distance from the origin, stopping when no row can
+    // contain anything closer than the best location found so far
+    int ox = origin.x();
+    int best = maxDistance + 1;
+    for (int dy = 0; qAbs(dy) < best; dy = (dy > 0) ? -dy : 1 - dy) {
+        int yy = origin.y() + dy;
+        int range = best - 1 - qAbs(dy);
+        int x1 = ox - range, x2 = ox + range;
+        for (int bx = x1 >> CollisionBlock::LgSize, bx2 = x2 >> CollisionBlock::LgSize;
+                bx <= bx2; bx++) {
+            int base = bx << CollisionBlock::LgSize;
+            int cx1 = qMax(x1, base), cx2 = qMin(x2, base + CollisionBlock::Mask);
+            quint32 free = ~collisionRow(QPoint(bx, yy >> CollisionBlock::LgSize), yy, mask);
 
-    QPoint location;
-    switch (portal.type()) {
-        case QVariant::Point:
-            location = portal.toPoint();
-            break;
+            // the nearest candidates are the highest free bit to the left of the origin and the
+            // lowest to the right
+            if (cx1 <= ox) {
+                quint32 left = free & CollisionBlock::span(cx1, qMin(ox, cx2));
+                if (left != 0) {
+                    int xx = base + CollisionBlock::Mask - __builtin_clz(left);
+                    int distance = ox - xx + qAbs(dy);
+                    if (distance < best) {
+                        best = distance;
+                        *result = QPoint(xx, yy);
+                    }
+                }
+            }
+            if (cx2 >= ox) {
+                quint32 right = free & CollisionBlock::span(qMax(ox, cx1), cx2);
+                if (right != 0) {
+                    int xx = base + __builtin_ctz(right);
+                    int distance = xx - ox + qAbs(dy);
+                    if (distance < best) {
+                        best = distance;
+                        *result = QPoint(xx, yy);
+                    }
+                }
+            }
+        }
     }
-    return new Pawn(this, session, location);
+    return best <= maxDistance;
 }
 
-void Scene::removeSession (Session* session)
+/**
+ * Helper function for spatial queries: appends the keys of the blocks at the specified
+ * (Chebyshev) distance from the center block.
+ */
+static void appendRingKeys (const QPoint& center, int distance, QVector<QPoint>& keys)
 {
-    Pawn* pawn = session->pawn();
-    if (pawn != 0) {
-        delete pawn;
+    if (distance == 0) {
+        keys.append(center);
+        return;
+    }
+    for (int dx = -distance; dx <= distance; dx++) {
+        keys.append(center + QPoint(dx, -distance));
+        keys.append(center + QPoint(dx, distance));
+    }
+    for (int dy = 1 - distance; dy < distance; dy++) {
+        keys.append(center + QPoint(-distance, dy));
+        keys.append(center + QPoint(distance, dy));
     }
-    _sessions.removeOne(session);
 }
 
-void Scene::updated (const SceneRecord& record)
+/**
+ * Helper function for the nearest queries: appends the keys of the blocks to search at the
+ * specified ring distance.  Once the rings span more keys than there are blocks in the hash, it's
+ * cheaper to append all the blocks beyond the inner rings, in which case we return true.
+ */
+template<class T> static bool appendSearchKeys (
+    const QHash<QPoint, T>& blocks, const QPoint& center, int ring, QVector<QPoint>& keys)
 {
-    emit recordChanged(_record = record);
+    qint64 side = 2 * (qint64)ring + 1;
+    if (side * side <= blocks.size()) {
+        appendRingKeys(center, ring, keys);
+        return false;
+    }
+    for (typename QHash<QPoint, T>::const_iterator it = blocks.constBegin(),
+            end = blocks.constEnd(); it != end; it++) {
+        QPoint offset = it.key() - center;
+        if (qMax(qAbs(offset.x()), qAbs(offset.y())) >= ring) {
+            keys.append(it.key());
+        }
+    }
+    return true;
 }
 
-void Scene::deleted ()
+/**
+ * Helper function for spatial queries: orders candidates by distance.
+ */
+template<class T> static bool closer (const QPair<int, T>& c1, const QPair<int, T>& c2)
 {
-    // TODO
+    return c1.first < c2.first;
 }
 
-void Scene::addSpatial (Actor* actor)
+/**
+ * Helper function for spatial queries: returns the keys of the blocks of a hash that intersect
+ * the specified rectangle, iterating over whichever of the two is smaller.
+ */
+template<class T> static QVector<QPoint> intersectingKeys (
+    const QHash<QPoint, T>& blocks, const QRect& rect, int lgSize)
 {
-    const QPoint& pos = actor->position();
-    int flags = actor->collisionFlags();
-    if (flags != 0) {
-        QPoint key(pos.x() >> Block::LgSize, pos.y() >> Block::LgSize);
-        FlagBlock& block = _collisionFlags[key];
-        block.setFlags(pos, flags);
+    QVector<QPoint> keys;
+    if (rect.isEmpty()) {
+        return keys;
     }
-    
-    // add to actor list
-    Actor*& aref = _actors[pos];
-    int character = actor->character();
-    if (character == ' ') {
-        // add invisible actors to the end of the list
-        if (aref == 0) {
-            aref = actor;
-
-        } else {
-            Actor* ptr = aref;
-            while (ptr->next() != 0) {
-                ptr = ptr->next();
+    QRect krect(QPoint(rect.left() >> lgSize, rect.top() >> lgSize),
+        QPoint(rect.right() >> lgSize, rect.bottom() >> lgSize));
+    if ((qint64)krect.width() * krect.height() > blocks.size()) {
+        for (typename QHash<QPoint, T>::const_iterator it = blocks.constBegin(),
+                end = blocks.constEnd(); it != end; it++) {
+            if (krect.contains(it.key())) {
+                keys.append(it.key());
             }
-            ptr->setNext(actor);
         }
-        return;
+        return keys;
     }
-    if (aref != 0) {
-        actor->setNext(aref);
+    for (int yy = krect.top(); yy <= krect.bottom(); yy++) {
+        for (int xx = krect.left(); xx <= krect.right(); xx++) {
+            QPoint key(xx, yy);
+            if (blocks.contains(key)) {
+                keys.append(key);
+            }
+        }
     }
-    aref = actor;
+    return keys;
+}
 
-    // set in block and dirty
-    setInBlocks(pos, character, actor->labelPointer());
+QVector<int> Scene::actorsWithin (const QRect& rect, int mask) const
+{
+    QVector<int> actors;
+    foreach (const QPoint& key, intersectingKeys(_actorBlocks, rect, Block::LgSize)) {
+        foreach (int idx, _actorBlocks.value(key)) {
+            if (rect.contains(_actorPool.position(idx)) &&
+                    (mask == 0 || (_actorPool.collisionFlags(idx) & mask) != 0)) {
+                actors.append(idx);
+            }
+        }
+    }
+    return actors;
 }
 
-void Scene::removeSpatial (Actor* actor, int character, const QPoint* npos)
+QVector<int> Scene::nearestActors (const QPoint& pos, int count, int maxDistance, int mask) const
 {
-    // remove from actor list
-    const QPoint& pos = actor->position();
-    Actor*& aref = _actors[pos];
-    if (aref != actor) {
-        // actor is not on top, so no need to update block
-        Actor* ptr = aref;
-        while (ptr->next() != actor) {
-            ptr = ptr->next();
+    // search rings of blocks around the one containing the position until no closer actors can
+    // remain: the cells of the ring at distance r are at least (r - 1) * Size + 1 away
+    QPoint center(pos.x() >> Block::LgSize, pos.y() >> Block::LgSize);
+    QVector<QPair<int, int> > candidates;
+    QVector<QPoint> keys;
+    int remaining = _actorBlocks.size();
+    int maxRing = (qMax(maxDistance, 1) - 1) / Block::Size + 1;
+    for (int ring = 0; count > 0 && remaining > 0 && ring <= maxRing; ring++) {
+        keys.clear();
+        bool exhaustive = appendSearchKeys(_actorBlocks, center, ring, keys);
+        foreach (const QPoint& key, keys) {
+            QHash<QPoint, QVector<int> >::const_iterator it = _actorBlocks.constFind(key);
+            if (it == _actorBlocks.constEnd()) {
+                continue;
+            }
+            remaining--;
+            foreach (int idx, *it) {
+                int distance = (_actorPool.position(idx) - pos).manhattanLength();
+                if (distance <= maxDistance &&
+                        (mask == 0 || (_actorPool.collisionFlags(idx) & mask) != 0)) {
+                    candidates.append(QPair<int, int>(distance, idx));
+                }
+            }
         }
-        ptr->setNext(actor->next());
-        actor->setNext(0);
-        if (actor->collisionFlags() != 0) {
-            updateCollisionFlags(pos, aref);
+        if (exhaustive) {
+            break;
         }
-        return;
-    }
-    Actor* next = actor->next();
-    int nchar;
-    LabelPointer nlabel;
-    if (next == 0) {
-        _actors.remove(pos);
-        nchar = _record.get(pos);
-        nlabel = 0;
-        
-    } else {
-        aref = next;
-        actor->setNext(0);
-        if ((nchar = next->character()) == ' ') {
-            nchar = _record.get(pos);
-            nlabel = 0;
-            
-        } else {
-            nlabel = next->labelPointer();
+        if (candidates.size() >= count) {
+            qSort(candidates.begin(), candidates.end(), closer<int>);
+            candidates.resize(count);
+            if (candidates.last().first <= ring * Block::Size) {
+                break;
+            }
         }
     }
+    qSort(candidates.begin(), candidates.end(), closer<int>);
+    QVector<int> actors;
+    for (int ii = 0, nn = qMin(count, candidates.size()); ii < nn; ii++) {
+        actors.append(candidates.at(ii).second);
+    }
+    return actors;
+}
 
-    // update block and dirty
-    setInBlocks(pos, nchar, nlabel, npos);
-    
-    // update the collision flags if appropriate
-    if (actor->collisionFlags() != 0) {
-        updateCollisionFlags(pos, next);
+/**
+ * Helper function for labelsWithin: appends the labels in a single row or column whose
+ * coordinates along the line lie within the given (inclusive) range.
+ */
+static void appendLineLabels (int line, const QMap<int, LabelPointer>& labels, int l1, int l2,
+    bool column, QVector<Scene::PositionLabel>& result)
+{
+    for (QMap<int, LabelPointer>::const_iterator it = labels.lowerBound(l1),
+            end = labels.constEnd(); it != end && it.key() <= l2; it++) {
+        result.append(Scene::PositionLabel(
+            column ? QPoint(line, it.key()) : QPoint(it.key(), line), it.value()));
     }
 }
 
-void Scene::characterLabelChanged (Actor* actor, int ochar)
+/**
+ * Helper function for labelsWithin: appends the labels in a range of rows or columns, iterating
+ * over whichever of the range and the index is smaller.
+ */
+static void appendIndexedLabels (const QHash<int, QMap<int, LabelPointer> >& index,
+    int line1, int line2, int l1, int l2, bool columns, QVector<Scene::PositionLabel>& result)
 {
-    // handle transitions between visible and invisible
-    int nchar = actor->character();
-    if (nchar == ' ') {
-        if (ochar != ' ') {
-            removeSpatial(actor, ochar);
+    if ((qint64)line2 - line1 + 1 > index.size()) {
+        for (QHash<int, QMap<int, LabelPointer> >::const_iterator it = index.constBegin(),
+                end = index.constEnd(); it != end; it++) {
+            if (it.key() >= line1 && it.key() <= line2) {
+                appendLineLabels(it.key(), *it, l1, l2, columns, result);
+            }
         }
         return;
     }
-    if (ochar == ' ') {
-        addSpatial(actor);
-        return;
-    }
-    const QPoint& pos = actor->position();
-    Actor* pactor = _actors.value(pos);
-    if (pactor == actor) {
-        setInBlocks(pos, nchar, actor->labelPointer());
+    for (int line = line1; line <= line2; line++) {
+        QHash<int, QMap<int, LabelPointer> >::const_iterator it = index.constFind(line);
+        if (it != index.constEnd()) {
+            appendLineLabels(line, *it, l1, l2, columns, result);
+        }
     }
 }
 
-void Scene::addSpatial (SceneView* view)
+QVector<Scene::PositionLabel> Scene::labelsWithin (const QRect& rect) const
 {
-    // add to lists for all intersecting blocks
-    const QRect& bounds = view->worldBounds();
-    int x1 = bounds.left() >> LgViewBlockSize;
-    int x2 = bounds.right() >> LgViewBlockSize;
-    int y1 = bounds.top() >> LgViewBlockSize;
-    int y2 = bounds.bottom() >> LgViewBlockSize;
-    for (int yy = y1; yy <= y2; yy++) {
-        for (int xx = x1; xx <= x2; xx++) {
-            _views[QPoint(xx, yy)].append(view);
-        }
+    // scan along the rectangle's shorter dimension, so that strips take one lookup per line
+    QVector<PositionLabel> labels;
+    if (rect.isEmpty()) {
+        return labels;
+    }
+    if (rect.height() <= rect.width()) {
+        appendIndexedLabels(_labelRows, rect.top(), rect.bottom(),
+            rect.left(), rect.right(), false, labels);
+    } else {
+        appendIndexedLabels(_labelColumns, rect.left(), rect.right(),
+            rect.top(), rect.bottom(), true, labels);
     }
+    return labels;
 }
 
-void Scene::removeSpatial (SceneView* view)
+QVector<Scene::PositionLabel> Scene::nearestLabels (
+    const QPoint& pos, int count, int maxDistance) const
 {
-    // remove from lists in all intersecting blocks
-    const QRect& bounds = view->worldBounds();
-    int x1 = bounds.left() >> LgViewBlockSize;
-    int x2 = bounds.right() >> LgViewBlockSize;
-    int y1 = bounds.top() >> LgViewBlockSize;
-    int y2 = bounds.bottom() >> LgViewBlockSize;
-    for (int yy = y1; yy <= y2; yy++) {
-        for (int xx = x1; xx <= x2; xx++) {
-            QPoint key(xx, yy);
-            SceneViewList& list = _views[key];
-            list.removeOne(view);
-            if (list.isEmpty()) {
-                _views.remove(key);
+    QPoint center(pos.x() >> LabelBlock::LgSize, pos.y() >> LabelBlock::LgSize);
+    QVector<QPair<int, PositionLabel> > candidates;
+    QVector<QPoint> keys;
+    int remaining = _labels.size();
+    int maxRing = (qMax(maxDistance, 1) - 1) / LabelBlock::Size + 1;
+    for (int ring = 0; count > 0 && remaining > 0 && ring <= maxRing; ring++) {
+        keys.clear();
+        bool exhaustive = appendSearchKeys(_labels, center, ring, keys);
+        foreach (const QPoint& key, keys) {
+            QHash<QPoint, LabelBlock>::const_iterator bit = _labels.constFind(key);
+            if (bit == _labels.constEnd()) {
+                continue;
+            }
+            remaining--;
+            for (LabelBlock::const_iterator it = bit->constBegin(), end = bit->constEnd();
+                    it != end; it++) {
+                QPoint lpos = LabelBlock::position(key, it.key());
+                int distance = (lpos - pos).manhattanLength();
+                if (distance <= maxDistance) {
+                    candidates.append(QPair<int, PositionLabel>(
+                        distance, PositionLabel(lpos, it.value())));
+                }
+            }
+        }
+        if (exhaustive) {
+            break;
+        }
+        if (candidates.size() >= count) {
+            qSort(candidates.begin(), candidates.end(), closer<PositionLabel>);
+            candidates.resize(count);
+            if (candidates.last().first <= ring * LabelBlock::Size) {
+                break;
             }
         }
     }
+    qSort(candidates.begin(), candidates.end(), closer<PositionLabel>);
+    QVector<PositionLabel> labels;
+    for (int ii = 0, nn = qMin(count, candidates.size()); ii < nn; ii++) {
+        labels.append(candidates.at(ii).second);
+    }
+    return labels;
 }
 
 /**
- * Contains all the information associated with a node.
+ * Helper function for the script queries: describes a list of actors.
  */
-class Node
+static QVariantList describeActors (const ActorPool& pool, const QVector<int>& actors)
 {
-public:
-
-    /** Whether or not the node is in the closed set. */
-    unsigned int closed : 1;
-    
-    /** Whether or not the node is in the open set. */
-    unsigned int open : 1;
-    
-    /** The distance from the source node. */
-    unsigned int gScore : 14;
-    
-    /** The combined distance and heuristic estimate. */
-    unsigned int fScore : 14;
-    
-    /** The direction from which we traveled. */
-    unsigned int cameFrom : 2;
-};
+    QVariantList list;
+    foreach (int idx, actors) {
+        const QPoint& pos = pool.position(idx);
+        Actor* object = pool.object(idx);
+        list.append(QVariant(QVariantList() << pos.x() << pos.y() << pool.character(idx) <<
+            (object == 0 ? QVariant() : QVariant::fromValue<QObject*>(object))));
+    }
+    return list;
+}
 
 /**
- * Functor to compare two nodes by their scores.
+ * Helper function for the script queries: describes a list of labels.
  */
-class NodeScoreGreater
+static QVariantList describeLabels (const QVector<Scene::PositionLabel>& labels)
 {
-public:
+    QVariantList list;
+    foreach (const Scene::PositionLabel& label, labels) {
+        list.append(QVariant(QVariantList() << label.first.x() << label.first.y() <<
+            label.second->first << label.second->second));
+    }
+    return list;
+}
 
-    /**
-     * Creates a new node comparer.
-     */
-    NodeScoreGreater (const QHash<QPoint, Node>* nodes) : _nodes(nodes) { }
+QVariantList Scene::scriptActorsWithin (const QRect& rect, int mask) const
+{
+    return describeActors(_actorPool, actorsWithin(rect, mask));
+}
 
-    /**
-     * Returns whether or not the score of the first point is greater than that of the second.
-     */
-    bool operator() (const QPoint& p1, const QPoint& p2)
-    {
-        return _nodes->value(p1).fScore > _nodes->value(p2).fScore;
+QVariantList Scene::scriptNearestActors (
+    const QPoint& pos, int count, int maxDistance, int mask) const
+{
+    return describeActors(_actorPool, nearestActors(pos, count, maxDistance, mask));
+}
+
+QVariantList Scene::scriptLabelsWithin (const QRect& rect) const
+{
+    return describeLabels(labelsWithin(rect));
+}
+
+QVariantList Scene::scriptNearestLabels (const QPoint& pos, int count, int maxDistance) const
+{
+    return describeLabels(nearestLabels(pos, count, maxDistance));
+}
+
+bool Scene::canEdit (Session* session) const
+{
+    return session->admin() || session->user().id == _record.creatorId;
+}
+
+/**
+ * Helper function for memoryUsage: returns the approximate number of bytes occupied by a hash of
+ * blocks.
+ */
+template<class T> static qint64 blockMemoryUsage (const QHash<QPoint, T>& blocks)
+{
+    qint64 usage = 0;
+    for (typename QHash<QPoint, T>::const_iterator it = blocks.constBegin(),
+            end = blocks.constEnd(); it != end; it++) {
+        usage += sizeof(QPoint) + it->memoryUsage();
     }
+    return usage;
+}
 
-protected:
-    
-    /** The map from point to node. */
-    const QHash<QPoint, Node>* _nodes;
-};
+qint64 Scene::collisionMemoryUsage () const
+{
+    qint64 usage = 0;
+    for (int bit = 0; bit < CollisionPlaneCount; bit++) {
+        usage += blockMemoryUsage(_collisionPlanes[bit]);
+    }
+    return usage;
+}
 
-QVector<QPoint> Scene::findPath (
-    const QPoint& start, const QPoint& end, int collisionMask, int maxLength) const
+qint64 Scene::memoryUsage () const
 {
-    QHash<QPoint, Node> nodes;
-    NodeScoreGreater compare(&nodes);
-    priority_queue<QPoint, QVector<QPoint>, NodeScoreGreater> open(compare);
+    // baselines only occupy their own memory once their record blocks have been changed
+    int detached = 0;
+    for (QHash<QPoint, SceneRecord::Block>::const_iterator it = _baselines.constBegin(),
+            end = _baselines.constEnd(); it != end; it++) {
+        if (!it->isSharedWith(_record.blocks.value(it.key()))) {
+            detached++;
+        }
+    }
+    return _record.blocks.size() * (qint64)(sizeof(QPoint) + sizeof(SceneRecord::Block) +
+            SceneRecord::Block::Size*SceneRecord::Block::Size*sizeof(int)) +
+        _baselines.size() * (qint64)(sizeof(QPoint) + sizeof(SceneRecord::Block)) +
+        detached * (qint64)(SceneRecord::Block::Size*SceneRecord::Block::Size*sizeof(int)) +
+        blockMemoryUsage(_blocks) + blockMemoryUsage(_labels) + blockMemoryUsage(_tiles) +
+        collisionMemoryUsage() +
+        _actors.size() * (qint64)(sizeof(QPoint) + sizeof(int)) + _actorPool.memoryUsage();
+}
+
+void Scene::updateMemoryUsage ()
+{
+    qint64 usage = memoryUsage();
+    if (usage != _reportedMemoryUsage) {
+        _app->sceneManager()->adjustSceneMemoryUsage(usage - _reportedMemoryUsage);
+        _reportedMemoryUsage = usage;
+    }
+}
+
+void Scene::pageOut ()
+{
+    // blocks written by a pending flush may have to be written again if it fails
+    int excess = _record.blocks.size() - _app->sceneManager()->scenePagedBlockLimit();
+    if (!_paged || excess <= 0 || !_flushingEdits.isEmpty()) {
+        return;
+    }
+    // find the blocks near views, which we keep regardless of age
+    int margin = _app->sceneManager()->scenePrefetchMargin();
+    QSet<QPoint> viewed;
+    foreach (Session* session, _sessions) {
+        QRect bounds = session->mainWindow()->sceneView()->worldBounds().adjusted(
+            -margin, -margin, margin, margin);
+        for (int yy = bounds.top() >> SceneRecord::Block::LgSize,
+                y2 = bounds.bottom() >> SceneRecord::Block::LgSize; yy <= y2; yy++) {
+            for (int xx = bounds.left() >> SceneRecord::Block::LgSize,
+                    x2 = bounds.right() >> SceneRecord::Block::LgSize; xx <= x2; xx++) {
+                viewed.insert(QPoint(xx, yy));
+            }
+        }
+    }
+
+    // sort the remaining unmodified blocks by last use and unload the oldest
+    QMap<quint64, QPoint> candidates;
+    for (SceneBlockHash::const_iterator it = _record.blocks.constBegin(),
+            end = _record.blocks.constEnd(); it != end; it++) {
+        const QPoint& key = it.key();
+        if (!(viewed.contains(key) || _record.added.contains(key) ||
+                _record.updated.contains(key))) {
+            candidates.insertMulti(_blockAccess.value(key), key);
+        }
+    }
+    for (QMap<quint64, QPoint>::const_iterator it = candidates.constBegin(),
+            end = candidates.constEnd(); it != end && excess > 0; it++, excess--) {
+        pageOut(it.value());
+    }
+}
+
+void Scene::setProperties (const QString& name, quint16 scrollWidth, quint16 scrollHeight,
+    quint32 seed, const QString& layers)
+{
+    // update the record
+    SceneRecord record = _record;
+    record.name = name;
+    record.scrollWidth = scrollWidth;
+    record.scrollHeight = scrollHeight;
+    record.seed = seed;
+    record.layers = layers;
+
+    // update in database
+    _app->databasePool()->sceneRepository(_record.id)->invoke("updateScene",
+        Q_ARG(const SceneRecord&, record), Q_ARG(const Callback&, Callback(
+            _app->sceneManager(), "broadcastSceneUpdated(SceneRecord)",
+            Q_ARG(const SceneRecord&, record))));
+}
+
+void Scene::set (const QPoint& pos, int character)
+{
+    // if the block hasn't been loaded, request it and apply the change when it arrives
+    if (_paged) {
+        QPoint key(pos.x() >> SceneRecord::Block::LgSize, pos.y() >> SceneRecord::Block::LgSize);
+        if (!isLoaded(key)) {
+            _deferredSets[key].append(PositionCharacter(pos, character));
+            loadBlocks(QRect(key, QSize(1, 1)));
+            return;
+        }
+        _blockAccess.insert(key, currentTimeMillis());
+    }
+
+    // set in the record, scheduling an autosave if necessary
+    _record.set(pos, character);
+    if (_record.dirty() && !_autosaveTimer->isActive()) {
+        _autosaveTimer->start();
+    }
+    addEdit(pos, character);
+
+    // notify the top actor at the position, if any; otherwise, set in the contents
+    if (!changedUnderneath(pos, character)) {
+        setInBlocks(pos, character);
+    }
+}
+
+void Scene::fill (const QRect& bounds, int character)
+{
+    setRegion(bounds, &character, 0, 0);
+    dirtyViews(bounds);
+}
+
+void Scene::paste (const QPoint& pos, const SceneRegion& region)
+{
+    QRect bounds(pos, region.size);
+    setRegion(bounds, region.data.constData(), 1, region.size.width());
+    dirtyViews(bounds);
+}
+
+bool Scene::loadRegion (const QRect& bounds)
+{
+    if (!_paged) {
+        return true;
+    }
+    QRect keys(
+        QPoint(bounds.left() >> SceneRecord::Block::LgSize,
+            bounds.top() >> SceneRecord::Block::LgSize),
+        QPoint(bounds.right() >> SceneRecord::Block::LgSize,
+            bounds.bottom() >> SceneRecord::Block::LgSize));
+    for (int yy = keys.top(); yy <= keys.bottom(); yy++) {
+        for (int xx = keys.left(); xx <= keys.right(); xx++) {
+            if (!isLoaded(QPoint(xx, yy))) {
+                loadBlocks(keys);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool Scene::move (const QRect& bounds, const QPoint& pos)
+{
+    // copying unloaded blocks would replace their contents with spaces
+    if (!loadRegion(bounds)) {
+        return false;
+    }
+    SceneRegion region = copy(bounds);
+    int space = ' ';
+    setRegion(bounds, &space, 0, 0);
+    QRect dest(pos, bounds.size());
+    setRegion(dest, region.data.constData(), 1, bounds.width());
+    dirtyViews(bounds | dest);
+    return true;
+}
+
+void Scene::remove ()
+{
+    // delete from the database
+    _app->databasePool()->sceneRepository(_record.id)->invoke("deleteScene",
+        Q_ARG(quint64, _record.id), Q_ARG(const Callback&, Callback(
+            _app->sceneManager(), "broadcastSceneDeleted(quint32)",
+            Q_ARG(quint32, _record.id))));
+}
+
+const ScenePortal* Scene::portal (const QPoint& pos) const
+{
+    QHash<QPoint, int>::const_iterator it = _portals.constFind(pos);
+    return (it == _portals.constEnd()) ? 0 : &_record.portals.at(*it);
+}
+
+void Scene::setPortal (const ScenePortal& portal)
+{
+    QList<ScenePortal> portals = _record.portals;
+    QHash<QPoint, int>::const_iterator it = _portals.constFind(portal.position);
+    if (it == _portals.constEnd()) {
+        portals.append(portal);
+    } else {
+        portals[*it] = portal;
+    }
+    updatePortals(portals);
+}
+
+void Scene::removePortal (const QPoint& pos)
+{
+    QHash<QPoint, int>::const_iterator it = _portals.constFind(pos);
+    if (it != _portals.constEnd()) {
+        QList<ScenePortal> portals = _record.portals;
+        portals.removeAt(*it);
+        updatePortals(portals);
+    }
+}
+
+void Scene::prefetchPortals (Session* session, const QPoint& pos)
+{
+    PortalPrefetcher* prefetcher = _app->sceneManager()->portalPrefetcher();
+    if (_portals.isEmpty() || prefetcher == 0) {
+        return;
+    }
+    int distance = _app->sceneManager()->portalPrefetchDistance();
+    int bx1 = (pos.x() - distance) >> LgPortalBlockSize;
+    int bx2 = (pos.x() + distance) >> LgPortalBlockSize;
+    int by1 = (pos.y() - distance) >> LgPortalBlockSize;
+    int by2 = (pos.y() + distance) >> LgPortalBlockSize;
+    for (int by = by1; by <= by2; by++) {
+        for (int bx = bx1; bx <= bx2; bx++) {
+            QHash<QPoint, QVector<int> >::const_iterator it =
+                _portalBlocks.constFind(QPoint(bx, by));
+            if (it == _portalBlocks.constEnd()) {
+                continue;
+            }
+            foreach (int idx, *it) {
+                const ScenePortal& portal = _record.portals.at(idx);
+                if (qAbs(portal.position.x() - pos.x()) <= distance &&
+                        qAbs(portal.position.y() - pos.y()) <= distance) {
+                    prefetcher->prefetch(session, portal);
+                }
+            }
+        }
+    }
+}
+
+Pawn* Scene::addSession (Session* session, const QVariant& portal)
+{
+    _sessions.append(session);
+
+    QPoint location;
+    switch (portal.type()) {
+        case QVariant::Point:
+            location = portal.toPoint();
+            break;
+    }
+    // avoid spawning on top of anything we would collide with
+    QPoint spawnPoint;
+    if (findSpawnPoint(location, Pawn::SpawnMask, MaxSpawnDistance, &spawnPoint)) {
+        location = spawnPoint;
+    }
+    return new Pawn(this, session, location);
+}
+
+void Scene::removeSession (Session* session)
+{
+    Pawn* pawn = session->pawn();
+    if (pawn != 0) {
+        delete pawn;
+    }
+    _sessions.removeOne(session);
+    if (_sessions.isEmpty()) {
+        _idleSince = currentTimeMillis();
+    }
+}
+
+void Scene::updated (const SceneRecord& record)
+{
+    // take only the metadata; our blocks may have changed since the record was copied
+    bool regenerate = (record.seed != _record.seed || record.layers != _record.layers);
+    _record.name = record.name;
+    _record.scrollWidth = record.scrollWidth;
+    _record.scrollHeight = record.scrollHeight;
+    _record.seed = record.seed;
+    _record.layers = record.layers;
+    _record.portals = record.portals;
+    indexPortals();
+    if (regenerate) {
+        resetGenerator();
+    }
+
+    emit recordChanged(_record);
+}
+
+void Scene::deleted ()
+{
+    // TODO
+}
+
+int Scene::addActor (int character, const QString& label, const QPoint& position,
+    int collisionFlags, int collisionMask, int spawnMask)
+{
+    int idx = _actorPool.allocate(
+        character, label, position, collisionFlags, collisionMask, spawnMask);
+    addSpatial(idx);
+    return idx;
+}
+
+void Scene::removeActor (int idx)
+{
+    removeSpatial(idx);
+    _actorPool.release(idx);
+}
+
+void Scene::setActorPosition (int idx, const QPoint& position)
+{
+    removeSpatial(idx, &position);
+    _actorPool.setPosition(idx, position);
+    addSpatial(idx);
+}
+
+void Scene::setActorCharacter (int idx, int character)
+{
+    int ochar = _actorPool.character(idx);
+    _actorPool.setCharacter(idx, character);
+    characterLabelChanged(idx, ochar);
+}
+
+void Scene::setActorLabel (int idx, const QString& label)
+{
+    _actorPool.setLabel(idx, label);
+    characterLabelChanged(idx, _actorPool.character(idx));
+}
+
+void Scene::setActorCollisionFlags (int idx, int flags)
+{
+    _actorPool.setCollisionFlags(idx, flags);
+    QPoint pos = _actorPool.position(idx);
+    updateCollisionFlags(pos, _actors.value(pos, ActorPool::None));
+}
+
+void Scene::addSpatial (int idx)
+{
+    QPoint pos = _actorPool.position(idx);
+    int flags = _actorPool.collisionFlags(idx);
+    if (flags != 0) {
+        setCollisionFlags(pos, flags, flags);
+    }
+    _actorBlocks[QPoint(pos.x() >> Block::LgSize, pos.y() >> Block::LgSize)].append(idx);
+    
+    // add to actor list
+    QHash<QPoint, int>::iterator it = _actors.find(pos);
+    int character = _actorPool.character(idx);
+    if (character == ' ') {
+        // add invisible actors to the end of the list
+        if (it == _actors.end()) {
+            _actors.insert(pos, idx);
+
+        } else {
+            int ptr = *it;
+            for (int next; (next = _actorPool.next(ptr)) != ActorPool::None; ptr = next);
+            _actorPool.setNext(ptr, idx);
+        }
+        return;
+    }
+    if (it == _actors.end()) {
+        _actors.insert(pos, idx);
+
+    } else {
+        _actorPool.setNext(idx, *it);
+        *it = idx;
+    }
+
+    // set in block and dirty
+    setInBlocks(pos, character, _actorPool.labelPointer(idx));
+}
+
+void Scene::removeSpatial (int idx, int character, const QPoint* npos)
+{
+    // remove from query index
+    QPoint pos = _actorPool.position(idx);
+    QHash<QPoint, QVector<int> >::iterator bit = _actorBlocks.find(
+        QPoint(pos.x() >> Block::LgSize, pos.y() >> Block::LgSize));
+    int bidx = (bit == _actorBlocks.end()) ? -1 : bit->indexOf(idx);
+    if (bidx == -1) {
+        qWarning() << "Actor missing from query index." << idx << pos;
+    } else {
+        QVector<int>& bidxs = *bit;
+        bidxs[bidx] = bidxs.last();
+        bidxs.pop_back();
+        if (bidxs.isEmpty()) {
+            _actorBlocks.erase(bit);
+        }
+    }
+
+    // remove from actor list
+    QHash<QPoint, int>::iterator it = _actors.find(pos);
+    if (it == _actors.end()) {
+        qWarning() << "Actor missing from actor list." << idx << pos;
+        return;
+    }
+    int next = _actorPool.next(idx);
+    _actorPool.setNext(idx, ActorPool::None);
+    if (*it != idx) {
+        // actor is not on top, so no need to update block
+        int ptr = *it;
+        while (_actorPool.next(ptr) != idx) {
+            ptr = _actorPool.next(ptr);
+        }
+        _actorPool.setNext(ptr, next);
+        if (_actorPool.collisionFlags(idx) != 0) {
+            updateCollisionFlags(pos, *it);
+        }
+        return;
+    }
+    int nchar;
+    LabelPointer nlabel;
+    if (next == ActorPool::None) {
+        _actors.erase(it);
+        nchar = _record.get(pos);
+        nlabel = 0;
+        
+    } else {
+        *it = next;
+        if ((nchar = _actorPool.character(next)) == ' ') {
+            nchar = _record.get(pos);
+            nlabel = 0;
+            
+        } else {
+            nlabel = _actorPool.labelPointer(next);
+        }
+    }
+
+    // update block and dirty
+    setInBlocks(pos, nchar, nlabel, npos);
+    
+    // update the collision flags if appropriate
+    if (_actorPool.collisionFlags(idx) != 0) {
+        updateCollisionFlags(pos, next);
+    }
+}
+
+void Scene::characterLabelChanged (int idx, int ochar)
+{
+    // actors changing between visible and invisible move to the other end of the actor list,
+    // remaining in the query index
+    int nchar = _actorPool.character(idx);
+    if ((nchar == ' ') != (ochar == ' ')) {
+        removeSpatial(idx, ochar);
+        addSpatial(idx);
+        return;
+    }
+    if (nchar == ' ') {
+        return;
+    }
+    QPoint pos = _actorPool.position(idx);
+    if (_actors.value(pos, ActorPool::None) == idx) {
+        setInBlocks(pos, nchar, _actorPool.labelPointer(idx));
+    }
+}
+
+void Scene::addSpatial (SceneView* view)
+{
+    // add to lists for all intersecting blocks
+    const QRect& bounds = view->worldBounds();
+    int x1 = bounds.left() >> LgViewBlockSize;
+    int x2 = bounds.right() >> LgViewBlockSize;
+    int y1 = bounds.top() >> LgViewBlockSize;
+    int y2 = bounds.bottom() >> LgViewBlockSize;
+    for (int yy = y1; yy <= y2; yy++) {
+        for (int xx = x1; xx <= x2; xx++) {
+            _views[QPoint(xx, yy)].append(view);
+        }
+    }
+
+    // make sure the surrounding blocks are loaded
+    if (_paged) {
+        prefetch(bounds);
+    }
+}
+
+void Scene::removeSpatial (SceneView* view)
+{
+    // remove from lists in all intersecting blocks
+    const QRect& bounds = view->worldBounds();
+    int x1 = bounds.left() >> LgViewBlockSize;
+    int x2 = bounds.right() >> LgViewBlockSize;
+    int y1 = bounds.top() >> LgViewBlockSize;
+    int y2 = bounds.bottom() >> LgViewBlockSize;
+    for (int yy = y1; yy <= y2; yy++) {
+        for (int xx = x1; xx <= x2; xx++) {
+            QPoint key(xx, yy);
+            SceneViewList& list = _views[key];
+            list.removeOne(view);
+            if (list.isEmpty()) {
+                _views.remove(key);
+            }
+        }
+    }
+}
+
+/**
+ * Contains all the information associated with a node.
+ */
+class Node
+{
+public:
+
+    /** Whether or not the node is in the closed set. */
+    unsigned int closed : 1;
+    
+    /** Whether or not the node is in the open set. */
+    unsigned int open : 1;
+    
+    /** The distance from the source node. */
+    unsigned int gScore : 14;
+    
+    /** The combined distance and heuristic estimate. */
+    unsigned int fScore : 14;
+    
+    /** The direction from which we traveled. */
+    unsigned int cameFrom : 2;
+};
+
+/**
+ * Functor to compare two nodes by their scores.
+ */
+class NodeScoreGreater
+{
+public:
+
+    /**
+     * Creates a new node comparer.
+     */
+    NodeScoreGreater (const QHash<QPoint, Node>* nodes) : _nodes(nodes) { }
+
+    /**
+     * Returns whether or not the score of the first point is greater than that of the second.
+     */
+    bool operator() (const QPoint& p1, const QPoint& p2)
+    {
+        return _nodes->value(p1).fScore > _nodes->value(p2).fScore;
+    }
+
+protected:
+    
+    /** The map from point to node. */
+    const QHash<QPoint, Node>* _nodes;
+};
+
+/** The directions in which paths may travel, indexed by Node::cameFrom. */
+static const QPoint PathDirections[] = {
+    QPoint(-1, 0), QPoint(1, 0), QPoint(0, -1), QPoint(0, 1) };
+
+/** The maximum path length, limited by the range of the node scores. */
+static const int MaxPathLength = (1 << 14) - 1;
+
+QVector<QPoint> Scene::findPath (
+    const QPoint& start, const QPoint& end, int collisionMask, int maxLength) const
+{
+    maxLength = qMin(maxLength, MaxPathLength);
+    QPoint delta = end - start;
+    if (delta.manhattanLength() > maxLength || collides(end, collisionMask)) {
+        return QVector<QPoint>();
+    }
+
+    // if the straight path (horizontal, then vertical) is clear, we can skip the search
+    QVector<QPoint> path;
+    path.reserve(delta.manhattanLength());
+    for (int ii = 1, dx = delta.x() < 0 ? -1 : 1, nn = qAbs(delta.x()); ii <= nn; ii++) {
+        path.append(QPoint(start.x() + ii*dx, start.y()));
+    }
+    for (int ii = 1, dy = delta.y() < 0 ? -1 : 1, nn = qAbs(delta.y()); ii <= nn; ii++) {
+        path.append(QPoint(end.x(), start.y() + ii*dy));
+    }
+    if (!collides(path, collisionMask)) {
+        return path;
+    }
+
+    QHash<QPoint, Node> nodes;
+    NodeScoreGreater compare(&nodes);
+    priority_queue<QPoint, QVector<QPoint>, NodeScoreGreater> open(compare);
     
     Node first = { false, true, 0, (start - end).manhattanLength() };
     nodes.insert(start, first);
@@ -369,79 +1115,901 @@ QVector<QPoint> Scene::findPath (
     while (!open.empty()) {
         QPoint current = open.top();
         if (current == end) {
-            QVector<QPoint> path;
-            while (current != start) {
-                path.append(current);
-                
+            int length = nodes.value(current).gScore;
+            path.resize(length);
+            for (int ii = length - 1; ii >= 0; ii--) {
+                path[ii] = current;
+                current -= PathDirections[nodes.value(current).cameFrom];
+            }
+            return path;
+        }
+        open.pop();
+        Node& cnode = nodes[current];
+        if (cnode.closed) {
+            continue; // a stale entry for a node that was reached by a shorter path
+        }
+        cnode.closed = true;
+        int ngscore = cnode.gScore + 1;
+        for (int ii = 0; ii < 4; ii++) {
+            // skip neighbors from which the end can't be reached within the maximum length
+            QPoint neighbor = current + PathDirections[ii];
+            int nfscore = ngscore + (neighbor - end).manhattanLength();
+            if (nfscore > maxLength || collides(neighbor, collisionMask)) {
+                continue;
+            }
+            Node& nnode = nodes[neighbor];
+            if (nnode.closed || (nnode.open && ngscore >= (int)nnode.gScore)) {
+                continue;
+            }
+            nnode.open = true;
+            nnode.gScore = ngscore;
+            nnode.fScore = nfscore;
+            nnode.cameFrom = ii;
+            open.push(neighbor);
+        }
+    }
+    
+    return QVector<QPoint>();
+}
+
+/**
+ * Delivers a chat message to a number of sessions, formatting and wrapping it only once for each
+ * distinct combination of translator (that is, locale) and line width.
+ */
+class ChatFanout
+{
+public:
+
+    /**
+     * Creates a new fan-out for the specified message.
+     */
+    ChatFanout (const QString& speaker, const QString& message, ChatWindow::SpeakMode mode) :
+        _speaker(speaker), _message(message), _mode(mode) { }
+
+    /**
+     * Displays the message in the chat window of the specified session.
+     */
+    void display (Session* session)
+    {
+        ChatWindow* window = session->chatWindow();
+        QPair<QTranslator*, int> key(session->translator(), window->lineWidth());
+        QHash<QPair<QTranslator*, int>, QStringList>::const_iterator it = _lines.constFind(key);
+        if (it == _lines.constEnd()) {
+            it = _lines.insert(key, ChatWindow::wrap(ChatWindow::format(
+                key.first, _speaker, _message, _mode), key.second));
+        }
+        window->displayLines(*it);
+    }
+
+protected:
+
+    /** The name of the speaker. */
+    const QString& _speaker;
+
+    /** The message spoken. */
+    const QString& _message;
+
+    /** The mode of speech. */
+    ChatWindow::SpeakMode _mode;
+
+    /** The wrapped lines for each translator and line width. */
+    QHash<QPair<QTranslator*, int>, QStringList> _lines;
+};
+
+void Scene::say (
+    const QPoint& pos, const QString& speaker, const QString& message, ChatWindow::SpeakMode mode)
+{
+    ChatFanout fanout(speaker, message, mode);
+    if (mode == ChatWindow::ShoutMode) {
+        // at least for now, shouting reaches everyone in the scene
+        foreach (Session* session, _sessions) {
+            fanout.display(session);
+        }
+        return;
+    }
+    QPoint key(pos.x() >> LgViewBlockSize, pos.y() >> LgViewBlockSize);
+    QHash<QPoint, SceneViewList>::const_iterator it = _views.constFind(key);
+    if (it != _views.constEnd()) {
+        foreach (SceneView* view, *it) {
+            const QRect& vbounds = view->worldBounds();
+            if (vbounds.contains(pos)) {
+                fanout.display(view->session());
+            }
+        }
+    }
+}
+
+void Scene::blocksLoaded (const QRect& keys, const SceneBlockHash& blocks)
+{
+    QList<QPoint> baselines;
+    for (SceneBlockHash::const_iterator it = blocks.constBegin(), end = blocks.constEnd();
+            it != end; it++) {
+        const QPoint& key = it.key();
+        if (!_record.unloaded.remove(key)) {
+            continue; // already loaded by an overlapping request
+        }
+        _requestedBlocks.remove(key);
+        addLoadedBlock(key, it.value());
+        if (_generator != 0) {
+            baselines.append(key);
+        }
+    }
+
+    // generate the baselines of modified blocks in the pool, for comparison when flushing
+    if (!baselines.isEmpty()) {
+        _app->sceneManager()->generateBlocks(_generator, baselines, Callback(_this,
+            "baselinesGenerated(int,SceneBlockHash)", Q_ARG(int, _generatorVersion)));
+    }
+
+    // requested blocks that weren't returned have since been removed from the database
+    for (int yy = keys.top(); yy <= keys.bottom(); yy++) {
+        for (int xx = keys.left(); xx <= keys.right(); xx++) {
+            QPoint key(xx, yy);
+            if (!(_record.unloaded.contains(key) && _requestedBlocks.remove(key))) {
+                continue;
+            }
+            _record.unloaded.remove(key);
+            if (_generator != 0) {
+                _record.modified.remove(key);
+                loadBlocks(QRect(key, QSize(1, 1)));
+
+            } else {
+                foreach (const PositionCharacter& change, _deferredSets.take(key)) {
+                    set(change.first, change.second);
+                }
+            }
+        }
+    }
+}
+
+void Scene::blocksGenerated (int version, const SceneBlockHash& blocks)
+{
+    if (version != _generatorVersion) {
+        return;
+    }
+    for (SceneBlockHash::const_iterator it = blocks.constBegin(), end = blocks.constEnd();
+            it != end; it++) {
+        const QPoint& key = it.key();
+        if (!isLoaded(key) && !_record.unloaded.contains(key) && _requestedBlocks.remove(key)) {
+            // the record block shares the baseline's data until changed
+            _baselines.insert(key, it.value());
+            addLoadedBlock(key, it.value());
+        }
+    }
+}
+
+void Scene::baselinesGenerated (int version, const SceneBlockHash& blocks)
+{
+    if (version != _generatorVersion) {
+        return;
+    }
+    for (SceneBlockHash::const_iterator it = blocks.constBegin(), end = blocks.constEnd();
+            it != end; it++) {
+        const QPoint& key = it.key();
+        if (_record.blocks.contains(key) && !_baselines.contains(key)) {
+            _baselines.insert(key, it.value());
+        }
+    }
+}
+
+void Scene::flush ()
+{
+    _autosaveTimer->stop();
+
+    // instances of paged scenes load the blocks that they lack from the database, so we must
+    // not publish edits to those blocks until they've been stored
+    SceneEdits edits = takeEdits();
+    if (!(_paged && (_record.dirty() || !_flushingEdits.isEmpty()))) {
+        publish(edits);
+        edits.blocks.clear();
+    }
+    if (!_record.dirty()) {
+        // any remaining edits were stored by the flushes under way
+        if (!edits.blocks.isEmpty()) {
+            _flushingEdits.last().blocks += edits.blocks;
+        }
+        return;
+    }
+
+    // send only the changed blocks
+    SceneBlockChanges changes = _record.takeChanges();
+    if (_generator != 0) {
+        // and of those, only the ones that differ from the baseline
+        SceneBlockHash updated = changes.updated;
+        changes.updated.clear();
+        for (SceneBlockHash::const_iterator it = updated.constBegin(),
+                end = updated.constEnd(); it != end; it++) {
+            // blocks whose baselines are still being generated are treated as different
+            const QPoint& key = it.key();
+            QHash<QPoint, SceneRecord::Block>::const_iterator bit = _baselines.constFind(key);
+            if (bit != _baselines.constEnd() && it.value() == *bit) {
+                if (_record.modified.remove(key)) {
+                    changes.removed.append(key);
+                }
+            } else if (_record.modified.contains(key)) {
+                changes.updated.insert(key, it.value());
+
+            } else {
+                _record.modified.insert(key);
+                changes.added.insert(key, it.value());
+            }
+        }
+    }
+    _flushingEdits.append(edits);
+    _app->databasePool()->sceneRepository(_record.id)->invoke("updateSceneBlocks",
+        Q_ARG(const SceneBlockChanges&, changes), Q_ARG(const Callback&, Callback(_this,
+            "blocksFlushed(SceneBlockChanges,bool)",
+            Q_ARG(const SceneBlockChanges&, changes))));
+}
+
+void Scene::blocksFlushed (const SceneBlockChanges& changes, bool success)
+{
+    SceneEdits edits = _flushingEdits.takeFirst();
+    if (success) {
+        publish(edits);
+        if (_generatorResetPending && _flushingEdits.isEmpty()) {
+            resetGenerator();
+        }
+        return;
+    }
+    // publish the edits with the next flush, before any made since
+    if (!_flushingEdits.isEmpty()) {
+        _flushingEdits.first().blocks = edits.blocks + _flushingEdits.first().blocks;
+
+    } else {
+        foreach (const SceneBlockEdit& edit, edits.blocks) {
+            QVector<int>& cells = _pendingEdits[edit.key];
+            cells = edit.cells + cells;
+        }
+    }
+
+    // the stored blocks are as they were, so mark the changes again (generated scenes mark all
+    // changes as updates, to be compared against the baseline)
+    for (int ii = 0; ii < 2; ii++) {
+        const SceneBlockHash& blocks = (ii == 0) ? changes.added : changes.updated;
+        for (SceneBlockHash::const_iterator it = blocks.constBegin(), end = blocks.constEnd();
+                it != end; it++) {
+            const QPoint& key = it.key();
+            if (_record.blocks.contains(key) && !_record.added.contains(key)) {
+                _record.updated.insert(key);
+            }
+        }
+    }
+    foreach (const QPoint& key, changes.removed) {
+        if (_generator != 0) {
+            _record.modified.insert(key);
+            if (_record.blocks.contains(key)) {
+                _record.updated.insert(key);
+            }
+        } else if (!(_record.blocks.contains(key) || _record.added.contains(key))) {
+            _record.removed.insert(key);
+        }
+    }
+    if (_record.dirty() && !_autosaveTimer->isActive()) {
+        _autosaveTimer->start();
+    }
+    if (_generatorResetPending && _flushingEdits.isEmpty()) {
+        resetGenerator();
+    }
+}
+
+void Scene::publishEdits ()
+{
+    if (_paged) {
+        flush();
+    } else {
+        publish(takeEdits());
+    }
+}
+
+void Scene::applyEdits (const SceneEdits& edits)
+{
+    foreach (const SceneBlockEdit& edit, edits.blocks) {
+        const QPoint& key = edit.key;
+        if (isLoaded(key)) {
+            applyEdit(edit);
+
+        } else if (_requestedBlocks.contains(key)) {
+            // the loaded version may predate the edit, so we apply it on arrival
+            _deferredEdits[key].append(edit);
+
+        } else if (_generator != 0 && !_record.unloaded.contains(key)) {
+            // the edit will be stored, so we must load rather than generate the block
+            _record.modified.insert(key);
+            _record.unloaded.insert(key);
+        }
+    }
+}
+
+SceneEdits Scene::takeEdits ()
+{
+    _publishTimer->stop();
+    SceneEdits edits = { _record.id, _instance->info().id };
+    for (QHash<QPoint, QVector<int> >::const_iterator it = _pendingEdits.constBegin(),
+            end = _pendingEdits.constEnd(); it != end; it++) {
+        SceneBlockEdit edit = { it.key(), it.value() };
+        edits.blocks.append(edit);
+    }
+    _pendingEdits.clear();
+    return edits;
+}
+
+void Scene::publish (const SceneEdits& edits)
+{
+    if (!edits.blocks.isEmpty()) {
+        _app->peerManager()->invoke(_app->sceneManager(), "sceneEdited(SceneEdits)",
+            Q_ARG(const SceneEdits&, edits));
+    }
+}
+
+void Scene::updateCollisionFlags (const QPoint& pos, int idx)
+{
+    int flags = 0;
+    for (; idx != ActorPool::None; idx = _actorPool.next(idx)) {
+        flags |= _actorPool.collisionFlags(idx);
+    }
+    setCollisionFlags(pos, flags, _collisionBits | flags);
+}
+
+void Scene::setCollisionFlags (const QPoint& pos, int flags, int mask)
+{
+    QPoint key(pos.x() >> CollisionBlock::LgSize, pos.y() >> CollisionBlock::LgSize);
+    for (int bit = 0; mask != 0; bit++) {
+        int flag = 1 << bit;
+        if ((mask & flag) == 0) {
+            continue;
+        }
+        mask &= ~flag;
+        CollisionPlane& plane = _collisionPlanes[bit];
+        if (flags & flag) {
+            plane[key].set(pos, true);
+            _collisionBits |= flag;
+            continue;
+        }
+        CollisionPlane::iterator it = plane.find(key);
+        if (it == plane.end()) {
+            continue;
+        }
+        it->set(pos, false);
+        if (it->filled() == 0) {
+            plane.erase(it);
+            if (plane.isEmpty()) {
+                _collisionBits &= ~flag;
+            }
+        }
+    }
+}
+
+quint32 Scene::collisionRow (const QPoint& key, int y, int mask) const
+{
+    quint32 row = 0;
+    for (int bit = 0; mask != 0; bit++) {
+        int flag = 1 << bit;
+        if ((mask & flag) == 0) {
+            continue;
+        }
+        mask &= ~flag;
+        const CollisionPlane& plane = _collisionPlanes[bit];
+        CollisionPlane::const_iterator it = plane.constFind(key);
+        if (it != plane.constEnd()) {
+            row |= it->row(y);
+        }
+    }
+    return row;
+}
+
+void Scene::copyRecordBlock (const QPoint& key, const SceneRecord::Block& sblock)
+{
+    // find the extents of the source block (inclusive)
+    int sx1 = key.x() << SceneRecord::Block::LgSize;
+    int sx2 = sx1 + SceneRecord::Block::Size - 1;
+    int sy1 = key.y() << SceneRecord::Block::LgSize;
+    int sy2 = sy1 + SceneRecord::Block::Size - 1;
+
+    // map them to destination blocks
+    int bx1 = sx1 >> Scene::Block::LgSize;
+    int bx2 = sx2 >> Scene::Block::LgSize;
+    int by1 = sy1 >> Scene::Block::LgSize;
+    int by2 = sy2 >> Scene::Block::LgSize;
+
+    // iterate over intersected destination blocks
+    for (int by = by1; by <= by2; by++) {
+        for (int bx = bx1; bx <= bx2; bx++) {
+            Block& dblock = _blocks[QPoint(bx, by)];
+
+            // find the extents of the destination block
+            int dx1 = bx << Scene::Block::LgSize;
+            int dx2 = dx1 + Scene::Block::Size - 1;
+            int dy1 = by << Scene::Block::LgSize;
+            int dy2 = dy1 + Scene::Block::Size - 1;
+
+            // find the intersection extents
+            int x1 = qMax(sx1, dx1);
+            int x2 = qMin(sx2, dx2);
+            int y1 = qMax(sy1, dy1);
+            int y2 = qMin(sy2, dy2);
+
+            // copy the non-empty values in the area of intersection
+            const int* lsptr = sblock.constData() +
+                (y1 - sy1 << SceneRecord::Block::LgSize) + (x1 - sx1);
+            for (int yy = y1; yy <= y2; yy++) {
+                const int *sptr = lsptr;
+                for (int xx = x1; xx <= x2; xx++) {
+                    int value = *sptr++;
+                    if (value != ' ') {
+                        QPoint pos(xx, yy);
+                        int idx = _actors.value(pos, ActorPool::None);
+                        if (idx == ActorPool::None || _actorPool.character(idx) == ' ') {
+                            dblock.set(pos, value);
+                        }
+                    }
+                }
+                lsptr += SceneRecord::Block::Size;
+            }
+            if (dblock.filled() == 0) {
+                _blocks.remove(QPoint(bx, by));
+            }
+        }
+    }
+    updateTiles(QRect(sx1, sy1, SceneRecord::Block::Size, SceneRecord::Block::Size));
+}
+
+bool Scene::isLoaded (const QPoint& key) const
+{
+    return !(_record.unloaded.contains(key) || (_generator != 0 && !_record.blocks.contains(key)));
+}
+
+void Scene::loadBlocks (const QRect& keys)
+{
+    bool request = false;
+    QList<QPoint> generate;
+    for (int yy = keys.top(); yy <= keys.bottom(); yy++) {
+        for (int xx = keys.left(); xx <= keys.right(); xx++) {
+            QPoint key(xx, yy);
+            if (isLoaded(key) || _requestedBlocks.contains(key)) {
+                continue;
+            }
+            _requestedBlocks.insert(key);
+            if (_record.unloaded.contains(key)) {
+                request = true;
+            } else {
+                generate.append(key);
             }
-            return path;
         }
-        open.pop();
-        Node& cnode = nodes[current];
-        cnode.closed = true;
-        int ngscore = cnode.gScore + 1;
-        
-        for (int ii = 0; ii < 4; ii++) {
-            QPoint neighbor;
-            Node& nnode = nodes[neighbor];
-            if (nnode.closed) {
+    }
+    if (request) {
+        _app->databasePool()->sceneRepository(_record.id)->invoke("loadSceneBlocks",
+            Q_ARG(quint32, _record.id), Q_ARG(const QRect&, keys), Q_ARG(const Callback&,
+                Callback(_this, "blocksLoaded(QRect,SceneBlockHash)", Q_ARG(const QRect&, keys))));
+    }
+    if (!generate.isEmpty()) {
+        _app->sceneManager()->generateBlocks(_generator, generate, Callback(_this,
+            "blocksGenerated(int,SceneBlockHash)", Q_ARG(int, _generatorVersion)));
+    }
+}
+
+void Scene::addLoadedBlock (const QPoint& key, const SceneRecord::Block& block)
+{
+    _record.blocks.insert(key, block);
+    _blockAccess.insert(key, currentTimeMillis());
+    copyRecordBlock(key, block);
+    dirtyViews(QRect(key.x() << SceneRecord::Block::LgSize, key.y() << SceneRecord::Block::LgSize,
+        SceneRecord::Block::Size, SceneRecord::Block::Size));
+
+    // apply any changes made while the block was loading
+    foreach (const SceneBlockEdit& edit, _deferredEdits.take(key)) {
+        applyEdit(edit);
+    }
+    foreach (const PositionCharacter& change, _deferredSets.take(key)) {
+        set(change.first, change.second);
+    }
+}
+
+void Scene::prefetch (const QRect& bounds)
+{
+    int margin = _app->sceneManager()->scenePrefetchMargin();
+    QRect expanded = bounds.adjusted(-margin, -margin, margin, margin);
+    QRect keys(
+        QPoint(expanded.left() >> SceneRecord::Block::LgSize,
+            expanded.top() >> SceneRecord::Block::LgSize),
+        QPoint(expanded.right() >> SceneRecord::Block::LgSize,
+            expanded.bottom() >> SceneRecord::Block::LgSize));
+
+    // note the use of the loaded blocks
+    quint64 now = currentTimeMillis();
+    for (int yy = keys.top(); yy <= keys.bottom(); yy++) {
+        for (int xx = keys.left(); xx <= keys.right(); xx++) {
+            QPoint key(xx, yy);
+            if (_record.blocks.contains(key)) {
+                _blockAccess.insert(key, now);
+            }
+        }
+    }
+    loadBlocks(keys);
+}
+
+void Scene::pageOut (const QPoint& key)
+{
+    // unmodified generated blocks can simply be regenerated
+    SceneRecord::Block sblock = _record.blocks.take(key);
+    if (_generator == 0 || _record.modified.contains(key)) {
+        _record.unloaded.insert(key);
+    }
+    _blockAccess.remove(key);
+    _baselines.remove(key);
+
+    // clear the non-empty locations not covered by visible actors
+    int x1 = key.x() << SceneRecord::Block::LgSize;
+    int y1 = key.y() << SceneRecord::Block::LgSize;
+    const int* sptr = sblock.constData();
+    for (int yy = y1, y2 = y1 + SceneRecord::Block::Size; yy < y2; yy++) {
+        for (int xx = x1, x2 = x1 + SceneRecord::Block::Size; xx < x2; xx++) {
+            if (*sptr++ == ' ') {
                 continue;
             }
-            if (!nnode.open || ngscore < nnode.gScore) {
-                
+            QPoint pos(xx, yy);
+            int idx = _actors.value(pos, ActorPool::None);
+            if (idx == ActorPool::None || _actorPool.character(idx) == ' ') {
+                QPoint bkey(xx >> Block::LgSize, yy >> Block::LgSize);
+                Block& block = _blocks[bkey];
+                block.set(pos, ' ');
+                if (block.filled() == 0) {
+                    _blocks.remove(bkey);
+                }
             }
-            
         }
     }
-    
-    return QVector<QPoint>();
 }
 
-void Scene::say (
-    const QPoint& pos, const QString& speaker, const QString& message, ChatWindow::SpeakMode mode)
+void Scene::resetGenerator ()
 {
-    if (mode == ChatWindow::ShoutMode) {
-        // at least for now, shouting reaches everyone in the scene
-        foreach (Session* session, _sessions) {
-            session->chatWindow()->display(speaker, message, mode);
+    // a failed flush would mark its blocks modified again, so they mustn't be regenerated yet
+    if (!_flushingEdits.isEmpty()) {
+        _generatorResetPending = true;
+        return;
+    }
+    _generatorResetPending = false;
+    _generatorVersion++;
+
+    // blocks awaiting the old generator must be generated again
+    QList<QPoint> pending;
+    foreach (const QPoint& key, _requestedBlocks) {
+        if (!_record.unloaded.contains(key)) {
+            pending.append(key);
+        }
+    }
+    foreach (const QPoint& key, pending) {
+        _requestedBlocks.remove(key);
+    }
+
+    bool generated = _record.generated();
+    if (_generator != 0) {
+        // unchanged blocks hold the old baseline, so unload them to be replaced
+        foreach (const QPoint& key, _record.blocks.keys()) {
+            if (!(_record.modified.contains(key) || _record.added.contains(key) ||
+                    _record.updated.contains(key))) {
+                pageOut(key);
+                dirtyViews(QRect(key.x() << SceneRecord::Block::LgSize,
+                    key.y() << SceneRecord::Block::LgSize,
+                    SceneRecord::Block::Size, SceneRecord::Block::Size));
+                pending.append(key);
+            }
+        }
+        if (!generated) {
+            // the blocks that matched the baseline were never stored, so changes to them are
+            // additions
+            foreach (const QPoint& key, _record.updated) {
+                if (!_record.modified.contains(key)) {
+                    _record.updated.remove(key);
+                    _record.added.insert(key);
+                }
+            }
+            _record.modified.clear();
+        }
+    } else if (generated) {
+        // the stored blocks now differ from the baseline; the others are compared on flushing
+        foreach (const QPoint& key, _record.blocks.keys()) {
+            if (_record.added.remove(key)) {
+                _record.updated.insert(key);
+            } else {
+                _record.modified.insert(key);
+            }
+        }
+        _record.modified += _record.unloaded;
+    }
+    _generator = generated ? SceneGeneratorPointer(new SceneGenerator(
+        _record, _app->sceneManager()->sceneGeneratorCacheSize())) : SceneGeneratorPointer();
+    _paged = generated || !_record.unloaded.isEmpty();
+    _baselines.clear();
+
+    // without a generator, the blocks that were awaiting one are simply empty
+    if (_generator == 0) {
+        foreach (const QPoint& key, pending) {
+            foreach (const SceneBlockEdit& edit, _deferredEdits.take(key)) {
+                applyEdit(edit);
+            }
+            foreach (const PositionCharacter& change, _deferredSets.take(key)) {
+                set(change.first, change.second);
+            }
         }
         return;
     }
-    QPoint key(pos.x() >> LgViewBlockSize, pos.y() >> LgViewBlockSize);
-    QHash<QPoint, SceneViewList>::const_iterator it = _views.constFind(key);
-    if (it != _views.constEnd()) {
-        foreach (SceneView* view, *it) {
-            const QRect& vbounds = view->worldBounds();
-            if (vbounds.contains(pos)) {
-                view->session()->chatWindow()->display(speaker, message, mode);
+
+    // generate the new baselines of the remaining blocks and the contents of the replaced ones
+    QList<QPoint> baselines = _record.blocks.keys();
+    if (!baselines.isEmpty()) {
+        _app->sceneManager()->generateBlocks(_generator, baselines, Callback(_this,
+            "baselinesGenerated(int,SceneBlockHash)", Q_ARG(int, _generatorVersion)));
+    }
+    if (!pending.isEmpty()) {
+        foreach (const QPoint& key, pending) {
+            _requestedBlocks.insert(key);
+        }
+        _app->sceneManager()->generateBlocks(_generator, pending, Callback(_this,
+            "blocksGenerated(int,SceneBlockHash)", Q_ARG(int, _generatorVersion)));
+    }
+
+    // blocks that were empty may now have content
+    foreach (Session* session, _sessions) {
+        prefetch(session->mainWindow()->sceneView()->worldBounds());
+    }
+}
+
+void Scene::setRegion (const QRect& bounds, const int* data, int xstep, int stride)
+{
+    // proceed a record block at a time (scene blocks never span record blocks)
+    quint64 now = currentTimeMillis();
+    for (int by = bounds.top() >> SceneRecord::Block::LgSize,
+            by2 = bounds.bottom() >> SceneRecord::Block::LgSize; by <= by2; by++) {
+        for (int bx = bounds.left() >> SceneRecord::Block::LgSize,
+                bx2 = bounds.right() >> SceneRecord::Block::LgSize; bx <= bx2; bx++) {
+            QPoint key(bx, by);
+            QRect isect = bounds.intersected(QRect(
+                bx << SceneRecord::Block::LgSize, by << SceneRecord::Block::LgSize,
+                SceneRecord::Block::Size, SceneRecord::Block::Size));
+            const int* bptr = data + (isect.top() - bounds.top()) * stride +
+                (isect.left() - bounds.left()) * xstep;
+
+            // if the block hasn't been loaded, apply the changes when it arrives
+            if (_paged) {
+                if (!isLoaded(key)) {
+                    QList<PositionCharacter>& deferred = _deferredSets[key];
+                    for (int yy = isect.top(); yy <= isect.bottom(); yy++, bptr += stride) {
+                        const int* ptr = bptr;
+                        for (int xx = isect.left(); xx <= isect.right(); xx++, ptr += xstep) {
+                            deferred.append(PositionCharacter(QPoint(xx, yy), *ptr));
+                        }
+                    }
+                    loadBlocks(QRect(key, QSize(1, 1)));
+                    continue;
+                }
+                _blockAccess.insert(key, now);
+            }
+            _record.set(isect, bptr, xstep, stride);
+            QVector<int>& edits = _pendingEdits[key];
+
+            // update the scene blocks, notifying actors on top of changed locations
+            for (int sby = isect.top() >> Block::LgSize, sby2 = isect.bottom() >> Block::LgSize;
+                    sby <= sby2; sby++) {
+                for (int sbx = isect.left() >> Block::LgSize,
+                        sbx2 = isect.right() >> Block::LgSize; sbx <= sbx2; sbx++) {
+                    QPoint skey(sbx, sby);
+                    QRect sisect = isect.intersected(QRect(sbx << Block::LgSize,
+                        sby << Block::LgSize, Block::Size, Block::Size));
+                    Block& block = _blocks[skey];
+                    const int* lptr = bptr + (sisect.top() - isect.top()) * stride +
+                        (sisect.left() - isect.left()) * xstep;
+                    for (int yy = sisect.top(); yy <= sisect.bottom(); yy++, lptr += stride) {
+                        const int* ptr = lptr;
+                        for (int xx = sisect.left(); xx <= sisect.right(); xx++, ptr += xstep) {
+                            QPoint pos(xx, yy);
+                            edits.append((yy & SceneRecord::Block::Mask) <<
+                                SceneRecord::Block::LgSize | xx & SceneRecord::Block::Mask);
+                            edits.append(*ptr);
+                            if (!changedUnderneath(pos, *ptr)) {
+                                block.set(pos, *ptr);
+                            }
+                        }
+                    }
+                    if (block.filled() == 0) {
+                        _blocks.remove(skey);
+                    }
+                }
             }
         }
     }
+
+    updateTiles(bounds);
+
+    // schedule an autosave and publication if necessary
+    if (_record.dirty() && !_autosaveTimer->isActive()) {
+        _autosaveTimer->start();
+    }
+    if (!(_pendingEdits.isEmpty() || _publishTimer->isActive())) {
+        _publishTimer->start();
+    }
+}
+
+void Scene::addEdit (const QPoint& pos, int character)
+{
+    QVector<int>& edits = _pendingEdits[QPoint(
+        pos.x() >> SceneRecord::Block::LgSize, pos.y() >> SceneRecord::Block::LgSize)];
+    edits.append((pos.y() & SceneRecord::Block::Mask) << SceneRecord::Block::LgSize |
+        pos.x() & SceneRecord::Block::Mask);
+    edits.append(character);
+    if (!_publishTimer->isActive()) {
+        _publishTimer->start();
+    }
+}
+
+void Scene::applyEdit (const SceneBlockEdit& edit)
+{
+    // update the record block directly, so as not to mark it dirty
+    const QPoint& key = edit.key;
+    SceneRecord::Block& sblock = _record.blocks[key];
+    QPoint origin(key.x() << SceneRecord::Block::LgSize, key.y() << SceneRecord::Block::LgSize);
+    QRect bounds;
+    for (const int* ptr = edit.cells.constBegin(), *end = edit.cells.constEnd(); ptr < end; ) {
+        int idx = *ptr++;
+        int character = *ptr++;
+        QPoint pos = origin + QPoint(idx & SceneRecord::Block::Mask,
+            idx >> SceneRecord::Block::LgSize);
+        sblock.set(pos, character);
+        bounds |= QRect(pos, QSize(1, 1));
+
+        // update the scene block, unless covered by an actor
+        if (changedUnderneath(pos, character)) {
+            continue;
+        }
+        QPoint bkey(pos.x() >> Block::LgSize, pos.y() >> Block::LgSize);
+        Block& block = _blocks[bkey];
+        block.set(pos, character);
+        if (block.filled() == 0) {
+            _blocks.remove(bkey);
+        }
+    }
+    if (sblock.filled() == 0 && !_record.generated()) {
+        _record.blocks.remove(key);
+    }
+    updateTiles(bounds);
+    dirtyViews(bounds);
 }
 
-void Scene::flush ()
+bool Scene::changedUnderneath (const QPoint& pos, int character)
+{
+    int idx = _actors.value(pos, ActorPool::None);
+    if (idx == ActorPool::None) {
+        return false;
+    }
+    Actor* actor = _actorPool.object(idx);
+    if (actor != 0) {
+        actor->sceneChangedUnderneath(character);
+    }
+    return true;
+}
+
+void Scene::dirtyViews (const QRect& bounds)
 {
-    if (_record.dirty()) {
-        QMetaObject::invokeMethod(_app->databaseThread()->sceneRepository(), "updateSceneBlocks",
-            Q_ARG(const SceneRecord&, _record));
-        _record.clean();
+    // a view may be listed in more than one view block, so collect them first
+    QSet<SceneView*> views;
+    for (int yy = bounds.top() >> LgViewBlockSize, y2 = bounds.bottom() >> LgViewBlockSize;
+            yy <= y2; yy++) {
+        for (int xx = bounds.left() >> LgViewBlockSize,
+                x2 = bounds.right() >> LgViewBlockSize; xx <= x2; xx++) {
+            foreach (SceneView* view, _views.value(QPoint(xx, yy))) {
+                views.insert(view);
+            }
+        }
+    }
+    foreach (SceneView* view, views) {
+        const QRect& vbounds = view->worldBounds();
+        QRect isect = vbounds.intersected(bounds);
+        if (!isect.isEmpty()) {
+            static_cast<Component*>(view)->dirty(isect.translated(-vbounds.topLeft()));
+        }
     }
 }
 
-void Scene::updateCollisionFlags (const QPoint& pos, Actor* actor)
+void Scene::updateTiles (const QRect& bounds)
 {
-    int flags = 0;
-    for (; actor != 0; actor = actor->next()) {
-        flags |= actor->collisionFlags();
+    bool changed = false;
+    for (int by = bounds.top() >> Block::LgSize, by2 = bounds.bottom() >> Block::LgSize;
+            by <= by2; by++) {
+        for (int bx = bounds.left() >> Block::LgSize, bx2 = bounds.right() >> Block::LgSize;
+                bx <= bx2; bx++) {
+            QPoint key(bx, by);
+            QHash<QPoint, Block>::const_iterator bit = _blocks.constFind(key);
+            const Block* block = (bit == _blocks.constEnd()) ? 0 : &*bit;
+            QHash<QPoint, Tile>::iterator it = _tiles.find(key);
+            if (it == _tiles.end()) {
+                if (block == 0) {
+                    continue;
+                }
+                it = _tiles.insert(key, Tile());
+            }
+            QPoint origin(bx << Block::LgSize, by << Block::LgSize);
+            if (it->update(block, bounds.intersected(
+                    QRect(origin, QSize(Block::Size, Block::Size))).translated(-origin))) {
+                changed = true;
+                if (it->empty()) {
+                    _tiles.erase(it);
+                }
+            }
+        }
     }
-    QPoint key(pos.x() >> Block::LgSize, pos.y() >> Block::LgSize);
-    FlagBlock& block = _collisionFlags[key];
-    block.set(pos, flags);
-    if (block.filled() == 0) {
-        _collisionFlags.remove(key);
+    if (changed) {
+        foreach (Minimap* minimap, _minimaps) {
+            minimap->tilesChanged(bounds);
+        }
+    }
+}
+
+void Scene::getSummaryRow (int level, int x, int y, int width, int* dest) const
+{
+    int lgSize = Tile::lgSize(level);
+    int mask = (1 << lgSize) - 1;
+    int ty = y & mask;
+    for (int xx = x, x2 = x + width; xx < x2; ) {
+        // copy the span of the row within the tile, or fill it with spaces if there's no tile
+        int tx = xx & mask;
+        int span = qMin(x2 - xx, (1 << lgSize) - tx);
+        QHash<QPoint, Tile>::const_iterator it = _tiles.constFind(
+            QPoint(xx >> lgSize, y >> lgSize));
+        if (it == _tiles.constEnd()) {
+            qFill(dest, dest + span, (int)' ');
+        } else {
+            for (int ii = 0; ii < span; ii++) {
+                dest[ii] = it->get(level, tx + ii, ty);
+            }
+        }
+        dest += span;
+        xx += span;
+    }
+}
+
+void Scene::updateLabelIndex (const QPoint& pos, LabelPointer label)
+{
+    if (label != 0) {
+        _labelRows[pos.y()].insert(pos.x(), label);
+        _labelColumns[pos.x()].insert(pos.y(), label);
+        return;
+    }
+    QHash<int, QMap<int, LabelPointer> >::iterator it = _labelRows.find(pos.y());
+    if (it != _labelRows.end() && it->remove(pos.x()) != 0 && it->isEmpty()) {
+        _labelRows.erase(it);
+    }
+    it = _labelColumns.find(pos.x());
+    if (it != _labelColumns.end() && it->remove(pos.y()) != 0 && it->isEmpty()) {
+        _labelColumns.erase(it);
+    }
+}
+
+void Scene::indexPortals ()
+{
+    _portals.clear();
+    _portalBlocks.clear();
+    for (int ii = 0, nn = _record.portals.size(); ii < nn; ii++) {
+        const QPoint& pos = _record.portals.at(ii).position;
+        _portals.insert(pos, ii);
+        QPoint key(pos.x() >> LgPortalBlockSize, pos.y() >> LgPortalBlockSize);
+        _portalBlocks[key].append(ii);
     }
 }
 
+void Scene::updatePortals (const QList<ScenePortal>& portals)
+{
+    // apply immediately, so that further changes build on this one
+    _record.portals = portals;
+    indexPortals();
+    SceneRecord record = _record;
+
+    // update in database
+    _app->databasePool()->sceneRepository(_record.id)->invoke("updateScene",
+        Q_ARG(const SceneRecord&, record), Q_ARG(const Callback&, Callback(
+            _app->sceneManager(), "broadcastSceneUpdated(SceneRecord)",
+            Q_ARG(const SceneRecord&, record))));
+}
+
 void Scene::setInBlocks (const QPoint& pos, int character, LabelPointer label, const QPoint* npos)
 {
     QPoint key(pos.x() >> Block::LgSize, pos.y() >> Block::LgSize);
@@ -458,6 +2026,12 @@ void Scene::setInBlocks (const QPoint& pos, int character, LabelPointer label, c
     if (ochar == character && olabel == label) {
         return;
     }
+    if (olabel != label) {
+        updateLabelIndex(pos, label);
+    }
+    if (ochar != character) {
+        updateTiles(QRect(pos, QSize(1, 1)));
+    }
     QPoint vkey(pos.x() >> LgViewBlockSize, pos.y() >> LgViewBlockSize);
     QHash<QPoint, SceneViewList>::const_iterator it = _views.constFind(vkey);
     if (it != _views.constEnd()) {
@@ -476,3 +2050,263 @@ void Scene::setInBlocks (const QPoint& pos, int character, LabelPointer label, c
     }
 }
 
+/** The value of Block::_lgBits indicating full-width storage. */
+static const int FullWidthLgBits = 5;
+
+/**
+ * Helper function for Scene::Block: extracts a palette index from packed data.
+ */
+static inline int unpack (const quint32* data, int lgBits, int idx)
+{
+    int lgPerWord = 5 - lgBits;
+    int shift = (idx & ((1 << lgPerWord) - 1)) << lgBits;
+    return (data[idx >> lgPerWord] >> shift) & ((1 << (1 << lgBits)) - 1);
+}
+
+/**
+ * Helper function for Scene::Block: stores a palette index in packed data.
+ */
+static inline void pack (quint32* data, int lgBits, int idx, int pidx)
+{
+    int lgPerWord = 5 - lgBits;
+    int shift = (idx & ((1 << lgPerWord) - 1)) << lgBits;
+    quint32 mask = (quint32)((1 << (1 << lgBits)) - 1) << shift;
+    quint32& word = data[idx >> lgPerWord];
+    word = (word & ~mask) | ((quint32)pidx << shift);
+}
+
+Scene::Block::Block () :
+    _palette(1, ' '),
+    _counts(1, Size*Size),
+    _data((Size*Size) >> 5, 0),
+    _lgBits(0),
+    _filled(0)
+{
+}
+
+int Scene::Block::set (const QPoint& pos, int value)
+{
+    int idx = (pos.y() & Mask) << LgSize | pos.x() & Mask;
+    int ovalue = get(idx);
+    if (ovalue == value) {
+        return ovalue;
+    }
+    _filled += (ovalue == ' ') - (value == ' ');
+
+    int pidx = paletteIndex(value);
+    if (pidx == -1) {
+        _data[idx] = value;
+
+    } else {
+        _counts[unpack(_data.constData(), _lgBits, idx)]--;
+        _counts[pidx]++;
+        pack(_data.data(), _lgBits, idx, pidx);
+    }
+    return ovalue;
+}
+
+void Scene::Block::getRow (int x, int y, int width, int* dest) const
+{
+    int idx = y << LgSize | x;
+    const quint32* data = _data.constData();
+    if (_lgBits == FullWidthLgBits) {
+        qCopy(data + idx, data + idx + width, dest);
+        return;
+    }
+    const int* palette = _palette.constData();
+    for (int* end = dest + width; dest < end; dest++, idx++) {
+        *dest = palette[unpack(data, _lgBits, idx)];
+    }
+}
+
+int Scene::Block::memoryUsage () const
+{
+    return sizeof(Block) + _palette.size()*sizeof(int) + _counts.size()*sizeof(quint16) +
+        _data.size()*sizeof(quint32);
+}
+
+int Scene::Block::get (int idx) const
+{
+    return (_lgBits == FullWidthLgBits) ? (int)_data.at(idx) :
+        _palette.at(unpack(_data.constData(), _lgBits, idx));
+}
+
+int Scene::Block::paletteIndex (int value)
+{
+    if (_lgBits == FullWidthLgBits) {
+        return -1;
+    }
+    int pidx = _palette.indexOf(value);
+    if (pidx != -1) {
+        return pidx;
+    }
+    // reuse an entry that's no longer referenced, if there is one
+    if ((pidx = _counts.indexOf(0)) != -1) {
+        _palette[pidx] = value;
+        return pidx;
+    }
+    // otherwise, append, widening the cells if the new index won't fit
+    pidx = _palette.size();
+    if (pidx == (1 << (1 << _lgBits))) {
+        repack(_lgBits == 3 ? FullWidthLgBits : _lgBits + 1);
+        if (_lgBits == FullWidthLgBits) {
+            return -1;
+        }
+    }
+    _palette.append(value);
+    _counts.append(0);
+    return pidx;
+}
+
+void Scene::Block::repack (int lgBits)
+{
+    QVector<quint32> ndata(lgBits == FullWidthLgBits ? Size*Size : (Size*Size << lgBits) >> 5, 0);
+    const quint32* odata = _data.constData();
+    quint32* data = ndata.data();
+    for (int ii = 0; ii < Size*Size; ii++) {
+        int pidx = unpack(odata, _lgBits, ii);
+        if (lgBits == FullWidthLgBits) {
+            data[ii] = _palette.at(pidx);
+        } else {
+            pack(data, lgBits, ii, pidx);
+        }
+    }
+    _data = ndata;
+    _lgBits = lgBits;
+    if (lgBits == FullWidthLgBits) {
+        _palette.clear();
+        _counts.clear();
+    }
+}
+
+Scene::CollisionBlock::CollisionBlock () :
+    _filled(0)
+{
+    qFill(_rows, _rows + Size, 0U);
+}
+
+void Scene::CollisionBlock::set (const QPoint& pos, bool value)
+{
+    quint32& row = _rows[pos.y() & Mask];
+    quint32 bit = 1U << (pos.x() & Mask);
+    if (((row & bit) != 0) != value) {
+        row ^= bit;
+        _filled += value ? 1 : -1;
+    }
+}
+
+bool Scene::CollisionBlock::intersects (int y1, int y2, quint32 span) const
+{
+    for (const quint32* row = _rows + (y1 & Mask), *end = _rows + (y2 & Mask); row <= end; row++) {
+        if (*row & span) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Helper function for Scene::Tile: returns the most common non-empty value in the provided array,
+ * or a space if all are empty.
+ */
+static int mostCommon (const int* values, int count)
+{
+    int best = ' ', bestCount = 0;
+    for (int ii = 0; ii < count; ii++) {
+        int value = values[ii];
+        if (value == ' ' || value == best) {
+            continue;
+        }
+        int valueCount = 1;
+        for (int jj = ii + 1; jj < count; jj++) {
+            valueCount += (values[jj] == value);
+        }
+        if (valueCount > bestCount) {
+            best = value;
+            bestCount = valueCount;
+        }
+    }
+    return best;
+}
+
+/** The number of summary cells (or block cells) from which each summary cell is computed. */
+static const int TileStepArea = 1 << (Scene::Tile::LgStep * 2);
+
+Scene::Tile::Tile ()
+{
+    for (int level = 0; level < LevelCount; level++) {
+        _levels[level] = QVector<int>(1 << (lgSize(level) * 2), ' ');
+    }
+}
+
+bool Scene::Tile::update (const Block* block, const QRect& bounds)
+{
+    int values[TileStepArea];
+    int step = 1 << LgStep;
+
+    // summarize the block cells at the finest level
+    bool changed = false;
+    QVector<int>& cells = _levels[0];
+    for (int yy = bounds.top() >> LgStep, y2 = bounds.bottom() >> LgStep; yy <= y2; yy++) {
+        for (int xx = bounds.left() >> LgStep, x2 = bounds.right() >> LgStep; xx <= x2; xx++) {
+            int value = ' ';
+            if (block != 0) {
+                for (int ii = 0; ii < step; ii++) {
+                    block->getRow(xx << LgStep, (yy << LgStep) + ii, step, values + ii*step);
+                }
+                value = mostCommon(values, TileStepArea);
+            }
+            int& cell = cells[yy << lgSize(0) | xx];
+            if (cell != value) {
+                cell = value;
+                changed = true;
+            }
+        }
+    }
+    bool anyChanged = changed;
+
+    // then each coarser level from the one before, as long as something changed
+    for (int level = 1; level < LevelCount && changed; level++) {
+        changed = false;
+        const QVector<int>& finer = _levels[level - 1];
+        QVector<int>& coarser = _levels[level];
+        int lgScale = Tile::lgScale(level), flgSize = lgSize(level - 1);
+        for (int yy = bounds.top() >> lgScale, y2 = bounds.bottom() >> lgScale; yy <= y2; yy++) {
+            for (int xx = bounds.left() >> lgScale, x2 = bounds.right() >> lgScale;
+                    xx <= x2; xx++) {
+                for (int ii = 0; ii < step; ii++) {
+                    const int* row = finer.constData() +
+                        (((yy << LgStep) + ii) << flgSize) + (xx << LgStep);
+                    qCopy(row, row + step, values + ii*step);
+                }
+                int value = mostCommon(values, TileStepArea);
+                int& cell = coarser[yy << lgSize(level) | xx];
+                if (cell != value) {
+                    cell = value;
+                    changed = true;
+                }
+            }
+        }
+    }
+    return anyChanged;
+}
+
+bool Scene::Tile::empty () const
+{
+    // the coarsest level is empty only if all the finer ones are
+    foreach (int value, _levels[LevelCount - 1]) {
+        if (value != ' ') {
+            return false;
+        }
+    }
+    return true;
+}
+
+int Scene::Tile::memoryUsage () const
+{
+    int usage = sizeof(Tile);
+    for (int level = 0; level < LevelCount; level++) {
+        usage += _levels[level].capacity() * sizeof(int);
+    }
+    return usage;
+}
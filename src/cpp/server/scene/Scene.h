@@ -5,13 +5,23 @@
 #define SCENE
 
 #include <QList>
+#include <QMap>
 #include <QObject>
 #include <QPair>
+#include <QVariant>
+#include <QVector>
 
 #include "actor/Actor.h"
 #include "chat/ChatWindow.h"
 #include "db/SceneRepository.h"
+#include "scene/SceneGenerator.h"
+#include "util/Callback.h"
 
+class QRect;
+class QTimer;
+
+class Instance;
+class Minimap;
 class Pawn;
 class SceneBlock;
 class SceneView;
@@ -19,21 +29,27 @@ class ServerApp;
 class Session;
 
 /**
- * The in-memory representation of a scene.
+ * The in-memory representation of a scene.  Scenes too large to load in their entirety are paged:
+ * blocks are loaded as views approach them (or as they are edited), and the least recently used
+ * blocks are unloaded when no longer needed.  Generated scenes are always paged; their blocks are
+ * generated in the scene manager's pool unless modified, in which case they're loaded.
  */
-class Scene : public QObject
+class Scene : public CallableObject
 {
     Q_OBJECT
 
 public:
 
     /**
-     * Template for the various block types.
+     * A directly renderable block of the scene.  Rather than storing each character in full,
+     * the block keeps a palette of the distinct values it contains and packs the palette indices
+     * into as few bits as possible (one, two, four, or eight), switching to full-width storage
+     * only when there are more than 256 distinct values.
      */
-    template<class T, int E> class GenericBlock : public QVector<T>
+    class Block
     {
     public:
-        
+
         /** The width/height of each block as a power of two. */
         static const int LgSize = 5;
 
@@ -42,73 +58,307 @@ public:
 
         /** The mask for coordinates. */
         static const int Mask = Size - 1;
-        
+
         /**
          * Creates an empty block.
          */
-        GenericBlock () : QVector<T>(Size*Size, E), _filled(0) { }
-        
+        Block ();
+
+        /**
+         * Returns the number of non-empty locations in the block.
+         */
+        int filled () const { return _filled; }
+
+        /**
+         * Sets the value at the specified position, returning the old value.
+         */
+        int set (const QPoint& pos, int value);
+
+        /**
+         * Returns the value at the specified position.
+         */
+        int get (const QPoint& pos) const {
+            return get((pos.y() & Mask) << LgSize | pos.x() & Mask); }
+
+        /**
+         * Expands part of a row of the block into the provided buffer.
+         *
+         * @param x the block-relative x coordinate at which to start.
+         * @param y the block-relative y coordinate of the row.
+         */
+        void getRow (int x, int y, int width, int* dest) const;
+
+        /**
+         * Returns the number of bytes occupied by the block.
+         */
+        int memoryUsage () const;
+
+    protected:
+
+        /**
+         * Returns the value at the specified index.
+         */
+        int get (int idx) const;
+
         /**
-         * Sets the number of non-empty locations in the block.
+         * Returns the palette index of the specified value, adding it to the palette (and
+         * widening the storage) if necessary.  Returns -1 if the block has switched to full-width
+         * storage.
          */
-        void setFilled (int filled) { _filled = filled; };
+        int paletteIndex (int value);
+
+        /**
+         * Repacks the cells using the specified number of bits per cell.
+         */
+        void repack (int lgBits);
+
+        /** The distinct values in the block. */
+        QVector<int> _palette;
+
+        /** The number of cells referring to each palette entry. */
+        QVector<quint16> _counts;
+
+        /** The packed palette indices or, in full-width mode, the values themselves. */
+        QVector<quint32> _data;
+
+        /** The base-two logarithm of the number of bits per cell (0-3, or 5 for full width). */
+        int _lgBits;
+
+        /** The number of non-empty locations in the block. */
+        int _filled;
+    };
+
+    /**
+     * Template for the sparse block types, which map block-relative cell indices to values and
+     * store nothing for empty (zero) cells.
+     */
+    template<class T> class SparseBlock : public QHash<int, T>
+    {
+    public:
+
+        /** The width/height of each block as a power of two. */
+        static const int LgSize = Block::LgSize;
+
+        /** The width/height of each block. */
+        static const int Size = (1 << LgSize);
+
+        /** The mask for coordinates. */
+        static const int Mask = Size - 1;
+
+        /**
+         * Returns the cell index corresponding to the specified position.
+         */
+        static int index (const QPoint& pos) { return (pos.y() & Mask) << LgSize | pos.x() & Mask; }
+
+        /**
+         * Returns the position of the cell with the given index in the block with the given key.
+         */
+        static QPoint position (const QPoint& key, int index) {
+            return QPoint(key.x() << LgSize | index & Mask, key.y() << LgSize | index >> LgSize); }
 
         /**
          * Returns the number of non-empty locations in the block.
          */
-        int filled () const { return _filled; }
-    
+        int filled () const { return this->size(); }
+
         /**
          * Sets the value at the specified position, returning the old value.
          */
         T set (const QPoint& pos, T nvalue)
         {
-            T& value = (*this)[(pos.y() & Mask) << LgSize | pos.x() & Mask];
+            if (nvalue == 0) {
+                return this->take(index(pos));
+            }
+            T& value = (*this)[index(pos)];
             T ovalue = value;
             value = nvalue;
-            _filled += (ovalue == E) - (nvalue == E);
             return ovalue;
         }
-        
+
         /**
          * Sets the bits in the specified value.
          */
         void setFlags (const QPoint& pos, T flags)
         {
-            T& value = (*this)[(pos.y() & Mask) << LgSize | pos.x() & Mask];
-            if (value == 0 && flags != 0) {
-                _filled++;
+            if (flags != 0) {
+                (*this)[index(pos)] |= flags;
             }
-            value |= flags;
         }
-        
+
         /**
          * Returns the value at the specified position.
          */
-        T get (const QPoint& pos) const
-        {
-            return this->at((pos.y() & Mask) << LgSize | pos.x() & Mask);
-        }
-        
+        T get (const QPoint& pos) const { return this->value(index(pos)); }
+
+        /**
+         * Returns the approximate number of bytes occupied by the block.
+         */
+        int memoryUsage () const { return sizeof(*this) +
+            this->size() * (sizeof(void*) + sizeof(uint) + sizeof(int) + sizeof(T)); }
+    };
+
+    /** Represents a block of label pointers. */
+    typedef SparseBlock<LabelPointer> LabelBlock;
+
+    /** Pairs a position with the label there. */
+    typedef QPair<QPoint, LabelPointer> PositionLabel;
+
+    /**
+     * A block of a single collision plane.  Each cell occupies one bit and each row one word, so
+     * that up to a block's width of cells can be tested with a single operation.
+     */
+    class CollisionBlock
+    {
+    public:
+
+        /** The width/height of each block as a power of two. */
+        static const int LgSize = Block::LgSize;
+
+        /** The width/height of each block. */
+        static const int Size = (1 << LgSize);
+
+        /** The mask for coordinates. */
+        static const int Mask = Size - 1;
+
+        /**
+         * Returns the bits of a row word covering the specified (inclusive) range of x
+         * coordinates, which must lie within a single block.
+         */
+        static quint32 span (int x1, int x2) {
+            return (~0U >> (Mask - (x2 & Mask) + (x1 & Mask))) << (x1 & Mask); }
+
+        /**
+         * Creates an empty block.
+         */
+        CollisionBlock ();
+
+        /**
+         * Returns the number of set cells in the block.
+         */
+        int filled () const { return _filled; }
+
+        /**
+         * Sets or clears the bit at the specified position.
+         */
+        void set (const QPoint& pos, bool value);
+
+        /**
+         * Returns the bit at the specified position.
+         */
+        bool get (const QPoint& pos) const {
+            return (_rows[pos.y() & Mask] >> (pos.x() & Mask)) & 1; }
+
+        /**
+         * Returns the word for the row at the specified y coordinate.
+         */
+        quint32 row (int y) const { return _rows[y & Mask]; }
+
+        /**
+         * Checks whether any of the bits in the given span are set in any of the rows between y1
+         * and y2 (inclusive).
+         */
+        bool intersects (int y1, int y2, quint32 span) const;
+
+        /**
+         * Returns the number of bytes occupied by the block.
+         */
+        int memoryUsage () const { return sizeof(CollisionBlock); }
+
     protected:
 
-        /** The number of non-empty locations in the block. */
+        /** The rows of the block, with the low bit of each representing the leftmost cell. */
+        quint32 _rows[Size];
+
+        /** The number of set cells in the block. */
         int _filled;
     };
 
-    /** Represents a directly renderable block of the scene. */
-    typedef GenericBlock<int, ' '> Block;
+    /** Maps block locations to the blocks of a single collision plane. */
+    typedef QHash<QPoint, CollisionBlock> CollisionPlane;
 
-    /** Represents a block of label pointers. */
-    typedef GenericBlock<LabelPointer, 0> LabelBlock;
+    /** The number of collision planes (one for each bit of the collision flags). */
+    static const int CollisionPlaneCount = 32;
 
-    /** Represents a block of flag pointers. */
-    typedef GenericBlock<int, 0> FlagBlock;
+    /**
+     * Summarizes a block at reduced levels of detail, so that overviews of the scene can be drawn
+     * at a cost that doesn't depend on the area shown.  Each summary cell at the finest level
+     * holds the most common non-empty value of the block cells it covers (or a space if they're
+     * all empty); each cell at a coarser level, the most common of the finer summary cells.
+     */
+    class Tile
+    {
+    public:
+
+        /** The number of levels of detail. */
+        static const int LevelCount = 2;
+
+        /**
+         * The width/height of the area covered by each summary cell at the finest level, as a
+         * power of two.  Each coarser level multiplies it by the same factor.
+         */
+        static const int LgStep = 2;
+
+        /**
+         * Returns the width/height of the area covered by each summary cell at the specified
+         * level, as a power of two.
+         */
+        static int lgScale (int level) { return (level + 1) * LgStep; }
+
+        /**
+         * Returns the width/height of the tile in summary cells at the specified level, as a power
+         * of two.
+         */
+        static int lgSize (int level) { return Block::LgSize - lgScale(level); }
+
+        /**
+         * Creates an empty tile.
+         */
+        Tile ();
+
+        /**
+         * Recomputes the summary cells covering the specified block-relative bounds.
+         *
+         * @param block the summarized block, or 0 if the block is empty.
+         * @return whether any summary cell changed.
+         */
+        bool update (const Block* block, const QRect& bounds);
+
+        /**
+         * Returns the value of the summary cell at the specified level and tile-relative position.
+         */
+        int get (int level, int x, int y) const {
+            return _levels[level].at(y << lgSize(level) | x); }
+
+        /**
+         * Checks whether all of the summary cells are empty.
+         */
+        bool empty () const;
+
+        /**
+         * Returns the number of bytes occupied by the tile.
+         */
+        int memoryUsage () const;
+
+    protected:
+
+        /** The summary cells of each level, row by row. */
+        QVector<int> _levels[LevelCount];
+    };
 
     /**
      * Creates a new scene.
      */
-    Scene (ServerApp* app, const SceneRecord& record);
+    Scene (Instance* instance, const SceneRecord& record);
+
+    /**
+     * Destroys the scene.
+     */
+    virtual ~Scene ();
+
+    /**
+     * Returns a pointer to the instance to which the scene belongs.
+     */
+    Instance* instance () const { return _instance; }
 
     /**
      * Returns a reference to the scene record.
@@ -126,35 +376,192 @@ public:
     const QHash<QPoint, LabelBlock>& labels () const { return _labels; }
 
     /**
-     * Returns a reference to the collision flag map.
+     * Returns a reference to the collision plane for the specified bit of the collision flags.
      */
-    const QHash<QPoint, FlagBlock>& collisionFlags () const { return _collisionFlags; }
+    const CollisionPlane& collisionPlane (int bit) const { return _collisionPlanes[bit]; }
 
     /**
      * Returns the collision flags at the specified point.
      */
     int collisionFlags (const QPoint& pos) const;
 
+    /**
+     * Checks whether any of the specified collision flags are set at the given point.
+     */
+    bool collides (const QPoint& pos, int mask) const;
+
+    /**
+     * Checks whether any of the specified collision flags are set anywhere within the given
+     * rectangle.
+     */
+    bool collides (const QRect& rect, int mask) const;
+
+    /**
+     * Checks whether any of the specified collision flags are set anywhere along the given path.
+     * Straight runs of the path are tested a row (or column) at a time.
+     */
+    bool collides (const QVector<QPoint>& path, int mask) const;
+
+    /**
+     * Finds the free location nearest (by Manhattan distance) to the specified origin, where a
+     * free location is one at which none of the flags in the spawn mask are set.
+     *
+     * @return whether or not a location within the maximum distance was found.
+     */
+    bool findSpawnPoint (const QPoint& origin, int mask, int maxDistance, QPoint* result) const;
+
+    /**
+     * Returns the pool indices of the actors within the specified rectangle.
+     *
+     * @param mask if non-zero, only actors with at least one of these collision flags are
+     * included.
+     */
+    QVector<int> actorsWithin (const QRect& rect, int mask = 0) const;
+
+    /**
+     * Returns the pool indices of up to the specified number of actors nearest (by Manhattan
+     * distance) to the given position, in order of increasing distance.
+     *
+     * @param mask if non-zero, only actors with at least one of these collision flags are
+     * included.
+     */
+    QVector<int> nearestActors (
+        const QPoint& pos, int count, int maxDistance, int mask = 0) const;
+
+    /**
+     * Returns the labels within the specified rectangle.  The labels are indexed by row and by
+     * column, so thin strips (such as those exposed by scrolling) are cheap to query.
+     */
+    QVector<PositionLabel> labelsWithin (const QRect& rect) const;
+
+    /**
+     * Returns up to the specified number of labels nearest (by Manhattan distance) to the given
+     * position, in order of increasing distance.
+     */
+    QVector<PositionLabel> nearestLabels (const QPoint& pos, int count, int maxDistance) const;
+
+    /**
+     * Script version of actorsWithin: returns a list containing, for each actor, a list of its
+     * x and y coordinates, character, and object (if any).
+     */
+    Q_INVOKABLE QVariantList scriptActorsWithin (const QRect& rect, int mask) const;
+
+    /**
+     * Script version of nearestActors: returns a list in the format of scriptActorsWithin.
+     */
+    Q_INVOKABLE QVariantList scriptNearestActors (
+        const QPoint& pos, int count, int maxDistance, int mask) const;
+
+    /**
+     * Script version of labelsWithin: returns a list containing, for each label, a list of its x
+     * and y coordinates, character, and text.
+     */
+    Q_INVOKABLE QVariantList scriptLabelsWithin (const QRect& rect) const;
+
+    /**
+     * Script version of nearestLabels: returns a list in the format of scriptLabelsWithin.
+     */
+    Q_INVOKABLE QVariantList scriptNearestLabels (
+        const QPoint& pos, int count, int maxDistance) const;
+
     /**
      * Checks whether the specified session can edit the scene.
      */
     bool canEdit (Session* session) const;
 
     /**
-     * Sets the scene properties.
+     * Returns a reference to the list of sessions in the scene.
+     */
+    const QList<Session*>& sessions () const { return _sessions; }
+
+    /**
+     * Returns the time at which the scene was loaded or last became unoccupied.
+     */
+    quint64 idleSince () const { return _idleSince; }
+
+    /**
+     * Returns an estimate of the number of bytes occupied by the scene contents.
+     */
+    qint64 memoryUsage () const;
+
+    /**
+     * Recomputes the memory usage estimate and reports any change to the scene manager.
      */
-    void setProperties (const QString& name, quint16 scrollWidth, quint16 scrollHeight);
+    void updateMemoryUsage ();
+
+    /**
+     * If the scene is paged, unloads the least recently used blocks beyond the configured limit
+     * that are neither modified nor near any view.
+     */
+    void pageOut ();
+
+    /**
+     * Sets the scene properties.  Changes to the generation parameters replace the unmodified
+     * blocks of running instances with newly generated ones.
+     */
+    void setProperties (const QString& name, quint16 scrollWidth, quint16 scrollHeight,
+        quint32 seed, const QString& layers);
 
     /**
      * Sets a location in the scene.
      */
     void set (const QPoint& pos, int character);
 
+    /**
+     * Fills a region of the scene with the specified character.
+     */
+    void fill (const QRect& bounds, int character);
+
+    /**
+     * Checks whether all of the blocks covering a region have been loaded, requesting any that
+     * haven't.  Regions must be loaded before they're copied.
+     */
+    bool loadRegion (const QRect& bounds);
+
+    /**
+     * Returns a copy of a region of the scene, which must be loaded.
+     */
+    SceneRegion copy (const QRect& bounds) const { return _record.copy(bounds); }
+
+    /**
+     * Pastes a region into the scene with its upper-left corner at the specified location.
+     */
+    void paste (const QPoint& pos, const SceneRegion& region);
+
+    /**
+     * Moves a region of the scene so that its upper-left corner is at the specified location.
+     *
+     * @return whether the region was moved.  It isn't if any part of it has yet to be loaded,
+     * but the missing blocks are requested so that the move may be retried.
+     */
+    bool move (const QRect& bounds, const QPoint& pos);
+
     /**
      * Removes the scene from the database.
      */
     void remove ();
 
+    /**
+     * Returns a pointer to the portal at the specified location, or 0 if there isn't one.
+     */
+    const ScenePortal* portal (const QPoint& pos) const;
+
+    /**
+     * Adds a portal to the scene, replacing any existing portal at the same location.
+     */
+    void setPortal (const ScenePortal& portal);
+
+    /**
+     * Removes the portal at the specified location, if any.
+     */
+    void removePortal (const QPoint& pos);
+
+    /**
+     * Prefetches the targets of the portals within the configured distance of the specified
+     * location on behalf of the given session, so that passing through them needn't wait.
+     */
+    void prefetchPortals (Session* session, const QPoint& pos);
+
     /**
      * Adds a session to the scene.  The session should already be in the scene thread.
      *
@@ -178,34 +585,48 @@ public:
     void deleted ();
 
     /**
-     * Adds the specified actor's visual representation to the scene contents.  This is done when
-     * the actor is created, and just after the actor is moved.
+     * Returns a reference to the actor pool.
      */
-    void addSpatial (Actor* actor);
+    ActorPool& actorPool () { return _actorPool; }
 
     /**
-     * Removes the specified actor's visual representation from the scene contents.  This is done
-     * when the actor is destroyed, and just before the actor is moved.
-     *
-     * @param npos the position to which the actor will be moving, or zero for none.
+     * Returns a reference to the actor pool.
      */
-    void removeSpatial (Actor* actor, const QPoint* npos = 0) {
-        removeSpatial(actor, actor->character(), npos); };
+    const ActorPool& actorPool () const { return _actorPool; }
 
     /**
-     * Removes the specified actor's visual representation from the scene contents.  This is done
-     * when the actor is destroyed, and just before the actor is moved.
+     * Adds an actor to the pool and its representation to the scene contents.  Actors added
+     * directly (rather than through the Actor constructor) have no object.
      *
-     * @param npos the position to which the actor will be moving, or zero for none.
+     * @return the index of the actor in the pool.
      */
-    void removeSpatial (Actor* actor, int character, const QPoint* npos = 0);
+    int addActor (int character, const QString& label, const QPoint& position,
+        int collisionFlags, int collisionMask, int spawnMask);
 
     /**
-     * Notes that an actor's character or label has changed.
-     *
-     * @param ocharacter the previous character.
+     * Removes an actor from the scene contents and releases it from the pool.
+     */
+    void removeActor (int idx);
+
+    /**
+     * Moves an actor to the specified position.
+     */
+    void setActorPosition (int idx, const QPoint& position);
+
+    /**
+     * Sets the character of an actor.
+     */
+    void setActorCharacter (int idx, int character);
+
+    /**
+     * Sets the label of an actor.
      */
-    void characterLabelChanged (Actor* actor, int ochar);
+    void setActorLabel (int idx, const QString& label);
+
+    /**
+     * Sets the collision flags of an actor.
+     */
+    void setActorCollisionFlags (int idx, int flags);
 
     /**
      * Adds a scene view to the map.  This is done when the session is added, and just after the
@@ -219,6 +640,23 @@ public:
      */
     void removeSpatial (SceneView* view);
 
+    /**
+     * Adds a minimap to be notified of changes to the tiles.
+     */
+    void addMinimap (Minimap* minimap) { _minimaps.append(minimap); }
+
+    /**
+     * Removes a minimap from the notification list.
+     */
+    void removeMinimap (Minimap* minimap) { _minimaps.removeOne(minimap); }
+
+    /**
+     * Expands part of a row of summary cells at the specified level of detail into the provided
+     * buffer.  The coordinates are those of the world scaled down by Tile::lgScale(level).
+     * Summaries persist when blocks are paged out, so areas already loaded remain visible.
+     */
+    void getSummaryRow (int level, int x, int y, int width, int* dest) const;
+
     /**
      * Attempts to find a path from the given start point to the specified end.  Returns an empty
      * path on failure.
@@ -232,6 +670,40 @@ public:
     void say (const QPoint& pos, const QString& speaker,
         const QString& message, ChatWindow::SpeakMode mode);
 
+    /**
+     * Adds a batch of blocks loaded from the database.
+     *
+     * @param keys the bounds of the block keys requested.
+     */
+    Q_INVOKABLE void blocksLoaded (const QRect& keys, const SceneBlockHash& blocks);
+
+    /**
+     * Adds a batch of generated blocks.
+     *
+     * @param version the version of the generator that produced them.
+     */
+    Q_INVOKABLE void blocksGenerated (int version, const SceneBlockHash& blocks);
+
+    /**
+     * Records the generated baselines of a batch of blocks loaded from the database.
+     *
+     * @param version the version of the generator that produced them.
+     */
+    Q_INVOKABLE void baselinesGenerated (int version, const SceneBlockHash& blocks);
+
+    /**
+     * Notes the outcome of a flush, publishing the edits that awaited it if it succeeded or
+     * marking the blocks as changed again if it failed, so that the next flush will retry them.
+     */
+    Q_INVOKABLE void blocksFlushed (const SceneBlockChanges& changes, bool success);
+
+    /**
+     * Applies a batch of edits made in another instance.  The edits are not persisted, since the
+     * other instance does that.  Edits to blocks neither loaded nor requested are skipped, since
+     * paged scenes store their edits before publishing them.
+     */
+    void applyEdits (const SceneEdits& edits);
+
 signals:
 
     /**
@@ -242,19 +714,176 @@ signals:
 public slots:
 
     /**
-     * Flushes the scene to the database.
+     * Flushes the blocks changed since the last flush to the database.
      */
     void flush ();
 
+    /**
+     * Publishes the edits made since the last publication to the other instances.  In paged
+     * scenes, this flushes the changed blocks and publishes the edits once they're stored.
+     */
+    void publishEdits ();
+
 protected:
     
     /** A list of scene views. */
     typedef QList<SceneView*> SceneViewList;
 
+    /** A character to set at a position. */
+    typedef QPair<QPoint, int> PositionCharacter;
+
+    /**
+     * Adds the specified actor's visual representation to the scene contents.  This is done when
+     * the actor is created, and just after the actor is moved.
+     */
+    void addSpatial (int idx);
+
+    /**
+     * Removes the specified actor's visual representation from the scene contents.  This is done
+     * when the actor is destroyed, and just before the actor is moved.
+     *
+     * @param npos the position to which the actor will be moving, or zero for none.
+     */
+    void removeSpatial (int idx, const QPoint* npos = 0) {
+        removeSpatial(idx, _actorPool.character(idx), npos); };
+
+    /**
+     * Removes the specified actor's visual representation from the scene contents.  This is done
+     * when the actor is destroyed, and just before the actor is moved.
+     *
+     * @param npos the position to which the actor will be moving, or zero for none.
+     */
+    void removeSpatial (int idx, int character, const QPoint* npos = 0);
+
+    /**
+     * Notes that an actor's character or label has changed.
+     *
+     * @param ocharacter the previous character.
+     */
+    void characterLabelChanged (int idx, int ochar);
+
+    /**
+     * Updates the collision flags at the specified position from the actor list starting with
+     * the given index.
+     */
+    void updateCollisionFlags (const QPoint& pos, int idx);
+
+    /**
+     * Returns the approximate number of bytes occupied by the collision planes.
+     */
+    qint64 collisionMemoryUsage () const;
+
+    /**
+     * Sets the collision flags within the given mask at the specified position.
+     */
+    void setCollisionFlags (const QPoint& pos, int flags, int mask);
+
+    /**
+     * Returns the union of the rows at the specified y coordinate of the collision planes in the
+     * given mask within the block with the given key.
+     */
+    quint32 collisionRow (const QPoint& key, int y, int mask) const;
+
+    /**
+     * Copies the non-empty contents of a record block into the scene blocks, skipping locations
+     * covered by visible actors.
+     */
+    void copyRecordBlock (const QPoint& key, const SceneRecord::Block& block);
+
+    /**
+     * Checks whether the record block with the specified key is loaded (or known to be empty).
+     */
+    bool isLoaded (const QPoint& key) const;
+
+    /**
+     * Requests (or generates) any unloaded, unrequested blocks within the specified (record
+     * block) bounds.
+     */
+    void loadBlocks (const QRect& keys);
+
+    /**
+     * Adds a loaded or generated record block to the scene and applies any changes deferred
+     * while it was loading.
+     */
+    void addLoadedBlock (const QPoint& key, const SceneRecord::Block& block);
+
+    /**
+     * Requests the unloaded blocks around the specified bounds and marks the loaded ones as
+     * recently used.
+     */
+    void prefetch (const QRect& bounds);
+
+    /**
+     * Unloads the record block with the specified key.
+     */
+    void pageOut (const QPoint& key);
+
+    /**
+     * Replaces the generator after a change to the generation parameters, regenerating the
+     * loaded blocks that haven't been modified.  If flushes are under way, this is deferred
+     * until they're complete.
+     */
+    void resetGenerator ();
+
+    /**
+     * Sets the contents of a region from the provided data (as in SceneRecord::set) without
+     * dirtying the views.
+     */
+    void setRegion (const QRect& bounds, const int* data, int xstep, int stride);
+
+    /**
+     * Records an edit to be published to the other instances.
+     */
+    void addEdit (const QPoint& pos, int character);
+
+    /**
+     * Applies the cells of a block edit received from another instance.
+     */
+    void applyEdit (const SceneBlockEdit& edit);
+
+    /**
+     * Collects and clears the edits awaiting publication.
+     */
+    SceneEdits takeEdits ();
+
+    /**
+     * Publishes a batch of edits to the other instances, unless it's empty.
+     */
+    void publish (const SceneEdits& edits);
+
+    /**
+     * Notifies the object of the top actor at the specified position (if any) that the location
+     * under it has changed.
+     *
+     * @return whether or not there was an actor at the position.
+     */
+    bool changedUnderneath (const QPoint& pos, int character);
+
+    /**
+     * Dirties the specified region in all intersecting views.
+     */
+    void dirtyViews (const QRect& bounds);
+
+    /**
+     * Recomputes the tiles covering the specified region after a change to its contents,
+     * notifying the minimaps if any summaries changed.
+     */
+    void updateTiles (const QRect& bounds);
+
+    /**
+     * Updates the row and column label indices for a change of label at the specified position.
+     */
+    void updateLabelIndex (const QPoint& pos, LabelPointer label);
+
     /**
-     * Updates the collision flags at the specified position from the actor list.
+     * Rebuilds the portal indices from the record.
      */
-    void updateCollisionFlags (const QPoint& pos, Actor* actor);
+    void indexPortals ();
+
+    /**
+     * Applies an updated list of portals, stores it in the database, and broadcasts the change.
+     */
+    void updatePortals (const QList<ScenePortal>& portals);
 
     /**
      * Sets a character in the scene blocks.
@@ -262,23 +891,56 @@ protected:
     void setInBlocks (const QPoint& pos, int character,
         LabelPointer label = 0, const QPoint* npos = 0);
 
+    /** The instance to which the scene belongs. */
+    Instance* _instance;
+
     /** The application object. */
     ServerApp* _app;
 
     /** The scene record. */
     SceneRecord _record;
 
+    /** Flushes the scene after the record has been modified. */
+    QTimer* _autosaveTimer;
+
     /** The current set of scene blocks. */
     QHash<QPoint, Block> _blocks;
 
     /** The label blocks. */
     QHash<QPoint, LabelBlock> _labels;
 
-    /** The collision flag blocks. */
-    QHash<QPoint, FlagBlock> _collisionFlags;
+    /** The summary tiles, mapped by block location. */
+    QHash<QPoint, Tile> _tiles;
+
+    /** The minimaps showing the scene. */
+    QList<Minimap*> _minimaps;
 
-    /** Maps locations to linked lists of actors. */
-    QHash<QPoint, Actor*> _actors;
+    /** The labels in each row, mapped by x coordinate, for strip queries. */
+    QHash<int, QMap<int, LabelPointer> > _labelRows;
+
+    /** The labels in each column, mapped by y coordinate, for strip queries. */
+    QHash<int, QMap<int, LabelPointer> > _labelColumns;
+
+    /** The collision planes, one for each bit of the collision flags. */
+    CollisionPlane _collisionPlanes[CollisionPlaneCount];
+
+    /** The bits for which the collision planes are non-empty. */
+    int _collisionBits;
+
+    /** The data of the actors in the scene. */
+    ActorPool _actorPool;
+
+    /** Maps locations to the indices of the first actors in the linked lists. */
+    QHash<QPoint, int> _actors;
+
+    /** The indices of the actors in each block, for spatial queries. */
+    QHash<QPoint, QVector<int> > _actorBlocks;
+
+    /** Maps portal locations to their indices in the record's portal list. */
+    QHash<QPoint, int> _portals;
+
+    /** The indices of the portals in each portal block, for proximity queries. */
+    QHash<QPoint, QVector<int> > _portalBlocks;
 
     /** The sessions in the scene. */
     QList<Session*> _sessions;
@@ -286,8 +948,56 @@ protected:
     /** Maps block locations to lists of intersecting views. */
     QHash<QPoint, SceneViewList> _views;
 
+    /** The time at which the scene was loaded or last became unoccupied. */
+    quint64 _idleSince;
+
+    /** The memory usage most recently reported to the scene manager. */
+    qint64 _reportedMemoryUsage;
+
+    /** Whether or not the scene is paged. */
+    bool _paged;
+
+    /** The generator for generated scenes. */
+    SceneGeneratorPointer _generator;
+
+    /** Incremented when the generator is replaced, so that the old one's output is discarded. */
+    int _generatorVersion;
+
+    /** Whether the generator is to be replaced once the flushes under way are complete. */
+    bool _generatorResetPending;
+
+    /** For generated scenes, the baselines of the loaded blocks, for comparison on flushing. */
+    QHash<QPoint, SceneRecord::Block> _baselines;
+
+    /**
+     * The edits awaiting each flush whose outcome we have yet to hear, in order.  We don't page
+     * out until we've heard.
+     */
+    QList<SceneEdits> _flushingEdits;
+
+    /** For paged scenes, the time at which each loaded record block was last used. */
+    QHash<QPoint, quint64> _blockAccess;
+
+    /** The keys of the record blocks requested from the database. */
+    QSet<QPoint> _requestedBlocks;
+
+    /** Changes to record blocks made while they were being loaded. */
+    QHash<QPoint, QList<PositionCharacter> > _deferredSets;
+
+    /** Edits received from other instances for blocks that were being loaded. */
+    QHash<QPoint, QList<SceneBlockEdit> > _deferredEdits;
+
+    /** The edits awaiting publication, mapped by block key. */
+    QHash<QPoint, QVector<int> > _pendingEdits;
+
+    /** Publishes the pending edits shortly after the first is made. */
+    QTimer* _publishTimer;
+
     /** The size of the view hash space blocks as a power of two. */
     static const int LgViewBlockSize = 7;
+
+    /** The size of the portal index blocks as a power of two. */
+    static const int LgPortalBlockSize = 4;
 };
 
 #endif // SCENE
@@ -0,0 +1,119 @@
+//
+// $Id$
+
+#include <math.h>
+
+#include <QMutexLocker>
+#include <QRegExp>
+#include <QStringList>
+#include <QtDebug>
+
+#include "scene/SceneGenerator.h"
+
+SceneGenerator::SceneGenerator (const SceneRecord& record, int cacheSize) :
+    _seed(record.seed),
+    _cache(cacheSize)
+{
+    foreach (const QString& spec, record.layers.split(QRegExp("[;\n]"), QString::SkipEmptyParts)) {
+        QStringList parts = spec.split(' ', QString::SkipEmptyParts);
+        bool ok = (parts.size() == 2 || parts.size() == 3) && parts.at(0).length() == 1;
+        Layer layer = { ok ? parts.at(0).at(0).unicode() : 0 };
+        if (ok) {
+            layer.density = parts.at(1).toFloat(&ok);
+        }
+        if (ok) {
+            layer.scale = (parts.size() == 3) ? parts.at(2).toInt(&ok) : 1;
+            ok = ok && layer.scale > 0;
+        }
+        if (ok) {
+            _layers.append(layer);
+        } else {
+            qWarning() << "Invalid layer in scene generator." << record.id << spec;
+        }
+    }
+}
+
+SceneRecord::Block SceneGenerator::block (const QPoint& key)
+{
+    {
+        QMutexLocker locker(&_mutex);
+        SceneRecord::Block* block = _cache.object(key);
+        if (block != 0) {
+            return *block;
+        }
+    }
+    // generate outside the lock; if another thread beats us to it, the results will be identical
+    SceneRecord::Block block = generate(key);
+    QMutexLocker locker(&_mutex);
+    _cache.insert(key, new SceneRecord::Block(block));
+    return block;
+}
+
+/**
+ * Helper function for generation: hashes a lattice point to a value between zero and one.
+ */
+static inline float latticeValue (quint32 seed, int x, int y)
+{
+    quint32 hash = seed ^ (quint32)x * 0x27d4eb2d ^ (quint32)y * 0x165667b1;
+    hash ^= hash >> 15;
+    hash *= 0x85ebca6b;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35;
+    hash ^= hash >> 16;
+    return (hash & 0xFFFFFF) / (float)0x1000000;
+}
+
+/**
+ * Helper function for generation: returns the smoothly interpolated noise value at a location.
+ */
+static float noise (quint32 seed, int x, int y, int scale)
+{
+    if (scale == 1) {
+        return latticeValue(seed, x, y);
+    }
+    float fx = x / (float)scale, fy = y / (float)scale;
+    int x0 = (int)floor(fx), y0 = (int)floor(fy);
+    float tx = fx - x0, ty = fy - y0;
+    float top = latticeValue(seed, x0, y0) +
+        (latticeValue(seed, x0 + 1, y0) - latticeValue(seed, x0, y0)) * tx;
+    float bottom = latticeValue(seed, x0, y0 + 1) +
+        (latticeValue(seed, x0 + 1, y0 + 1) - latticeValue(seed, x0, y0 + 1)) * tx;
+    return top + (bottom - top) * ty;
+}
+
+SceneRecord::Block SceneGenerator::generate (const QPoint& key) const
+{
+    SceneRecord::Block block;
+    int x1 = key.x() << SceneRecord::Block::LgSize;
+    int y1 = key.y() << SceneRecord::Block::LgSize;
+    for (int ii = 0, nn = _layers.size(); ii < nn; ii++) {
+        const Layer& layer = _layers.at(ii);
+        quint32 seed = _seed + ii * 0x9e3779b9;
+        for (int yy = y1, y2 = y1 + SceneRecord::Block::Size; yy < y2; yy++) {
+            for (int xx = x1, x2 = x1 + SceneRecord::Block::Size; xx < x2; xx++) {
+                if (noise(seed, xx, yy, layer.scale) < layer.density) {
+                    block.set(QPoint(xx, yy), layer.character);
+                }
+            }
+        }
+    }
+    return block;
+}
+
+SceneGeneratorTask::SceneGeneratorTask (
+        const SceneGeneratorPointer& generator, const QList<QPoint>& keys,
+        const Callback& callback) :
+    _generator(generator),
+    _keys(keys),
+    _callback(callback)
+{
+}
+
+void SceneGeneratorTask::run ()
+{
+    SceneBlockHash blocks;
+    foreach (const QPoint& key, _keys) {
+        blocks.insert(key, _generator->block(key));
+    }
+    _callback.invoke(Q_ARG(const SceneBlockHash&, blocks));
+}
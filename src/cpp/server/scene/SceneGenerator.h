@@ -0,0 +1,111 @@
+//
+// $Id$
+
+#ifndef SCENE_GENERATOR
+#define SCENE_GENERATOR
+
+#include <QCache>
+#include <QList>
+#include <QMutex>
+#include <QPoint>
+#include <QRunnable>
+#include <QSharedPointer>
+
+#include "db/SceneRepository.h"
+#include "util/Callback.h"
+
+/**
+ * Generates the baseline contents of a scene deterministically from a seed and a list of layers.
+ * The layers are separated by semicolons or newlines, and each takes the form
+ * "<character> <density> [<scale>]": the character is placed in (approximately) the given
+ * fraction of locations, in patches whose size is given by the scale (one for scattered noise).
+ * Later layers overwrite earlier ones.  Generated blocks are kept in a least-recently-used cache.
+ * This class is thread-safe.
+ */
+class SceneGenerator
+{
+public:
+
+    /**
+     * Creates a generator for the specified scene record.
+     *
+     * @param cacheSize the maximum number of generated blocks to cache.
+     */
+    SceneGenerator (const SceneRecord& record, int cacheSize);
+
+    /**
+     * Returns the baseline block with the specified key, generating it if necessary.
+     */
+    SceneRecord::Block block (const QPoint& key);
+
+protected:
+
+    /**
+     * A single layer of generated content.
+     */
+    class Layer
+    {
+    public:
+
+        /** The character to place. */
+        int character;
+
+        /** The fraction of locations in which to place it. */
+        float density;
+
+        /** The size of the patches in which the character is placed. */
+        int scale;
+    };
+
+    /**
+     * Generates the block with the specified key.
+     */
+    SceneRecord::Block generate (const QPoint& key) const;
+
+    /** The seed from which all content is generated. */
+    quint32 _seed;
+
+    /** The layers of content. */
+    QList<Layer> _layers;
+
+    /** The most recently used generated blocks. */
+    QCache<QPoint, SceneRecord::Block> _cache;
+
+    /** Protects the cache. */
+    QMutex _mutex;
+};
+
+/** A shared pointer to a generator. */
+typedef QSharedPointer<SceneGenerator> SceneGeneratorPointer;
+
+/**
+ * Generates a batch of blocks in a worker thread, passing them to a callback as a SceneBlockHash.
+ */
+class SceneGeneratorTask : public QRunnable
+{
+public:
+
+    /**
+     * Creates a new task.
+     */
+    SceneGeneratorTask (const SceneGeneratorPointer& generator,
+        const QList<QPoint>& keys, const Callback& callback);
+
+    /**
+     * Generates the blocks and invokes the callback.
+     */
+    virtual void run ();
+
+protected:
+
+    /** The generator to use. */
+    SceneGeneratorPointer _generator;
+
+    /** The keys of the blocks to generate. */
+    QList<QPoint> _keys;
+
+    /** The callback to invoke with the results. */
+    Callback _callback;
+};
+
+#endif // SCENE_GENERATOR
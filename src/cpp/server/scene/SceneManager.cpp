@@ -1,31 +1,87 @@
 //
 // $Id$
 
+#include <time.h>
+
+#include <QDateTime>
 #include <QMetaObject>
+#include <QMutexLocker>
 #include <QThread>
+#include <QThreadPool>
+#include <QTimer>
 #include <QtDebug>
 
 #include "ServerApp.h"
-#include "db/DatabaseThread.h"
+#include "db/DatabasePool.h"
+#include "db/ResourceIndex.h"
 #include "db/SceneRepository.h"
+#include "net/Session.h"
+#include "scene/SceneGenerator.h"
 #include "scene/SceneManager.h"
 #include "scene/Zone.h"
 
+/** The interval at which we sample the loads on the scene threads. */
+static const int LoadSampleInterval = 5 * 1000;
+
+/** The weight given to each new load sample. */
+static const float LoadSmoothing = 0.5f;
+
+/** The load assumed for each new instance until it's reflected in the samples. */
+static const float NewInstanceLoad = 0.02f;
+
+/** The number of consecutive imbalanced samples after which we migrate an instance. */
+static const int ImbalancedSampleLimit = 3;
+
 SceneManager::SceneManager (ServerApp* app) :
     CallableObject(app),
     _app(app),
-    _lastThreadIdx(0)
+    _lastThreadIdx(0),
+    _loadTimer(new QTimer(this)),
+    _threadImbalanceThreshold(app->config().value("scene_thread_imbalance", 0.25).toFloat()),
+    _imbalancedSamples(0),
+    _sceneIdleTimeout(app->config().value("scene_idle_timeout", 10).toULongLong() * 60 * 1000),
+    _instanceIdleTimeout(
+        app->config().value("instance_idle_timeout", 30).toULongLong() * 60 * 1000),
+    _sceneAutosaveInterval(app->config().value("scene_autosave_interval", 30).toInt() * 1000),
+    _sceneMemoryLimit(app->config().value("scene_memory_limit", -1).toLongLong()),
+    _scenePagingThreshold(app->config().value("scene_paging_threshold", -1).toInt()),
+    _scenePagedBlockLimit(app->config().value("scene_paged_block_limit", 256).toInt()),
+    _scenePrefetchMargin(app->config().value("scene_prefetch_margin", 64).toInt()),
+    _sceneGeneratorCacheSize(app->config().value("scene_generator_cache", 256).toInt()),
+    _portalPrefetchDistance(app->config().value("portal_prefetch_distance", 8).toInt()),
+    _generatorPool(new QThreadPool(this)),
+    _sceneMemoryUsage(0)
 {
+    // the limit is configured in megabytes
+    if (_sceneMemoryLimit != -1) {
+        _sceneMemoryLimit *= 1024 * 1024;
+    }
+
     // register for remote invocation
     _app->peerManager()->registerSharedObject(this);
 
-    // create the configured number of scene threads
+    // create the configured number of scene threads, each with its own prefetch budget
     int nthreads = app->config().value("scene_threads").toInt();
     if (nthreads == -1) {
         nthreads = qMax(1, QThread::idealThreadCount() - 1);
     }
+    int prefetchBudget = app->config().value("portal_prefetch_budget", 4).toInt();
     for (int ii = 0; ii < nthreads; ii++) {
-        _threads.append(new QThread(this));
+        QThread* thread = new QThread(this);
+        _threads.append(thread);
+        ThreadLoad load = { new SceneThreadMonitor(), 0, 0, 0.0f, 0.0f, 0.0f };
+        load.monitor->moveToThread(thread);
+        _threadLoads.append(load);
+        PortalPrefetcher* prefetcher = new PortalPrefetcher(prefetchBudget);
+        prefetcher->moveToThread(thread);
+        _portalPrefetchers.insert(thread, prefetcher);
+    }
+    connect(_loadTimer, SIGNAL(timeout()), SLOT(balanceThreads()));
+
+    // and the pool in which we generate scene contents
+    int ngenerators = app->config().value("scene_generator_threads", -1).toInt();
+    if (ngenerators != -1) {
+        _generatorPool->setMaxThreadCount(qMax(1, ngenerators));
     }
 }
 
@@ -35,29 +91,169 @@ Instance* SceneManager::instance (quint64 id) const
     return (zone == 0) ? 0 : zone->instances().value(getInstanceOffset(id));
 }
 
+void SceneManager::adjustSceneMemoryUsage (qint64 delta)
+{
+    QMutexLocker locker(&_sceneMemoryMutex);
+    _sceneMemoryUsage += delta;
+}
+
+qint64 SceneManager::sceneMemoryUsage () const
+{
+    QMutexLocker locker(&_sceneMemoryMutex);
+    return _sceneMemoryUsage;
+}
+
+bool SceneManager::sceneMemoryExceeded () const
+{
+    return _sceneMemoryLimit != -1 && sceneMemoryUsage() > _sceneMemoryLimit;
+}
+
+PortalPrefetcher* SceneManager::portalPrefetcher () const
+{
+    return _portalPrefetchers.value(QThread::currentThread());
+}
+
+void SceneManager::generateBlocks (const QSharedPointer<SceneGenerator>& generator,
+    const QList<QPoint>& keys, const Callback& callback)
+{
+    _generatorPool->start(new SceneGeneratorTask(generator, keys, callback));
+}
+
 void SceneManager::startThreads ()
 {
     foreach (QThread* thread, _threads) {
         _app->prefetchRuntimeConfig(thread);
         thread->start();
     }
+    _loadTimer->start(LoadSampleInterval);
 }
 
 void SceneManager::stopThreads ()
 {
-//    foreach (Scene* scene, _scenes) {
-//        QMetaObject::invokeMethod(scene, "flush");
-//    }
+    // flush the scenes of all instances, waiting for each to finish
+    foreach (Zone* zone, _zones) {
+        foreach (Instance* instance, zone->instances()) {
+            QMetaObject::invokeMethod(instance, "flush", Qt::BlockingQueuedConnection);
+        }
+    }
+    _generatorPool->waitForDone();
+    _loadTimer->stop();
     foreach (QThread* thread, _threads) {
         thread->exit();
         thread->wait();
     }
+    foreach (const ThreadLoad& load, _threadLoads) {
+        delete load.monitor;
+    }
+    _threadLoads.clear();
 }
 
 QThread* SceneManager::nextThread ()
 {
-    _lastThreadIdx = (_lastThreadIdx + 1) % _threads.size();
-    return _threads.at(_lastThreadIdx);
+    // start searching after the last thread chosen so that ties are broken round-robin
+    int nthreads = _threads.size();
+    int best = _lastThreadIdx;
+    float bestLoad = 0.0f;
+    for (int ii = 1; ii <= nthreads; ii++) {
+        int idx = (_lastThreadIdx + ii) % nthreads;
+        float load = _threadLoads.at(idx).load();
+        if (ii == 1 || load < bestLoad) {
+            best = idx;
+            bestLoad = load;
+        }
+    }
+    _lastThreadIdx = best;
+
+    // count the new instance until the next sample reflects it
+    _threadLoads[best].provisional += NewInstanceLoad;
+    return _threads.at(best);
+}
+
+void SceneManager::threadSampled (int idx, quint64 time, quint64 cpuTime, quint64 queueDelay)
+{
+    if (idx >= _threadLoads.size()) {
+        return; // stopped in the meantime
+    }
+    ThreadLoad& load = _threadLoads[idx];
+    if (load.sampleTime != 0 && time > load.sampleTime) {
+        float busy = (cpuTime - load.cpuTime) / (1000.0f * (time - load.sampleTime));
+        load.busy += (qMin(busy, 1.0f) - load.busy) * LoadSmoothing;
+    }
+    load.queueDelay += (queueDelay - load.queueDelay) * LoadSmoothing;
+    load.sampleTime = time;
+    load.cpuTime = cpuTime;
+    load.provisional = 0.0f;
+}
+
+void SceneManager::balanceThreads ()
+{
+    // find the busiest and idlest threads
+    int busiest = 0, idlest = 0;
+    for (int ii = 1, nn = _threadLoads.size(); ii < nn; ii++) {
+        float load = _threadLoads.at(ii).load();
+        if (load > _threadLoads.at(busiest).load()) {
+            busiest = ii;
+        }
+        if (load < _threadLoads.at(idlest).load()) {
+            idlest = ii;
+        }
+    }
+
+    // migrate only when the imbalance persists, to avoid reacting to momentary spikes
+    float imbalance = _threadLoads.at(busiest).load() - _threadLoads.at(idlest).load();
+    if (imbalance < _threadImbalanceThreshold) {
+        _imbalancedSamples = 0;
+
+    } else if (++_imbalancedSamples >= ImbalancedSampleLimit) {
+        _imbalancedSamples = 0;
+
+        // moving a thread's only instance would just move the problem, so we need at least two;
+        // we pick the one whose population is closest to half the thread's total
+        QThread* thread = _threads.at(busiest);
+        QList<Instance*> instances;
+        int total = 0;
+        foreach (Zone* zone, _zones) {
+            foreach (Instance* instance, zone->instances()) {
+                if (instance->thread() == thread) {
+                    instances.append(instance);
+                    total += population(instance);
+                }
+            }
+        }
+        if (instances.size() >= 2) {
+            Instance* chosen = 0;
+            int bestDiff = 0;
+            foreach (Instance* instance, instances) {
+                int diff = qAbs(2 * population(instance) - total);
+                if (chosen == 0 || diff < bestDiff) {
+                    chosen = instance;
+                    bestDiff = diff;
+                }
+            }
+            qDebug() << "Migrating instance." << chosen->info().id << busiest << idlest;
+            QMetaObject::invokeMethod(chosen, "migrate",
+                Q_ARG(QObject*, _threads.at(idlest)));
+        }
+    }
+
+    // request new samples
+    quint64 now = currentTimeMillis();
+    for (int ii = 0, nn = _threadLoads.size(); ii < nn; ii++) {
+        QMetaObject::invokeMethod(_threadLoads.at(ii).monitor, "sample", Q_ARG(quint64, now),
+            Q_ARG(const Callback&, Callback(_this, "threadSampled(int,quint64,quint64,quint64)",
+                Q_ARG(int, ii))));
+    }
+}
+
+float SceneManager::ThreadLoad::load () const
+{
+    return busy + queueDelay / LoadSampleInterval + provisional;
+}
+
+int SceneManager::population (Instance* instance) const
+{
+    InstanceInfoPointer info = _app->peerManager()->localInstances().value(instance->info().id);
+    return info.isNull() ? 0 : instance->zone()->record().maxPopulation - info->open;
 }
 
 void SceneManager::createInstance (quint64 userId, quint32 zoneId, const Callback& callback)
@@ -103,11 +299,42 @@ void SceneManager::resolveZone (quint32 id, const Callback& callback)
     }
 
     // fetch the scene from the database
-    QMetaObject::invokeMethod(_app->databaseThread()->sceneRepository(), "loadZone",
+    _app->databasePool()->sceneRepository()->invoke("loadZone",
         Q_ARG(quint32, id), Q_ARG(const Callback&,
             Callback(_this, "zoneMaybeLoaded(quint32,ZoneRecord)", Q_ARG(quint32, id))));
 }
 
+void SceneManager::prefetchScene (quint64 instanceId, quint32 sceneId)
+{
+    Instance* instance = this->instance(instanceId);
+    if (instance != 0) {
+        QMetaObject::invokeMethod(instance, "prefetchScene", Q_ARG(quint32, sceneId));
+    }
+}
+
+void SceneManager::removeZone (quint32 id)
+{
+    Zone* zone = _zones.take(id);
+    if (zone != 0) {
+        zone->deleteLater();
+    }
+}
+
+void SceneManager::broadcastZoneInserted (quint32 id, const QString& name,
+    quint64 creatorId, const QString& creatorName, const QDateTime& created)
+{
+    _app->peerManager()->invoke(this, "zoneInserted(quint32,QString,quint64,QString,QDateTime)",
+        Q_ARG(quint32, id), Q_ARG(const QString&, name), Q_ARG(quint64, creatorId),
+        Q_ARG(const QString&, creatorName), Q_ARG(const QDateTime&, created));
+}
+
+void SceneManager::zoneInserted (quint32 id, const QString& name,
+    quint64 creatorId, const QString& creatorName, const QDateTime& created)
+{
+    ResourceDescriptor desc = { id, name, creatorId, creatorName, created };
+    _app->databasePool()->zoneIndex().insert(desc);
+}
+
 void SceneManager::broadcastZoneUpdated (const ZoneRecord& record)
 {
     _app->peerManager()->invoke(this, "zoneUpdated(ZoneRecord)", Q_ARG(const ZoneRecord&, record));
@@ -115,6 +342,8 @@ void SceneManager::broadcastZoneUpdated (const ZoneRecord& record)
 
 void SceneManager::zoneUpdated (const ZoneRecord& record)
 {
+    _app->databasePool()->zoneIndex().rename(record.id, record.name);
+
     Zone* zone = _zones.value(record.id);
     if (zone != 0) {
         zone->updated(record);
@@ -128,12 +357,29 @@ void SceneManager::broadcastZoneDeleted (quint32 id)
 
 void SceneManager::zoneDeleted (quint32 id)
 {
+    _app->databasePool()->zoneIndex().remove(id);
+
     Zone* zone = _zones.value(id);
     if (zone != 0) {
         zone->deleted();
     }
 }
 
+void SceneManager::broadcastSceneInserted (quint32 id, const QString& name,
+    quint64 creatorId, const QString& creatorName, const QDateTime& created)
+{
+    _app->peerManager()->invoke(this, "sceneInserted(quint32,QString,quint64,QString,QDateTime)",
+        Q_ARG(quint32, id), Q_ARG(const QString&, name), Q_ARG(quint64, creatorId),
+        Q_ARG(const QString&, creatorName), Q_ARG(const QDateTime&, created));
+}
+
+void SceneManager::sceneInserted (quint32 id, const QString& name,
+    quint64 creatorId, const QString& creatorName, const QDateTime& created)
+{
+    ResourceDescriptor desc = { id, name, creatorId, creatorName, created };
+    _app->databasePool()->sceneIndex().insert(desc);
+}
+
 void SceneManager::broadcastSceneUpdated (const SceneRecord& record)
 {
     _app->peerManager()->invoke(this, "sceneUpdated(SceneRecord)",
@@ -142,7 +388,14 @@ void SceneManager::broadcastSceneUpdated (const SceneRecord& record)
 
 void SceneManager::sceneUpdated (const SceneRecord& record)
 {
+    _app->databasePool()->sceneIndex().rename(record.id, record.name);
 
+    foreach (Zone* zone, _zones) {
+        foreach (Instance* instance, zone->instances()) {
+            QMetaObject::invokeMethod(instance, "sceneUpdated",
+                Q_ARG(const SceneRecord&, record));
+        }
+    }
 }
 
 void SceneManager::broadcastSceneDeleted (quint32 id)
@@ -152,7 +405,17 @@ void SceneManager::broadcastSceneDeleted (quint32 id)
 
 void SceneManager::sceneDeleted (quint32 id)
 {
+    _app->databasePool()->sceneIndex().remove(id);
+}
 
+void SceneManager::sceneEdited (const SceneEdits& edits)
+{
+    foreach (Zone* zone, _zones) {
+        foreach (Instance* instance, zone->instances()) {
+            QMetaObject::invokeMethod(instance, "sceneEdited",
+                Q_ARG(const SceneEdits&, edits));
+        }
+    }
 }
 
 void SceneManager::zoneMaybeLoaded (quint32 id, const ZoneRecord& record)
@@ -179,3 +442,72 @@ void SceneManager::continueCreatingInstance (
     }
     static_cast<Zone*>(zobj)->createInstance(userId, callback);
 }
+
+void SceneThreadMonitor::sample (quint64 sent, const Callback& callback)
+{
+    timespec cpuTime;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuTime);
+    quint64 now = currentTimeMillis();
+    callback.invoke(Q_ARG(quint64, now),
+        Q_ARG(quint64, cpuTime.tv_sec * Q_UINT64_C(1000000) + cpuTime.tv_nsec / 1000),
+        Q_ARG(quint64, now - sent));
+}
+
+PortalPrefetcher::PortalPrefetcher (int budget) :
+    _budget(budget)
+{
+}
+
+void PortalPrefetcher::prefetch (Session* session, const ScenePortal& portal)
+{
+    Instance* instance = session->instance();
+    if (instance == 0 || _scenes.size() + _zones.size() >= _budget) {
+        return;
+    }
+
+    // scenes in other zones require a place in one of their instances
+    if (portal.targetZoneId != 0 && portal.targetZoneId != instance->record().id) {
+        quint64 userId = session->user().id;
+        if (!_zones.contains(userId)) {
+            // the callback dies with the session, so we must watch for its destruction
+            _zones.insert(userId, session);
+            connect(session, SIGNAL(destroyed(QObject*)), SLOT(sessionDestroyed(QObject*)),
+                Qt::UniqueConnection);
+            session->prefetchZone(portal.targetZoneId, portal.targetSceneId,
+                Callback(_this, "zonePrefetched(quint64)", Q_ARG(quint64, userId)));
+        }
+        return;
+    }
+
+    // scenes in the same zone need only be loaded into the instance
+    quint32 sceneId = (portal.targetSceneId == 0) ?
+        instance->record().defaultSceneId : portal.targetSceneId;
+    QPair<quint64, quint32> key(instance->info().id, sceneId);
+    if (sceneId != 0 && !_scenes.contains(key)) {
+        _scenes.insert(key);
+        instance->resolveScene(sceneId, Callback(_this,
+            "scenePrefetched(quint64,quint32,QObject*)",
+            Q_ARG(quint64, key.first), Q_ARG(quint32, key.second)));
+    }
+}
+
+void PortalPrefetcher::scenePrefetched (quint64 instanceId, quint32 sceneId, QObject* scene)
+{
+    _scenes.remove(QPair<quint64, quint32>(instanceId, sceneId));
+}
+
+void PortalPrefetcher::zonePrefetched (quint64 userId)
+{
+    _zones.remove(userId);
+}
+
+void PortalPrefetcher::sessionDestroyed (QObject* session)
+{
+    for (QHash<quint64, QObject*>::iterator it = _zones.begin(); it != _zones.end(); ) {
+        if (it.value() == session) {
+            it = _zones.erase(it);
+        } else {
+            it++;
+        }
+    }
+}
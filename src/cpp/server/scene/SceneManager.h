@@ -6,18 +6,32 @@
 
 #include <QHash>
 #include <QList>
+#include <QMutex>
 #include <QObject>
+#include <QPair>
+#include <QPoint>
+#include <QSet>
+#include <QSharedPointer>
 #include <QVector>
 
 #include "peer/PeerManager.h"
 #include "util/Callback.h"
 
+class QDateTime;
 class QThread;
+class QThreadPool;
+class QTimer;
 
 class Instance;
+class PortalPrefetcher;
 class Scene;
+class SceneGenerator;
+class SceneThreadMonitor;
+class SceneEdits;
+class ScenePortal;
 class SceneRecord;
 class ServerApp;
+class Session;
 class Zone;
 class ZoneRecord;
 
@@ -40,21 +54,109 @@ public:
      */
     Instance* instance (quint64 id) const;
 
+    /**
+     * Returns the time in milliseconds after which unoccupied scenes are unloaded.
+     */
+    quint64 sceneIdleTimeout () const { return _sceneIdleTimeout; }
+
+    /**
+     * Returns the time in milliseconds after which unoccupied instances are shut down.
+     */
+    quint64 instanceIdleTimeout () const { return _instanceIdleTimeout; }
+
+    /**
+     * Returns the time in milliseconds after the first unsaved change at which scenes are
+     * flushed to the database.
+     */
+    int sceneAutosaveInterval () const { return _sceneAutosaveInterval; }
+
+    /**
+     * Returns the number of blocks beyond which scenes are paged in as needed rather than loaded
+     * in their entirety, or -1 to always load entire scenes.
+     */
+    int scenePagingThreshold () const { return _scenePagingThreshold; }
+
+    /**
+     * Returns the number of blocks that paged scenes keep resident before paging out the least
+     * recently used.
+     */
+    int scenePagedBlockLimit () const { return _scenePagedBlockLimit; }
+
+    /**
+     * Returns the distance (in cells) around views within which paged scenes prefetch blocks.
+     */
+    int scenePrefetchMargin () const { return _scenePrefetchMargin; }
+
+    /**
+     * Returns the distance (in cells) from portals within which pawns prefetch their targets.
+     */
+    int portalPrefetchDistance () const { return _portalPrefetchDistance; }
+
+    /**
+     * Returns the portal prefetcher for the current scene thread, or 0 if not called from a scene
+     * thread.  This method is thread-safe.
+     */
+    PortalPrefetcher* portalPrefetcher () const;
+
+    /**
+     * Returns the number of blocks that each scene generator caches.
+     */
+    int sceneGeneratorCacheSize () const { return _sceneGeneratorCacheSize; }
+
+    /**
+     * Generates the identified blocks in the generator pool.  The callback will receive a
+     * SceneBlockHash containing the blocks.  This method is thread-safe.
+     */
+    void generateBlocks (const QSharedPointer<SceneGenerator>& generator,
+        const QList<QPoint>& keys, const Callback& callback);
+
+    /**
+     * Adjusts the total number of bytes occupied by loaded scenes.  This method is thread-safe.
+     */
+    void adjustSceneMemoryUsage (qint64 delta);
+
+    /**
+     * Returns the total number of bytes occupied by loaded scenes.  This method is thread-safe.
+     */
+    qint64 sceneMemoryUsage () const;
+
+    /**
+     * Checks whether the loaded scenes exceed the configured memory limit, in which case
+     * unoccupied scenes should be evicted regardless of age.  This method is thread-safe.
+     */
+    bool sceneMemoryExceeded () const;
+
     /**
      * Starts the scene threads.
      */
     void startThreads ();
 
     /**
-     * Stops the scene threads.
+     * Stops the scene threads, first flushing all loaded scenes.
      */
     void stopThreads ();
 
     /**
-     * Returns the next thread in the round-robin sequence.
+     * Returns the least loaded scene thread, in which to place a new instance.
      */
     QThread* nextThread ();
 
+    /**
+     * Returns the number of scene threads.
+     */
+    int threadCount () const { return _threads.size(); }
+
+    /**
+     * Returns the smoothed fraction of time that the identified scene thread spends busy.
+     */
+    float threadBusy (int idx) const { return _threadLoads.at(idx).busy; }
+
+    /**
+     * Returns the smoothed time in milliseconds that events wait in the identified scene thread's
+     * queue.
+     */
+    float threadQueueDelay (int idx) const { return _threadLoads.at(idx).queueDelay; }
+
     /**
      * Creates a new instance of the identified zone for the identified session.  The callback will
      * receive the instance id.
@@ -79,6 +181,29 @@ public:
      */
     Q_INVOKABLE void resolveZone (quint32 id, const Callback& callback);
 
+    /**
+     * Loads the identified scene (or the default scene, if zero) into the identified instance in
+     * anticipation of a session arriving there.
+     */
+    Q_INVOKABLE void prefetchScene (quint64 instanceId, quint32 sceneId);
+
+    /**
+     * Unloads a zone that no longer has any instances.
+     */
+    void removeZone (quint32 id);
+
+    /**
+     * Broadcasts the creation of a zone to all peers.
+     */
+    Q_INVOKABLE void broadcastZoneInserted (quint32 id, const QString& name,
+        quint64 creatorId, const QString& creatorName, const QDateTime& created);
+
+    /**
+     * Notifies the manager that a zone has been inserted into the database.
+     */
+    Q_INVOKABLE void zoneInserted (quint32 id, const QString& name,
+        quint64 creatorId, const QString& creatorName, const QDateTime& created);
+
     /**
      * Broadcasts a change of zone record to instances on all peers.
      */
@@ -99,6 +224,18 @@ public:
      */
     Q_INVOKABLE void zoneDeleted (quint32 id);
 
+    /**
+     * Broadcasts the creation of a scene to all peers.
+     */
+    Q_INVOKABLE void broadcastSceneInserted (quint32 id, const QString& name,
+        quint64 creatorId, const QString& creatorName, const QDateTime& created);
+
+    /**
+     * Notifies the manager that a scene has been inserted into the database.
+     */
+    Q_INVOKABLE void sceneInserted (quint32 id, const QString& name,
+        quint64 creatorId, const QString& creatorName, const QDateTime& created);
+
     /**
      * Broadcasts a change of scene record to instances on all peers.
      */
@@ -119,6 +256,11 @@ public:
      */
     Q_INVOKABLE void sceneDeleted (quint32 id);
 
+    /**
+     * Notifies the manager that a scene has been edited in one of the instances of a peer.
+     */
+    Q_INVOKABLE void sceneEdited (const SceneEdits& edits);
+
 protected:
 
     /**
@@ -132,6 +274,61 @@ protected:
     Q_INVOKABLE void continueCreatingInstance (
         quint64 userId, const Callback& callback, QObject* zobj);
 
+    /**
+     * Records a load sample from a scene thread.
+     *
+     * @param time the time at which the sample was taken.
+     * @param cpuTime the CPU time consumed by the thread, in microseconds.
+     * @param queueDelay the time that the sample request waited in the queue.
+     */
+    Q_INVOKABLE void threadSampled (int idx, quint64 time, quint64 cpuTime, quint64 queueDelay);
+
+protected slots:
+
+    /**
+     * Migrates an instance if the thread loads have been out of balance, then requests new
+     * samples from the threads.
+     */
+    void balanceThreads ();
+
+protected:
+
+    /**
+     * Tracks the load on a scene thread.
+     */
+    class ThreadLoad
+    {
+    public:
+
+        /** The object that samples the load in the thread. */
+        SceneThreadMonitor* monitor;
+
+        /** The time of the last sample, or zero for none. */
+        quint64 sampleTime;
+
+        /** The CPU time consumed by the thread as of the last sample, in microseconds. */
+        quint64 cpuTime;
+
+        /** The smoothed fraction of time that the thread spends busy. */
+        float busy;
+
+        /** The smoothed time in milliseconds that events wait in the queue. */
+        float queueDelay;
+
+        /** The estimated load of the instances placed since the last sample. */
+        float provisional;
+
+        /**
+         * Returns the combined load estimate.
+         */
+        float load () const;
+    };
+
+    /**
+     * Returns the population of the specified instance.
+     */
+    int population (Instance* instance) const;
+
     /** The application object. */
     ServerApp* _app;
 
@@ -144,8 +341,132 @@ protected:
     /** The list of scene threads. */
     QVector<QThread*> _threads;
 
+    /** The load on each scene thread. */
+    QVector<ThreadLoad> _threadLoads;
+
     /** The index of the last thread to which we assigned a scene. */
     int _lastThreadIdx;
+
+    /** Periodically samples the thread loads. */
+    QTimer* _loadTimer;
+
+    /** The difference in load between the busiest and idlest threads that triggers migration. */
+    float _threadImbalanceThreshold;
+
+    /** The number of consecutive samples for which the loads have been out of balance. */
+    int _imbalancedSamples;
+
+    /** The time in milliseconds after which unoccupied scenes are unloaded. */
+    quint64 _sceneIdleTimeout;
+
+    /** The time in milliseconds after which unoccupied instances are shut down. */
+    quint64 _instanceIdleTimeout;
+
+    /** The time in milliseconds after the first unsaved change at which scenes are flushed. */
+    int _sceneAutosaveInterval;
+
+    /** The number of bytes of loaded scenes beyond which we evict regardless of age, or -1. */
+    qint64 _sceneMemoryLimit;
+
+    /** The number of blocks beyond which scenes are paged, or -1 for never. */
+    int _scenePagingThreshold;
+
+    /** The number of blocks that paged scenes keep resident. */
+    int _scenePagedBlockLimit;
+
+    /** The distance around views within which paged scenes prefetch blocks. */
+    int _scenePrefetchMargin;
+
+    /** The number of blocks that each scene generator caches. */
+    int _sceneGeneratorCacheSize;
+
+    /** The distance from portals within which pawns prefetch their targets. */
+    int _portalPrefetchDistance;
+
+    /** The portal prefetchers of the scene threads. */
+    QHash<QThread*, PortalPrefetcher*> _portalPrefetchers;
+
+    /** The pool of threads in which we generate scene contents. */
+    QThreadPool* _generatorPool;
+
+    /** The total number of bytes occupied by loaded scenes. */
+    qint64 _sceneMemoryUsage;
+
+    /** Protects the memory usage total, which scenes update from their own threads. */
+    mutable QMutex _sceneMemoryMutex;
+};
+
+/**
+ * Samples the load on a scene thread.
+ */
+class SceneThreadMonitor : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    /**
+     * Measures the CPU time consumed by the thread and the time that the request waited in the
+     * queue.  The callback will receive the current time, the CPU time in microseconds, and the
+     * queue delay in milliseconds (all quint64).
+     *
+     * @param sent the time at which the request was sent.
+     */
+    Q_INVOKABLE void sample (quint64 sent, const Callback& callback);
+};
+
+/**
+ * Warms the targets of the portals approached by pawns in a scene thread, limiting the number of
+ * prefetches outstanding at once so that a crowd milling around portals doesn't flood the
+ * database or the other peers.
+ */
+class PortalPrefetcher : public CallableObject
+{
+    Q_OBJECT
+
+public:
+
+    /**
+     * Creates a new prefetcher.
+     *
+     * @param budget the maximum number of prefetches to have outstanding at once.
+     */
+    PortalPrefetcher (int budget);
+
+    /**
+     * Warms the target of the specified portal for the given session, unless it's already being
+     * warmed or the budget is exhausted.  Targets in the session's zone are loaded into its
+     * instance; targets in other zones have a place reserved in one of their instances.
+     */
+    void prefetch (Session* session, const ScenePortal& portal);
+
+protected slots:
+
+    /**
+     * Releases the zone prefetch of a session that was destroyed before it completed.
+     */
+    void sessionDestroyed (QObject* session);
+
+protected:
+
+    /**
+     * Called when a prefetched scene has been resolved.
+     */
+    Q_INVOKABLE void scenePrefetched (quint64 instanceId, quint32 sceneId, QObject* scene);
+
+    /**
+     * Called when a session has finished prefetching a zone.
+     */
+    Q_INVOKABLE void zonePrefetched (quint64 userId);
+
+    /** The maximum number of prefetches to have outstanding at once. */
+    int _budget;
+
+    /** The instance and scene ids of the scenes being prefetched. */
+    QSet<QPair<quint64, quint32> > _scenes;
+
+    /** The sessions for which zones are being prefetched, mapped by user id. */
+    QHash<quint64, QObject*> _zones;
 };
 
 #endif // SCENE_MANAGER
@@ -25,6 +25,9 @@ using namespace std;
 /** Expression for unsigned shorts. */
 const QRegExp UShortExp("\\d{0,5}");
 
+/** Expression for unsigned ints. */
+const QRegExp UIntExp("\\d{0,10}");
+
 ScenePropertiesDialog::ScenePropertiesDialog (Session* parent) :
     Window(parent, parent->highestWindowLayer(), true, true)
 {
@@ -63,6 +66,13 @@ ScenePropertiesDialog::ScenePropertiesDialog (Session* parent) :
         new RegExpDocument(UShortExp, QString::number(record.scrollHeight), 5), true));
     connect(_name, SIGNAL(textChanged()), SLOT(updateApply()));
 
+    icont->addChild(new Label(tr("Seed:")));
+    icont->addChild(_seed = new TextField(20,
+        new RegExpDocument(UIntExp, QString::number(record.seed), 10), true));
+
+    icont->addChild(new Label(tr("Layers:")));
+    icont->addChild(_layers = new TextField(20, new Document(record.layers, 1024)));
+
     addChild(new Spacer(1, 1));
 
     Button* imp = new Button(tr("Import"));
@@ -122,7 +132,8 @@ void ScenePropertiesDialog::apply ()
 {
     // handle update through the scene
     session()->scene()->setProperties(_name->text().simplified(),
-        _scrollWidth->text().toInt(), _scrollHeight->text().toInt());
+        _scrollWidth->text().toInt(), _scrollHeight->text().toInt(),
+        _seed->text().toUInt(), _layers->text().trimmed());
 }
 
 void ScenePropertiesDialog::importScene (const QByteArray& content)
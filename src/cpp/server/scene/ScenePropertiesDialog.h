@@ -72,6 +72,12 @@ protected:
     /** The scroll height field. */
     TextField* _scrollHeight;
 
+    /** The generation seed field. */
+    TextField* _seed;
+
+    /** The generation layers field. */
+    TextField* _layers;
+
     /** The apply/OK buttons. */
     Button* _apply, *_ok;
 };
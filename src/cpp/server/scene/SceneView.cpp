@@ -134,25 +134,29 @@ void SceneView::draw (DrawContext* ctx)
     dirty.translate(_worldBounds.topLeft());
     dirty &= _worldBounds;
 
-    // draw all blocks that intersect
+    // draw all blocks that intersect, expanding the intersecting rows of each into a buffer
     int bx1 = dirty.left() >> Scene::Block::LgSize;
     int bx2 = dirty.right() >> Scene::Block::LgSize;
     int by1 = dirty.top() >> Scene::Block::LgSize;
     int by2 = dirty.bottom() >> Scene::Block::LgSize;
     QRect bbounds(0, 0, Scene::Block::Size, Scene::Block::Size);
+    int buffer[Scene::Block::Size*Scene::Block::Size];
     for (int by = by1; by <= by2; by++) {
         for (int bx = bx1; bx <= bx2; bx++) {
             QHash<QPoint, Scene::Block>::const_iterator it = blocks.constFind(QPoint(bx, by));
             if (it != blocks.constEnd()) {
                 const Scene::Block& block = *it;
                 bbounds.moveTo(bx << Scene::Block::LgSize, by << Scene::Block::LgSize);
-                QRect ibounds = bbounds.intersected(_worldBounds);
+                QRect ibounds = bbounds.intersected(dirty);
+                int width = ibounds.width(), height = ibounds.height();
+                int x = ibounds.left() - bbounds.left();
+                int y = ibounds.top() - bbounds.top();
+                for (int ii = 0; ii < height; ii++) {
+                    block.getRow(x, y + ii, width, buffer + ii*width);
+                }
                 ctx->drawContents(
                     ibounds.left() - _worldBounds.left(), ibounds.top() - _worldBounds.top(),
-                    ibounds.width(), ibounds.height(), block.constData() +
-                        (ibounds.top() - bbounds.top() << Scene::Block::LgSize) +
-                        (ibounds.left() - bbounds.left()),
-                    true, Scene::Block::Size);
+                    width, height, buffer);
             }
         }
     }
@@ -1,11 +1,14 @@
 //
 // $Id$
 
+#include <QMap>
 #include <QMetaObject>
+#include <QThread>
 #include <QTimer>
+#include <QtDebug>
 
 #include "ServerApp.h"
-#include "db/DatabaseThread.h"
+#include "db/DatabasePool.h"
 #include "db/SceneRepository.h"
 #include "net/Session.h"
 #include "scene/Scene.h"
@@ -15,12 +18,15 @@
 Zone::Zone (ServerApp* app, const ZoneRecord& record) :
     CallableObject(app->sceneManager()),
     _app(app),
-    _record(record)
+    _record(record),
+    _pendingInstances(0)
 {
 }
 
 void Zone::createInstance (quint64 userId, const Callback& callback)
 {
+    _pendingInstances++;
+
     // get a unique instance id from the lead node
     _app->peerManager()->invokeLead(_app->peerManager(),
         "reserveInstanceId(QString,quint64,Callback)",
@@ -45,17 +51,34 @@ void Zone::deleted ()
     }
 }
 
+void Zone::removeInstance (quint32 offset)
+{
+    Instance* instance = _instances.take(offset);
+    if (instance != 0) {
+        instance->deleteLater();
+    }
+    if (_instances.isEmpty() && _pendingInstances == 0) {
+        _app->sceneManager()->removeZone(_record.id);
+    }
+}
+
 void Zone::continueCreatingInstance (
     quint64 userId, const Callback& callback, quint64 instanceId)
 {
+    _pendingInstances--;
     Instance* instance = new Instance(this, instanceId);
     _instances.insert(getInstanceOffset(instanceId), instance);
     callback.invoke(Q_ARG(quint64, instanceId));
 }
 
+/** The interval at which instances check for scenes to unload. */
+static const int MaintenanceInterval = 60 * 1000;
+
 Instance::Instance (Zone* zone, quint64 id) :
     _zone(zone),
-    _record(zone->record())
+    _record(zone->record()),
+    _idleSince(currentTimeMillis()),
+    _closed(false)
 {
     // add info on all peers
     InstanceInfo info = { id, zone->app()->peerManager()->record().name,
@@ -64,6 +87,11 @@ Instance::Instance (Zone* zone, quint64 id) :
     zone->app()->peerManager()->invoke(zone->app()->peerManager(), "instanceAdded(InstanceInfo)",
         Q_ARG(const InstanceInfo&, info));
 
+    // periodically check for scenes to unload
+    QTimer* timer = new QTimer(this);
+    connect(timer, SIGNAL(timeout()), SLOT(maintain()));
+    timer->start(MaintenanceInterval);
+
     moveToThread(zone->app()->sceneManager()->nextThread());
 }
 
@@ -72,6 +100,11 @@ bool Instance::canEdit (Session* session) const
     return session->admin();
 }
 
+bool Instance::occupied () const
+{
+    return _info.open < _record.maxPopulation || !_placeReservationTimers.isEmpty();
+}
+
 void Instance::setProperties (const QString& name, quint16 maxPopulation, quint32 defaultSceneId)
 {
     // update the record
@@ -81,7 +114,7 @@ void Instance::setProperties (const QString& name, quint16 maxPopulation, quint3
     record.defaultSceneId = defaultSceneId;
 
     // update in database
-    QMetaObject::invokeMethod(_zone->app()->databaseThread()->sceneRepository(), "updateZone",
+    _zone->app()->databasePool()->sceneRepository()->invoke("updateZone",
         Q_ARG(const ZoneRecord&, record), Q_ARG(const Callback&, Callback(
             _zone->app()->sceneManager(), "broadcastZoneUpdated(ZoneRecord)",
             Q_ARG(const ZoneRecord&, record))));
@@ -90,7 +123,7 @@ void Instance::setProperties (const QString& name, quint16 maxPopulation, quint3
 void Instance::remove ()
 {
     // remove from database
-    QMetaObject::invokeMethod(_zone->app()->databaseThread()->sceneRepository(), "deleteZone",
+    _zone->app()->databasePool()->sceneRepository()->invoke("deleteZone",
         Q_ARG(quint32, _record.id), Q_ARG(const Callback&, Callback(
             _zone->app()->sceneManager(), "broadcastZoneDeleted(quint32)",
             Q_ARG(quint32, _record.id))));
@@ -101,7 +134,7 @@ static const int PlaceReservationTimeout = 5000;
 
 void Instance::reservePlace (quint64 userId, const Callback& callback)
 {
-    if (_info.open <= 0) {
+    if (_closed || _info.open <= 0) {
         callback.invoke(Q_ARG(bool, false));
         return;
     }
@@ -162,11 +195,39 @@ void Instance::resolveScene (quint32 id, const Callback& callback)
     }
 
     // fetch the scene from the database
-    QMetaObject::invokeMethod(_zone->app()->databaseThread()->sceneRepository(), "loadScene",
-        Q_ARG(quint32, id), Q_ARG(const Callback&,
+    _zone->app()->databasePool()->sceneRepository(id)->invoke("loadScene",
+        Q_ARG(quint32, id), Q_ARG(int, _zone->app()->sceneManager()->scenePagingThreshold()),
+        Q_ARG(const Callback&,
             Callback(_this, "sceneMaybeLoaded(quint32,SceneRecord)", Q_ARG(quint32, id))));
 }
 
+void Instance::prefetchScene (quint32 id)
+{
+    if (id == 0) {
+        id = _record.defaultSceneId;
+    }
+    if (id != 0 && !_closed) {
+        resolveScene(id, Callback());
+    }
+}
+
+void Instance::flush ()
+{
+    foreach (Scene* scene, _scenes) {
+        scene->flush();
+    }
+}
+
+void Instance::migrate (QObject* thread)
+{
+    // the sessions are our children and move with us, but the scenes must be moved separately
+    QThread* target = static_cast<QThread*>(thread);
+    foreach (Scene* scene, _scenes) {
+        scene->moveToThread(target);
+    }
+    moveToThread(target);
+}
+
 void Instance::updated (const ZoneRecord& record)
 {
     // adjust the number of open spaces if necessary
@@ -184,17 +245,69 @@ void Instance::deleted ()
     // TODO
 }
 
+void Instance::sceneUpdated (const SceneRecord& record)
+{
+    Scene* scene = _scenes.value(record.id);
+    if (scene != 0) {
+        scene->updated(record);
+    }
+}
+
+void Instance::sceneEdited (const SceneEdits& edits)
+{
+    if (edits.instanceId != _info.id) {
+        Scene* scene = _scenes.value(edits.sceneId);
+        if (scene != 0) {
+            scene->applyEdits(edits);
+        }
+    }
+}
+
 void Instance::clearPlaceReservation ()
 {
     cancelPlaceReservation(sender()->property("userId").toULongLong());
 }
 
+void Instance::maintain ()
+{
+    SceneManager* sceneManager = _zone->app()->sceneManager();
+    quint64 now = currentTimeMillis();
+
+    // refresh the memory estimates and sort the unoccupied scenes by the time they became idle
+    QMap<quint64, Scene*> idle;
+    foreach (Scene* scene, _scenes) {
+        scene->pageOut();
+        scene->updateMemoryUsage();
+        if (scene->sessions().isEmpty()) {
+            idle.insertMulti(scene->idleSince(), scene);
+        }
+    }
+
+    // evict the oldest first; while memory is scarce, evict regardless of age
+    for (QMap<quint64, Scene*>::const_iterator it = idle.constBegin(), end = idle.constEnd();
+            it != end; it++) {
+        if (!sceneManager->sceneMemoryExceeded() &&
+                now - it.key() < sceneManager->sceneIdleTimeout()) {
+            break;
+        }
+        evictScene(it.value());
+    }
+
+    // shut down once we've been empty for long enough
+    if (occupied() || !_scenePenders.isEmpty()) {
+        _idleSince = now;
+
+    } else if (_scenes.isEmpty() && now - _idleSince >= sceneManager->instanceIdleTimeout()) {
+        shutdown();
+    }
+}
+
 void Instance::sceneMaybeLoaded (quint32 id, const SceneRecord& record)
 {
-    // create the scene if it resolved
+    // create the scene if it resolved (and we haven't shut down in the meantime)
     Scene* scene = 0;
-    if (record.id != 0) {
-        _scenes.insert(id, scene = new Scene(_zone->app(), record));
+    if (record.id != 0 && !_closed) {
+        _scenes.insert(id, scene = new Scene(this, record));
     }
 
     // remove and notify the penders
@@ -204,9 +317,31 @@ void Instance::sceneMaybeLoaded (quint32 id, const SceneRecord& record)
     }
 }
 
+void Instance::evictScene (Scene* scene)
+{
+    quint32 id = scene->record().id;
+    qDebug() << "Unloading scene." << _info.id << id;
+
+    scene->flush();
+    _scenes.remove(id);
+    delete scene;
+}
+
 void Instance::shutdown ()
 {
-    // remove info on all peers
+    qDebug() << "Shutting down instance." << _info.id;
+    _closed = true;
+
+    // flush and unload any remaining scenes
+    foreach (Scene* scene, _scenes) {
+        evictScene(scene);
+    }
+
+    // remove info on all peers, which releases the id for reuse
     _zone->app()->peerManager()->invoke(_zone->app()->peerManager(), "instanceRemoved(quint64)",
         Q_ARG(quint64, _info.id));
+
+    // let the zone delete us
+    QMetaObject::invokeMethod(_zone, "removeInstance",
+        Q_ARG(quint32, getInstanceOffset(_info.id)));
 }
@@ -65,6 +65,11 @@ public:
      */
     void deleted ();
 
+    /**
+     * Removes an instance that has shut down, unloading the zone if it was the last one.
+     */
+    Q_INVOKABLE void removeInstance (quint32 offset);
+
 protected:
 
     /**
@@ -81,6 +86,9 @@ protected:
 
     /** The active instances, mapped by offset. */
     QHash<quint32, Instance*> _instances;
+
+    /** The number of instances awaiting ids from the lead node. */
+    int _pendingInstances;
 };
 
 /**
@@ -117,6 +125,11 @@ public:
      */
     bool canEdit (Session* session) const;
 
+    /**
+     * Checks whether the instance contains (or expects) any sessions.
+     */
+    bool occupied () const;
+
     /**
      * Sets the zone properties.
      */
@@ -154,6 +167,22 @@ public:
      */
     void resolveScene (quint32 id, const Callback& callback);
 
+    /**
+     * Loads the identified scene (or the default scene, if zero) in anticipation of a session
+     * arriving there.
+     */
+    Q_INVOKABLE void prefetchScene (quint32 id);
+
+    /**
+     * Flushes all loaded scenes to the database.
+     */
+    Q_INVOKABLE void flush ();
+
+    /**
+     * Moves the instance, along with its scenes and sessions, to the specified (QThread) thread.
+     */
+    Q_INVOKABLE void migrate (QObject* thread);
+
     /**
      * Notes that the zone record has been updated in the database.
      */
@@ -164,6 +193,16 @@ public:
      */
     Q_INVOKABLE void deleted ();
 
+    /**
+     * Notes that the record of one of our scenes has been updated in the database.
+     */
+    Q_INVOKABLE void sceneUpdated (const SceneRecord& record);
+
+    /**
+     * Applies edits made to one of our scenes in another instance.
+     */
+    Q_INVOKABLE void sceneEdited (const SceneEdits& edits);
+
 signals:
 
     /**
@@ -178,6 +217,12 @@ protected slots:
      */
     void clearPlaceReservation ();
 
+    /**
+     * Unloads scenes that have been unoccupied for too long (or sooner, if memory is scarce) and
+     * shuts down the instance once it has been empty for too long.
+     */
+    void maintain ();
+
 protected:
 
     /**
@@ -185,6 +230,11 @@ protected:
      */
     Q_INVOKABLE void sceneMaybeLoaded (quint32 id, const SceneRecord& record);
 
+    /**
+     * Flushes and unloads the specified scene.
+     */
+    void evictScene (Scene* scene);
+
     /**
      * Shuts down the instance.
      */
@@ -207,6 +257,12 @@ protected:
 
     /** Callbacks awaiting scene resolution. */
     QHash<quint32, QList<Callback> > _scenePenders;
+
+    /** The time at which the instance was created or last found to be unoccupied. */
+    quint64 _idleSince;
+
+    /** Set when the instance has shut down and can no longer accept sessions. */
+    bool _closed;
 };
 
 /**
@@ -5,6 +5,9 @@
 
 #include <QCoreApplication>
 #include <QMutex>
+#include <QPoint>
+#include <QRect>
+#include <QThread>
 #include <QWaitCondition>
 #include <QtDebug>
 
@@ -2524,6 +2527,127 @@ static ScriptObjectPointer invokeMethod (Evaluator* eval, int argc, ScriptObject
         args[0], args[1], args[2], args[3], args[4], args[5], args[6], args[7], args[8], args[9]));
 }
 
+/**
+ * Helper function for the spatial queries: checks the arguments, storing the integer values of
+ * all but the first and returning the object wrapped by the first.
+ */
+static QObject* queryArguments (int argc, ScriptObjectPointer* argv, int* values)
+{
+    if (argv[0]->type() != ScriptObject::WrappedObjectType) {
+        throw QString("Invalid argument.");
+    }
+    for (int ii = 1; ii < argc; ii++) {
+        if (argv[ii]->type() != ScriptObject::IntegerType) {
+            throw QString("Invalid argument.");
+        }
+        values[ii - 1] = static_cast<Integer*>(argv[ii].data())->value();
+    }
+    // a null pointer may be wrapped, but there is no scene to query
+    QObject* scene = static_cast<WrappedObject*>(argv[0].data())->object();
+    if (scene == 0) {
+        throw QString("Invalid argument.");
+    }
+    return scene;
+}
+
+/**
+ * Helper function for the spatial queries: returns the type of connection through which to
+ * query the scene, which must block until the result is available if the scene lives in another
+ * thread.
+ */
+static Qt::ConnectionType queryConnection (QObject* scene)
+{
+    return (scene->thread() != QThread::currentThread()) ?
+        Qt::BlockingQueuedConnection : Qt::DirectConnection;
+}
+
+/**
+ * Helper function for the spatial queries: converts the result of a query to a list, throwing
+ * an exception if the query couldn't be invoked.
+ */
+static ScriptObjectPointer queryResult (Evaluator* eval, bool success, const QVariantList& result)
+{
+    if (!success) {
+        throw QString("Failed to query scene.");
+    }
+    ScriptObjectPointerVector contents;
+    foreach (const QVariant& element, result) {
+        contents.append(variantToScriptObject(eval, element));
+    }
+    return eval->listInstance(contents.constData(), contents.size());
+}
+
+/**
+ * Returns a list of the actors within a rectangle of a scene, optionally limited to those with
+ * any of a set of collision flags.
+ */
+static ScriptObjectPointer actorsWithin (Evaluator* eval, int argc, ScriptObjectPointer* argv)
+{
+    if (argc != 5 && argc != 6) {
+        throw QString("Requires five or six arguments.");
+    }
+    int values[] = { 0, 0, 0, 0, 0 };
+    QObject* scene = queryArguments(argc, argv, values);
+    QVariantList result;
+    bool success = QMetaObject::invokeMethod(scene, "scriptActorsWithin", queryConnection(scene),
+        Q_RETURN_ARG(QVariantList, result),
+        Q_ARG(const QRect&, QRect(values[0], values[1], values[2], values[3])),
+        Q_ARG(int, values[4]));
+    return queryResult(eval, success, result);
+}
+
+/**
+ * Returns a list of up to a number of actors nearest to a location in a scene, optionally limited
+ * to those with any of a set of collision flags.
+ */
+static ScriptObjectPointer nearestActors (Evaluator* eval, int argc, ScriptObjectPointer* argv)
+{
+    if (argc != 5 && argc != 6) {
+        throw QString("Requires five or six arguments.");
+    }
+    int values[] = { 0, 0, 0, 0, 0 };
+    QObject* scene = queryArguments(argc, argv, values);
+    QVariantList result;
+    bool success = QMetaObject::invokeMethod(scene, "scriptNearestActors", queryConnection(scene),
+        Q_RETURN_ARG(QVariantList, result), Q_ARG(const QPoint&, QPoint(values[0], values[1])),
+        Q_ARG(int, values[2]), Q_ARG(int, values[3]), Q_ARG(int, values[4]));
+    return queryResult(eval, success, result);
+}
+
+/**
+ * Returns a list of the labels within a rectangle of a scene.
+ */
+static ScriptObjectPointer labelsWithin (Evaluator* eval, int argc, ScriptObjectPointer* argv)
+{
+    if (argc != 5) {
+        throw QString("Requires exactly five arguments.");
+    }
+    int values[4];
+    QObject* scene = queryArguments(argc, argv, values);
+    QVariantList result;
+    bool success = QMetaObject::invokeMethod(scene, "scriptLabelsWithin", queryConnection(scene),
+        Q_RETURN_ARG(QVariantList, result),
+        Q_ARG(const QRect&, QRect(values[0], values[1], values[2], values[3])));
+    return queryResult(eval, success, result);
+}
+
+/**
+ * Returns a list of up to a number of labels nearest to a location in a scene.
+ */
+static ScriptObjectPointer nearestLabels (Evaluator* eval, int argc, ScriptObjectPointer* argv)
+{
+    if (argc != 5) {
+        throw QString("Requires exactly five arguments.");
+    }
+    int values[4];
+    QObject* scene = queryArguments(argc, argv, values);
+    QVariantList result;
+    bool success = QMetaObject::invokeMethod(scene, "scriptNearestLabels", queryConnection(scene),
+        Q_RETURN_ARG(QVariantList, result), Q_ARG(const QPoint&, QPoint(values[0], values[1])),
+        Q_ARG(int, values[2]), Q_ARG(int, values[3]));
+    return queryResult(eval, success, result);
+}
+
 /**
  * Returns the evaluator's standard input port.
  */
@@ -2800,6 +2924,11 @@ static Scope createGlobalScope ()
     scope.addVariable("set-property!", setProperty);
     scope.addVariable("invoke-method", invokeMethod);
 
+    scope.addVariable("actors-within", actorsWithin);
+    scope.addVariable("nearest-actors", nearestActors);
+    scope.addVariable("labels-within", labelsWithin);
+    scope.addVariable("nearest-labels", nearestLabels);
+
     ScriptObjectPointer standardInput(new NativeProcedure(standardInputPort));
     scope.addVariable("standard-input-port", ScriptObjectPointer(), standardInput);
     scope.addVariable("current-input-port", ScriptObjectPointer(), standardInput);
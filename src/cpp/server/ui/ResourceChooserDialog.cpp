@@ -1,11 +1,12 @@
 //
 // $Id$
 
-#include <QMetaObject>
+#include <QTimer>
 #include <QTranslator>
 
 #include "ServerApp.h"
-#include "db/DatabaseThread.h"
+#include "db/DatabasePool.h"
+#include "db/ResourceIndex.h"
 #include "db/SceneRepository.h"
 #include "net/Session.h"
 #include "ui/Border.h"
@@ -17,10 +18,19 @@
 // translate through the session
 #define tr(...) this->session()->translator()->translate("ResourceChooserDialog", __VA_ARGS__)
 
-ResourceChooserDialog::ResourceChooserDialog (Session* parent, quint32 id, bool allowZero) :
+/** The time (in ms) that typing must pause before we look up the entered name. */
+static const int QueryDelay = 150;
+
+/** The maximum number of resources to list. */
+static const int ListLimit = 100;
+
+ResourceChooserDialog::ResourceChooserDialog (
+        Session* parent, ResourceIndex* index, quint32 id, bool allowZero) :
     Window(parent, parent->highestWindowLayer(), true, true),
+    _index(index),
     _initialId(id),
-    _allowZero(allowZero)
+    _allowZero(allowZero),
+    _queryTimer(new QTimer(this))
 {
     setBorder(new FrameBorder());
     setLayout(new BoxLayout(Qt::Vertical, BoxLayout::HStretch, Qt::AlignCenter, 1));
@@ -29,7 +39,12 @@ ResourceChooserDialog::ResourceChooserDialog (Session* parent, quint32 id, bool
     addChild(ncont);
     ncont->addChild(new Label(tr("Name:")), BoxLayout::Fixed);
     ncont->addChild(_name = new TextField(20, new Document("", 255)));
-    connect(_name, SIGNAL(textChanged()), SLOT(updateSelection()));
+
+    // each change restarts the timer, so that superseded lookups are never made
+    _queryTimer->setSingleShot(true);
+    _queryTimer->setInterval(QueryDelay);
+    connect(_name, SIGNAL(textChanged()), _queryTimer, SLOT(start()));
+    connect(_queryTimer, SIGNAL(timeout()), SLOT(updateSelection()));
 
     addChild(_list = new ScrollingList());
     if (!allowZero) {
@@ -46,6 +61,15 @@ ResourceChooserDialog::ResourceChooserDialog (Session* parent, quint32 id, bool
     connect(_ok, SIGNAL(pressed()), SLOT(deleteLater()));
     addChild(BoxLayout::createHBox(Qt::AlignCenter, 2, cancel, _ok));
 
+    // list the initial resources, making sure the current one is among them
+    ResourceDescriptorList resources = _index->find("", 0, 0, ListLimit);
+    populateList(resources);
+    ResourceDescriptor initial = _index->descriptor(_initialId);
+    if (_list->selectedIndex() == -1 && initial.id != 0) {
+        resources.append(initial);
+        populateList(resources);
+    }
+
     pack();
     center();
 }
@@ -53,13 +77,11 @@ ResourceChooserDialog::ResourceChooserDialog (Session* parent, quint32 id, bool
 void ResourceChooserDialog::updateSelection ()
 {
     QString prefix = _name->text().simplified();
-    for (int ii = 0, nn = _list->values().length(); ii < nn; ii++) {
-        if (_list->values().at(ii).toLower().startsWith(prefix, Qt::CaseInsensitive)) {
-            _list->setSelectedIndex(ii);
-            return;
-        }
+    populateList(_index->find(prefix, 0, 0, ListLimit));
+    if (_list->selectedIndex() == -1 && !(prefix.isEmpty() || _resources.isEmpty())) {
+        _list->setSelectedIndex(0);
     }
-    _list->setSelectedIndex(-1);
+    updateOk();
 }
 
 void ResourceChooserDialog::updateOk ()
@@ -88,26 +110,18 @@ void ResourceChooserDialog::populateList (const ResourceDescriptorList& resource
     }
     _list->setValues(names);
 
-    if (idx != -1) {
-        _list->setSelectedIndex(idx);
-    }
+    _list->setSelectedIndex(idx);
     updateOk();
 }
 
 ZoneChooserDialog::ZoneChooserDialog (Session* parent, quint32 id, bool allowZero) :
-    ResourceChooserDialog(parent, id, allowZero)
+    ResourceChooserDialog(parent, &parent->app()->databasePool()->zoneIndex(), id, allowZero)
 {
-    QMetaObject::invokeMethod(parent->app()->databaseThread()->sceneRepository(), "findZones",
-        Q_ARG(const QString&, ""), Q_ARG(quint32, 0), Q_ARG(const Callback&, Callback(_this,
-            "populateList(ResourceDescriptorList)")));
 }
 
 SceneChooserDialog::SceneChooserDialog (Session* parent, quint32 id, bool allowZero) :
-    ResourceChooserDialog(parent, id, allowZero)
+    ResourceChooserDialog(parent, &parent->app()->databasePool()->sceneIndex(), id, allowZero)
 {
-    QMetaObject::invokeMethod(parent->app()->databaseThread()->sceneRepository(), "findScenes",
-        Q_ARG(const QString&, ""), Q_ARG(quint32, 0), Q_ARG(const Callback&, Callback(_this,
-            "populateList(ResourceDescriptorList)")));
 }
 
 ResourceChooserButton::ResourceChooserButton (QObject* parent) :
@@ -169,7 +183,9 @@ void ZoneChooserButton::openDialog ()
 
 void ZoneChooserButton::loadName (Session* session)
 {
-    QMetaObject::invokeMethod(session->app()->databaseThread()->sceneRepository(), "loadZoneName",
+    SceneRepository* repository =
+        session->app()->databasePool()->sceneRepository(DatabasePool::Interactive);
+    repository->invoke("loadZoneName",
         Q_ARG(quint32, _id), Q_ARG(const Callback&, Callback(_this, "updateLabel(QString)")));
 }
 
@@ -182,6 +198,8 @@ void SceneChooserButton::openDialog ()
 
 void SceneChooserButton::loadName (Session* session)
 {
-    QMetaObject::invokeMethod(session->app()->databaseThread()->sceneRepository(), "loadSceneName",
+    SceneRepository* repository =
+        session->app()->databasePool()->sceneRepository(DatabasePool::Interactive);
+    repository->invoke("loadSceneName",
         Q_ARG(quint32, _id), Q_ARG(const Callback&, Callback(_this, "updateLabel(QString)")));
 }
@@ -8,11 +8,15 @@
 #include "ui/Window.h"
 #include "util/General.h"
 
+class QTimer;
+
+class ResourceIndex;
 class ScrollingList;
 class TextField;
 
 /**
- * Base class for resource chooser dialogs.
+ * Base class for resource chooser dialogs.  The list shows the resources whose names start with
+ * the entered text, looked up in the in-memory name index once typing pauses.
  */
 class ResourceChooserDialog : public Window
 {
@@ -23,9 +27,11 @@ public:
     /**
      * Initializes the dialog.
      *
+     * @param index the index in which to look up resources.
      * @param allowZero whether or not we allow a zero selection.
      */
-    ResourceChooserDialog (Session* parent, quint32 id = 0, bool allowZero = true);
+    ResourceChooserDialog (Session* parent, ResourceIndex* index,
+        quint32 id = 0, bool allowZero = true);
 
 signals:
 
@@ -37,7 +43,7 @@ signals:
 protected slots:
 
     /**
-     * Updates the selected field based on the entered name.
+     * Updates the list and selection based on the entered name.
      */
     void updateSelection ();
 
@@ -56,7 +62,10 @@ protected:
     /**
      * Populates the list with the supplied descriptors.
      */
-    Q_INVOKABLE void populateList (const ResourceDescriptorList& resources);
+    void populateList (const ResourceDescriptorList& resources);
+
+    /** The index in which we look up resources. */
+    ResourceIndex* _index;
 
     /** The name field. */
     TextField* _name;
@@ -75,6 +84,9 @@ protected:
 
     /** The resources corresponding to the names. */
     ResourceDescriptorList _resources;
+
+    /** Delays the lookup until the user stops typing. */
+    QTimer* _queryTimer;
 };
 
 /**
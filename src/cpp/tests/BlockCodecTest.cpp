@@ -0,0 +1,143 @@
+//
+// $Id$
+
+#include <QByteArray>
+#include <QtTest>
+
+#include "BlockCodecTest.h"
+#include "db/SceneRepository.h"
+
+typedef SceneRecord::Block Block;
+
+/**
+ * Helper function: checks whether the encoded data decodes to the specified block.
+ */
+static bool decodesTo (const QByteArray& encoded, const Block& block)
+{
+    Block decoded(encoded);
+    return decoded == block && decoded.filled() == block.filled();
+}
+
+void BlockCodecTest::emptyBlock ()
+{
+    Block block;
+    QByteArray encoded = block.encode();
+    QCOMPARE((int)encoded.at(0), (int)Block::EncodingVersion);
+    QVERIFY(decodesTo(encoded, block));
+    QVERIFY(decodesTo(QByteArray(), block));
+}
+
+void BlockCodecTest::sparseBlock ()
+{
+    Block block;
+    block.set(QPoint(0, 0), '#');
+    block.set(QPoint(5, 3), 'x');
+    block.set(QPoint(Block::Size - 1, Block::Size - 1), '#' | 0x10000);
+    QCOMPARE(block.filled(), 3);
+
+    QByteArray encoded = block.encode();
+    QCOMPARE((int)encoded.at(1), 0);
+    QVERIFY(decodesTo(encoded, block));
+}
+
+void BlockCodecTest::widePalette ()
+{
+    // every cell distinct, including values beyond the 16-bit range and negative ones
+    QVector<int> values(Block::Size*Block::Size);
+    for (int ii = 0; ii < values.size(); ii++) {
+        values[ii] = (ii % 3 == 0) ? -ii - 1 : ii * 65537 + '!';
+    }
+    Block block(values.constData());
+    QCOMPARE(block.filled(), values.size());
+    QVERIFY(decodesTo(block.encode(), block));
+
+    // and a palette just past the single-byte threshold, with runs of spaces between
+    Block partial;
+    for (int ii = 0; ii < 257; ii++) {
+        partial.set(QPoint((ii * 3) % Block::Size, (ii * 3) / Block::Size), 'A' + ii);
+    }
+    QVERIFY(decodesTo(partial.encode(), partial));
+}
+
+void BlockCodecTest::deflatedBlock ()
+{
+    Block block;
+    for (int yy = 0; yy < Block::Size; yy++) {
+        for (int xx = 0; xx < Block::Size; xx += 2) {
+            block.set(QPoint(xx, yy), "ab"[(xx / 2 + yy) % 2]);
+        }
+    }
+    QByteArray encoded = block.encode();
+    QVERIFY(encoded.at(1) != 0);
+    QVERIFY(decodesTo(encoded, block));
+}
+
+void BlockCodecTest::legacyBlock ()
+{
+    QVector<int> values(Block::Size*Block::Size, ' ');
+    for (int ii = 0; ii < values.size(); ii += 7) {
+        values[ii] = 'A' + ii % 26;
+    }
+    QByteArray legacy = qCompress((const uchar*)values.constData(), values.size() * sizeof(int));
+    QCOMPARE((int)legacy.at(0), 0);
+
+    QVERIFY(decodesTo(legacy, Block(values.constData())));
+}
+
+void BlockCodecTest::corruptBlock ()
+{
+    // a single value: version, flags, palette (count and value), then runs of 65 spaces and one
+    // index, then the remaining spaces (a two-byte varint) and no indices
+    Block block;
+    block.set(QPoint(1, 1), '@');
+    QByteArray encoded = block.encode();
+    QCOMPARE(encoded.size(), 13);
+    QCOMPARE((int)encoded.at(8), 1);
+    QCOMPARE((int)encoded.at(9), 0);
+
+    QByteArray index = encoded;
+    index[9] = 1;
+    QVERIFY(decodesTo(index, Block()));
+
+    QByteArray overrun = encoded;
+    overrun[8] = 2;
+    QVERIFY(decodesTo(overrun, Block()));
+
+    QByteArray missing = encoded;
+    missing[encoded.size() - 1] = 1;
+    QVERIFY(decodesTo(missing, Block()));
+
+    QVERIFY(decodesTo(encoded + '\0', Block()));
+}
+
+void BlockCodecTest::truncatedBlock ()
+{
+    Block block;
+    block.set(QPoint(1, 1), '@');
+    QByteArray encoded = block.encode();
+    for (int ii = 2; ii < encoded.size(); ii++) {
+        QVERIFY(decodesTo(encoded.left(ii), Block()));
+    }
+
+    Block deflated;
+    for (int yy = 0; yy < Block::Size; yy++) {
+        for (int xx = 0; xx < Block::Size; xx += 2) {
+            deflated.set(QPoint(xx, yy), "ab"[(xx / 2 + yy) % 2]);
+        }
+    }
+    encoded = deflated.encode();
+    QVERIFY(encoded.at(1) != 0);
+    QVERIFY(decodesTo(encoded.left(encoded.size() / 2), Block()));
+    QVERIFY(decodesTo(encoded.left(encoded.size() - 1), Block()));
+}
+
+void BlockCodecTest::unknownVersion ()
+{
+    Block block;
+    block.set(QPoint(1, 1), '@');
+    QByteArray encoded = block.encode();
+    encoded[0] = (char)(Block::EncodingVersion + 1);
+    QVERIFY(decodesTo(encoded, Block()));
+}
+
+QTEST_MAIN(BlockCodecTest)
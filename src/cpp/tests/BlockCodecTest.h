@@ -0,0 +1,60 @@
+//
+// $Id$
+
+#ifndef BLOCK_CODEC_TEST
+#define BLOCK_CODEC_TEST
+
+#include <QObject>
+
+/**
+ * Checks that scene blocks survive encoding and decoding.
+ */
+class BlockCodecTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+
+    /**
+     * Round-trips an empty block, and decodes an empty array.
+     */
+    void emptyBlock ();
+
+    /**
+     * Round-trips a block with a few values, which is stored without deflation.
+     */
+    void sparseBlock ();
+
+    /**
+     * Round-trips a block with more than 256 distinct values, which uses two-byte indices.
+     */
+    void widePalette ();
+
+    /**
+     * Round-trips a block whose payload is large and repetitive enough to be deflated.
+     */
+    void deflatedBlock ();
+
+    /**
+     * Decodes a block stored in the legacy format (the compressed raw values).
+     */
+    void legacyBlock ();
+
+    /**
+     * Checks that invalid palette indices, overlong runs, and trailing bytes yield an empty
+     * block.
+     */
+    void corruptBlock ();
+
+    /**
+     * Checks that truncated data, deflated or not, yields an empty block.
+     */
+    void truncatedBlock ();
+
+    /**
+     * Checks that an unknown version byte yields an empty block.
+     */
+    void unknownVersion ();
+};
+
+#endif // BLOCK_CODEC_TEST
@@ -0,0 +1,324 @@
+//
+// $Id$
+
+#include <iostream>
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QSettings>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QString>
+#include <QStringList>
+#include <QVariant>
+#include <QVariantList>
+
+using namespace std;
+
+/** The pragmas executed on opening an embedded SQLite database (as in the server). */
+static const char* SqlitePragmas[] = {
+    "pragma journal_mode = WAL", "pragma synchronous = NORMAL", "pragma busy_timeout = 10000",
+    "pragma temp_store = MEMORY", "pragma cache_size = -16384", 0 };
+
+/** The number of blocks in each benchmark scene. */
+static const int BlocksPerScene = 64;
+
+/** The size of each block's data, roughly that of a populated scene block. */
+static const int BlockDataSize = 2048;
+
+/**
+ * Accumulates the execution times of a single operation.
+ */
+class Timing
+{
+public:
+
+    /**
+     * Creates an empty timing for the named operation.
+     */
+    Timing (const QString& name) : name(name), count(0), totalTime(0), maxTime(0) { }
+
+    /**
+     * Records an execution of the operation.
+     */
+    void record (qint64 time) { count++; totalTime += time; maxTime = qMax(maxTime, time); }
+
+    /**
+     * Prints a summary of the timing to standard output.
+     */
+    void print () const;
+
+    /** The name of the operation. */
+    QString name;
+
+    /** The number of executions. */
+    int count;
+
+    /** The total execution time, in nanoseconds. */
+    qint64 totalTime;
+
+    /** The longest single execution time, in nanoseconds. */
+    qint64 maxTime;
+};
+
+void Timing::print () const
+{
+    double seconds = totalTime / 1000000000.0;
+    cout << qPrintable(name.leftJustified(24)) <<
+        qPrintable(QString::number(count).rightJustified(10)) <<
+        qPrintable(QString::number(seconds == 0.0 ? 0.0 : count / seconds, 'f', 0).
+            rightJustified(12)) <<
+        qPrintable(QString::number(count == 0 ? 0.0 : totalTime / (count * 1000.0), 'f', 1).
+            rightJustified(12)) <<
+        qPrintable(QString::number(maxTime / 1000.0, 'f', 1).rightJustified(12)) << endl;
+}
+
+/**
+ * Executes a query that must succeed, recording its time in the provided timing.
+ *
+ * @return whether the query succeeded.
+ */
+static bool execute (QSqlQuery& query, Timing* timing = 0, bool batch = false)
+{
+    QElapsedTimer timer;
+    timer.start();
+    bool success = batch ? query.execBatch() : query.exec();
+    if (timing != 0) {
+        timing->record(timer.nsecsElapsed());
+    }
+    if (!success) {
+        cerr << qPrintable(query.lastQuery()) << ": " << qPrintable(query.lastError().text()) <<
+            endl;
+    }
+    return success;
+}
+
+/**
+ * Runs the benchmark against the provided connection.
+ *
+ * @return whether the benchmark completed successfully.
+ */
+static bool run (QSqlDatabase& database, bool sqlite, int users, int batchSize)
+{
+    QSqlQuery query(database);
+
+    // (re)create the benchmark tables, which mirror the shapes of USERS and SCENE_BLOCKS
+    query.exec("drop table BENCH_USERS");
+    query.exec("drop table BENCH_BLOCKS");
+    if (!(query.exec(QString(
+                "create table BENCH_USERS ("
+                    "ID %1,"
+                    "SESSION_TOKEN binary(16) not null,"
+                    "NAME_LOWER varchar(16) not null unique,"
+                    "LAST_ONLINE datetime not null)").arg(sqlite ?
+                        "integer primary key autoincrement" :
+                        "bigint unsigned not null auto_increment primary key")) &&
+            query.exec(
+                "create table BENCH_BLOCKS ("
+                    "SCENE_ID int unsigned not null,"
+                    "X int not null,"
+                    "Y int not null,"
+                    "DATA blob not null,"
+                    "primary key (SCENE_ID, X, Y))"))) {
+        cerr << "Failed to create tables: " << qPrintable(query.lastError().text()) << endl;
+        return false;
+    }
+
+    QByteArray token(16, 'x');
+    QDateTime now = QDateTime::currentDateTime();
+    QList<quint64> ids;
+
+    Timing inserts("user insert");
+    query.prepare("insert into BENCH_USERS (SESSION_TOKEN, NAME_LOWER, LAST_ONLINE) "
+        "values (?, ?, ?)");
+    for (int ii = 0; ii < users; ii++) {
+        query.addBindValue(token);
+        query.addBindValue("user" + QString::number(ii));
+        query.addBindValue(now);
+        if (!execute(query, &inserts)) {
+            return false;
+        }
+        ids.append(query.lastInsertId().toULongLong());
+    }
+
+    Timing nameChecks("name check");
+    query.prepare("select count(*) from BENCH_USERS where NAME_LOWER = ?");
+    for (int ii = 0; ii < users; ii++) {
+        // alternate between taken and free names
+        query.addBindValue((ii % 2 == 0 ? "user" : "free") + QString::number(ii));
+        if (!execute(query, &nameChecks)) {
+            return false;
+        }
+        query.next();
+    }
+
+    Timing tokens("session token check");
+    query.prepare("select NAME_LOWER, LAST_ONLINE from BENCH_USERS "
+        "where ID = ? and SESSION_TOKEN = ?");
+    foreach (quint64 id, ids) {
+        query.addBindValue(id);
+        query.addBindValue(token);
+        if (!execute(query, &tokens)) {
+            return false;
+        }
+        query.next();
+    }
+
+    Timing lastOnline("last online flush");
+    query.prepare("update BENCH_USERS set LAST_ONLINE = ? where ID = ?");
+    for (int ii = 0; ii < ids.size(); ii += batchSize) {
+        QVariantList times, batch;
+        for (int jj = ii, nn = qMin(ii + batchSize, ids.size()); jj < nn; jj++) {
+            times.append(now);
+            batch.append(ids.at(jj));
+        }
+        query.addBindValue(times);
+        query.addBindValue(batch);
+        QElapsedTimer timer;
+        timer.start();
+        database.transaction();
+        bool success = execute(query, 0, true);
+        database.commit();
+        lastOnline.record(timer.nsecsElapsed());
+        if (!success) {
+            return false;
+        }
+    }
+
+    Timing upserts("scene block store");
+    query.prepare(sqlite ?
+        "insert or replace into BENCH_BLOCKS (SCENE_ID, X, Y, DATA) values (?, ?, ?, ?)" :
+        "insert into BENCH_BLOCKS (SCENE_ID, X, Y, DATA) values (?, ?, ?, ?) "
+            "on duplicate key update DATA = values(DATA)");
+    QByteArray data(BlockDataSize, 'b');
+    int scenes = qMax(1, users / BlocksPerScene);
+    for (int pass = 0; pass < 2; pass++) { // the second pass replaces the blocks of the first
+        for (int ii = 0; ii < scenes; ii++) {
+            QVariantList sceneIds, xs, ys, datas;
+            for (int jj = 0; jj < BlocksPerScene; jj++) {
+                sceneIds.append(ii + 1);
+                xs.append(jj % 8);
+                ys.append(jj / 8);
+                datas.append(data);
+            }
+            query.addBindValue(sceneIds);
+            query.addBindValue(xs);
+            query.addBindValue(ys);
+            query.addBindValue(datas);
+            QElapsedTimer timer;
+            timer.start();
+            database.transaction();
+            bool success = execute(query, 0, true);
+            database.commit();
+            upserts.record(timer.nsecsElapsed());
+            if (!success) {
+                return false;
+            }
+        }
+    }
+
+    Timing loads("scene block load");
+    query.prepare("select X, Y, DATA from BENCH_BLOCKS where SCENE_ID = ?");
+    for (int ii = 0; ii < scenes; ii++) {
+        query.addBindValue(ii + 1);
+        QElapsedTimer timer;
+        timer.start();
+        bool success = execute(query);
+        while (query.next()) {
+            query.value(2).toByteArray();
+        }
+        loads.record(timer.nsecsElapsed());
+        if (!success) {
+            return false;
+        }
+    }
+
+    query.exec("drop table BENCH_USERS");
+    query.exec("drop table BENCH_BLOCKS");
+
+    cout << "operation                    count       ops/s     mean us      max us" << endl;
+    inserts.print();
+    nameChecks.print();
+    tokens.print();
+    lastOnline.print();
+    upserts.print();
+    loads.print();
+    return true;
+}
+
+/**
+ * Program entry point.
+ */
+int main (int argc, char** argv)
+{
+    // process the command line arguments
+    QString config;
+    int users = 10000;
+    int batchSize = 100;
+    for (int ii = 1; ii < argc; ii++) {
+        QString arg(argv[ii]);
+        if (!arg.startsWith('-')) {
+            config = arg;
+            continue;
+        }
+        QStringRef name = arg.midRef(1);
+        if (name == "n" || name == "b") {
+            if (++ii == argc) {
+                cerr << "Missing count argument for " << arg.toStdString() << endl;
+                return 1;
+            }
+            int value = QString(argv[ii]).toInt();
+            if (value <= 0) {
+                cerr << "Invalid count argument for " << arg.toStdString() << endl;
+                return 1;
+            }
+            if (name == "n") {
+                users = value;
+            } else {
+                batchSize = value;
+            }
+
+        } else {
+            cerr << "Unknown option " << arg.toStdString() << endl;
+            return 1;
+        }
+    }
+    if (config.isNull()) {
+        cerr << "Usage: dbbench [OPTION]... config file" << endl;
+        cerr << "Runs the server's query mix against the database described by the config file."
+            << endl;
+        cerr << "Where options include:" << endl;
+        cerr << "  -n count: The number of users to create and query (default 10000)." << endl;
+        cerr << "  -b count: The number of users per last online flush (default 100)." << endl;
+        return 0;
+    }
+
+    // connect as the server would
+    QSettings settings(config, QSettings::IniFormat);
+    QString type = settings.value("database_type").toString();
+    bool sqlite = (type == "QSQLITE");
+    QSqlDatabase database = QSqlDatabase::addDatabase(type);
+    database.setDatabaseName(settings.value("database_name").toString());
+    if (!sqlite) {
+        database.setHostName(settings.value("database_hostname").toString());
+        database.setPort(settings.value("database_port").toInt());
+        database.setUserName(settings.value("database_username").toString());
+        database.setPassword(settings.value("database_password").toString());
+        database.setConnectOptions(settings.value("database_connect_options").toString());
+    }
+    if (!database.open()) {
+        cerr << "Failed to connect to database: " <<
+            qPrintable(database.lastError().text()) << endl;
+        return 1;
+    }
+    if (sqlite) {
+        QSqlQuery query(database);
+        for (const char** pragma = SqlitePragmas; *pragma != 0; pragma++) {
+            query.exec(*pragma);
+        }
+    }
+    cout << "Benchmarking " << qPrintable(type) << " with " << users << " users." << endl;
+    return run(database, sqlite, users, batchSize) ? 0 : 1;
+}
@@ -256,6 +256,48 @@ bool Throttle::attemptOp ()
     return true;
 }
 
+AliasTable::AliasTable (const double* probs, int count) :
+    _probs(count),
+    _aliases(count)
+{
+    double total = 0.0;
+    for (int ii = 0; ii < count; ii++) {
+        total += probs[ii];
+    }
+
+    // scale the probabilities so that the average is one, then pair each bucket that falls short
+    // with one that has an excess
+    QVector<double> scaled(count);
+    QVector<int> small, large;
+    for (int ii = 0; ii < count; ii++) {
+        scaled[ii] = (total > 0.0) ? probs[ii] * count / total : 1.0;
+        (scaled.at(ii) < 1.0 ? small : large).append(ii);
+    }
+    while (!small.isEmpty() && !large.isEmpty()) {
+        int sidx = small.last();
+        small.pop_back();
+        int lidx = large.last();
+        _probs[sidx] = scaled.at(sidx);
+        _aliases[sidx] = lidx;
+        if ((scaled[lidx] -= 1.0 - scaled.at(sidx)) < 1.0) {
+            large.pop_back();
+            small.append(lidx);
+        }
+    }
+
+    // whatever remains is (within rounding error) full
+    foreach (int idx, small + large) {
+        _probs[idx] = 1.0;
+        _aliases[idx] = idx;
+    }
+}
+
+int AliasTable::sample () const
+{
+    int idx = qrand() % _probs.size();
+    return (qrand() / ((double)RAND_MAX + 1.0) < _probs.at(idx)) ? idx : _aliases.at(idx);
+}
+
 QByteArray generateToken (int length)
 {
     QByteArray token(length, 0);
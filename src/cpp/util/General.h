@@ -224,6 +224,37 @@ protected:
     int _bucketIdx;
 };
 
+/**
+ * Samples indices from a fixed discrete distribution in constant time using Vose's alias method.
+ */
+class AliasTable
+{
+public:
+
+    /**
+     * Creates an empty table.
+     */
+    AliasTable () { }
+
+    /**
+     * Creates a table for the given probabilities, which need not sum to exactly one.
+     */
+    AliasTable (const double* probs, int count);
+
+    /**
+     * Returns a random index distributed according to the table's probabilities.
+     */
+    int sample () const;
+
+protected:
+
+    /** For each index, the probability of choosing it rather than its alias. */
+    QVector<double> _probs;
+
+    /** For each index, the index chosen when it isn't. */
+    QVector<int> _aliases;
+};
+
 /**
  * Generic descriptor for various resources (zones, scenes, etc.)
  */
@@ -0,0 +1,85 @@
+//
+// $Id$
+
+#include <QQueue>
+
+#include "util/StringMatcher.h"
+
+StringMatcher::StringMatcher (const QStringList& patterns)
+{
+    addState();
+
+    // build the trie of patterns
+    foreach (const QString& pattern, patterns) {
+        if (pattern.isEmpty()) {
+            continue;
+        }
+        int state = 0;
+        foreach (QChar ch, pattern) {
+            int next = _states.at(state).children.value(ch, -1);
+            if (next == -1) {
+                next = addState();
+                _states[state].children.insert(ch, next);
+            }
+            state = next;
+        }
+        _states[state].terminal = true;
+    }
+
+    // link each state to its fallback in breadth-first order, so that the fallbacks of shallower
+    // states are always known by the time they're needed
+    QQueue<int> queue;
+    queue.enqueue(0);
+    while (!queue.isEmpty()) {
+        int state = queue.dequeue();
+        const QHash<QChar, int>& children = _states.at(state).children;
+        for (QHash<QChar, int>::const_iterator it = children.constBegin(),
+                end = children.constEnd(); it != end; it++) {
+            int child = it.value();
+            int fallback = 0;
+            if (state != 0) {
+                for (int candidate = _states.at(state).fallback;; ) {
+                    int next = _states.at(candidate).children.value(it.key(), -1);
+                    if (next != -1) {
+                        fallback = next;
+                        break;
+                    }
+                    if (candidate == 0) {
+                        break;
+                    }
+                    candidate = _states.at(candidate).fallback;
+                }
+            }
+            State& cstate = _states[child];
+            cstate.fallback = fallback;
+
+            // a state that ends with a pattern is a match even if it isn't the end of one itself
+            cstate.terminal |= _states.at(fallback).terminal;
+            queue.enqueue(child);
+        }
+    }
+}
+
+bool StringMatcher::matches (const QString& string) const
+{
+    int state = 0;
+    foreach (QChar ch, string) {
+        int next;
+        while ((next = _states.at(state).children.value(ch, -1)) == -1 && state != 0) {
+            state = _states.at(state).fallback;
+        }
+        if (next != -1 && _states.at(state = next).terminal) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int StringMatcher::addState ()
+{
+    State state;
+    state.fallback = 0;
+    state.terminal = false;
+    _states.append(state);
+    return _states.size() - 1;
+}
@@ -0,0 +1,63 @@
+//
+// $Id$
+
+#ifndef STRING_MATCHER
+#define STRING_MATCHER
+
+#include <QHash>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+/**
+ * Searches strings for any of a fixed set of literal substrings in a single pass, using an
+ * Aho-Corasick automaton compiled from the patterns.
+ */
+class StringMatcher
+{
+public:
+
+    /**
+     * Creates a matcher for the specified patterns.  Empty patterns are ignored.
+     */
+    StringMatcher (const QStringList& patterns = QStringList());
+
+    /**
+     * Checks whether the matcher has any patterns.
+     */
+    bool isEmpty () const { return _states.size() == 1; }
+
+    /**
+     * Checks whether the specified string contains any of the patterns.
+     */
+    bool matches (const QString& string) const;
+
+protected:
+
+    /**
+     * A state in the automaton: a node in the trie of patterns.
+     */
+    class State
+    {
+    public:
+
+        /** The transitions to child states, mapped by character. */
+        QHash<QChar, int> children;
+
+        /** The state for the longest proper suffix of this one that is also a trie node. */
+        int fallback;
+
+        /** Whether reaching this state means that a pattern has been found. */
+        bool terminal;
+    };
+
+    /**
+     * Adds a state to the automaton and returns its index.
+     */
+    int addState ();
+
+    /** The states of the automaton.  The first is the root. */
+    QVector<State> _states;
+};
+
+#endif // STRING_MATCHER